@@ -0,0 +1,1661 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../headers/tokenizer.h"
+#include "../headers/ExpressionTree.h"
+#include "../headers/symtab.h"
+#include "../headers/jit.h"
+#include "../headers/compact.h"
+#include "../headers/column.h"
+#include "../headers/pareval.h"
+#include "../headers/emit.h"
+#include "../headers/cache.h"
+#include "../headers/document.h"
+#include "../headers/literal.h"
+#include "exprgen.h"
+#include "loadgen.h"
+
+/*
+ * Benchmark suite (make bench). It runs, in this order:
+ * - a few expressions with prefix operators where an operand starts ("2 * -3", "a + ++b"),
+ *   parsed and evaluated by expressiontree_evaluate and vm_run, which must both give the
+ *   value worked out by hand (stage "prefix", not timed).
+ * - for every GenSpec of exprgen.c, a fixed set of expressions, each stage of the pipeline
+ *   timed over all of them separately:
+ *	tokenize	tokenizer_tokenize
+ *	validate	expressiontree_validate (TOK_ERROR and parentheses check)
+ *	build		expressiontree_build_tree (validation included, nodes malloc'd)
+ *	print		expressiontree_print_to_file (to /dev/null)
+ *	emit_<format>	emitter_tree in each format of emit.h, one Emitter to /dev/null's fd
+ *	destroy		expressiontree_destroy_tree
+ * - the same expressions of every spec, as interned trees evaluated by
+ *	eval_tree	expressiontree_evaluate_slots
+ *	eval_vm		bytecode_compile'd, vm_run
+ *	eval_jit	jit_compile'd, jit_run (the VM where there is no native code)
+ *	eval_compact	compact_from_tree'd, compact_evaluate
+ *   which must agree on every expression (status, result and variables), compact_to_tree
+ *   giving back each tree compact_from_tree was given.
+ * - the same expressions built simplified (BuildOptions.simplify) and as parsed, evaluated
+ *   with some variables bound to 0 by
+ *	simplified	expressiontree_evaluate_slots of the simplified tree
+ *	unsimplified	expressiontree_evaluate_slots of the tree as parsed
+ *   which must agree on every expression (status, result and variables left behind).
+ * - a few expressions over columns of random values:
+ *	eval_columns	column_evaluate (rows/sec and column bytes read/sec)
+ *	eval_rows	compact_evaluate on one row at a time, the results must be the same
+ * - a few very large trees (generated expressions joined into one), evaluated by
+ *	eval_tree	expressiontree_evaluate_slots
+ *	eval_compact	compact_evaluate
+ *	eval_plan	pareval_run of a pareval_plan'd tree on the calling thread alone
+ *	eval_tasks	pareval_run on a TaskPool of one worker per CPU
+ *   which must agree as well.
+ * - one long expression, tokenized whole by
+ *	lex		tokenizer_tokenize
+ *	lex_parallel	tokenizer_tokenize_parallel on one thread per CPU
+ *   the two token streams (and one cut into 7 chunks) must be the same.
+ * - random literals of 1 to 44 digits (leading zeros, values around 2^63 and 2^128) through
+ *	literal		literal_decode
+ *	literal_128	literal_decode_128
+ *   both checked against a digit-by-digit decoding.
+ * - one "long" expression kept parsed in a Document through random edits, by
+ *	document_edit	incremental re-parse (subtrees the edit did not touch are reused)
+ *	reparse		tokenizer_tokenize and a parse from scratch of the edited text
+ *   every version's tree must be the same both ways (no tree when the text does not parse).
+ * - BENCH_CACHE_THREADS threads looking up "mixed" expressions in one ParseCache too small to
+ *   hold them all, each expression spelled three ways (as generated, tokenizer_normalize'd,
+ *   one space between tokens):
+ *	cache		parsecache_get / parsecache_release
+ *   every tree handed out must print as a fresh parse of the expression does (no tree for an
+ *   invalid one), and the run must see hits, misses and evictions.
+ * Each stage keeps its fastest time over the rounds. Results go to stdout as one JSON object
+ * per line (spec, stage, sizes, seconds, rates, allocations per expression), ready to be
+ * diffed or loaded by a script. A stage fails when fewer than half of its inputs got a result
+ * (a tree, a value), as when it fails a check: it timed and compared next to nothing.
+ *
+ *	bench [rounds]				run the suite (default 5 rounds)
+ *	bench --generate <spec> <n> [seed]	print n expressions of spec, one per line
+ *	bench --load <socket | -> <spec> <n> [depth]
+ *						time n parse requests to a server (loadgen.h)
+ */
+
+#define BENCH_OPERANDS (1 << 20)	// operands generated per spec (n_exprs * n_operands)
+#define BENCH_SEED 20240229
+#define BENCH_ROUNDS 5
+#define BENCH_MIN_CHECKED 2	// a stage fails unless it checked at least 1 in 2 of its inputs
+
+enum stage_t {
+	STAGE_TOKENIZE, STAGE_VALIDATE, STAGE_BUILD, STAGE_PRINT,
+	STAGE_EMIT_TREE, STAGE_EMIT_SEXPR, STAGE_EMIT_RPN, STAGE_EMIT_JSON,
+	STAGE_DESTROY, N_STAGES
+};
+
+/* StageResult: best time of a stage over the rounds, allocations counted on the first */
+typedef struct {
+	double seconds;
+	size_t n_allocs;
+} StageResult;
+
+// allocation counter: the bench binary is linked with --wrap=malloc,--wrap=calloc,--wrap=realloc
+// (atomic: the threads of the task and cache stages allocate too)
+static atomic_size_t n_allocs;
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+	atomic_fetch_add_explicit(&n_allocs, 1, memory_order_relaxed);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+	atomic_fetch_add_explicit(&n_allocs, 1, memory_order_relaxed);
+	return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	atomic_fetch_add_explicit(&n_allocs, 1, memory_order_relaxed);
+	return __real_realloc(ptr, size);
+}
+
+static int _generate(char const *name, size_t n, uint64_t seed);
+static int _run_prefix(void);
+static int _run_spec(GenSpec const *spec, size_t rounds, FILE *sink);
+static int _run_eval(GenSpec const *spec, size_t rounds);
+static int _run_simplify(GenSpec const *spec, size_t rounds);
+static int _run_column_suite(size_t rounds);
+static int _run_columns(char const *expression, Column const *table, size_t rounds);
+static int _run_task_suite(size_t rounds);
+static int _run_tasks(char const *label, GenSpec const *spec, char const *suffix, TaskPool *pool,
+		      size_t rounds);
+static int _run_lex(size_t rounds);
+static int _run_literals(size_t rounds);
+static int _run_document(size_t rounds, FILE *sink);
+static size_t _random_edit(uint64_t *bits, char *text, size_t length, TextEdit *edit,
+			   char *undo, TextEdit *undo_edit);
+static int _run_cache(size_t rounds, FILE *sink);
+static void *_cache_main(void *arg);
+static char *_print(ExpressionTree root);
+static void _emit_all(ExpressionTree const *roots, size_t n, int fd, enum emit_format_t format);
+static size_t _join(ExprGen *gen, GenSpec const *spec, size_t n, char *text, size_t depth);
+static inline bool _too_few(char const *name, char const *what, size_t n_checked, size_t n);
+static inline size_t _count_nodes(ExpressionTree root);
+static inline bool _same_tree(ExpressionTree a, ExpressionTree b);
+static inline bool _same_slots(VarList const *vars, uint32_t const *slots, size_t n_slots);
+static inline double _now(void);
+
+int main(int argc, char **argv)
+{
+	if (argc >= 4 && strcmp(argv[1], "--generate") == 0) {
+		uint64_t seed = (argc == 5) ? strtoull(argv[4], NULL, 10) : BENCH_SEED;
+		return _generate(argv[2], strtoul(argv[3], NULL, 10), seed);
+	}
+	if ((argc == 5 || argc == 6) && strcmp(argv[1], "--load") == 0) {
+		size_t depth = (argc == 6) ? strtoul(argv[5], NULL, 10) : 1;
+		return loadgen_run(argv[2], argv[3], strtoul(argv[4], NULL, 10), depth);
+	}
+	size_t rounds = (argc == 2) ? strtoul(argv[1], NULL, 10) : BENCH_ROUNDS;
+	if (argc > 2 || rounds == 0) {
+		fprintf(stderr, "usage: %s [rounds]\n"
+				"       %s --generate <spec> <n> [seed]\n"
+				"       %s --load <socket path, - for a private server> <spec> <n> [depth]\n",
+				argv[0], argv[0], argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	FILE *sink = fopen("/dev/null", "w");
+	if (!sink) {
+		perror("/dev/null");
+		return EXIT_FAILURE;
+	}
+	int status = _run_prefix();
+	for (size_t i = 0; i < exprgen_n_specs && status == EXIT_SUCCESS; i++) {
+		status = _run_spec(&exprgen_specs[i], rounds, sink);
+	}
+	for (size_t i = 0; i < exprgen_n_specs && status == EXIT_SUCCESS; i++) {
+		status = _run_eval(&exprgen_specs[i], rounds);
+	}
+	for (size_t i = 0; i < exprgen_n_specs && status == EXIT_SUCCESS; i++) {
+		status = _run_simplify(&exprgen_specs[i], rounds);
+	}
+	status = (status == EXIT_SUCCESS) ? _run_column_suite(rounds) : status;
+	status = (status == EXIT_SUCCESS) ? _run_task_suite(rounds) : status;
+	status = (status == EXIT_SUCCESS) ? _run_lex(rounds) : status;
+	status = (status == EXIT_SUCCESS) ? _run_literals(rounds) : status;
+	status = (status == EXIT_SUCCESS) ? _run_document(rounds, sink) : status;
+	status = (status == EXIT_SUCCESS) ? _run_cache(rounds, sink) : status;
+	fclose(sink);
+	return status;
+}
+
+static int _generate(char const *name, size_t n, uint64_t seed)
+{
+	GenSpec const *spec = exprgen_spec(name);
+	if (!spec) {
+		fprintf(stderr, "unknown spec \"%s\", one of:", name);
+		for (size_t i = 0; i < exprgen_n_specs; i++) {
+			fprintf(stderr, " %s", exprgen_specs[i].name);
+		}
+		fprintf(stderr, "\n");
+		return EXIT_FAILURE;
+	}
+	char *buf = malloc(exprgen_max_length(spec));
+	if (!buf) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+	ExprGen gen;
+	exprgen_init(&gen, seed);
+	for (size_t i = 0; i < n; i++) {
+		exprgen_expression(&gen, spec, buf, exprgen_max_length(spec));
+		puts(buf);
+	}
+	free(buf);
+	return EXIT_SUCCESS;
+}
+
+static int _run_prefix(void)
+{
+	// prefix operators where the operand of a tighter operator starts, each must get its own
+	// operand: evaluated tree-walking and on the VM from a = 2, b = 3
+	static struct {char const *text; long expected;} const cases[] = {
+		{"2 * -3", -6},		{"a + ++b", 6},		{"a * -(b + 1)", -8},
+		{"2 * - - a", 4},	{"a - -b", 5},		{"-a * b", -6},
+		{"a % --b", 0},		{"b / -a", -1},		{"a -b", -1},
+		{"a (-b)", -6},		{"-a--", -2},		{"a * ++b", 8},
+	};
+	size_t n_cases = sizeof(cases) / sizeof(cases[0]), n_failed = 0;
+	VM vm;
+	vm_init(&vm);
+	for (size_t i = 0; i < n_cases; i++) {
+		Tokenizer tkz = tokenizer_tokenize(cases[i].text, strlen(cases[i].text));
+		ExpressionTree root = expressiontree_build_tree(&tkz);
+		tokenizer_distroy(&tkz);
+		Binding bindings[] = {{"a", 2}, {"b", 3}};
+		long tree_result = 0, vm_result = 0, vars[2];
+		eval_status_t tree_status = expressiontree_evaluate(root, bindings, 2, &tree_result);
+		Program prog;
+		eval_status_t vm_status = bytecode_compile(root, &prog);
+		if (vm_status == EVAL_OK) {
+			bindings[0].value = 2;
+			bindings[1].value = 3;
+			vm_status = bytecode_bind(&prog, bindings, 2, vars);
+		}
+		if (vm_status == EVAL_OK) {
+			vm_status = vm_run(&vm, &prog, vars, &vm_result);
+			bytecode_destroy(&prog);
+		}
+		if (tree_status != EVAL_OK || vm_status != EVAL_OK || tree_result != cases[i].expected
+		    || vm_result != cases[i].expected) {
+			fprintf(stderr, "\"%s\": %s %ld (tree), %s %ld (vm), expected %ld\n", cases[i].text,
+				eval_status_str(tree_status), tree_result, eval_status_str(vm_status),
+				vm_result, cases[i].expected);
+			n_failed += 1;
+		}
+		expressiontree_destroy_tree(&root);
+	}
+	vm_destroy(&vm);
+	printf("{\"stage\": \"prefix\", \"exprs\": %zu, \"failed\": %zu}\n", n_cases, n_failed);
+	fflush(stdout);
+	return (n_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int _run_spec(GenSpec const *spec, size_t rounds, FILE *sink)
+{
+	// generate the spec's expressions (one buffer, null-separated), then time every stage
+	size_t n_exprs = BENCH_OPERANDS / spec->n_operands;
+	size_t max_length = exprgen_max_length(spec);
+	char *text = malloc(n_exprs * max_length);
+	size_t *offsets = malloc((n_exprs + 1) * sizeof(*offsets));
+	Tokenizer *tkzs = malloc(n_exprs * sizeof(*tkzs));
+	ExpressionTree *roots = malloc(n_exprs * sizeof(*roots));
+	if (!text || !offsets || !tkzs || !roots) {
+		perror("malloc");
+		free(text);
+		free(offsets);
+		free(tkzs);
+		free(roots);
+		return EXIT_FAILURE;
+	}
+	ExprGen gen;
+	exprgen_init(&gen, BENCH_SEED);
+	offsets[0] = 0;
+	for (size_t i = 0; i < n_exprs; i++) {
+		size_t length = exprgen_expression(&gen, spec, text + offsets[i], max_length);
+		offsets[i + 1] = offsets[i] + length + 1;
+	}
+
+	StageResult results[N_STAGES];
+	size_t n_tokens = 0, n_nodes = 0, n_invalid = 0;
+	for (size_t round = 0; round < rounds; round++) {
+		double times[N_STAGES];
+		size_t allocs[N_STAGES];
+		double start;
+
+#define STAGE(stage, ...) do { \
+			size_t allocs_before = n_allocs; \
+			start = _now(); \
+			__VA_ARGS__ \
+			times[stage] = _now() - start; \
+			allocs[stage] = n_allocs - allocs_before; \
+		} while (0)
+
+		STAGE(STAGE_TOKENIZE,
+			for (size_t i = 0; i < n_exprs; i++) {
+				tkzs[i] = tokenizer_tokenize(text + offsets[i], offsets[i + 1] - offsets[i] - 1);
+			}
+		);
+		STAGE(STAGE_VALIDATE,
+			n_invalid = 0;
+			for (size_t i = 0; i < n_exprs; i++) {
+				n_invalid += expressiontree_validate(&tkzs[i]) != (ptrdiff_t)tkzs[i].n_tokens;
+			}
+		);
+		STAGE(STAGE_BUILD,
+			for (size_t i = 0; i < n_exprs; i++) {
+				roots[i] = expressiontree_build_tree(&tkzs[i]);
+			}
+		);
+		STAGE(STAGE_PRINT,
+			for (size_t i = 0; i < n_exprs; i++) {
+				expressiontree_print_to_file(sink, 0, roots[i]);
+			}
+			fflush(sink);
+		);
+		STAGE(STAGE_EMIT_TREE, _emit_all(roots, n_exprs, fileno(sink), EMIT_TREE););
+		STAGE(STAGE_EMIT_SEXPR, _emit_all(roots, n_exprs, fileno(sink), EMIT_SEXPR););
+		STAGE(STAGE_EMIT_RPN, _emit_all(roots, n_exprs, fileno(sink), EMIT_RPN););
+		STAGE(STAGE_EMIT_JSON, _emit_all(roots, n_exprs, fileno(sink), EMIT_JSON););
+		if (round == 0) {
+			for (size_t i = 0; i < n_exprs; i++) {
+				n_tokens += tkzs[i].n_tokens;
+				n_nodes += _count_nodes(roots[i]);
+			}
+		}
+		STAGE(STAGE_DESTROY,
+			for (size_t i = 0; i < n_exprs; i++) {
+				expressiontree_destroy_tree(&roots[i]);
+			}
+		);
+#undef STAGE
+
+		for (size_t i = 0; i < n_exprs; i++) {
+			tokenizer_distroy(&tkzs[i]);
+		}
+		for (size_t stage = 0; stage < N_STAGES; stage++) {
+			if (round == 0 || times[stage] < results[stage].seconds) {
+				results[stage].seconds = times[stage];
+			}
+			if (round == 0) {
+				results[stage].n_allocs = allocs[stage];
+			}
+		}
+	}
+
+	static char const *stage_names[] = {
+		[STAGE_TOKENIZE] = "tokenize",
+		[STAGE_VALIDATE] = "validate",
+		[STAGE_BUILD]    = "build",
+		[STAGE_PRINT]    = "print",
+		[STAGE_EMIT_TREE]  = "emit_tree",
+		[STAGE_EMIT_SEXPR] = "emit_sexpr",
+		[STAGE_EMIT_RPN]   = "emit_rpn",
+		[STAGE_EMIT_JSON]  = "emit_json",
+		[STAGE_DESTROY]  = "destroy"
+	};
+	size_t n_bytes = offsets[n_exprs] - n_exprs;	// without the null terminators
+	for (size_t stage = 0; stage < N_STAGES; stage++) {
+		double seconds = (results[stage].seconds > 0) ? results[stage].seconds : 1e-9;
+		printf("{\"spec\": \"%s\", \"stage\": \"%s\", \"exprs\": %zu, \"invalid\": %zu, "
+		       "\"bytes\": %zu, \"tokens\": %zu, \"nodes\": %zu, \"seconds\": %.6f, "
+		       "\"bytes_per_sec\": %.0f, \"tokens_per_sec\": %.0f, \"nodes_per_sec\": %.0f, "
+		       "\"allocs_per_expr\": %.2f}\n",
+		       spec->name, stage_names[stage], n_exprs, n_invalid, n_bytes, n_tokens, n_nodes,
+		       results[stage].seconds, n_bytes / seconds, n_tokens / seconds,
+		       n_nodes / seconds, (double)results[stage].n_allocs / n_exprs);
+	}
+	fflush(stdout);
+
+	free(text);
+	free(offsets);
+	free(tkzs);
+	free(roots);
+	return _too_few(spec->name, "expressions parsed", n_exprs - n_invalid, n_exprs)
+	       ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#define BENCH_EVAL_OPERANDS (1 << 18)	// operands evaluated per spec
+enum eval_stage_t {EVAL_TREE, EVAL_VM, EVAL_JIT, EVAL_COMPACT, N_EVAL_STAGES};
+
+static int _run_eval(GenSpec const *spec, size_t rounds)
+{
+	// build interned trees of spec, evaluate each one tree-walking, on the VM, natively and
+	// flattened
+	size_t n_exprs = BENCH_EVAL_OPERANDS / spec->n_operands;
+	size_t max_length = exprgen_max_length(spec);
+	char *text = malloc(max_length);
+	ExpressionTree *roots = calloc(n_exprs, sizeof(*roots));
+	JitProgram *jits = calloc(n_exprs, sizeof(*jits));
+	CompactTree *compacts = calloc(n_exprs, sizeof(*compacts));
+	long *results = malloc(N_EVAL_STAGES * n_exprs * sizeof(*results));
+	eval_status_t *statuses = malloc(N_EVAL_STAGES * n_exprs * sizeof(*statuses));
+	SymbolTable symbols;
+	symtab_init(&symbols);
+	int status = (text && roots && jits && compacts && results && statuses) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	ExprGen gen;
+	exprgen_init(&gen, BENCH_SEED);
+	BuildOptions opts = {.symbols = &symbols};
+	NodeArena rebuilt;
+	nodearena_init(&rebuilt, NODEARENA_DEFAULT_SLAB);
+	size_t max_vars = 0, n_compiled = 0, n_native = 0, n_not_rebuilt = 0, n_other_vars = 0;
+	for (size_t i = 0; i < n_exprs && status == EXIT_SUCCESS; i++) {
+		size_t length = exprgen_expression(&gen, spec, text, max_length);
+		Tokenizer tkz = tokenizer_tokenize(text, length);
+		roots[i] = expressiontree_build_tree_opts(&tkz, &opts);
+		tokenizer_distroy(&tkz);
+		// expressions that do not compile (no tree, malformed) are skipped by every stage
+		eval_status_t compiled = roots[i] ? jit_compile(roots[i], &jits[i]) : EVAL_MALFORMED;
+		if (compiled == EVAL_OK) {
+			compiled = compact_from_tree(roots[i], &compacts[i]);
+		}
+		if (compiled == EVAL_OK) {
+			// and back: the same tree, up to the literals' text
+			n_not_rebuilt += !_same_tree(compact_to_tree(&compacts[i], &rebuilt), roots[i]);
+			nodearena_reset(&rebuilt);
+		}
+		if (compiled == EVAL_OK) {
+			// the variables the tree uses are the ones both compilers numbered, in their order
+			VarList used;
+			if (symtab_variables(roots[i], &used) != 0) {
+				compiled = EVAL_NO_MEMORY;
+			} else {
+				n_other_vars += !_same_slots(&used, jits[i].prog.symbols, jits[i].prog.n_vars)
+						|| !_same_slots(&used, compacts[i].symbols, compacts[i].n_vars);
+				varlist_destroy(&used);
+			}
+		}
+		if (compiled != EVAL_OK) {
+			expressiontree_destroy_tree(&roots[i]);
+			status = (compiled == EVAL_NO_MEMORY) ? EXIT_FAILURE : status;
+		}
+		n_compiled += roots[i] != NULL;
+		if (max_vars < jits[i].prog.n_vars) {
+			max_vars = jits[i].prog.n_vars;
+		}
+		n_native += jits[i].fn != NULL;
+	}
+	nodearena_destroy(&rebuilt);
+	// values[slot] binds every variable, each evaluation starts over from them
+	long *values = malloc((symbols.n_symbols + 1) * sizeof(*values));
+	long *vars = malloc((symbols.n_symbols + max_vars + 1) * sizeof(*vars));
+	long *finals = malloc(N_EVAL_STAGES * (symbols.n_symbols + 1) * sizeof(*finals));
+	if (status != EXIT_SUCCESS || !values || !vars || !finals) {
+		perror("malloc");
+		status = EXIT_FAILURE;
+		goto out;
+	}
+	for (size_t slot = 0; slot < symbols.n_symbols; slot++) {
+		values[slot] = (slot % 2) ? 2 + (long)(slot % 5) : -3 - (long)(slot % 3);	// never 0
+	}
+
+	VM vm;
+	vm_init(&vm);
+	double seconds[N_EVAL_STAGES];
+	for (size_t round = 0; round < rounds; round++) {
+		for (size_t stage = 0; stage < N_EVAL_STAGES; stage++) {
+			long *result = results + stage * n_exprs;
+			eval_status_t *st = statuses + stage * n_exprs;
+			long *final = finals + stage * (symbols.n_symbols + 1);
+			final[symbols.n_symbols] = 0;
+			double start = _now();
+			for (size_t i = 0; i < n_exprs; i++) {
+				if (!roots[i]) {
+					st[i] = EVAL_MALFORMED;
+					continue;
+				}
+				Program const *prog = &jits[i].prog;
+				result[i] = 0;
+				if (stage == EVAL_TREE) {
+					memcpy(vars, values, symbols.n_symbols * sizeof(*vars));
+					st[i] = expressiontree_evaluate_slots(roots[i], vars, symbols.n_symbols,
+									      &result[i]);
+				} else if (stage == EVAL_COMPACT) {
+					compact_bind_slots(&compacts[i], values, symbols.n_symbols, vars);
+					st[i] = compact_evaluate(&compacts[i], &vm, vars, &result[i]);
+				} else {
+					bytecode_bind_slots(prog, values, symbols.n_symbols, vars);
+					st[i] = (stage == EVAL_VM) ? vm_run(&vm, prog, vars, &result[i])
+						: jit_run(&jits[i], &vm, vars, &result[i]);
+				}
+				// fold the variables the expression left behind into one checksum
+				uint32_t const *slots = (stage == EVAL_COMPACT) ? compacts[i].symbols
+						      : prog->symbols;
+				for (size_t v = 0; v < prog->n_vars; v++) {
+					long value = (stage == EVAL_TREE) ? vars[slots[v]] : vars[v];
+					final[symbols.n_symbols] += value * (long)(slots[v] + 1);
+				}
+			}
+			double time = _now() - start;
+			if (round == 0 || time < seconds[stage]) {
+				seconds[stage] = time;
+			}
+		}
+	}
+	vm_destroy(&vm);
+
+	static char const *stage_names[] = {
+		[EVAL_TREE] = "eval_tree",
+		[EVAL_VM]   = "eval_vm",
+		[EVAL_JIT]  = "eval_jit",
+		[EVAL_COMPACT] = "eval_compact"
+	};
+	size_t n_mismatches = n_not_rebuilt + n_other_vars, n_div_by_zero = 0, n_ok = 0;
+	for (size_t i = 0; i < n_exprs; i++) {
+		n_div_by_zero += statuses[i] == EVAL_DIV_BY_ZERO;
+		n_ok += statuses[i] == EVAL_OK;
+		for (size_t stage = 1; stage < N_EVAL_STAGES; stage++) {
+			eval_status_t st = statuses[stage * n_exprs + i];
+			n_mismatches += st != statuses[i]
+					|| (st == EVAL_OK && results[stage * n_exprs + i] != results[i]);
+		}
+	}
+	for (size_t stage = 1; stage < N_EVAL_STAGES; stage++) {
+		n_mismatches += finals[stage * (symbols.n_symbols + 1) + symbols.n_symbols]
+				!= finals[symbols.n_symbols];
+	}
+	for (size_t stage = 0; stage < N_EVAL_STAGES; stage++) {
+		double time = (seconds[stage] > 0) ? seconds[stage] : 1e-9;
+		printf("{\"spec\": \"%s\", \"stage\": \"%s\", \"exprs\": %zu, \"compiled\": %zu, \"native\": %zu, "
+		       "\"div_by_zero\": %zu, \"mismatches\": %zu, \"seconds\": %.6f, "
+		       "\"exprs_per_sec\": %.0f}\n",
+		       spec->name, stage_names[stage], n_exprs, n_compiled, n_native, n_div_by_zero, n_mismatches,
+		       seconds[stage], n_compiled / time);
+	}
+	fflush(stdout);
+	if (n_mismatches > 0) {
+		fprintf(stderr, "%s: %zu evaluations disagree (%zu trees not rebuilt by compact_to_tree, "
+			"%zu with other variables than symtab_variables lists)\n",
+			spec->name, n_mismatches, n_not_rebuilt, n_other_vars);
+		status = EXIT_FAILURE;
+	}
+	if (_too_few(spec->name, "expressions evaluated to a result", n_ok, n_exprs)) {
+		status = EXIT_FAILURE;
+	}
+
+out:
+	for (size_t i = 0; i < n_exprs && roots && jits && compacts; i++) {
+		jit_destroy(&jits[i]);
+		compact_destroy(&compacts[i]);
+		expressiontree_destroy_tree(&roots[i]);
+	}
+	symtab_destroy(&symbols);
+	free(text);
+	free(roots);
+	free(jits);
+	free(compacts);
+	free(results);
+	free(statuses);
+	free(values);
+	free(vars);
+	free(finals);
+	return status;
+}
+
+static int _run_simplify(GenSpec const *spec, size_t rounds)
+{
+	/*
+	 * Build interned trees of spec as parsed and simplified, evaluate both from the same
+	 * bindings, one variable in 31 bound to 0 so that divisions by zero are met too.
+	 */
+	enum {PLAIN, SIMPLIFIED, N_SIMPLIFY_STAGES};
+	size_t n_exprs = BENCH_EVAL_OPERANDS / spec->n_operands;
+	size_t max_length = exprgen_max_length(spec);
+	char *text = malloc(max_length);
+	ExpressionTree *roots = calloc(N_SIMPLIFY_STAGES * n_exprs, sizeof(*roots));
+	long *results = malloc(N_SIMPLIFY_STAGES * n_exprs * sizeof(*results));
+	eval_status_t *statuses = malloc(N_SIMPLIFY_STAGES * n_exprs * sizeof(*statuses));
+	SymbolTable symbols;
+	symtab_init(&symbols);
+	int status = (text && roots && results && statuses) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	ExprGen gen;
+	exprgen_init(&gen, BENCH_SEED);
+	size_t n_nodes[N_SIMPLIFY_STAGES] = {0}, n_built = 0;
+	for (size_t i = 0; i < n_exprs && status == EXIT_SUCCESS; i++) {
+		size_t length = exprgen_expression(&gen, spec, text, max_length);
+		Tokenizer tkz = tokenizer_tokenize(text, length);
+		for (size_t stage = 0; stage < N_SIMPLIFY_STAGES; stage++) {
+			BuildOptions opts = {.symbols = &symbols, .simplify = stage == SIMPLIFIED};
+			ExpressionTree root = expressiontree_build_tree_opts(&tkz, &opts);
+			roots[stage * n_exprs + i] = root;
+			n_nodes[stage] += _count_nodes(root);
+		}
+		tokenizer_distroy(&tkz);
+		n_built += roots[i] != NULL;
+		status = (!roots[i] != !roots[n_exprs + i]) ? EXIT_FAILURE : status;
+	}
+	size_t n_vars = symbols.n_symbols;
+	long *values = malloc((n_vars + 1) * sizeof(*values));
+	long *vars = malloc(N_SIMPLIFY_STAGES * n_exprs * (n_vars + 1) * sizeof(*vars));
+	if (status != EXIT_SUCCESS || !values || !vars) {
+		fprintf(stderr, "%s: simplified trees could not be built\n", spec->name);
+		status = EXIT_FAILURE;
+		goto out;
+	}
+	for (size_t slot = 0; slot < n_vars; slot++) {
+		values[slot] = (slot % 31 == 3) ? 0 : (slot % 2) ? 2 + (long)(slot % 5) : -3 - (long)(slot % 3);
+	}
+
+	double seconds[N_SIMPLIFY_STAGES];
+	for (size_t round = 0; round < rounds; round++) {
+		for (size_t stage = 0; stage < N_SIMPLIFY_STAGES; stage++) {
+			double time = 0;
+			for (size_t i = 0; i < n_exprs; i++) {
+				size_t at = stage * n_exprs + i;
+				long *left = vars + at * (n_vars + 1);	// the variables after evaluating
+				memcpy(left, values, n_vars * sizeof(*left));
+				results[at] = 0;
+				double start = _now();
+				statuses[at] = roots[at] ? expressiontree_evaluate_slots(roots[at], left, n_vars,
+											  &results[at])
+						 : EVAL_MALFORMED;
+				time += _now() - start;
+			}
+			if (round == 0 || time < seconds[stage]) {
+				seconds[stage] = time;
+			}
+		}
+	}
+
+	size_t n_mismatches = 0, n_failed = 0;
+	for (size_t i = 0; i < n_exprs; i++) {
+		size_t at = n_exprs + i;
+		n_failed += statuses[i] != EVAL_OK;
+		n_mismatches += statuses[at] != statuses[i]
+				|| (statuses[i] == EVAL_OK && results[at] != results[i])
+				|| memcmp(vars + at * (n_vars + 1), vars + i * (n_vars + 1),
+					  n_vars * sizeof(*vars)) != 0;
+	}
+	static char const *stage_names[] = {[PLAIN] = "unsimplified", [SIMPLIFIED] = "simplified"};
+	for (size_t stage = 0; stage < N_SIMPLIFY_STAGES; stage++) {
+		double time = (seconds[stage] > 0) ? seconds[stage] : 1e-9;
+		printf("{\"spec\": \"%s\", \"stage\": \"%s\", \"exprs\": %zu, \"built\": %zu, "
+		       "\"failed\": %zu, \"nodes\": %zu, \"mismatches\": %zu, \"seconds\": %.6f, "
+		       "\"exprs_per_sec\": %.0f}\n",
+		       spec->name, stage_names[stage], n_exprs, n_built, n_failed, n_nodes[stage],
+		       n_mismatches, seconds[stage], n_exprs / time);
+	}
+	fflush(stdout);
+	if (n_mismatches > 0) {
+		fprintf(stderr, "%s: %zu simplified trees evaluate differently\n", spec->name,
+			n_mismatches);
+		status = EXIT_FAILURE;
+	}
+	if (_too_few(spec->name, "simplified expressions evaluated to a result",
+		     n_exprs - n_failed, n_exprs)) {
+		status = EXIT_FAILURE;
+	}
+
+out:
+	for (size_t i = 0; i < N_SIMPLIFY_STAGES * n_exprs && roots; i++) {
+		expressiontree_destroy_tree(&roots[i]);
+	}
+	symtab_destroy(&symbols);
+	free(text);
+	free(roots);
+	free(results);
+	free(statuses);
+	free(values);
+	free(vars);
+	return status;
+}
+
+#define BENCH_ROWS (1 << 22)	// rows of every column
+static int _run_column_suite(size_t rounds)
+{
+	/*
+	 * columns a (int64), b (int64, 1 row in 64 null), c (int32), d (double, 1 row in 128 out of
+	 * a long's range), then one expression per pattern: bandwidth bound, arithmetic, divisions (by 0
+	 * included), '++'/'--'
+	 */
+	static char const *expressions[] = {
+		"a + b",
+		"a * b - c * 3 + d - (a - c) * (b + 5)",
+		"(a + 7) / (c % 5) + b % 3",
+		"a++ * 2 - c-- + a * c"
+	};
+	long *a = malloc(BENCH_ROWS * sizeof(*a));
+	long *b = malloc(BENCH_ROWS * sizeof(*b));
+	int32_t *c = malloc(BENCH_ROWS * sizeof(*c));
+	double *d = malloc(BENCH_ROWS * sizeof(*d));
+	uint8_t *b_validity = malloc(BENCH_ROWS / 8);
+	int status = (a && b && c && d && b_validity) ? EXIT_SUCCESS : EXIT_FAILURE;
+	if (status != EXIT_SUCCESS) {
+		perror("malloc");
+		goto out;
+	}
+	uint64_t bits = BENCH_SEED;
+	for (size_t i = 0; i < BENCH_ROWS; i++) {
+		bits ^= bits << 13;	// xorshift64
+		bits ^= bits >> 7;
+		bits ^= bits << 17;
+		a[i] = (long)(bits >> 1) - (long)(UINT64_MAX >> 2);
+		b[i] = (long)(bits % 2001) - 1000;
+		c[i] = (int32_t)(bits >> 32);
+		d[i] = (i % 128 == 127) ? 1e19 : (double)(int32_t)bits / 16;
+	}
+	for (size_t i = 0; i < BENCH_ROWS / 8; i++) {
+		b_validity[i] = (i % 8 == 7) ? 0xfe : 0xff;
+	}
+	Column table[] = {
+		{.type = COLUMN_INT64, .n_rows = BENCH_ROWS, .values = a},
+		{.type = COLUMN_INT64, .n_rows = BENCH_ROWS, .values = b, .validity = b_validity},
+		{.type = COLUMN_INT32, .n_rows = BENCH_ROWS, .values = c},
+		{.type = COLUMN_DOUBLE, .n_rows = BENCH_ROWS, .values = d}
+	};
+	for (size_t i = 0; i < sizeof(expressions) / sizeof(*expressions); i++) {
+		status = _run_columns(expressions[i], table, rounds);
+		if (status != EXIT_SUCCESS) {
+			break;
+		}
+	}
+
+out:
+	free(a);
+	free(b);
+	free(c);
+	free(d);
+	free(b_validity);
+	return status;
+}
+
+static int _run_columns(char const *expression, Column const *table, size_t rounds)
+{
+	// evaluate expression over table (variable "a" bound to table[0], "b" to table[1], ...)
+	Tokenizer tkz = tokenizer_tokenize(expression, strlen(expression));
+	ExpressionTree root = expressiontree_build_tree(&tkz);
+	CompactTree ct = { 0 };
+	Column const *bound[4] = { 0 };
+	long *results = malloc(2 * BENCH_ROWS * sizeof(*results));
+	uint8_t *validity = malloc(2 * BENCH_ROWS / 8);
+	int status = EXIT_FAILURE;
+	if (!root || compact_from_tree(root, &ct) != EVAL_OK || ct.n_vars > 4 || !results
+	    || !validity) {
+		fprintf(stderr, "%s: cannot be evaluated\n", expression);
+		goto out;
+	}
+	for (size_t v = 0; v < ct.n_vars; v++) {
+		bound[v] = &table[ct.vars[v].token_string[0] - 'a'];
+	}
+
+	enum {COLUMNS, ROWS, N_COLUMN_STAGES};
+	double seconds[N_COLUMN_STAGES];
+	ColumnReport report;
+	VM vm;
+	vm_init(&vm);
+	for (size_t round = 0; round < rounds; round++) {
+		double start = _now();
+		if (column_evaluate(&ct, bound, BENCH_ROWS, results, validity, &report) != EVAL_OK) {
+			fprintf(stderr, "%s: cannot be evaluated\n", expression);
+			goto out;
+		}
+		double time = _now() - start;
+		if (round == 0 || time < seconds[COLUMNS]) {
+			seconds[COLUMNS] = time;
+		}
+
+		// the same rows one at a time, with the conversions and nulls of column.h
+		long *row_results = results + BENCH_ROWS;
+		uint8_t *row_validity = validity + BENCH_ROWS / 8;
+		memset(row_validity, 0, BENCH_ROWS / 8);
+		start = _now();
+		for (size_t i = 0; i < BENCH_ROWS; i++) {
+			long vars[4];
+			bool valid = true;
+			for (size_t v = 0; v < ct.n_vars; v++) {
+				Column const *column = bound[v];
+				if (column->type == COLUMN_INT64) {
+					vars[v] = ((long const *)column->values)[i];
+				} else if (column->type == COLUMN_INT32) {
+					vars[v] = ((int32_t const *)column->values)[i];
+				} else {
+					double x = ((double const *)column->values)[i];
+					valid &= x >= -0x1p63 && x < 0x1p63;
+					vars[v] = valid ? (long)x : 0;
+				}
+				valid &= !column->validity || (column->validity[i / 8] >> (i % 8)) & 1;
+			}
+			row_results[i] = 0;
+			if (valid && compact_evaluate(&ct, &vm, vars, &row_results[i]) == EVAL_OK) {
+				row_validity[i / 8] |= 1 << (i % 8);
+			}
+		}
+		time = _now() - start;
+		if (round == 0 || time < seconds[ROWS]) {
+			seconds[ROWS] = time;
+		}
+	}
+	vm_destroy(&vm);
+
+	size_t n_mismatches = 0;
+	for (size_t i = 0; i < BENCH_ROWS; i++) {
+		n_mismatches += results[i] != results[BENCH_ROWS + i]
+				|| ((validity[i / 8] ^ validity[BENCH_ROWS / 8 + i / 8]) >> (i % 8)) & 1;
+	}
+	static char const *stage_names[] = {[COLUMNS] = "eval_columns", [ROWS] = "eval_rows"};
+	for (size_t stage = 0; stage < N_COLUMN_STAGES; stage++) {
+		double time = (seconds[stage] > 0) ? seconds[stage] : 1e-9;
+		printf("{\"spec\": \"%s\", \"stage\": \"%s\", \"rows\": %d, \"null\": %zu, "
+		       "\"div_by_zero\": %zu, \"mismatches\": %zu, \"seconds\": %.6f, "
+		       "\"rows_per_sec\": %.0f, \"bytes_per_sec\": %.0f}\n",
+		       expression, stage_names[stage], BENCH_ROWS, report.n_null, report.n_div_by_zero,
+		       n_mismatches, seconds[stage], BENCH_ROWS / time, report.n_bytes / time);
+	}
+	fflush(stdout);
+	status = EXIT_SUCCESS;
+	if (n_mismatches > 0) {
+		fprintf(stderr, "%s: %zu rows disagree\n", expression, n_mismatches);
+		status = EXIT_FAILURE;
+	}
+	if (_too_few(expression, "rows evaluated to a result", BENCH_ROWS - report.n_null,
+		     BENCH_ROWS)) {
+		status = EXIT_FAILURE;
+	}
+
+out:
+	compact_destroy(&ct);
+	expressiontree_destroy_tree(&root);
+	tokenizer_distroy(&tkz);
+	free(results);
+	free(validity);
+	return status;
+}
+
+#define BENCH_TASK_EXPRS (1 << 14)	// expressions joined into each large tree
+static int _run_task_suite(size_t rounds)
+{
+	/*
+	 * trees of about 2M nodes, then the first one updating a variable: every subtree reading
+	 * it must run in order, in the task of the whole tree.
+	 * No '/' nor '%': a division by 0 anywhere would end every evaluation early. No '++'/'--'
+	 * from the generator: updates all over the tree would leave it little to run in parallel.
+	 */
+	static struct {char const *label, *spec_name, *suffix;} trees[] = {
+		{"flat", "flat", ""},
+		{"nested", "nested", ""},
+		{"flat, x0++", "flat", " + x0++"}
+	};
+	TaskPool *pool = taskpool_create(0);
+	if (!pool) {
+		perror("taskpool_create");
+		return EXIT_FAILURE;
+	}
+	int status = EXIT_SUCCESS;
+	for (size_t i = 0; i < sizeof(trees) / sizeof(*trees) && status == EXIT_SUCCESS; i++) {
+		GenSpec spec = *exprgen_spec(trees[i].spec_name);
+		spec.incdec_pct = 0;
+		spec.op_weights[3] = spec.op_weights[4] = 0;
+		status = _run_tasks(trees[i].label, &spec, trees[i].suffix, pool, rounds);
+	}
+	taskpool_destroy(pool);
+	return status;
+}
+
+static int _run_tasks(char const *label, GenSpec const *spec, char const *suffix, TaskPool *pool,
+		      size_t rounds)
+{
+	// the tree of BENCH_TASK_EXPRS expressions of spec (_join) followed by suffix
+	char *text = malloc(BENCH_TASK_EXPRS * (exprgen_max_length(spec) + 4) + strlen(suffix));
+	SymbolTable symbols;
+	symtab_init(&symbols);
+	ExpressionTree root = NULL;
+	EvalPlan plan = { 0 };
+	long *values = NULL, *vars = NULL, *finals = NULL;
+	int status = EXIT_FAILURE;
+	if (!text) {
+		perror("malloc");
+		goto out;
+	}
+	ExprGen gen;
+	exprgen_init(&gen, BENCH_SEED);
+	size_t length = _join(&gen, spec, BENCH_TASK_EXPRS, text, 0);
+	strcpy(text + length, suffix);
+	length += strlen(suffix);
+	Tokenizer tkz = tokenizer_tokenize(text, length);
+	BuildOptions opts = {.symbols = &symbols};
+	root = expressiontree_build_tree_opts(&tkz, &opts);
+	tokenizer_distroy(&tkz);
+	if (!root || pareval_plan(root, 0, &plan) != EVAL_OK || !plan.ct.well_formed) {
+		fprintf(stderr, "%s: cannot be evaluated\n", label);
+		goto out;
+	}
+
+	// every stage starts over from values, its variables end up in finals[stage]
+	enum {TREE, COMPACT, PLAN, TASKS, N_TASK_STAGES};
+	size_t n_vars = plan.ct.n_vars;
+	values = malloc((symbols.n_symbols + 1) * sizeof(*values));
+	vars = malloc((symbols.n_symbols + n_vars + 1) * sizeof(*vars));
+	finals = malloc(N_TASK_STAGES * (n_vars + 1) * sizeof(*finals));
+	if (!values || !vars || !finals) {
+		perror("malloc");
+		goto out;
+	}
+	for (size_t slot = 0; slot < symbols.n_symbols; slot++) {
+		values[slot] = (slot % 2) ? 2 + (long)(slot % 5) : -3 - (long)(slot % 3);
+	}
+	long results[N_TASK_STAGES];
+	eval_status_t statuses[N_TASK_STAGES];
+	double seconds[N_TASK_STAGES];
+	VM vm;
+	vm_init(&vm);
+	for (size_t round = 0; round < rounds; round++) {
+		for (size_t stage = 0; stage < N_TASK_STAGES; stage++) {
+			if (stage == TREE) {
+				memcpy(vars, values, symbols.n_symbols * sizeof(*vars));
+			} else {
+				compact_bind_slots(&plan.ct, values, symbols.n_symbols, vars);
+			}
+			results[stage] = 0;
+			double start = _now();
+			if (stage == TREE) {
+				statuses[stage] = expressiontree_evaluate_slots(root, vars, symbols.n_symbols,
+										&results[stage]);
+			} else if (stage == COMPACT) {
+				statuses[stage] = compact_evaluate(&plan.ct, &vm, vars, &results[stage]);
+			} else {
+				statuses[stage] = pareval_run(&plan, (stage == TASKS) ? pool : NULL, vars,
+							      &results[stage]);
+			}
+			double time = _now() - start;
+			if (round == 0 || time < seconds[stage]) {
+				seconds[stage] = time;
+			}
+			for (size_t v = 0; v < n_vars; v++) {
+				finals[stage * (n_vars + 1) + v] = (stage == TREE) ? vars[plan.ct.symbols[v]]
+										    : vars[v];
+			}
+		}
+	}
+	vm_destroy(&vm);
+
+	size_t n_mismatches = 0;
+	for (size_t stage = 1; stage < N_TASK_STAGES; stage++) {
+		n_mismatches += statuses[stage] != statuses[TREE]
+				|| (statuses[stage] == EVAL_OK && results[stage] != results[TREE])
+				|| memcmp(finals + stage * (n_vars + 1), finals, n_vars * sizeof(*finals));
+	}
+	static char const *stage_names[] = {
+		[TREE] = "eval_tree",
+		[COMPACT] = "eval_compact",
+		[PLAN] = "eval_plan",
+		[TASKS] = "eval_tasks"
+	};
+	for (size_t stage = 0; stage < N_TASK_STAGES; stage++) {
+		double time = (seconds[stage] > 0) ? seconds[stage] : 1e-9;
+		printf("{\"spec\": \"%s\", \"stage\": \"%s\", \"nodes\": %zu, \"tasks\": %zu, "
+		       "\"threads\": %zu, \"steals\": %zu, \"status\": \"%s\", \"mismatches\": %zu, "
+		       "\"seconds\": %.6f, \"nodes_per_sec\": %.0f}\n",
+		       label, stage_names[stage], plan.ct.n_nodes, plan.n_tasks,
+		       (stage == TASKS) ? taskpool_size(pool) : 1,
+		       (stage == TASKS) ? taskpool_steals(pool) : 0, eval_status_str(statuses[TREE]),
+		       n_mismatches, seconds[stage], plan.ct.n_nodes / time);
+	}
+	fflush(stdout);
+	status = EXIT_SUCCESS;
+	if (n_mismatches > 0) {
+		fprintf(stderr, "%s: %zu evaluations of the large tree disagree\n", label,
+			n_mismatches);
+		status = EXIT_FAILURE;
+	}
+	if (_too_few(label, "large trees evaluated to a result", statuses[TREE] == EVAL_OK, 1)) {
+		status = EXIT_FAILURE;
+	}
+
+out:
+	pareval_destroy(&plan);
+	expressiontree_destroy_tree(&root);
+	symtab_destroy(&symbols);
+	free(text);
+	free(values);
+	free(vars);
+	free(finals);
+	return status;
+}
+
+#define BENCH_LEX_EXPRS (1 << 16)	// expressions joined into the long one tokenized
+static int _run_lex(size_t rounds)
+{
+	// "mixed" expressions joined as in _run_tasks, about 40MB of them
+	GenSpec const *spec = exprgen_spec("mixed");
+	char *text = malloc(BENCH_LEX_EXPRS * (exprgen_max_length(spec) + 4));
+	if (!text) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+	ExprGen gen;
+	exprgen_init(&gen, BENCH_SEED);
+	size_t length = _join(&gen, spec, BENCH_LEX_EXPRS, text, 0);
+
+	enum {LEX, LEX_PARALLEL, LEX_CHUNKED, N_LEX_STAGES};
+	size_t const n_threads[] = {[LEX] = 1, [LEX_PARALLEL] = 0, [LEX_CHUNKED] = 7};
+	Tokenizer tkzs[N_LEX_STAGES] = { 0 };
+	double seconds[N_LEX_STAGES];
+	for (size_t round = 0; round < rounds; round++) {
+		for (size_t stage = 0; stage < N_LEX_STAGES; stage++) {
+			tokenizer_distroy(&tkzs[stage]);
+			double start = _now();
+			tkzs[stage] = (stage == LEX) ? tokenizer_tokenize(text, length)
+				      : tokenizer_tokenize_parallel(text, length, n_threads[stage]);
+			double time = _now() - start;
+			if (round == 0 || time < seconds[stage]) {
+				seconds[stage] = time;
+			}
+		}
+	}
+	size_t n_tokens = tkzs[LEX].n_tokens, n_mismatches = 0;
+	for (size_t stage = 1; stage < N_LEX_STAGES; stage++) {
+		Tokenizer const *tkz = &tkzs[stage];
+		n_mismatches += tkz->n_tokens != n_tokens
+				|| memcmp(tkz->types, tkzs[LEX].types, n_tokens * sizeof(*tkz->types))
+				|| memcmp(tkz->offsets, tkzs[LEX].offsets, n_tokens * sizeof(*tkz->offsets))
+				|| memcmp(tkz->lengths, tkzs[LEX].lengths, n_tokens * sizeof(*tkz->lengths));
+	}
+	// threads tokenizer_tokenize_parallel starts with n_threads 0 on this input
+	long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t n_chunks = length / TOKENIZER_MIN_CHUNK;
+	if (n_cpus > 0 && (size_t)n_cpus < n_chunks) {
+		n_chunks = n_cpus;
+	}
+	static char const *stage_names[] = {[LEX] = "lex", [LEX_PARALLEL] = "lex_parallel"};
+	for (size_t stage = 0; stage < LEX_CHUNKED; stage++) {
+		double time = (seconds[stage] > 0) ? seconds[stage] : 1e-9;
+		printf("{\"spec\": \"%s\", \"stage\": \"%s\", \"bytes\": %zu, \"tokens\": %zu, "
+		       "\"threads\": %zu, \"mismatches\": %zu, \"seconds\": %.6f, "
+		       "\"bytes_per_sec\": %.0f, \"tokens_per_sec\": %.0f}\n",
+		       spec->name, stage_names[stage], length, n_tokens,
+		       (stage == LEX || n_chunks <= 1) ? 1 : n_chunks, n_mismatches, seconds[stage],
+		       length / time, n_tokens / time);
+	}
+	fflush(stdout);
+	for (size_t stage = 0; stage < N_LEX_STAGES; stage++) {
+		tokenizer_distroy(&tkzs[stage]);
+	}
+	free(text);
+	if (n_mismatches > 0) {
+		fprintf(stderr, "%s: parallel tokenizing disagrees\n", spec->name);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+#define BENCH_LITERALS (1 << 18)
+#define BENCH_LITERAL_DIGITS 44	// longest literal, 5 more than 2^128 - 1
+
+static int _run_literals(size_t rounds)
+{
+	/*
+	 * Literals are drawn around the edges: every length up to BENCH_LITERAL_DIGITS, a run of
+	 * leading zeros in one of 4, prefixes of 2^63 and 2^128 (the first value too large for each
+	 * decoder) in one of 8 each. The reference decoding is schoolbook, 32 bits per limb.
+	 */
+	static char const two_63[] = "9223372036854775808";
+	static char const two_128[] = "340282366920938463463374607431768211456";
+	enum {LITERAL, LITERAL_128, N_LITERAL_STAGES};
+	char *digits = malloc(BENCH_LITERALS * BENCH_LITERAL_DIGITS);
+	uint8_t *lengths = malloc(BENCH_LITERALS);
+	Literal128 *expected = malloc(BENCH_LITERALS * sizeof(*expected));
+	bool *fits = malloc(BENCH_LITERALS);		// expected holds the value (below 2^128)
+	long *values = malloc(BENCH_LITERALS * sizeof(*values));
+	Literal128 *values_128 = malloc(BENCH_LITERALS * sizeof(*values_128));
+	literal_status_t *statuses = malloc(N_LITERAL_STAGES * BENCH_LITERALS * sizeof(*statuses));
+	int status = (digits && lengths && expected && fits && values && values_128 && statuses)
+		     ? EXIT_SUCCESS : EXIT_FAILURE;
+	if (status != EXIT_SUCCESS) {
+		perror("malloc");
+		goto out;
+	}
+
+	uint64_t bits = BENCH_SEED;
+	size_t n_digits = 0;
+	for (size_t i = 0; i < BENCH_LITERALS; i++) {
+		bits ^= bits << 13;	// xorshift64
+		bits ^= bits >> 7;
+		bits ^= bits << 17;
+		char *literal = digits + i * BENCH_LITERAL_DIGITS;
+		size_t length = 1 + (bits >> 8) % BENCH_LITERAL_DIGITS;
+		size_t n_zeros = (bits % 4 == 0) ? (bits >> 16) % length : 0;
+		uint64_t draw = bits;
+		for (size_t k = 0; k < length; k++) {
+			if (k % 16 == 0) {
+				draw = draw * 6364136223846793005ULL + 1442695040888963407ULL;
+			}
+			literal[k] = (k < n_zeros) ? '0' : '0' + (draw >> (4 * (k % 16))) % 10;
+		}
+		char const *edge = ((bits >> 24) % 8 == 0) ? two_63 : ((bits >> 24) % 8 == 1) ? two_128 : NULL;
+		if (edge) {
+			// the edge value, or a value one digit off from it
+			length = strlen(edge);
+			memcpy(literal, edge, length);
+			size_t at = (bits >> 32) % (length + 1);
+			literal[at % length] = (at == length) ? literal[at % length] : '0' + (bits >> 40) % 10;
+		}
+		lengths[i] = (uint8_t)length;
+		n_digits += length;
+
+		uint64_t limbs[4] = {0};
+		fits[i] = true;
+		for (size_t k = 0; k < length && fits[i]; k++) {
+			uint64_t carry = (uint64_t)(literal[k] - '0');
+			for (size_t l = 0; l < 4; l++) {
+				uint64_t t = limbs[l] * 10 + carry;
+				limbs[l] = t & 0xffffffffULL;
+				carry = t >> 32;
+			}
+			fits[i] = carry == 0;
+		}
+		expected[i] = (Literal128) {.hi = limbs[3] << 32 | limbs[2], .lo = limbs[1] << 32 | limbs[0]};
+	}
+
+	double seconds[N_LITERAL_STAGES];
+	for (size_t round = 0; round < rounds; round++) {
+		double start = _now();
+		for (size_t i = 0; i < BENCH_LITERALS; i++) {
+			statuses[i] = literal_decode(digits + i * BENCH_LITERAL_DIGITS, lengths[i], &values[i]);
+		}
+		double time = _now() - start;
+		seconds[LITERAL] = (round == 0 || time < seconds[LITERAL]) ? time : seconds[LITERAL];
+		start = _now();
+		for (size_t i = 0; i < BENCH_LITERALS; i++) {
+			statuses[BENCH_LITERALS + i] = literal_decode_128(digits + i * BENCH_LITERAL_DIGITS,
+									  lengths[i], &values_128[i]);
+		}
+		time = _now() - start;
+		seconds[LITERAL_128] = (round == 0 || time < seconds[LITERAL_128]) ? time : seconds[LITERAL_128];
+	}
+
+	size_t n_mismatches[N_LITERAL_STAGES] = {0}, n_overflows[N_LITERAL_STAGES] = {0};
+	for (size_t i = 0; i < BENCH_LITERALS; i++) {
+		bool fits_long = fits[i] && expected[i].hi == 0 && expected[i].lo <= LONG_MAX;
+		literal_status_t st = statuses[i], st_128 = statuses[BENCH_LITERALS + i];
+		n_overflows[LITERAL] += st == LITERAL_OVERFLOW;
+		n_overflows[LITERAL_128] += st_128 == LITERAL_OVERFLOW;
+		n_mismatches[LITERAL] += (st == LITERAL_OK) != fits_long
+					 || (fits_long && (unsigned long)values[i] != expected[i].lo);
+		n_mismatches[LITERAL_128] += (st_128 == LITERAL_OK) != fits[i]
+					     || (fits[i] && (values_128[i].hi != expected[i].hi
+							     || values_128[i].lo != expected[i].lo));
+	}
+	static char const *stage_names[] = {[LITERAL] = "literal", [LITERAL_128] = "literal_128"};
+	for (size_t stage = 0; stage < N_LITERAL_STAGES; stage++) {
+		double time = (seconds[stage] > 0) ? seconds[stage] : 1e-9;
+		printf("{\"stage\": \"%s\", \"literals\": %d, \"digits\": %zu, \"overflows\": %zu, "
+		       "\"mismatches\": %zu, \"seconds\": %.6f, \"literals_per_sec\": %.0f, "
+		       "\"digits_per_sec\": %.0f}\n",
+		       stage_names[stage], BENCH_LITERALS, n_digits, n_overflows[stage], n_mismatches[stage],
+		       seconds[stage], BENCH_LITERALS / time, n_digits / time);
+	}
+	fflush(stdout);
+	if (n_mismatches[LITERAL] + n_mismatches[LITERAL_128] > 0) {
+		fprintf(stderr, "literals: %zu decoded wrong, %zu by literal_decode_128\n",
+			n_mismatches[LITERAL] + n_mismatches[LITERAL_128], n_mismatches[LITERAL_128]);
+		status = EXIT_FAILURE;
+	}
+
+out:
+	free(digits);
+	free(lengths);
+	free(expected);
+	free(fits);
+	free(values);
+	free(values_128);
+	free(statuses);
+	return status;
+}
+
+#define BENCH_DOC_EDITS 2048	// per round
+#define BENCH_DOC_SLACK 64	// bytes an edit may add to the text
+
+static int _run_document(size_t rounds, FILE *sink)
+{
+	/*
+	 * The same edits every round: a third of them break the text (random bytes deleted or
+	 * inserted) and the next edit puts it back, the others keep it valid (a name or literal
+	 * respelled, an operator swapped, whitespace moved).
+	 */
+	enum {EDIT, REPARSE, N_DOC_STAGES};
+	GenSpec const *spec = exprgen_spec("long");
+	size_t max_length = exprgen_max_length(spec);
+	size_t capacity = max_length + BENCH_DOC_EDITS * BENCH_DOC_SLACK;
+	char *original = malloc(max_length);
+	char *text = malloc(capacity);
+	char *undo = malloc(BENCH_DOC_SLACK);
+	if (!original || !text || !undo) {
+		perror("malloc");
+		free(original);
+		free(text);
+		free(undo);
+		return EXIT_FAILURE;
+	}
+	ExprGen gen;
+	exprgen_init(&gen, BENCH_SEED);
+	size_t original_length = exprgen_expression(&gen, spec, original, max_length);
+
+	SymbolTable symbols;
+	symtab_init(&symbols);
+	double seconds[N_DOC_STAGES] = {0};
+	size_t n_mismatches = 0, n_invalid = 0, n_reused = 0, n_full_parses = 0, n_nodes = 0;
+	for (size_t round = 0; round < rounds; round++) {
+		memcpy(text, original, original_length);
+		size_t length = original_length;
+		Document doc;
+		ExpressionTree root = document_open(&doc, text, length, &symbols, sink);
+		uint64_t bits = BENCH_SEED;
+		bool pending_undo = false;
+		TextEdit undo_edit;
+		double time[N_DOC_STAGES] = {0};
+		n_invalid = 0;
+		for (size_t e = 0; e < BENCH_DOC_EDITS && root; e++) {
+			TextEdit edit;
+			if (pending_undo) {
+				// put back what the previous edit broke
+				memmove(text + undo_edit.offset + undo_edit.n_inserted,
+					text + undo_edit.offset + undo_edit.n_deleted,
+					length - undo_edit.offset - undo_edit.n_deleted);
+				memcpy(text + undo_edit.offset, undo, undo_edit.n_inserted);
+				length = length - undo_edit.n_deleted + undo_edit.n_inserted;
+				edit = undo_edit;
+				pending_undo = false;
+			} else {
+				length = _random_edit(&bits, text, length, &edit, undo, &undo_edit);
+				pending_undo = undo_edit.n_deleted + undo_edit.n_inserted > 0;
+			}
+
+			double start = _now();
+			ExpressionTree edited = document_edit(&doc, text, length, &edit);
+			time[EDIT] += _now() - start;
+			start = _now();
+			Tokenizer tkz = tokenizer_tokenize(text, length);
+			BuildOptions opts = {.symbols = &symbols, .errors = sink};
+			ExpressionTree fresh = expressiontree_build_tree_opts(&tkz, &opts);
+			time[REPARSE] += _now() - start;
+
+			char *printed = _print(edited), *expected = _print(fresh);
+			n_mismatches += (printed == NULL) != (expected == NULL)
+					|| (printed && strcmp(printed, expected) != 0);
+			n_invalid += fresh == NULL;
+			n_nodes = (fresh) ? _count_nodes(fresh) : n_nodes;
+			free(printed);
+			free(expected);
+			expressiontree_destroy_tree(&fresh);
+			tokenizer_distroy(&tkz);
+		}
+		n_mismatches += root == NULL;	// the generated expression must parse
+		n_reused = doc.memo.n_reused;
+		n_full_parses = doc.n_full_parses;
+		document_close(&doc);
+		for (size_t stage = 0; stage < N_DOC_STAGES; stage++) {
+			if (round == 0 || time[stage] < seconds[stage]) {
+				seconds[stage] = time[stage];
+			}
+		}
+	}
+	symtab_destroy(&symbols);
+
+	static char const *stage_names[] = {[EDIT] = "document_edit", [REPARSE] = "reparse"};
+	for (size_t stage = 0; stage < N_DOC_STAGES; stage++) {
+		double time = (seconds[stage] > 0) ? seconds[stage] : 1e-9;
+		printf("{\"spec\": \"%s\", \"stage\": \"%s\", \"edits\": %d, \"nodes\": %zu, "
+		       "\"invalid\": %zu, \"reused\": %zu, \"full_parses\": %zu, \"mismatches\": %zu, "
+		       "\"seconds\": %.6f, \"edits_per_sec\": %.0f}\n",
+		       spec->name, stage_names[stage], BENCH_DOC_EDITS, n_nodes, n_invalid, n_reused,
+		       n_full_parses, n_mismatches, seconds[stage], BENCH_DOC_EDITS / time);
+	}
+	fflush(stdout);
+	free(original);
+	free(text);
+	free(undo);
+	if (n_mismatches > 0) {
+		fprintf(stderr, "%s: %zu document versions differ from a parse from scratch\n",
+			spec->name, n_mismatches);
+		return EXIT_FAILURE;
+	}
+	return _too_few(spec->name, "document versions parsed", BENCH_DOC_EDITS - n_invalid,
+			BENCH_DOC_EDITS) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static size_t _random_edit(uint64_t *bits, char *text, size_t length, TextEdit *edit,
+			   char *undo, TextEdit *undo_edit)
+{
+	/*
+	 * Apply a random edit to text[0...length - 1] (room for BENCH_DOC_SLACK more bytes),
+	 * describe it in edit and return the new length. An edit that may break the text saves
+	 * what it replaced in undo, undo_edit being the edit that puts it back (else undo_edit
+	 * changes nothing).
+	 */
+	static char const names[] = "abcxyz", digits[] = "0123456789", ops[] = "+*/%";
+	static char const noise[] = "+-*/%() a1";
+	*bits ^= *bits << 13;	// xorshift64
+	*bits ^= *bits >> 7;
+	*bits ^= *bits << 17;
+	uint64_t r = *bits;
+	size_t at = (r >> 8) % length;
+	*undo_edit = (TextEdit) {.offset = at};
+	*edit = (TextEdit) {.offset = at, .n_deleted = 1, .n_inserted = 1};
+	char ch = text[at];
+	if (r % 3 == 0) {
+		// delete up to 8 bytes, insert up to 4 noise bytes
+		size_t n_deleted = (r >> 40) % 9, n_inserted = (r >> 44) % 5;
+		n_deleted = (at + n_deleted > length) ? length - at : n_deleted;
+		memcpy(undo, text + at, n_deleted);
+		memmove(text + at + n_inserted, text + at + n_deleted, length - at - n_deleted);
+		for (size_t k = 0; k < n_inserted; k++) {
+			text[at + k] = noise[(r >> (48 + 3 * k)) % (sizeof(noise) - 1)];
+		}
+		*edit = (TextEdit) {.offset = at, .n_deleted = n_deleted, .n_inserted = n_inserted};
+		*undo_edit = (TextEdit) {.offset = at, .n_deleted = n_inserted, .n_inserted = n_deleted};
+		return length - n_deleted + n_inserted;
+	}
+	if (ch >= 'a' && ch <= 'z') {
+		text[at] = names[(r >> 40) % (sizeof(names) - 1)];
+	} else if (ch >= '0' && ch <= '9') {
+		text[at] = digits[(r >> 40) % (sizeof(digits) - 1)];
+	} else if (ch != '\0' && strchr(ops, ch) && (at == 0 || text[at - 1] != ch)
+		   && (at + 1 == length || text[at + 1] != ch)) {
+		text[at] = ops[(r >> 40) % (sizeof(ops) - 1)];
+	} else if (at == 0 || !strchr(" ()", text[at - 1]) || !strchr(" ()", ch)) {
+		*edit = (TextEdit) {0};	// whitespace that may separate two tokens stays
+	} else if (ch == ' ') {
+		*edit = (TextEdit) {.offset = at, .n_deleted = 1};	// removed
+		memmove(text + at, text + at + 1, length - at - 1);
+		return length - 1;
+	} else {
+		*edit = (TextEdit) {.offset = at, .n_inserted = 1};	// a space before ch
+		memmove(text + at + 1, text + at, length - at);
+		text[at] = ' ';
+		return length + 1;
+	}
+	return length;
+}
+
+#define BENCH_CACHE_EXPRS 4096
+#define BENCH_CACHE_THREADS 4
+#define BENCH_CACHE_LOOKUPS (1 << 15)	// per thread and round
+#define BENCH_CACHE_BATCH 256		// lookups between two checks
+#define BENCH_CACHE_BYTES (1 << 26)	// a fraction of what the expressions need
+
+/* CacheWorker: one thread of _run_cache */
+typedef struct {
+	ParseCache *cache;
+	char *const *spellings;		/* 3 per expression */
+	size_t const *lengths;
+	char *const *expected;		/* tree printed from a fresh parse, NULL if invalid */
+	size_t n_exprs;
+	uint64_t seed;
+	double seconds;			/* in parsecache_get/parsecache_release */
+	size_t n_mismatches;
+} CacheWorker;
+
+static int _run_cache(size_t rounds, FILE *sink)
+{
+	GenSpec const *spec = exprgen_spec("mixed");
+	size_t max_length = exprgen_max_length(spec);
+	size_t n_spellings = 3 * BENCH_CACHE_EXPRS;
+	char **spellings = calloc(n_spellings, sizeof(*spellings));
+	size_t *lengths = calloc(n_spellings, sizeof(*lengths));
+	char **expected = calloc(BENCH_CACHE_EXPRS, sizeof(*expected));
+	char *keys = malloc(3 * max_length);
+	int status = (spellings && lengths && expected && keys) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	ExprGen gen;
+	exprgen_init(&gen, BENCH_SEED);
+	size_t n_invalid = 0, n_key_mismatches = 0;
+	for (size_t i = 0; i < BENCH_CACHE_EXPRS && status == EXIT_SUCCESS; i++) {
+		char **spelling = spellings + 3 * i;
+		size_t *length = lengths + 3 * i;
+		for (size_t k = 0; k < 3; k++) {
+			spelling[k] = malloc(2 * max_length);	// room for a space after every token
+		}
+		if (!spelling[0] || !spelling[1] || !spelling[2]) {
+			status = EXIT_FAILURE;
+			break;
+		}
+		length[0] = exprgen_expression(&gen, spec, spelling[0], max_length);
+		if (i % 64 == 63) {
+			memcpy(spelling[0] + length[0], " *", 3);	// a few invalid expressions
+			length[0] += 2;
+		}
+		length[1] = tokenizer_normalize(spelling[0], length[0], spelling[1]);
+		Tokenizer tkz = tokenizer_tokenize(spelling[0], length[0]);
+		length[2] = 0;
+		for (size_t t = 0; t + 1 < tkz.n_tokens; t++) {
+			Token token = tokenizer_token(&tkz, t);
+			memcpy(spelling[2] + length[2], token.token_string, token.length);
+			length[2] += token.length;
+			spelling[2][length[2]++] = ' ';
+		}
+		BuildOptions opts = {.errors = sink};
+		ExpressionTree root = expressiontree_build_tree_opts(&tkz, &opts);
+		tokenizer_distroy(&tkz);
+		expected[i] = _print(root);
+		n_invalid += root == NULL;
+		status = (root && !expected[i]) ? EXIT_FAILURE : status;
+		expressiontree_destroy_tree(&root);
+
+		// the three spellings must make one key
+		size_t key_lengths[3];
+		for (size_t k = 0; k < 3; k++) {
+			key_lengths[k] = tokenizer_normalize(spelling[k], length[k], keys + k * max_length);
+		}
+		for (size_t k = 1; k < 3; k++) {
+			n_key_mismatches += key_lengths[k] != key_lengths[0]
+					    || memcmp(keys + k * max_length, keys, key_lengths[0]) != 0;
+		}
+	}
+	ParseCache *cache = (status == EXIT_SUCCESS) ? parsecache_create(BENCH_CACHE_BYTES, sink) : NULL;
+	if (!cache) {
+		perror("malloc");
+		status = EXIT_FAILURE;
+		goto out;
+	}
+
+	CacheWorker workers[BENCH_CACHE_THREADS];
+	double seconds = 0;
+	size_t n_mismatches = n_key_mismatches;
+	for (size_t round = 0; round < rounds && status == EXIT_SUCCESS; round++) {
+		pthread_t threads[BENCH_CACHE_THREADS];
+		size_t n_started = 0;
+		for (; n_started < BENCH_CACHE_THREADS; n_started++) {
+			workers[n_started] = (CacheWorker) {
+				.cache = cache, .spellings = spellings, .lengths = lengths,
+				.expected = expected, .n_exprs = BENCH_CACHE_EXPRS,
+				.seed = BENCH_SEED + round * BENCH_CACHE_THREADS + n_started
+			};
+			if (pthread_create(&threads[n_started], NULL, _cache_main,
+					   &workers[n_started]) != 0) {
+				status = EXIT_FAILURE;
+				break;
+			}
+		}
+		double time = 0;
+		for (size_t t = 0; t < n_started; t++) {
+			pthread_join(threads[t], NULL);
+			time = (workers[t].seconds > time) ? workers[t].seconds : time;
+			n_mismatches += workers[t].n_mismatches;
+		}
+		if (round == 0 || time < seconds) {
+			seconds = time;
+		}
+	}
+	CacheStats stats;
+	parsecache_stats(cache, &stats);
+	parsecache_destroy(cache);
+	size_t n_lookups = BENCH_CACHE_THREADS * BENCH_CACHE_LOOKUPS;
+	double time = (seconds > 0) ? seconds : 1e-9;
+	printf("{\"spec\": \"%s\", \"stage\": \"cache\", \"exprs\": %zu, \"invalid\": %zu, "
+	       "\"threads\": %d, \"hits\": %zu, \"misses\": %zu, \"evictions\": %zu, "
+	       "\"mismatches\": %zu, \"seconds\": %.6f, \"lookups_per_sec\": %.0f}\n",
+	       spec->name, (size_t)BENCH_CACHE_EXPRS, n_invalid, BENCH_CACHE_THREADS, stats.n_hits,
+	       stats.n_misses, stats.n_evictions, n_mismatches, seconds, n_lookups / time);
+	fflush(stdout);
+	if (status == EXIT_SUCCESS && n_mismatches > 0) {
+		fprintf(stderr, "%s: %zu cached trees differ from a fresh parse\n", spec->name,
+			n_mismatches);
+		status = EXIT_FAILURE;
+	}
+	if (status == EXIT_SUCCESS && (stats.n_hits == 0 || stats.n_misses == 0 || stats.n_evictions == 0)) {
+		fprintf(stderr, "%s: the cache run saw no hit, miss or eviction\n", spec->name);
+		status = EXIT_FAILURE;
+	}
+	if (status == EXIT_SUCCESS && _too_few(spec->name, "cached expressions parsed",
+					       BENCH_CACHE_EXPRS - n_invalid, BENCH_CACHE_EXPRS)) {
+		status = EXIT_FAILURE;
+	}
+
+out:
+	for (size_t i = 0; i < n_spellings && spellings; i++) {
+		free(spellings[i]);
+	}
+	for (size_t i = 0; i < BENCH_CACHE_EXPRS && expected; i++) {
+		free(expected[i]);
+	}
+	free(spellings);
+	free(lengths);
+	free(expected);
+	free(keys);
+	return status;
+}
+
+static void *_cache_main(void *arg)
+{
+	// BENCH_CACHE_LOOKUPS lookups, low indices more often than high ones
+	CacheWorker *worker = arg;
+	uint64_t bits = worker->seed;
+	CacheEntry const *entries[BENCH_CACHE_BATCH];
+	size_t picks[BENCH_CACHE_BATCH];
+	for (size_t done = 0; done < BENCH_CACHE_LOOKUPS; done += BENCH_CACHE_BATCH) {
+		for (size_t j = 0; j < BENCH_CACHE_BATCH; j++) {
+			// the product of two uniform draws: skewed towards 0
+			bits ^= bits << 13;	// xorshift64
+			bits ^= bits >> 7;
+			bits ^= bits << 17;
+			uint64_t a = (bits >> 32) % worker->n_exprs, b = (uint32_t)bits % worker->n_exprs;
+			picks[j] = 3 * (a * b / worker->n_exprs) + (bits >> 16) % 3;
+		}
+		double start = _now();
+		for (size_t j = 0; j < BENCH_CACHE_BATCH; j++) {
+			entries[j] = parsecache_get(worker->cache, worker->spellings[picks[j]],
+						    worker->lengths[picks[j]]);
+		}
+		worker->seconds += _now() - start;
+		for (size_t j = 0; j < BENCH_CACHE_BATCH; j++) {
+			char const *expected = worker->expected[picks[j] / 3];
+			char *printed = entries[j] ? _print(entries[j]->root) : NULL;
+			worker->n_mismatches += !entries[j] || (expected == NULL) != (printed == NULL)
+						|| (expected && strcmp(expected, printed) != 0);
+			free(printed);
+		}
+		start = _now();
+		for (size_t j = 0; j < BENCH_CACHE_BATCH; j++) {
+			parsecache_release(entries[j]);
+		}
+		worker->seconds += _now() - start;
+	}
+	return NULL;
+}
+
+static char *_print(ExpressionTree root)
+{
+	// root as printed to parseTree.txt, in a malloc'd string (NULL for no tree)
+	if (!root) {
+		return NULL;
+	}
+	char *text = NULL;
+	size_t size = 0;
+	FILE *fp = open_memstream(&text, &size);
+	if (!fp) {
+		return NULL;
+	}
+	expressiontree_print_to_file(fp, 0, root);
+	fclose(fp);
+	return text;
+}
+
+static void _emit_all(ExpressionTree const *roots, size_t n, int fd, enum emit_format_t format)
+{
+	// every tree through one Emitter, as batch_emit_file does
+	Emitter em;
+	emitter_init(&em, fd, NULL, 0);
+	for (size_t i = 0; i < n; i++) {
+		emitter_tree(&em, roots[i], format, 0);
+	}
+	emitter_flush(&em);
+	emitter_destroy(&em);
+}
+
+static size_t _join(ExprGen *gen, GenSpec const *spec, size_t n, char *text, size_t depth)
+{
+	// n expressions of spec joined into a balanced tree: "((e1) + (e2)) - ((e3) + (e4))"
+	size_t length = 0;
+	text[length++] = '(';
+	if (n == 1) {
+		length += exprgen_expression(gen, spec, text + length, exprgen_max_length(spec));
+	} else {
+		length += _join(gen, spec, n / 2, text + length, depth + 1);
+		text[length++] = (depth % 2) ? '+' : '-';
+		length += _join(gen, spec, n - n / 2, text + length, depth + 1);
+	}
+	text[length++] = ')';
+	text[length] = '\0';
+	return length;
+}
+
+static inline bool _too_few(char const *name, char const *what, size_t n_checked, size_t n)
+{
+	// a stage whose inputs almost all failed timed and compared next to nothing: report it
+	if (n > 0 && n_checked * BENCH_MIN_CHECKED >= n) {
+		return false;
+	}
+	fprintf(stderr, "%s: only %zu of %zu %s\n", name, n_checked, n, what);
+	return true;
+}
+
+static inline size_t _count_nodes(ExpressionTree root)
+{
+	ExpressionTree inline_nodes[64];
+	ExpressionTree *nodes = inline_nodes;
+	size_t capacity = 64, size = 0, n_nodes = 0;
+	if (root) {
+		nodes[size++] = root;
+	}
+	while (size > 0) {
+		ExpressionTree node = nodes[--size];
+		n_nodes++;
+		if (!stack_reserve((void **)&nodes, &capacity, size + 2, sizeof(*nodes), inline_nodes)) {
+			break;
+		}
+		if (node->binary.left) {
+			nodes[size++] = node->binary.left;
+		}
+		if (node->binary.right) {
+			nodes[size++] = node->binary.right;
+		}
+	}
+	stack_release(nodes, inline_nodes);
+	return n_nodes;
+}
+
+static inline bool _same_tree(ExpressionTree a, ExpressionTree b)
+{
+	// same shape, operators and operands; literals are compared by value, not by text
+	struct {ExpressionTree a, b;} inline_pairs[64], *pairs = inline_pairs;
+	size_t capacity = 64, size = 1;
+	bool same = true;
+	pairs[0].a = a;
+	pairs[0].b = b;
+	while (size > 0 && same) {
+		a = pairs[--size].a;
+		b = pairs[size].b;
+		if (!a || !b) {
+			same = a == b;
+			continue;
+		}
+		same = a->token.type == b->token.type && a->prefix == b->prefix
+		       && a->postfix == b->postfix;
+		if (same && a->token.type == TOK_LIT) {
+			same = a->value == b->value;
+		} else if (same && a->token.type == TOK_VAR) {
+			same = a->slot == b->slot && a->token.length == b->token.length
+			       && memcmp(a->token.token_string, b->token.token_string, a->token.length) == 0;
+		} else if (same) {
+			if (!stack_reserve((void **)&pairs, &capacity, size + 2, sizeof(*pairs), inline_pairs)) {
+				same = false;
+				break;
+			}
+			pairs[size].a = a->binary.left;
+			pairs[size++].b = b->binary.left;
+			pairs[size].a = a->binary.right;
+			pairs[size++].b = b->binary.right;
+		}
+	}
+	stack_release(pairs, inline_pairs);
+	return same;
+}
+
+static inline bool _same_slots(VarList const *vars, uint32_t const *slots, size_t n_slots)
+{
+	return vars->n_slots == n_slots
+	       && (n_slots == 0 || memcmp(vars->slots, slots, n_slots * sizeof(*slots)) == 0);
+}
+
+static inline double _now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
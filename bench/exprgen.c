@@ -0,0 +1,142 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "exprgen.h"
+
+#define N_VARIABLES 32
+
+GenSpec const exprgen_specs[] = {
+	// name        operands depth paren% + - * / %  weights   impl% incdec% chain lit% neg% divvar%
+	{"flat",          64,     0,    0, {4, 4, 2, 1, 1},         0,     0,     0,   50,  10,   50},
+	{"nested",        64,    32,   60, {3, 3, 3, 1, 1},         0,     0,     0,   50,  10,   50},
+	{"implicit",      64,     4,   10, {2, 2, 2, 1, 1},        70,     0,     0,   50,  10,   50},
+	{"incdec",        64,     4,   10, {3, 3, 2, 1, 1},        10,    60,     4,   30,  10,   50},
+	{"mixed",         64,     8,   20, {3, 3, 3, 1, 1},        20,    15,     2,   50,  10,   50},
+	{"long",        4096,    16,   15, {3, 3, 3, 1, 1},        15,    10,     2,   50,  10,    0},
+};
+size_t const exprgen_n_specs = sizeof(exprgen_specs) / sizeof(exprgen_specs[0]);
+
+static inline uint64_t _next(ExprGen *gen);
+static inline unsigned _below(ExprGen *gen, unsigned n);
+static inline char const *_pick_op(ExprGen *gen, GenSpec const *spec);
+
+void exprgen_init(ExprGen *gen, uint64_t seed)
+{
+	assert(gen && "parameter gen must be a valid ExprGen *");
+	gen->state = seed ? seed : 0x9e3779b97f4a7c15ULL;	// xorshift must not start at 0
+}
+
+GenSpec const *exprgen_spec(char const *name)
+{
+	// the spec called name, NULL if none is
+	for (size_t i = 0; i < exprgen_n_specs; i++) {
+		if (strcmp(exprgen_specs[i].name, name) == 0) {
+			return &exprgen_specs[i];
+		}
+	}
+	return NULL;
+}
+
+size_t exprgen_max_length(GenSpec const *spec)
+{
+	// per operand: "( " and ") ", 2 chains of "++ ", "- ", a literal of 6 digits or a
+	// variable, " % "
+	return spec->n_operands * (4 + 6 * spec->max_chain + 2 + 6 + 3) + 1;
+}
+
+size_t exprgen_expression(ExprGen *gen, GenSpec const *spec, char *buf, size_t size)
+{
+	/*
+	 * - Writes the next expression of spec into buf (null-terminated, no '\n'), returns its
+	 *   length.
+	 * - size must be at least exprgen_max_length(spec).
+	 */
+	assert(gen && spec && buf);
+	assert(size >= exprgen_max_length(spec) && "buf is too small for spec");
+	(void)size;
+	char *p = buf;
+	size_t depth = 0;
+	for (size_t i = 0; i < spec->n_operands; i++) {
+		// after implicit multiplication the operand starts with its leaf: a prefix '-' or
+		// '++'/'--' would turn into an infix '-' or a postfix of the operand before
+		bool implicit = false;
+		char const *op = "";
+		if (i > 0) {
+			implicit = _below(gen, 100) < spec->implicit_pct;
+			op = implicit ? "" : _pick_op(gen, spec);
+			p += implicit ? sprintf(p, " ") : sprintf(p, " %s ", op);
+		}
+		// the right operand of '/' and '%' is a literal or a variable: only a variable bound
+		// to 0, or moved there by '++'/'--', divides by 0
+		bool divisor = *op == '/' || *op == '%';
+		if (!divisor && depth < spec->max_depth && i + 1 < spec->n_operands
+		    && _below(gen, 100) < spec->paren_pct) {
+			p += sprintf(p, "( ");
+			depth++;
+			implicit = false;
+		}
+
+		// operand: [chain] [-] leaf [chain]
+		bool incdec = !divisor && _below(gen, 100) < spec->incdec_pct;
+		bool prefix = incdec && !implicit && _below(gen, 2);
+		size_t chain = incdec ? 1 + _below(gen, spec->max_chain) : 0;
+		for (size_t j = 0; prefix && j < chain; j++) {
+			p += sprintf(p, "%s ", _below(gen, 2) ? "++" : "--");
+		}
+		if (!incdec && !implicit && !divisor && _below(gen, 100) < spec->unary_pct) {
+			p += sprintf(p, "- ");
+		}
+		bool literal = divisor ? _below(gen, 100) >= spec->div_var_pct
+			       : _below(gen, 100) < spec->literal_pct;
+		if (literal) {
+			p += sprintf(p, "%u", 1 + _below(gen, 999999));
+		} else {
+			p += sprintf(p, "x%u", _below(gen, N_VARIABLES));
+		}
+		for (size_t j = 0; !prefix && j < chain; j++) {
+			p += sprintf(p, " %s", _below(gen, 2) ? "++" : "--");
+		}
+
+		if (depth > 0 && (_below(gen, 100) < spec->paren_pct || i + 1 == spec->n_operands)) {
+			p += sprintf(p, " )");
+			depth--;
+		}
+	}
+	while (depth > 0) {
+		p += sprintf(p, " )");
+		depth--;
+	}
+	*p = '\0';
+	return p - buf;
+}
+
+static inline uint64_t _next(ExprGen *gen)
+{
+	// xorshift64*
+	gen->state ^= gen->state >> 12;
+	gen->state ^= gen->state << 25;
+	gen->state ^= gen->state >> 27;
+	return gen->state * 0x2545f4914f6cdd1dULL;
+}
+
+static inline unsigned _below(ExprGen *gen, unsigned n)
+{
+	// uniform enough in [0, n) for benchmark inputs
+	return (n > 0) ? (_next(gen) >> 32) % n : 0;
+}
+
+static inline char const *_pick_op(ExprGen *gen, GenSpec const *spec)
+{
+	static char const *ops[] = {"+", "-", "*", "/", "%"};
+	unsigned total = 0;
+	for (size_t i = 0; i < 5; i++) {
+		total += spec->op_weights[i];
+	}
+	unsigned pick = _below(gen, total);
+	size_t i = 0;
+	while (pick >= spec->op_weights[i]) {
+		pick -= spec->op_weights[i++];
+	}
+	return ops[i];
+}
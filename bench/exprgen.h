@@ -0,0 +1,49 @@
+#ifndef __EXPRGEN_H__
+#define __EXPRGEN_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * ExprGen: a deterministic generator of synthetic expressions, for benchmarks.
+ * - The same GenSpec and seed always produce the same expressions, on every platform (the
+ *   generator has its own PRNG, xorshift64*).
+ * - An expression is a sequence of n_operands operands, each a variable or a literal possibly
+ *   wrapped in '++'/'--' chains and unary '-', joined by binary operators drawn from
+ *   op_weights or by implicit multiplication. Parentheses open before an operand and close
+ *   after one, never deeper than max_depth.
+ * - Every expression parses and evaluates (evaluate.h). An operand joined by implicit
+ *   multiplication starts with its leaf (a prefix '-' or chain there would read as an infix
+ *   '-' or a postfix chain of the operand before). The right operand of '/' or '%' is a bare
+ *   literal or variable, so only a variable at 0 divides by 0: "long" divides by literals
+ *   alone, any one of its thousands of divisions would otherwise end it early.
+ */
+
+/* GenSpec: shape of the generated expressions (percentages are out of 100) */
+typedef struct {
+	char const *name;
+	size_t n_operands;	/* operands per expression */
+	size_t max_depth;	/* parentheses nesting */
+	unsigned paren_pct;	/* chance an operand opens a '(' (if under max_depth) */
+	unsigned op_weights[5];	/* relative weights of '+' '-' '*' '/' '%' */
+	unsigned implicit_pct;	/* chance two operands are joined by implicit multiplication */
+	unsigned incdec_pct;	/* chance an operand carries a '++'/'--' chain */
+	size_t max_chain;	/* longest '++'/'--' chain */
+	unsigned literal_pct;	/* chance an operand is a literal rather than a variable */
+	unsigned unary_pct;	/* chance an operand without '++'/'--' is negated by a unary '-' */
+	unsigned div_var_pct;	/* chance the right operand of '/' or '%' is a variable */
+} GenSpec;
+
+typedef struct {
+	uint64_t state;
+} ExprGen;
+
+void exprgen_init(ExprGen *gen, uint64_t seed);
+size_t exprgen_expression(ExprGen *gen, GenSpec const *spec, char *buf, size_t size);
+size_t exprgen_max_length(GenSpec const *spec);
+GenSpec const *exprgen_spec(char const *name);
+
+extern GenSpec const exprgen_specs[];
+extern size_t const exprgen_n_specs;
+
+#endif /* end of __EXPRGEN_H__ */
@@ -0,0 +1,202 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../headers/server.h"
+#include "exprgen.h"
+#include "loadgen.h"
+
+#define LOADGEN_SEED 20240229
+#define LOADGEN_READ (1 << 16)
+
+static int _connect(char const *socket_path, pid_t *server);
+static int _compare_double(void const *a, void const *b);
+static inline double _now(void);
+
+int loadgen_run(char const *socket_path, char const *spec_name, size_t n, size_t depth)
+{
+	GenSpec const *spec = exprgen_spec(spec_name);
+	if (!spec || n == 0 || depth == 0) {
+		fprintf(stderr, "--load needs a known spec, n > 0 and depth > 0\n");
+		return EXIT_FAILURE;
+	}
+
+	// every request framed up front: requests[starts[i] ... starts[i + 1] - 1]
+	size_t max_length = exprgen_max_length(spec);
+	char *requests = malloc(n * (SERVER_FRAME + max_length));
+	size_t *starts = malloc((n + 1) * sizeof(*starts));
+	double *sent_at = malloc(n * sizeof(*sent_at));
+	double *latency = malloc(n * sizeof(*latency));
+	char *replies = malloc(LOADGEN_READ);
+	if (!requests || !starts || !sent_at || !latency || !replies) {
+		perror("malloc");
+		free(requests), free(starts), free(sent_at), free(latency), free(replies);
+		return EXIT_FAILURE;
+	}
+	ExprGen gen;
+	exprgen_init(&gen, LOADGEN_SEED);
+	starts[0] = 0;
+	for (size_t i = 0; i < n; i++) {
+		char *frame = requests + starts[i];
+		size_t length = exprgen_expression(&gen, spec, frame + SERVER_FRAME, max_length);
+		server_frame_encode((uint8_t *)frame, length, SERVER_PARSE);
+		starts[i + 1] = starts[i] + SERVER_FRAME + length;
+	}
+
+	pid_t server = 0;
+	int fd = _connect(socket_path, &server);
+	if (fd < 0) {
+		perror(socket_path);
+		free(requests), free(starts), free(sent_at), free(latency), free(replies);
+		return EXIT_FAILURE;
+	}
+
+	/*
+	 * one poll loop: write requests while fewer than depth are unanswered, read replies as
+	 * they come (never blocking on one direction while the server waits on the other)
+	 */
+	size_t n_sent = 0, n_done = 0, n_errors = 0, out_pos = 0;
+	size_t in_size = 0, in_cap = LOADGEN_READ, reply_bytes = 0;
+	bool failed = false;
+	double start = _now();
+	while (n_done < n && !failed) {
+		size_t window_end = (n_done + depth < n) ? n_done + depth : n;
+		struct pollfd pfd = {.fd = fd, .events = POLLIN | (n_sent < window_end ? POLLOUT : 0)};
+		if (poll(&pfd, 1, -1) < 0) {
+			failed = errno != EINTR;
+			continue;
+		}
+		if ((pfd.revents & POLLOUT) && n_sent < window_end) {
+			ssize_t w = write(fd, requests + out_pos, starts[window_end] - out_pos);
+			if (w < 0) {
+				failed = errno != EAGAIN && errno != EINTR;
+				continue;
+			}
+			double now = _now();
+			out_pos += w;
+			while (n_sent < window_end && starts[n_sent] < out_pos) {
+				sent_at[n_sent++] = now;	// its first byte went out
+			}
+		}
+		if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+			ssize_t r = read(fd, replies + in_size, in_cap - in_size);
+			if (r <= 0) {
+				failed = r == 0 || (errno != EAGAIN && errno != EINTR);
+				continue;
+			}
+			double now = _now();
+			in_size += r;
+			reply_bytes += r;
+			size_t pos = 0;
+			while (in_size - pos >= SERVER_FRAME) {
+				uint8_t const *frame = (uint8_t const *)replies + pos;
+				size_t length = server_frame_length(frame);
+				if (in_size - pos - SERVER_FRAME < length) {
+					break;
+				}
+				n_errors += frame[4] != SERVER_OK;
+				latency[n_done] = now - sent_at[n_done];
+				n_done++;
+				pos += SERVER_FRAME + length;
+			}
+			memmove(replies, replies + pos, in_size - pos);
+			in_size -= pos;
+			if (in_size >= SERVER_FRAME
+			    && SERVER_FRAME + server_frame_length((uint8_t *)replies) > in_cap) {
+				in_cap = SERVER_FRAME + server_frame_length((uint8_t *)replies);
+				char *grown = realloc(replies, in_cap);
+				failed = !grown;
+				replies = grown ? grown : replies;
+			}
+		}
+	}
+	double seconds = _now() - start;
+	close(fd);
+	if (server > 0) {
+		waitpid(server, NULL, 0);
+	}
+
+	if (failed) {
+		fprintf(stderr, "connection to the server failed after %zu of %zu replies\n", n_done,
+			n);
+	} else {
+		qsort(latency, n, sizeof(*latency), _compare_double);
+		printf("{\"spec\": \"%s\", \"stage\": \"serve\", \"requests\": %zu, \"depth\": %zu, "
+		       "\"errors\": %zu, \"bytes_out\": %zu, \"bytes_in\": %zu, \"seconds\": %.6f, "
+		       "\"requests_per_sec\": %.0f, \"p50_us\": %.1f, \"p99_us\": %.1f, "
+		       "\"max_us\": %.1f}\n",
+		       spec->name, n, depth, n_errors, starts[n], reply_bytes, seconds, n / seconds,
+		       latency[n / 2] * 1e6, latency[n - 1 - n / 100] * 1e6, latency[n - 1] * 1e6);
+	}
+	free(requests), free(starts), free(sent_at), free(latency), free(replies);
+	return (failed || n_errors > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int _connect(char const *socket_path, pid_t *server)
+{
+	// non-blocking connection to the server at socket_path, or to a private one ("-")
+	int fd = -1;
+	if (strcmp(socket_path, "-") == 0) {
+		int pair[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+			return -1;
+		}
+		fflush(stdout);
+		*server = fork();
+		if (*server < 0) {
+			close(pair[0]), close(pair[1]);
+			return -1;
+		}
+		if (*server == 0) {
+			close(pair[0]);
+			ServerReport report;
+			int status = server_serve(pair[1], pair[1], &report);
+			_exit(status < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+		}
+		close(pair[1]);
+		fd = pair[0];
+	} else {
+		struct sockaddr_un addr = {.sun_family = AF_UNIX};
+		if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		strcpy(addr.sun_path, socket_path);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0) {
+			return -1;
+		}
+		if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+			int saved = errno;
+			close(fd);
+			errno = saved;
+			return -1;
+		}
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	return fd;
+}
+
+static int _compare_double(void const *a, void const *b)
+{
+	double x = *(double const *)a, y = *(double const *)b;
+	return (x > y) - (x < y);
+}
+
+static inline double _now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,16 @@
+#ifndef __LOADGEN_H__
+#define __LOADGEN_H__
+
+#include <stddef.h>
+
+/*
+ * Load generator for the server mode (server.h): sends n SERVER_PARSE requests of generated
+ * expressions (exprgen.h) over one connection, keeping up to depth of them in flight, and
+ * reports the throughput and the latency of each request (from its write to its reply) as one
+ * JSON line. socket_path "-" starts a private server in a child process over a socketpair.
+ * Returns EXIT_SUCCESS, or EXIT_FAILURE if the server could not be reached or answered a
+ * request with an error.
+ */
+int loadgen_run(char const *socket_path, char const *spec_name, size_t n, size_t depth);
+
+#endif /* end of __LOADGEN_H__ */
@@ -1,6 +1,8 @@
 #ifndef __EXPRESSION_TREE__
 #define __EXPRESSION_TREE__
 
+#include <stddef.h>
+
 #include "tokenizer.h"
 #include "stack.h"
 
@@ -11,6 +13,11 @@ typedef struct ASTNode {
 	Token token;
         long value;	/* the (partial) result of the entire expression evaluated at this node
                            value == NAN indicates this node is a TOK_VAR */
+	bool postfix;	/* '++'/'--' nodes only: true for a++, false for ++a */
+	bool prefix;	/* '+'/'-'/'++'/'--' nodes only: true for +a, -a and ++a, false for a + b */
+	bool shared;	/* hash-consed nodes only: the node stands for more than one occurrence */
+	bool pure;	/* hash-consed nodes only: no '++'/'--' on a variable in this subtree */
+	uint32_t slot;	/* TOK_VAR nodes of an interned tree only: the variable's slot (symtab.h) */
 	union {
 		struct { struct ASTNode *operand; } unary;
 		struct { struct ASTNode *left; struct ASTNode *right; } binary;
@@ -18,11 +25,58 @@ typedef struct ASTNode {
 } ASTNode;
 
 typedef ASTNode *ExpressionTree;
+typedef struct NodeArena NodeArena;	/* see arena.h */
+typedef struct HashCons HashCons;	/* see hashcons.h */
+typedef struct SymbolTable SymbolTable;	/* see symtab.h */
+typedef struct ParseMemo ParseMemo;	/* see document.h */
+
+/* '++'/'--' nodes are always unary, a '+'/'-' node is unary when it is a prefix operator (a
+ * binary one missing its right operand is malformed, not unary) */
+static inline bool astnode_is_unary(ASTNode const *node)
+{
+	switch (node->token.type) {
+	case TOK_INC: case TOK_DEC:
+		return true;
+	case TOK_ADD: case TOK_MINUS:
+		return node->prefix;
+	default:
+		return false;
+	}
+}
 
 #define NAN 0xffUL << 23 | 1	// a (bit) pattern resembling a not-a-number 32-bit float by IEEE-754
-#define panic(msg) {fprintf(stderr, "%s on line %d of %s\n", msg, __LINE__, __FILE__); exit(1);}
+
+/* BuildOptions: how expressiontree_build_tree_opts builds a tree
+ *	- arena: NodeArena * := where nodes come from, NULL meant malloc
+ *	- hashcons: HashCons * := if not NULL, build a DAG owned by hashcons instead (arena unused)
+ *	- max_depth: size_t := nesting budget (parser stack frames), 0 meant unlimited
+ *	- max_nodes: size_t := node budget, 0 meant unlimited
+ *	- simplify: bool := fold constants and apply algebraic identities (simplify.h) before
+ *	  the tree is returned (or hash-consed)
+ *	- symbols: SymbolTable * := if not NULL, intern the tree's variables into symbols and
+ *	  detach the tree from the input (symtab.h)
+ *	- memo: ParseMemo * := if not NULL, reuse the subtrees it holds from the parse of a previous
+ *	  version of the tokens and record the new ones (document.h). Needs arena and symbols,
+ *	  excludes hashcons and simplify.
+ *	- errors: FILE * := where a rejected expression is reported, NULL meant stderr
+ * Parsing stops as soon as a budget runs out, the expression is then rejected.
+ */
+typedef struct {
+	NodeArena *arena;
+	HashCons *hashcons;
+	size_t max_depth;
+	size_t max_nodes;
+	bool simplify;
+	SymbolTable *symbols;
+	ParseMemo *memo;
+	FILE *errors;
+} BuildOptions;
 
 ExpressionTree expressiontree_build_tree(Tokenizer *tkz);
+ExpressionTree expressiontree_build_tree_arena(Tokenizer *tkz, NodeArena *arena);
+ExpressionTree expressiontree_build_tree_opts(Tokenizer *tkz, BuildOptions const *opts);
+ExpressionTree expressiontree_build_tree_stream(TokenStream *ts, BuildOptions const *opts);
+ptrdiff_t expressiontree_validate(Tokenizer const *tkz);
 void expressiontree_print_to_file(FILE *fp, int depth, ExpressionTree root);
 void expressiontree_destroy_tree(ExpressionTree *root);
 
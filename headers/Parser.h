@@ -4,39 +4,66 @@
 #include "tokenizer.h"
 
 typedef struct {
-	Token *curr;
-        Token *const end;       /* fixed addr of a *mutable* Token (Token itself can change, but
-                                   Parser shall never modify where end points to*/
-} Parser;  // 0 ≤ end - curr ≤ number of tokens 
+	Tokenizer const *tkz;   /* token arrays read in place */
+        TokenStream *stream;    /* if not NULL, tokens are pulled from it instead (tkz unused) */
+	size_t curr;            /* index of the current token */
+        size_t const end;       /* number of tokens, Parser shall never modify it */
+        struct NodeArena *arena;        /* where ASTNodes come from, NULL meant malloc */
+        size_t nodes_left;      /* node budget */
+        bool failed;            /* out of memory, out of node budget or unexpected token, parsing must stop */
+        bool unexpected;        /* the token at curr cannot appear there (e.g. ')' in "()") */
+        struct ParseMemo *memo; /* subtrees of a previous parse to reuse, NULL meant none */
+        struct SymbolTable *symbols;    /* if not NULL, nodes are detached from the input as they are built */
+} Parser;  // 0 ≤ curr ≤ end, end ≥ 1
 
 static inline Parser parser_init(Tokenizer *tkz)
 {
-	assert(tkz && "parameter tkz must be a valid Tokenizer *");
-	return (Parser) {.curr = tkz->tokens, .end = tkz->tokens + tkz->n_tokens};
+	assert(tkz && tkz->n_tokens > 0 && "parameter tkz must be a valid Tokenizer *");
+	return (Parser) {.tkz = tkz, .curr = 0, .end = tkz->n_tokens, .nodes_left = SIZE_MAX};
+}
+
+static inline Parser parser_init_stream(TokenStream *ts)
+{
+	// curr counts the tokens pulled, there is no end until the stream's final TOK_EOF
+	assert(ts && "parameter ts must be a valid TokenStream *");
+	return (Parser) {.stream = ts, .curr = 0, .end = SIZE_MAX, .nodes_left = SIZE_MAX};
 }
 
 static inline bool parser_parse_completed(Parser *parser)
 {
-	return parser->curr == parser->end || parser->curr->type == TOK_EOF;
+	if (parser->stream) {
+		return parser->stream->token.type == TOK_EOF;
+	}
+	return parser->curr == parser->end || parser->tkz->types[parser->curr] == TOK_EOF;
 }
 
 static inline Token parser_peek(Parser *parser)
 {
 	// returns the token parser->curr is pointing to
 	assert(parser && "parameter parser must be a valid Parser *");
-	return (parser->curr < parser->end) ? 
-		parser->curr[0] :
-		parser->end[-1];
+	if (parser->stream) {
+		return parser->stream->token;
+	}
+	return tokenizer_token(parser->tkz, (parser->curr < parser->end) ?
+					    parser->curr :
+					    parser->end - 1);
 }
 
 static inline Token parser_advance(Parser *parser)
 {
 	// advance curr, then return the token it was pointing to before hand
+	// (streaming: the text of that token may already be gone)
 	assert(parser && "parameter parser must be a valid Parser *");
+	if (parser->stream) {
+		Token prev = parser->stream->token;
+		tokenstream_advance(parser->stream);
+		parser->curr++;
+		return prev;
+	}
 	if (parser->curr < parser->end) {
 		++parser->curr;
 	}
-	return parser->curr[-1];
+	return tokenizer_token(parser->tkz, parser->curr - 1);
 }
 
 #endif /* end of __PARSER_H__ */
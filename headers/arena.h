@@ -0,0 +1,38 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include "ExpressionTree.h"
+
+/*
+ * NodeArena: a bump allocator for ASTNodes.
+ * - Nodes are carved out of chunked slabs, a tree built in an arena is released all at once by
+ *   nodearena_reset in O(1) (never call expressiontree_destroy_tree on it).
+ * - Slabs are kept across resets and reused by the next expression, so once the arena has grown
+ *   to fit the largest tree, building a tree makes no malloc call for its nodes.
+ */
+typedef struct NodeSlab {
+	struct NodeSlab *next;
+	size_t capacity;	/* number of nodes in this slab */
+	ASTNode nodes[];
+} NodeSlab;
+
+struct NodeArena {
+	NodeSlab *slabs;	/* every slab owned by the arena, in allocation order */
+	NodeSlab *curr;		/* slab being bump-allocated from */
+	size_t used;		/* nodes handed out from curr */
+	size_t slab_nodes;	/* capacity of the next slab to be malloc'd */
+
+	// counters
+	size_t n_mallocs;	/* slabs malloc'd over the arena's lifetime */
+	size_t n_nodes;		/* nodes handed out since the last reset */
+	size_t n_resets;
+};
+
+#define NODEARENA_DEFAULT_SLAB 256	// nodes in the first slab, later slabs double in size
+
+void nodearena_init(NodeArena *arena, size_t slab_nodes);
+ASTNode *nodearena_alloc(NodeArena *arena);
+void nodearena_reset(NodeArena *arena);
+void nodearena_destroy(NodeArena *arena);
+
+#endif /* end of __ARENA_H__ */
@@ -0,0 +1,72 @@
+#ifndef __ASTFILE_H__
+#define __ASTFILE_H__
+
+#include <stdint.h>
+#include "ExpressionTree.h"
+
+/*
+ * AST images: a list of trees saved to a file that is memory-mapped back without parsing.
+ * - layout: AstFileHeader | roots (ExpressionTree[n_roots]) | statuses (uint8_t[n_roots]) |
+ *   nodes (ASTNode[n_nodes]) | strings
+ * - statuses say why a root is NULL (the line was empty, or did not parse), so that an image
+ *   prints back as the batch run that wrote it.
+ * - nodes are ASTNode records written in post-order (children before their parent). Every
+ *   pointer (root, child, token string) is stored as an offset from the start of the file,
+ *   0 standing for NULL. Hash-consed nodes (hashcons.h) are written once, so DAGs stay DAGs.
+ * - token strings (variable names, literals, operators) are interned: each distinct spelling is
+ *   stored once in the string table, null-terminated.
+ * - astfile_load maps the file privately, checks it and adds the mapping's address to every
+ *   offset, the trees are then used in place: no per-node allocation, no tokenizing. An image
+ *   is untrusted input, every offset has to be checked before a tree is walked: relocation is
+ *   done in that same pass, so that any code taking an ExpressionTree can use a loaded one.
+ * - slots (ASTNode.slot) are kept as written: they number the variables in the SymbolTable that
+ *   interned the trees, which the image does not hold. Loaded trees are read-only and cannot be
+ *   interned again in place; bind their variables by name (expressiontree_evaluate), or intern
+ *   the names (TOK_VAR token strings) in a table of one's own to bind them by slot.
+ * - an image is tied to the ABI that wrote it (node size, pointer size, byte order), other
+ *   images are rejected.
+ */
+
+#define ASTFILE_MAGIC "EXPRAST"	/* 7 characters + '\0' */
+#define ASTFILE_VERSION 4
+
+/* what became of the input a root was built from: a tree (root != NULL), or none and why */
+enum astfile_status_t {
+	ASTFILE_OK = 0,
+	ASTFILE_EMPTY = 1,
+	ASTFILE_ERROR = 2
+};
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint16_t node_size;	/* sizeof(ASTNode) */
+	uint8_t pointer_size;	/* sizeof(void *) */
+	uint8_t byte_order;	/* 1 little endian, 2 big endian */
+	uint64_t file_size;
+	uint64_t n_roots;
+	uint64_t roots_offset;
+	uint64_t statuses_offset;
+	uint64_t n_nodes;
+	uint64_t nodes_offset;
+	uint64_t strings_offset;
+	uint64_t strings_size;
+} AstFileHeader;
+
+/* AstImage: a loaded image, roots[i] is NULL where tree i was not built, statuses[i] (enum
+ * astfile_status_t) says why (the trees are read-only, never call expressiontree_destroy_tree on
+ * them) */
+typedef struct {
+	void *base;
+	size_t size;
+	ExpressionTree const *roots;
+	uint8_t const *statuses;
+	size_t n_roots;
+	size_t n_nodes;
+} AstImage;
+
+int astfile_write(FILE *fp, ExpressionTree const *roots, uint8_t const *statuses, size_t n_roots);
+int astfile_load(char const *path, AstImage *image);
+void astfile_unload(AstImage *image);
+
+#endif /* end of __ASTFILE_H__ */
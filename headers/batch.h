@@ -0,0 +1,51 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "emit.h"
+
+/*
+ * batch mode: parse a file holding one expression per line.
+ * - The input file is memory-mapped, every line is tokenized and parsed in place (no copy).
+ * - Each line produces a status header followed by its parse tree (if any), all written to
+ *   one buffered output stream:
+ *		line <n>: ok | empty | error
+ * - batch_parse_file_parallel cuts the input into chunks of whole lines, parses them on a pool
+ *   of worker threads (each with its own NodeArena) and writes the output in input order, the
+ *   same bytes as batch_parse_file.
+ * - The trees can instead be saved as an AST image (see astfile.h), which is printed back
+ *   without tokenizing or parsing anything.
+ * - batch_parse_stream parses a whole file (or stdin) as a single expression, pulled through
+ *   a TokenStream: the file is never held in memory, however large it is.
+ * - batch_emit_file writes the trees straight to a file descriptor in any format of emit.h.
+ */
+
+/* BatchReport: counters filled in by batch_parse_file */
+typedef struct {
+	size_t n_lines;
+	size_t n_ok;
+	size_t n_empty;
+	size_t n_failed;
+	size_t n_bytes;		/* size of the input file */
+	size_t n_mallocs;	/* of the memory reused line after line: NodeArena slabs and Tokenizer
+				 * arrays. Flat once both fit the largest line, so a count that grows
+				 * with the input means per-line allocations. Not counted: stdio, and
+				 * the parser's frame stack of a line nested over 64 frames deep */
+	size_t n_threads;	/* worker threads (batch_parse_file_parallel), 0 for none */
+	size_t n_steals;	/* chunks a worker took from another worker's queue */
+	size_t n_writes;	/* write calls on the output (batch_emit_file), 0 for none */
+	double seconds;		/* wall-clock time spent parsing and printing */
+} BatchReport;
+
+int batch_parse_file(char const *in_path, FILE *out, BatchReport *report);
+int batch_emit_file(char const *in_path, int fd, enum emit_format_t format, BatchReport *report);
+int batch_parse_file_parallel(char const *in_path, FILE *out, size_t n_threads,
+			      BatchReport *report);
+int batch_parse_stream(char const *in_path, FILE *out, BatchReport *report);
+int batch_save_ast(char const *in_path, FILE *ast_out, BatchReport *report);
+int batch_print_ast(char const *ast_path, FILE *out, BatchReport *report);
+void batch_report_display(FILE *fp, BatchReport const *report);
+
+#endif /* end of __BATCH_H__ */
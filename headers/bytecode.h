@@ -0,0 +1,73 @@
+#ifndef __BYTECODE_H__
+#define __BYTECODE_H__
+
+#include <stdint.h>
+#include "evaluate.h"
+
+/*
+ * Compile-once/run-many evaluation:
+ * - bytecode_compile flattens an ExpressionTree into a linear Program for a stack machine
+ *   (post-order, so operands are always computed before their operator).
+ * - Variables are numbered 0 ... n_vars - 1 in order of first appearance, the VM reads and
+ *   updates (for '++'/'--') them through a plain `long vars[n_vars]` array.
+ * - vm_run executes a Program against such an array, with the semantics of evaluate.h.
+ * - Compiling a pure hash-consed DAG (hashcons.h) evaluates each shared subexpression once: its
+ *   value is kept in a temporary (OP_TEE) and reloaded (OP_TEMP) at its later occurrences.
+ */
+
+enum opcode_t {
+	OP_CONST,		/* push consts[arg] */
+	OP_LOAD,		/* push vars[arg] */
+	OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD,
+	OP_NEG,			/* unary '-' (unary '+' compiles to nothing) */
+	OP_INC, OP_DEC,		/* prefix '++'/'--' on a value that is not a variable */
+	OP_PRE_INC, OP_PRE_DEC,	/* ++vars[arg] / --vars[arg], push the new value */
+	OP_POST_INC, OP_POST_DEC,	/* vars[arg]++ / vars[arg]--, push the old value */
+	OP_TEE,			/* temps[arg] = top of the stack (left on the stack) */
+	OP_TEMP			/* push temps[arg] */
+};
+
+typedef struct {
+	uint8_t op;		/* enum opcode_t */
+	uint32_t arg;		/* constant pool index or variable slot, unused otherwise */
+} Instr;
+
+/* Program:
+ *	- code: Instr[n_code] := the instruction stream
+ *	- consts: long[n_consts] := literal values referred to by OP_CONST
+ *	- vars: Token[n_vars] := name of each variable slot, borrowed from the tree's input string
+ *	  (or from its SymbolTable)
+ *	- symbols: uint32_t[n_vars] := symbol table slot of each variable slot (interned trees)
+ *	- max_stack: size_t := deepest the VM stack gets while running code
+ *	- n_temps: size_t := temporaries used by OP_TEE/OP_TEMP
+ */
+typedef struct {
+	Instr *code;
+	size_t n_code;
+	long *consts;
+	size_t n_consts;
+	Token *vars;
+	uint32_t *symbols;
+	size_t n_vars;
+	size_t max_stack;
+	size_t n_temps;
+} Program;
+
+/* VM: scratch stack (and temporaries) reused across runs (one VM per thread) */
+typedef struct {
+	long *stack;
+	size_t capacity;
+} VM;
+
+eval_status_t bytecode_compile(ExpressionTree root, Program *prog);
+void bytecode_destroy(Program *prog);
+eval_status_t bytecode_bind(Program const *prog, Binding const *bindings, size_t n_bindings,
+			    long *vars);
+eval_status_t bytecode_bind_slots(Program const *prog, long const *values, size_t n_values,
+				  long *vars);
+
+void vm_init(VM *vm);
+eval_status_t vm_run(VM *vm, Program const *prog, long *vars, long *result);
+void vm_destroy(VM *vm);
+
+#endif /* end of __BYTECODE_H__ */
@@ -0,0 +1,59 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stdatomic.h>
+#include "arena.h"
+#include "bytecode.h"
+
+/*
+ * ParseCache: parsed (and compiled) expressions keyed by their text, shared between threads.
+ * - Keys are the canonical spelling of the input (tokenizer_normalize), so inputs with the same
+ *   tokens share an entry, however they are spaced.
+ * - Entries are immutable once published, parsecache_get hands out a reference that stays valid
+ *   until parsecache_release, even if the entry is evicted in the meantime.
+ * - The cache is split in shards by hash, each behind its own reader-writer lock:
+ *   hits only take the read lock, parsing on a miss happens outside of any lock.
+ * - Memory is bounded by max_bytes (split evenly between shards), entries are evicted in CLOCK
+ *   order (an entry hit since the hand last passed it gets a second chance).
+ * - Invalid expressions are cached too (root == NULL). Their message is written once, by the
+ *   miss that parsed them, to the errors stream given to parsecache_create.
+ */
+
+/* CacheEntry: one cached expression (read-only for users of the cache)
+ *	- key: char[key_length + 1] := canonical spelling, the tree's tokens point into it
+ *	- root: ExpressionTree := the parse tree, NULL if the expression does not parse
+ *	- prog: Program := root compiled to bytecode when compile_status == EVAL_OK
+ */
+typedef struct CacheEntry {
+	struct CacheEntry *next;	/* bucket chain */
+	uint64_t hash;
+	char *key;
+	size_t key_length;
+	ExpressionTree root;
+	NodeArena arena;		/* root's nodes */
+	Program prog;
+	eval_status_t compile_status;
+	size_t bytes;			/* memory charged to the shard */
+	size_t clock_slot;		/* index in the shard's CLOCK ring */
+	atomic_size_t refs;		/* the cache's own reference + references handed out */
+	atomic_bool referenced;		/* CLOCK bit, set by every hit */
+} CacheEntry;
+
+typedef struct ParseCache ParseCache;	/* opaque, see cache.c */
+
+/* CacheStats: totals over every shard */
+typedef struct {
+	size_t n_hits;
+	size_t n_misses;
+	size_t n_evictions;
+	size_t n_entries;
+	size_t bytes;
+} CacheStats;
+
+ParseCache *parsecache_create(size_t max_bytes, FILE *errors);
+CacheEntry const *parsecache_get(ParseCache *cache, char const *input, size_t length);
+void parsecache_release(CacheEntry const *entry);
+void parsecache_stats(ParseCache *cache, CacheStats *stats);
+void parsecache_destroy(ParseCache *cache);
+
+#endif /* end of __CACHE_H__ */
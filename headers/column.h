@@ -0,0 +1,77 @@
+#ifndef __COLUMN_H__
+#define __COLUMN_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include "compact.h"
+
+/*
+ * Columnar evaluation: one expression over many rows, each variable bound to a column.
+ * - column_evaluate runs a CompactTree over the rows COLUMN_BLOCK at a time: every node is one
+ *   loop over the block (a kernel), with the semantics of evaluate.h applied to each row on its
+ *   own ('++'/'--' update a row's variable for the rest of that row only).
+ * - Kernels are plain fixed-length loops for the compiler to vectorize. On Linux x86-64 (unless
+ *   built with -DEXPR_NO_SIMD) they are compiled for AVX-512, AVX2 and the baseline, the best
+ *   one the CPU supports being picked at load time. '/' and '%' stay one division per row.
+ * - A row is null when one of the columns it reads is null there, when it divides by 0, or when
+ *   a COLUMN_DOUBLE value is not a number or does not fit a long (other doubles are truncated
+ *   toward zero, int32 values are widened). A null row's result is 0.
+ * - Column files: ColumnFileHeader | values (n_rows values of the column's type, 64-byte
+ *   aligned) | validity bitmap (optional, bit i of byte i / 8 set when row i is not null).
+ *   column_load maps a file read-only and uses it in place. Like AST images, a file is tied to
+ *   the byte order that wrote it.
+ */
+
+#define COLUMN_BLOCK 1024	// rows per block: a block of every live value stays in L2
+#define COLUMN_MAGIC "EXPRCOL"	/* 7 characters + '\0' */
+#define COLUMN_VERSION 1
+
+enum column_type_t {
+	COLUMN_INT64 = 1,
+	COLUMN_INT32 = 2,
+	COLUMN_DOUBLE = 3
+};
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint8_t type;		/* enum column_type_t */
+	uint8_t byte_order;	/* 1 little endian, 2 big endian */
+	uint16_t reserved;
+	uint64_t file_size;
+	uint64_t n_rows;
+	uint64_t values_offset;
+	uint64_t validity_offset;	/* 0 if the column has no nulls */
+} ColumnFileHeader;
+
+/* Column: n_rows values of type, validity NULL if none is null
+ * (base/size: the file mapping of a loaded column, NULL for a column over caller memory) */
+typedef struct {
+	enum column_type_t type;
+	size_t n_rows;
+	void const *values;
+	uint8_t const *validity;
+	void *base;
+	size_t size;
+} Column;
+
+/* ColumnReport: counters filled in by column_evaluate (and column_evaluate_files) */
+typedef struct {
+	size_t n_rows;
+	size_t n_null;		/* rows whose result is null, division by 0 included */
+	size_t n_div_by_zero;	/* rows nulled by a division by 0 alone */
+	size_t n_bytes;		/* bytes of column values and bitmaps read */
+	double seconds;		/* wall-clock time spent evaluating (column_evaluate_files) */
+} ColumnReport;
+
+eval_status_t column_evaluate(CompactTree const *ct, Column const *const *columns, size_t n_rows,
+			      long *result, uint8_t *validity, ColumnReport *report);
+int column_load(char const *path, Column *column);
+void column_unload(Column *column);
+int column_write(FILE *fp, enum column_type_t type, void const *values, uint8_t const *validity,
+		 size_t n_rows);
+int column_evaluate_files(char const *expression, char *const *bindings, size_t n_bindings,
+			  FILE *out, ColumnReport *report);
+void column_report_display(FILE *fp, ColumnReport const *report);
+
+#endif /* end of __COLUMN_H__ */
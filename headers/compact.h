@@ -0,0 +1,71 @@
+#ifndef __COMPACT_H__
+#define __COMPACT_H__
+
+#include <stdint.h>
+#include "bytecode.h"
+
+/*
+ * CompactTree: an ExpressionTree flattened into one array of 16-byte nodes.
+ * - Nodes are stored in post-order (operands before their operator, left before right), the
+ *   root last. Children are 32-bit indices into the same array: the right operand of a binary
+ *   node at i is always i - 1, the left one is stored.
+ * - A leaf holds an index into a side table instead of its text: literal values in `values`,
+ *   variables in `vars` (numbered in order of first appearance, like bytecode.h).
+ * - Walking the tree is a scan of the array: compact_evaluate runs it front to back with the
+ *   semantics of evaluate.h, no pointer is followed.
+ * - compact_from_tree / compact_to_tree convert from and to the pointer-based representation,
+ *   so code still working on ExpressionTrees can share trees with code that moved over.
+ *   A DAG (hashcons.h) is expanded into a tree.
+ */
+
+enum compact_op_t {
+	CT_LIT,			/* values[leaf] */
+	CT_VAR,			/* variable number leaf */
+	CT_ADD, CT_SUB, CT_MUL, CT_DIV, CT_MOD,
+	CT_POS, CT_NEG,		/* unary '+'/'-', operand in left */
+	CT_PRE_INC, CT_PRE_DEC,	/* operand in left, leaf: the variable updated (COMPACT_NONE if the */
+	CT_POST_INC, CT_POST_DEC	/* operand is not a variable, then only a value is computed) */
+};
+
+#define COMPACT_NONE UINT32_MAX	// missing operand, or no leaf
+
+/* CompactNode: op (enum compact_op_t), left/right operands, leaf index (see enum compact_op_t) */
+typedef struct {
+	uint8_t op;
+	uint8_t reserved[3];
+	uint32_t left;
+	uint32_t right;
+	uint32_t leaf;
+} CompactNode;
+
+_Static_assert(sizeof(CompactNode) == 16, "a CompactNode must stay 16 bytes");
+
+/* CompactTree:
+ *	- nodes: CompactNode[n_nodes] := in post-order, nodes[n_nodes - 1] is the root
+ *	- values: long[n_values] := literal values
+ *	- vars: Token[n_vars] := name of each variable, borrowed from the tree's input string (or
+ *	  from its SymbolTable)
+ *	- symbols: uint32_t[n_vars] := symbol table slot of each variable (interned trees)
+ *	- max_stack: size_t := values compact_evaluate keeps at most
+ *	- well_formed: bool := every operator has all of its operands
+ */
+typedef struct {
+	CompactNode *nodes;
+	size_t n_nodes;
+	long *values;
+	size_t n_values;
+	Token *vars;
+	uint32_t *symbols;
+	size_t n_vars;
+	size_t max_stack;
+	bool well_formed;
+} CompactTree;
+
+eval_status_t compact_from_tree(ExpressionTree root, CompactTree *ct);
+ExpressionTree compact_to_tree(CompactTree const *ct, NodeArena *arena);
+eval_status_t compact_bind_slots(CompactTree const *ct, long const *values, size_t n_values,
+				 long *vars);
+eval_status_t compact_evaluate(CompactTree const *ct, VM *vm, long *vars, long *result);
+void compact_destroy(CompactTree *ct);
+
+#endif /* end of __COMPACT_H__ */
@@ -0,0 +1,70 @@
+#ifndef __DOCUMENT_H__
+#define __DOCUMENT_H__
+
+#include "tokenizer.h"
+#include "arena.h"
+#include "symtab.h"
+
+/*
+ * Document: a long expression kept parsed while it is being edited.
+ * - document_edit takes the whole new text and the edit that produced it. Only the tokens
+ *   around the edit are lexed again (tokenizer_relex), and the parser reuses every subtree of
+ *   the previous tree whose tokens the edit did not touch: lexing, allocation and parsing
+ *   cost about the size of the edit plus the nodes above it, not the size of the text.
+ * - Reuse works on the calls the Pratt parser makes to parse an expr (an operand, the inside
+ *   of parentheses, the whole text): the tree such a call returns only depends on its binding
+ *   power and on its tokens, from the first one to the one that ended it. ParseMemo records
+ *   each call of a parse by its first token; the next parse makes the same call over the same
+ *   unchanged tokens by taking the recorded tree instead.
+ * - Trees are interned into the document's SymbolTable as they are built (symtab.h), they do
+ *   not point into any version of the text. Nodes live in the document's arena: a version's
+ *   tree shares nodes with the previous ones, and stays valid until the next edit.
+ * - Nodes no tree uses any more are reclaimed by parsing from scratch, once they outnumber the
+ *   nodes of the last full parse.
+ * - Not thread-safe.
+ */
+
+/* ParseMemo: by token index (parallel to the token arrays), the expr call that started there
+ *	- roots: ExpressionTree[] := the tree the call returned
+ *	- spans: uint32_t[] := tokens from the first one to the token that ended the call
+ *	- bps: signed char[] := binding power of the call, -1 meant no call recorded there
+ *	- dirty_start, dirty_end: size_t := tokens [dirty_start, dirty_end) changed since the
+ *	  calls were recorded (if dirty), a call reaching into or across them is stale
+ *	- visited: size_t := while parsing, calls before it are from this parse or inside a
+ *	  reused tree (the others are cleared as the parser goes)
+ */
+struct ParseMemo {
+	ExpressionTree *roots;
+	uint32_t *spans;
+	signed char *bps;
+	size_t capacity;
+	size_t dirty_start;
+	size_t dirty_end;
+	bool dirty;
+	size_t visited;
+
+	// counters
+	size_t n_reused;	/* subtrees taken from the previous parse, over the memo's lifetime */
+};
+
+typedef struct {
+	Tokenizer tkz;		/* tokens of the current text */
+	ExpressionTree root;	/* tree of the current text, NULL if it does not parse */
+	SymbolTable *symbols;
+	FILE *errors;		/* where a text that does not parse is reported, NULL meant stderr */
+	NodeArena arena;
+	ParseMemo memo;
+	size_t n_full_nodes;	/* nodes of the last parse from scratch */
+
+	// counters
+	size_t n_edits;
+	size_t n_full_parses;
+} Document;
+
+ExpressionTree document_open(Document *doc, char const *text, size_t length,
+			     SymbolTable *symbols, FILE *errors);
+ExpressionTree document_edit(Document *doc, char const *text, size_t length,
+			     TextEdit const *edit);
+void document_close(Document *doc);
+
+#endif /* end of __DOCUMENT_H__ */
@@ -0,0 +1,68 @@
+#ifndef __EMIT_H__
+#define __EMIT_H__
+
+#include "ExpressionTree.h"
+
+/*
+ * Emitter: writes trees as text into a buffer, flushed to a file descriptor (or a FILE *) in
+ * blocks of its size, or kept whole in memory.
+ * - One iterative walk per tree, no stdio formatting: every piece of text is copied in place
+ *   and literal values are converted by hand.
+ * - Formats (one tree per line except EMIT_TREE):
+ *	EMIT_TREE	the indented '|__' tree of parseTree.txt, the same bytes as
+ *			expressiontree_print_to_file (which now goes through an Emitter)
+ *	EMIT_SEXPR	(+ a (* 2 (neg b)))
+ *	EMIT_RPN	a 2 b neg * +
+ *	EMIT_JSON	{"op":"+","left":{"var":"a"},"right":{"lit":2}}, unary operators have an
+ *			"operand" instead
+ *   A unary '+'/'-' is spelled "pos"/"neg", a '++'/'--' "pre++", "post++", "pre--" or "post--"
+ *   (in EMIT_TREE they are spelled as in the input).
+ * - A NULL tree emits nothing. A DAG (hashcons.h) is emitted as the tree it stands for.
+ * - Errors stick: once a write fails (or memory runs out), nothing more is emitted and every
+ *   call returns -1 with errno set to the first error.
+ */
+
+#define EMIT_BLOCK (1 << 16)	// buffer malloc'd when the caller gives none
+#define EMIT_MIN_BUFFER 64	// a caller's buffer smaller than this is not used
+
+enum emit_format_t {
+	EMIT_TREE,
+	EMIT_SEXPR,
+	EMIT_RPN,
+	EMIT_JSON
+};
+
+/* Emitter:
+ *	- buf: char[capacity] := the caller's buffer, or one the emitter malloc'd (owned)
+ *	- size: size_t := bytes in buf not flushed yet (in memory: every byte emitted)
+ *	- fd: int := where full blocks are written, -1 for none
+ *	- fp: FILE * := where full blocks are written if fd is -1, NULL for none. With neither, buf
+ *	  grows to hold the whole output (it is moved to a malloc'd buffer if it was the caller's).
+ *	- n_written: size_t := bytes written to fd or fp so far
+ *	- n_writes: size_t := write/fwrite calls made
+ *	- error: int := errno of the first failure, 0 if none
+ *	- frames: void * := walk stack of a tree too deep for the C stack, kept for the next trees
+ */
+typedef struct {
+	char *buf;
+	size_t size;
+	size_t capacity;
+	bool owned;
+	int fd;
+	FILE *fp;
+	size_t n_written;
+	size_t n_writes;
+	int error;
+	void *frames;
+	size_t frames_capacity;
+} Emitter;
+
+void emitter_init(Emitter *em, int fd, char *buf, size_t capacity);
+void emitter_init_file(Emitter *em, FILE *fp, char *buf, size_t capacity);
+int emitter_tree(Emitter *em, ExpressionTree root, enum emit_format_t format, int depth);
+int emitter_text(Emitter *em, char const *text, size_t length);
+int emitter_flush(Emitter *em);
+void emitter_destroy(Emitter *em);
+int emit_format_parse(char const *name, enum emit_format_t *format);
+
+#endif /* end of __EMIT_H__ */
@@ -0,0 +1,72 @@
+#ifndef __EVALUATE_H__
+#define __EVALUATE_H__
+
+#include <limits.h>
+#include "ExpressionTree.h"
+
+/*
+ * Evaluation semantics, shared by every evaluator of this project:
+ * - values are `long`, '+' '-' '*' wrap around (two's complement) instead of overflowing.
+ * - '/' and '%' truncate toward zero like C. Dividing by 0 fails with EVAL_DIV_BY_ZERO,
+ *   LONG_MIN / -1 wraps to LONG_MIN and LONG_MIN % -1 is 0.
+ * - '++'/'--' applied to a variable update that variable's binding (prefix yields the new value,
+ *   postfix the old one). Applied to anything else they only compute a value (v ± 1 / v).
+ * - operands are evaluated left to right, so a later read of a variable sees earlier updates.
+ */
+typedef enum {
+	EVAL_OK,
+	EVAL_DIV_BY_ZERO,
+	EVAL_UNBOUND_VAR,	/* a TOK_VAR has no binding */
+	EVAL_MALFORMED,		/* empty tree, or an operator is missing an operand */
+	EVAL_NO_MEMORY
+} eval_status_t;
+
+/* Binding: value of the variable called name (a null-terminated string) */
+typedef struct {
+	char const *name;
+	long value;
+} Binding;
+
+static inline long eval_add(long a, long b)
+{
+	return (long)((unsigned long)a + (unsigned long)b);
+}
+
+static inline long eval_sub(long a, long b)
+{
+	return (long)((unsigned long)a - (unsigned long)b);
+}
+
+static inline long eval_mul(long a, long b)
+{
+	return (long)((unsigned long)a * (unsigned long)b);
+}
+
+static inline eval_status_t eval_div(long a, long b, long *result)
+{
+	if (b == 0) {
+		return EVAL_DIV_BY_ZERO;
+	}
+	*result = (b == -1) ? (long)(0UL - (unsigned long)a) : a / b;
+	return EVAL_OK;
+}
+
+static inline eval_status_t eval_mod(long a, long b, long *result)
+{
+	if (b == 0) {
+		return EVAL_DIV_BY_ZERO;
+	}
+	*result = (b == -1) ? 0 : a % b;
+	return EVAL_OK;
+}
+
+char const *eval_status_str(eval_status_t status);
+
+// reference evaluator: walks the tree, looks variables up by name (bindings are updated by '++'/'--')
+eval_status_t expressiontree_evaluate(ExpressionTree root, Binding *bindings, size_t n_bindings,
+				      long *result);
+// same, for an interned tree (symtab.h): vars[slot] is the value of the variable at slot
+eval_status_t expressiontree_evaluate_slots(ExpressionTree root, long *vars, size_t n_vars,
+					    long *result);
+
+#endif /* end of __EVALUATE_H__ */
@@ -0,0 +1,44 @@
+#ifndef __HASHCONS_H__
+#define __HASHCONS_H__
+
+#include "arena.h"
+
+/*
+ * HashCons: turns parse trees into DAGs by hash-consing.
+ * - Structurally identical subtrees (same token type, same leaf text/value, same '++'/'--'
+ *   fixity, same children) are stored once. Every tree interned into the same HashCons shares
+ *   them, within a tree and across trees.
+ * - Every node of a DAG is owned by its HashCons and stays valid until hashcons_destroy frees
+ *   them all at once (never call expressiontree_destroy_tree on a DAG).
+ * - Token text is copied, a DAG does not point into the input it was parsed from.
+ * - A node is flagged `shared` once it stands for more than one occurrence, and `pure` when
+ *   no '++'/'--' on a variable sits in its subtree: bytecode_compile then evaluates each shared
+ *   subexpression of a pure DAG once.
+ * - Not thread-safe.
+ */
+
+/* TextChunk: storage for the copied token text */
+typedef struct TextChunk {
+	struct TextChunk *next;
+	size_t size;
+	size_t used;
+	char text[];
+} TextChunk;
+
+struct HashCons {
+	NodeArena nodes;	/* the distinct nodes */
+	NodeArena scratch;	/* trees are parsed here before they are interned */
+	ASTNode **slots;	/* open addressing set of the distinct nodes, NULL meant empty */
+	size_t n_slots;		/* a power of 2 */
+	TextChunk *chunks;	/* newest first */
+
+	// counters
+	size_t n_interned;	/* nodes interned, one per occurrence */
+	size_t n_distinct;	/* nodes actually stored */
+};
+
+void hashcons_init(HashCons *hc);
+ExpressionTree hashcons_intern(HashCons *hc, ExpressionTree root);
+void hashcons_destroy(HashCons *hc);
+
+#endif /* end of __HASHCONS_H__ */
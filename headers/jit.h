@@ -0,0 +1,38 @@
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include "bytecode.h"
+
+/*
+ * Native evaluation (Linux x86-64):
+ * - jit_compile lowers an ExpressionTree to machine code through its bytecode Program: the VM
+ *   stack is mapped to registers (spilled to the native stack past JIT_REGS values), variables
+ *   are read and updated in the same `long vars[n_vars]` slot array as vm_run (see bytecode.h
+ *   to bind them), temporaries of OP_TEE/OP_TEMP live in the native stack frame.
+ * - The code is written to mmap'd pages, then made read+exec (never writable and executable at
+ *   once). jit->fn is a plain function pointer with the semantics of evaluate.h, '/' and '%'
+ *   by 0 included (EVAL_DIV_BY_ZERO, *result untouched).
+ * - On other architectures, or when built with -DEXPR_NO_JIT, jit->fn is NULL and jit_run falls
+ *   back to vm_run: call jit_run to be portable, jit->fn directly to skip the check.
+ */
+
+typedef eval_status_t (*JitFn)(long *vars, long *result);
+
+/* JitProgram:
+ *	- fn: JitFn := the compiled function, NULL if not compiled to native code
+ *	- code: void * := mmap'd pages holding fn, code_size bytes long
+ *	- prog: Program := the bytecode fn was lowered from, holds the variable slots (and runs on
+ *	  the VM as the fallback)
+ */
+typedef struct {
+	JitFn fn;
+	void *code;
+	size_t code_size;
+	Program prog;
+} JitProgram;
+
+eval_status_t jit_compile(ExpressionTree root, JitProgram *jit);
+eval_status_t jit_run(JitProgram const *jit, VM *vm, long *vars, long *result);
+void jit_destroy(JitProgram *jit);
+
+#endif /* end of __JIT_H__ */
@@ -0,0 +1,32 @@
+#ifndef __LITERAL_H__
+#define __LITERAL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Decoding of TOK_LIT tokens ([0-9]+) into integers:
+ * - exactly length digits are read (the token need not be followed by a non-digit or a '\0'),
+ *   8 at a time as one 64-bit word (SWAR): a 16-digit literal costs two multiply-shift
+ *   reductions instead of 16 multiply-adds.
+ * - a literal that does not fit is reported (LITERAL_OVERFLOW) instead of wrapping around,
+ *   *value is then left untouched. Leading zeros never overflow.
+ * - literal_decode_128 takes literals up to 2^128 - 1 (39 digits), for callers that want to
+ *   handle oversized literals themselves.
+ */
+
+typedef enum {
+	LITERAL_OK,
+	LITERAL_OVERFLOW
+} literal_status_t;
+
+/* Literal128: an unsigned 128-bit value, hi * 2^64 + lo */
+typedef struct {
+	uint64_t hi;
+	uint64_t lo;
+} Literal128;
+
+literal_status_t literal_decode(char const *digits, size_t length, long *value);
+literal_status_t literal_decode_128(char const *digits, size_t length, Literal128 *value);
+
+#endif /* end of __LITERAL_H__ */
@@ -0,0 +1,84 @@
+#ifndef __NODEMAP_H__
+#define __NODEMAP_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+struct ASTNode;
+
+/*
+ * NodeMap: open addressing hash map from node addresses to a size_t (e.g. a file offset or a
+ * slot number), for walks that must recognize nodes they have already been through in a DAG.
+ * A zeroed NodeMap is an empty map.
+ */
+typedef struct {
+	struct ASTNode const **keys;	/* NULL meant empty */
+	size_t *values;
+	size_t n_slots;			/* a power of 2 */
+	size_t n_keys;
+} NodeMap;
+
+static inline size_t _nodemap_slot(NodeMap const *map, struct ASTNode const *node)
+{
+	// nodes are at least 8-byte aligned, the low bits carry no information
+	uint64_t hash = ((uintptr_t)node >> 3) * 0x9e3779b97f4a7c15ULL;
+	size_t i = (hash >> 32) & (map->n_slots - 1);
+	while (map->keys[i] && map->keys[i] != node) {
+		i = (i + 1) & (map->n_slots - 1);
+	}
+	return i;
+}
+
+static inline bool nodemap_get(NodeMap const *map, struct ASTNode const *node, size_t *value)
+{
+	if (map->n_keys == 0) {
+		return false;
+	}
+	size_t i = _nodemap_slot(map, node);
+	if (!map->keys[i]) {
+		return false;
+	}
+	*value = map->values[i];
+	return true;
+}
+
+static inline bool nodemap_put(NodeMap *map, struct ASTNode const *node, size_t value)
+{
+	// insert or overwrite node's value, returns false if out of memory
+	if (2 * (map->n_keys + 1) > map->n_slots) {
+		NodeMap grown = {.n_slots = map->n_slots ? 2 * map->n_slots : 64};
+		grown.keys = calloc(grown.n_slots, sizeof(*grown.keys));
+		grown.values = malloc(grown.n_slots * sizeof(*grown.values));
+		if (!grown.keys || !grown.values) {
+			free(grown.keys);
+			free(grown.values);
+			return false;
+		}
+		for (size_t i = 0; i < map->n_slots; i++) {
+			if (map->keys[i]) {
+				size_t j = _nodemap_slot(&grown, map->keys[i]);
+				grown.keys[j] = map->keys[i];
+				grown.values[j] = map->values[i];
+			}
+		}
+		grown.n_keys = map->n_keys;
+		free(map->keys);
+		free(map->values);
+		*map = grown;
+	}
+	size_t i = _nodemap_slot(map, node);
+	map->n_keys += !map->keys[i];
+	map->keys[i] = node;
+	map->values[i] = value;
+	return true;
+}
+
+static inline void nodemap_destroy(NodeMap *map)
+{
+	free(map->keys);
+	free(map->values);
+	*map = (NodeMap) { 0 };
+}
+
+#endif /* end of __NODEMAP_H__ */
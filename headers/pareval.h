@@ -0,0 +1,56 @@
+#ifndef __PAREVAL_H__
+#define __PAREVAL_H__
+
+#include "compact.h"
+
+/*
+ * Task-parallel evaluation of large trees.
+ * - pareval_plan flattens a tree (compact.h) and cuts it into tasks. A task is a subtree, so a
+ *   range of the post-order node array, run front to back like compact_evaluate. Subtrees
+ *   handed to other tasks are holes in it: their values are pushed when the scan reaches them.
+ * - A subtree becomes a task of its own when it is an operand of a binary node whose operands
+ *   both have at least grain nodes, and it reads no variable the tree updates ('++'/'--'
+ *   anywhere). Such a task has no effect on the others and no other task has an effect on it,
+ *   so it can run at any time. Everything else, '++'/'--' included, runs in its enclosing task in
+ *   the order of evaluate.h: the result, the status and the variables after the run are those of
+ *   compact_evaluate.
+ * - pareval_run runs a plan on a TaskPool, the calling thread included. Each worker keeps the
+ *   holes of the task it runs in a deque of its own: it takes them back one by one as its scan
+ *   reaches them, idle workers steal the others from the far end. A worker waiting on a stolen
+ *   hole runs other tasks meanwhile.
+ * - A plan is read only by pareval_run: it can be run any number of times, with other variables.
+ *   A pool runs one plan at a time.
+ */
+
+#define PAREVAL_GRAIN 4096	// default grain: nodes below which a subtree is never split
+
+/* PlanTask: the subtree nodes[first ... last], its holes are tasks[hole_ids[holes ...
+ * holes + n_holes - 1]] in the order the scan reaches them */
+typedef struct {
+	uint32_t first;
+	uint32_t last;
+	uint32_t holes;
+	uint32_t n_holes;
+	uint32_t max_stack;	/* values the scan keeps at most (holes count for one) */
+} PlanTask;
+
+/* EvalPlan: a CompactTree and its tasks, tasks[0] is the whole tree */
+typedef struct {
+	CompactTree ct;
+	PlanTask *tasks;
+	size_t n_tasks;
+	uint32_t *hole_ids;
+} EvalPlan;
+
+typedef struct TaskPool TaskPool;
+
+eval_status_t pareval_plan(ExpressionTree root, size_t grain, EvalPlan *plan);
+eval_status_t pareval_run(EvalPlan const *plan, TaskPool *pool, long *vars, long *result);
+void pareval_destroy(EvalPlan *plan);
+
+TaskPool *taskpool_create(size_t n_threads);
+size_t taskpool_size(TaskPool const *pool);
+size_t taskpool_steals(TaskPool const *pool);
+void taskpool_destroy(TaskPool *pool);
+
+#endif /* end of __PAREVAL_H__ */
@@ -0,0 +1,78 @@
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Server mode: a long-running process parsing (and evaluating) expressions sent over a Unix
+ * domain socket or a pair of pipes, instead of one process and one parseTree.txt per expression.
+ * - A request is an 8-byte frame header (SERVER_FRAME: length of what follows, 4 bytes little
+ *   endian, then the op, then 3 reserved bytes) followed by length bytes of payload. A reply
+ *   has the same header, with a status in place of the op.
+ *	SERVER_PARSE	payload: an expression. Reply: its tree, as printed to parseTree.txt.
+ *	SERVER_EVAL	payload: an expression, then one "name=value" line per variable, each
+ *			after a '\n'. Reply: the value in decimal (evaluate.h semantics).
+ *   An expression that cannot be parsed or evaluated gets a SERVER_ERROR reply, the payload
+ *   being the message the command line would print. The connection stays up.
+ * - Requests are pipelined: a client may send any number of them before reading a reply.
+ *   Replies come in request order, those of every request read so far are written together.
+ * - Each connection keeps its scratch memory (token arrays, NodeArena, reply buffer) from one
+ *   request to the next: once warm, serving a request makes no malloc call.
+ * - Trees come from a ParseCache (cache.h) of SERVER_CACHE bytes shared by every connection:
+ *   an expression sent again, however it is spaced, is not parsed again. An invalid one is,
+ *   so that its reply holds the message.
+ * - server_listen serves every connection of a socket on its own thread, server_serve one
+ *   connection (e.g. stdin/stdout) on the calling thread.
+ */
+
+#define SERVER_FRAME 8				// bytes of a frame header
+#define SERVER_MAX_REQUEST (1U << 26)		// longest request payload accepted
+#define SERVER_CACHE (1U << 26)			// memory budget of the parse cache
+
+enum server_op_t {
+	SERVER_PARSE = 1,
+	SERVER_EVAL = 2
+};
+
+enum server_status_t {
+	SERVER_OK = 0,
+	SERVER_ERROR = 1
+};
+
+/* ServerReport: counters filled in by server_serve / server_listen */
+typedef struct {
+	size_t n_connections;
+	size_t n_requests;
+	size_t n_errors;	/* SERVER_ERROR replies */
+	size_t n_bytes_in;	/* bytes read, frame headers included */
+	size_t n_bytes_out;	/* bytes written */
+	size_t n_writes;	/* write calls, one per batch of replies */
+	size_t n_cache_hits;	/* requests whose tree came from the parse cache */
+	size_t n_cache_misses;
+	size_t n_cache_evictions;
+	double seconds;		/* wall-clock time from start to shutdown */
+} ServerReport;
+
+static inline void server_frame_encode(uint8_t *frame, uint32_t length, uint8_t op)
+{
+	// frame[0 ... SERVER_FRAME - 1] := header of a payload of length bytes
+	for (int i = 0; i < 4; i++) {
+		frame[i] = (uint8_t)(length >> (8 * i));
+	}
+	frame[4] = op;
+	frame[5] = frame[6] = frame[7] = 0;
+}
+
+static inline uint32_t server_frame_length(uint8_t const *frame)
+{
+	return (uint32_t)frame[0] | (uint32_t)frame[1] << 8 | (uint32_t)frame[2] << 16
+	       | (uint32_t)frame[3] << 24;
+}
+
+int server_serve(int in_fd, int out_fd, ServerReport *report);
+int server_listen(char const *path, ServerReport *report);
+void server_report_display(FILE *fp, ServerReport const *report);
+
+#endif /* end of __SERVER_H__ */
@@ -0,0 +1,26 @@
+#ifndef __SIMPLIFY_H__
+#define __SIMPLIFY_H__
+
+#include "ExpressionTree.h"
+
+/*
+ * Simplifier: constant folding and algebraic identities, rewriting a tree in place.
+ * - '+'/'-' chains and '*' chains (explicit or implicit) are regrouped so that their constants
+ *   fold into one literal, kept as the right operand: `2 3 x` becomes x * 6, `1 + x - 4` x - 3.
+ *   Values wrap around (evaluate.h), so regrouping never changes a result.
+ * - identities: x + 0, x - 0, x * 1, x / 1 are x; x * -1, x / -1, 0 - x are -x; - - x and +x
+ *   are x; x * 0 and x % 1 are 0.
+ * - '++'/'--' on anything but a variable only computes a value: ++(e) becomes e + 1, (e)++
+ *   becomes e. On a variable they are kept.
+ * - literals produced by folding have no text (token_string == NULL), their value is in
+ *   ASTNode.value.
+ * - operands are still evaluated left to right, a '/' or '%' that may divide by zero is only
+ *   folded once its divisor is known not to be 0, and a subtree is only dropped (x * 0, x % 1)
+ *   when evaluating it cannot fail or update a variable. A dropped variable no longer needs
+ *   a binding.
+ * - the tree must not be a hash-consed DAG (hash-cons after simplifying instead).
+ */
+
+ExpressionTree expressiontree_simplify(ExpressionTree root, NodeArena *arena);
+
+#endif /* end of __SIMPLIFY_H__ */
@@ -1,44 +1,48 @@
-#ifndef __STACK_H__
-#define __STACK_H__
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <stdbool.h>
-
-// Nothing but a linked list, so will access the head by a pointer (address) to the first node
-typedef struct _sf {
-	void *content;
-	struct _sf *next;
-} StackFrame;
-
-static inline bool is_empty(StackFrame *stack)
-{
-	return stack == NULL;
-}
-
-static inline void push(StackFrame **a_stack, void *content)
-{
-	StackFrame *new_frame = malloc(sizeof(*new_frame));
-	*new_frame = (StackFrame){.content = content, .next = *a_stack};
-	*a_stack = new_frame;
-}
-
-static inline void *get_top(StackFrame *stack)
-{
-	if (!is_empty(stack)) {
-		return stack->content;
-	}
-	fprintf(stderr, "%s:%s: trying to get top of an empty stack\n", __FILE__, __func__);
-	return NULL;
-}
-
-static inline void pop(StackFrame **a_stack)
-{
-	if (!is_empty(*a_stack)) {
-		StackFrame *tmp = *a_stack;
-		*a_stack = (*a_stack)->next;
-		free(tmp);
-	}
-}
-
-#endif
+#ifndef __STACK_H__
+#define __STACK_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+/*
+ * Array-backed stacks for the iterative tree walks: *items starts out as a small buffer owned by
+ * the caller (inline_items, usually on the C stack) and moves to the heap only once it overflows.
+ * Release with stack_release.
+ */
+static inline bool stack_reserve(void **items, size_t *capacity, size_t size, size_t item_size,
+				 void *inline_items)
+{
+	if (size <= *capacity) {
+		return true;
+	}
+	size_t new_cap = (*capacity) ? *capacity * 2 : 16;
+	while (new_cap < size) {
+		new_cap *= 2;
+	}
+	void *grown = NULL;
+	if (*items == inline_items) {
+		grown = malloc(new_cap * item_size);
+		if (grown && *capacity) {
+			memcpy(grown, *items, *capacity * item_size);
+		}
+	} else {
+		grown = realloc(*items, new_cap * item_size);
+	}
+	if (!grown) {
+		return false;
+	}
+	*items = grown;
+	*capacity = new_cap;
+	return true;
+}
+
+static inline void stack_release(void *items, void *inline_items)
+{
+	if (items != inline_items) {
+		free(items);
+	}
+}
+
+#endif
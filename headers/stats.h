@@ -0,0 +1,90 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+/*
+ * Instrumentation of the parse pipeline.
+ * - A thread attaches a ParseStats with stats_attach, from then on tokenizer_tokenize,
+ *   expressiontree_build_tree*, expressiontree_print_to_file and expressiontree_destroy_tree
+ *   called by that thread add their counters and timings to it (monotonic clock, ns).
+ * - Each phase keeps a latency histogram with power-of-2 buckets, good for percentiles over
+ *   long batch runs (stats_percentile).
+ * - Nothing is measured while no ParseStats is attached (one thread-local load per call).
+ *   Building with -DEXPR_NO_STATS compiles the instrumentation out entirely.
+ */
+
+enum stats_phase_t {
+	STATS_LEX,		/* tokenizer_tokenize */
+	STATS_VALIDATE,		/* TOK_ERROR and parentheses check */
+	STATS_PARSE,		/* Pratt parser */
+	STATS_PRINT,		/* expressiontree_print_to_file */
+	STATS_DESTROY,		/* expressiontree_destroy_tree */
+	STATS_N_PHASES
+};
+
+#define STATS_BUCKETS 40	// bucket i counts calls of [2^i, 2^(i+1)) ns, the last one also longer
+
+/* PhaseStats: calls, total/max time and latency histogram of one phase */
+typedef struct {
+	uint64_t n_calls;
+	uint64_t total_ns;
+	uint64_t max_ns;
+	uint64_t buckets[STATS_BUCKETS];
+} PhaseStats;
+
+/* ParseStats: everything measured while attached to a thread */
+typedef struct {
+	PhaseStats phases[STATS_N_PHASES];
+	uint64_t n_bytes;		/* input bytes tokenized */
+	uint64_t n_tokens;		/* tokens produced */
+	uint64_t n_nodes;		/* ASTNodes allocated by the parser */
+	uint64_t n_parse_frames;	/* parser stack frames pushed */
+	uint64_t n_parens;		/* '(' checked by validation */
+	uint64_t max_depth;		/* deepest parser stack (nesting of the expression) */
+	uint64_t n_trees;		/* trees built */
+	uint64_t n_rejected;		/* expressions no tree was built for */
+} ParseStats;
+
+ParseStats *stats_attach(ParseStats *stats);
+ParseStats *stats_attached(void);
+void stats_merge(ParseStats *dst, ParseStats const *src);
+uint64_t stats_percentile(PhaseStats const *phase, double q);
+void stats_write_text(FILE *fp, ParseStats const *stats);
+void stats_write_json(FILE *fp, ParseStats const *stats);
+
+// used by the instrumentation macros
+uint64_t stats_now_ns(void);
+void stats_record(ParseStats *stats, enum stats_phase_t phase, uint64_t ns);
+
+#ifndef EXPR_NO_STATS
+extern _Thread_local ParseStats *stats_sink;
+
+// STATS_BEGIN(t) starts timer t, STATS_END(phase, t) records it
+#define STATS_BEGIN(t) uint64_t t = stats_sink ? stats_now_ns() : 0
+#define STATS_END(phase, t) do { \
+		if (stats_sink) { \
+			stats_record(stats_sink, (phase), stats_now_ns() - (t)); \
+		} \
+	} while (0)
+#define STATS_ADD(field, n) do { \
+		if (stats_sink) { \
+			stats_sink->field += (n); \
+		} \
+	} while (0)
+#define STATS_MAX(field, n) do { \
+		if (stats_sink && stats_sink->field < (uint64_t)(n)) { \
+			stats_sink->field = (n); \
+		} \
+	} while (0)
+#else
+// n is still evaluated, so a local only counted (and the warnings about it) stays used
+#define STATS_BEGIN(t)
+#define STATS_END(phase, t) ((void)0)
+#define STATS_ADD(field, n) ((void)(n))
+#define STATS_MAX(field, n) ((void)(n))
+#endif
+
+#endif /* end of __STATS_H__ */
@@ -0,0 +1,53 @@
+#ifndef __SYMTAB_H__
+#define __SYMTAB_H__
+
+#include <stdint.h>
+#include "ExpressionTree.h"
+
+/*
+ * SymbolTable: interned variable names, numbered 0 ... n_symbols - 1 in order of interning.
+ * - Building a tree with BuildOptions.symbols interns each of its variables and stores the
+ *   number in the leaf (ASTNode.slot). Evaluators then bind variables by index
+ *   (expressiontree_evaluate_slots, bytecode_bind_slots) instead of comparing names.
+ * - Such a tree no longer points into the input it was parsed from: variable names point into
+ *   the table (null-terminated copies), operators point to static strings. A literal is printed
+ *   from its value, unless its spelling says otherwise ("007"): that spelling is then interned
+ *   too, apart from the variables (it gets no slot). The tree stays valid as long as the table.
+ * - One table can be shared by many trees, a name gets the same slot in all of them.
+ * - Not thread-safe.
+ */
+
+#define SYMTAB_NO_SLOT UINT32_MAX
+
+/* Symbol: name[0 ... length - 1] of a variable, name[length] == '\0' */
+typedef struct {
+	char *name;
+	size_t length;
+} Symbol;
+
+struct SymbolTable {
+	Symbol *symbols;	/* by slot */
+	size_t n_symbols;
+	size_t capacity;
+	uint32_t *index;	/* open addressing set of the slots, by name hash, SYMTAB_NO_SLOT meant empty */
+	size_t n_index;		/* a power of 2 */
+	struct SymbolTable *spellings;	/* literals with leading zeros, NULL until the first one */
+};
+
+/* VarList: the distinct variables a tree uses (their slots), in order of first appearance */
+typedef struct {
+	uint32_t *slots;
+	size_t n_slots;
+} VarList;
+
+void symtab_init(SymbolTable *st);
+uint32_t symtab_intern(SymbolTable *st, char const *name, size_t length);
+uint32_t symtab_find(SymbolTable const *st, char const *name, size_t length);
+void symtab_destroy(SymbolTable *st);
+
+bool symtab_intern_node(SymbolTable *st, ASTNode *node);
+ExpressionTree symtab_intern_tree(SymbolTable *st, ExpressionTree root);
+int symtab_variables(ExpressionTree root, VarList *vars);
+void varlist_destroy(VarList *vars);
+
+#endif /* end of __SYMTAB_H__ */
@@ -1,62 +1,150 @@
-#ifndef __TOKENIZER_H__
-#define __TOKENIZER_H__
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <assert.h>
-#include <stdbool.h>
-#include <ctype.h>
-
-/*
- * lexer/tokenizer takes an input character stream and returns a stream of tokens.
- * - It is done here by labelling substrings of the input stream as one of the
- *   following tok_type_t and filtering out whitespaces.
- *
- * Parser will take this stream of tokens and build
- * structure (ExpresssionTree) based on the "grammatical" rules of computer
- * arithmetic.
- */
-
-enum tok_type_t {
-	// atoms
-	TOK_VAR, TOK_LIT,
-	// operators: just a bunch of reserved symbols that meant math operations
-	//  (what kind of operation will be determined in the parsing/tree-building stage)
-	TOK_ADD,TOK_MINUS,TOK_MULT, TOK_DIV, TOK_MOD,
-	// unary operators
-	TOK_INC, TOK_DEC,
-	// special symbols (parentheses meant grouping, EOF meant end of expression)
-	TOK_LPAREN,TOK_RPAREN, TOK_EOF,
-	// error type: none of the above
-	// an TOK_ERROR starts with an illegal character followed by 0 or more
-	// non-whitespace characters
-	TOK_ERROR
-};
-
-// Token:
-// 	- token_string: char * := starting address of the token
-// 	- length: size_t := length of the token 
-// 	- type: enum tok_type_t:= what kind of token 
-// 	** want token_string[0...length -  1] to entail all the characters in the actual token **
-typedef struct {
-	enum tok_type_t type;
-	char const *token_string;
-	size_t length;
-} Token;
-
-
-/* Tokenizer:  
- *	-  tokens: Token[] := an array of Token
- *	-  n_tokens: size_t := length of tokens (n_tokens ≤ input_size)
- */
-typedef struct {
-	Token *tokens;
-	size_t n_tokens;
-} Tokenizer;
-
-Tokenizer tokenizer_tokenize(char const *input, size_t length);
-void tokenizer_display(Tokenizer *a_tkz);
-void tokenizer_distroy(Tokenizer *a_tkz);	// free the tokens array basically
-
-#endif
+#ifndef __TOKENIZER_H__
+#define __TOKENIZER_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <ctype.h>
+
+/*
+ * lexer/tokenizer takes an input character stream and returns a stream of tokens.
+ * - It is done here by labelling substrings of the input stream as one of the
+ *   following tok_type_t and filtering out whitespaces.
+ *
+ * Parser will take this stream of tokens and build
+ * structure (ExpresssionTree) based on the "grammatical" rules of computer
+ * arithmetic.
+ */
+
+enum tok_type_t {
+	// atoms
+	TOK_VAR, TOK_LIT,
+	// operators: just a bunch of reserved symbols that meant math operations
+	//  (what kind of operation will be determined in the parsing/tree-building stage)
+	TOK_ADD,TOK_MINUS,TOK_MULT, TOK_DIV, TOK_MOD,
+	// unary operators
+	TOK_INC, TOK_DEC,
+	// special symbols (parentheses meant grouping, EOF meant end of expression)
+	TOK_LPAREN,TOK_RPAREN, TOK_EOF,
+	// error type: none of the above
+	// an TOK_ERROR starts with an illegal character followed by 0 or more
+	// non-whitespace characters
+	TOK_ERROR
+};
+
+// Token:
+// 	- token_string: char * := starting address of the token
+// 	- length: size_t := length of the token 
+// 	- type: enum tok_type_t:= what kind of token 
+// 	** want token_string[0...length -  1] to entail all the characters in the actual token **
+typedef struct {
+	enum tok_type_t type;
+	char const *token_string;
+	size_t length;
+} Token;
+
+
+/* Tokenizer: the token stream as a structure of arrays (9 bytes per token)
+ *	-  input: char const * := the tokenized string, every offset is relative to it
+ *	-  types: uint8_t[] := enum tok_type_t of each token
+ *	-  offsets: uint32_t[] := token i starts at input + offsets[i]
+ *	-  lengths: uint32_t[] := length of each token
+ *	-  n_tokens: size_t := number of tokens, the last one is always TOK_EOF
+ *	   (n_tokens == 0 meant tokenizing failed: input longer than TOKENIZER_MAX_INPUT or out of
+ *	   memory)
+ *	-  capacity: size_t := number of tokens the arrays have room for (grown on demand)
+ *	-  n_mallocs: size_t := realloc calls on the arrays (3 per growth) since the arrays
+ *	   were last freed, flat once they fit the longest input (tokenizer_tokenize_into)
+ */
+typedef struct {
+	char const *input;
+	uint8_t *types;
+	uint32_t *offsets;
+	uint32_t *lengths;
+	size_t n_tokens;
+	size_t capacity;
+	size_t n_mallocs;
+} Tokenizer;
+
+#define TOKENIZER_MAX_INPUT ((size_t)UINT32_MAX)	// offsets are 32-bit
+#define TOKENIZER_MIN_CHUNK (1 << 20)	// bytes below which tokenizer_tokenize_parallel adds no thread
+
+static inline Token tokenizer_token(Tokenizer const *tkz, size_t i)
+{
+	// materialize the i-th token
+	return (Token) {
+		.type = tkz->types[i],
+		.token_string = tkz->input + tkz->offsets[i],
+		.length = tkz->lengths[i]
+	};
+}
+
+/* TextEdit: bytes [offset, offset + n_deleted) of the previous text were replaced by the
+ * n_inserted bytes at [offset, offset + n_inserted) of the new text */
+typedef struct {
+	size_t offset;
+	size_t n_deleted;
+	size_t n_inserted;
+} TextEdit;
+
+/* TokenSplice: tokens [first, first + n_removed) of the previous stream were replaced by tokens
+ * [first, first + n_added) of the new one, the tokens after them are the previous ones shifted */
+typedef struct {
+	size_t first;
+	size_t n_removed;
+	size_t n_added;
+} TokenSplice;
+
+/* TokenStream: tokens pulled one at a time from a file descriptor, no token array is built
+ *	-  token: Token := the current token, token_string points into window and is only valid
+ *	   until the next tokenstream_advance (copy out what must outlive it, see symtab.h)
+ *	-  window: char[] := bytes read from fd and not consumed yet, [pos, size) is still to be
+ *	   lexed, window[size] == '\0'
+ *	-  capacity: size_t := room in window (grown only for a token longer than the window)
+ *	-  offset: size_t := input offset of window[0]
+ *	-  n_tokens: size_t := tokens pulled so far, the current one included
+ *	-  eof: bool := fd has no more bytes to give
+ *	-  error: int := errno of the read that failed (or ENOMEM), 0 if none. The stream then
+ *	   ends with a TOK_EOF token.
+ * Memory stays at the window size however long the input is.
+ */
+typedef struct {
+	int fd;
+	Token token;
+	char *window;
+	size_t pos;
+	size_t size;
+	size_t capacity;
+	size_t offset;
+	size_t n_tokens;
+	bool eof;
+	int error;
+} TokenStream;
+
+#define TOKENSTREAM_DEFAULT_WINDOW (1 << 16)
+
+/* instruction sets the tokenizer can scan input with, in increasing order of width */
+enum tokenizer_isa_t {
+	TOKENIZER_ISA_SCALAR,
+	TOKENIZER_ISA_SSE2,
+	TOKENIZER_ISA_AVX2
+};
+
+Tokenizer tokenizer_tokenize(char const *input, size_t length);
+bool tokenizer_tokenize_into(Tokenizer *tkz, char const *input, size_t length);
+Tokenizer tokenizer_tokenize_parallel(char const *input, size_t length, size_t n_threads);
+bool tokenizer_relex(Tokenizer *tkz, char const *input, size_t length, TextEdit const *edit,
+		     TokenSplice *splice);
+size_t tokenizer_normalize(char const *input, size_t length, char *out);
+bool tokenstream_init(TokenStream *ts, int fd, size_t window);
+Token tokenstream_advance(TokenStream *ts);
+size_t tokenstream_offset(TokenStream const *ts);
+void tokenstream_destroy(TokenStream *ts);
+enum tokenizer_isa_t tokenizer_select_isa(enum tokenizer_isa_t isa);
+void tokenizer_display(Tokenizer *a_tkz);
+void tokenizer_distroy(Tokenizer *a_tkz);	// free the token arrays basically
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef __VARINDEX_H__
+#define __VARINDEX_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "tokenizer.h"
+
+/*
+ * VarIndex: finds the variables a compiler already numbered (local index, in order of first
+ * appearance), the names and symbol table slots of which it keeps in its own arrays
+ * (vars[local], symbols[local]), without scanning them.
+ * - An interned tree (symtab.h) gives every occurrence of a variable the same slot: by_slot,
+ *   open addressing by hash of the slot, finds it after one name comparison.
+ * - The leaves of a tree built without a table all have slot 0: the first variable takes the
+ *   entry of slot 0, any other lands in by_name, open addressing by hash of the name.
+ * Both hold local index + 1 (0 meant empty). A zeroed VarIndex is an empty index.
+ */
+typedef struct {
+	uint32_t *by_slot;
+	uint32_t *by_name;
+	size_t n_slots;		/* entries of each, a power of 2 */
+	size_t n_keys;
+} VarIndex;
+
+static inline bool _varindex_same(Token a, Token b)
+{
+	return a.length == b.length && (a.token_string == b.token_string
+					|| memcmp(a.token_string, b.token_string, a.length) == 0);
+}
+
+static inline size_t _varindex_slot_hash(VarIndex const *ix, uint32_t slot)
+{
+	return (((uint64_t)slot * 0x9e3779b97f4a7c15ULL) >> 32) & (ix->n_slots - 1);
+}
+
+static inline size_t _varindex_name_hash(VarIndex const *ix, Token name)
+{
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < name.length; i++) {
+		hash = (hash ^ (unsigned char)name.token_string[i]) * 0x100000001b3ULL;
+	}
+	return hash & (ix->n_slots - 1);
+}
+
+static inline long varindex_find(VarIndex const *ix, Token const *vars, uint32_t const *symbols,
+				 Token name, uint32_t slot)
+{
+	// local index of the variable name (at slot), -1 if it has none yet
+	if (ix->n_keys == 0) {
+		return -1;
+	}
+	size_t mask = ix->n_slots - 1;
+	for (size_t i = _varindex_slot_hash(ix, slot); ix->by_slot[i]; i = (i + 1) & mask) {
+		uint32_t local = ix->by_slot[i] - 1;
+		if (symbols[local] == slot) {
+			if (_varindex_same(vars[local], name)) {
+				return local;
+			}
+			break;	// slot 0 of a tree without a table: look the name up
+		}
+	}
+	for (size_t i = _varindex_name_hash(ix, name); ix->by_name[i]; i = (i + 1) & mask) {
+		uint32_t local = ix->by_name[i] - 1;
+		if (_varindex_same(vars[local], name)) {
+			return local;
+		}
+	}
+	return -1;
+}
+
+static inline void _varindex_place(VarIndex *ix, Token const *vars, uint32_t const *symbols,
+				   uint32_t local)
+{
+	// by_slot if no variable holds the entry of its slot yet, by_name otherwise
+	size_t mask = ix->n_slots - 1;
+	size_t i = _varindex_slot_hash(ix, symbols[local]);
+	while (ix->by_slot[i] && symbols[ix->by_slot[i] - 1] != symbols[local]) {
+		i = (i + 1) & mask;
+	}
+	if (!ix->by_slot[i]) {
+		ix->by_slot[i] = local + 1;
+		return;
+	}
+	i = _varindex_name_hash(ix, vars[local]);
+	while (ix->by_name[i]) {
+		i = (i + 1) & mask;
+	}
+	ix->by_name[i] = local + 1;
+}
+
+static inline bool varindex_add(VarIndex *ix, Token const *vars, uint32_t const *symbols,
+				uint32_t local)
+{
+	// index vars[local] (at symbols[local]), not indexed yet; returns false if out of memory
+	if (2 * (ix->n_keys + 1) > ix->n_slots) {
+		VarIndex grown = {.n_slots = ix->n_slots ? 2 * ix->n_slots : 64, .n_keys = ix->n_keys};
+		grown.by_slot = calloc(grown.n_slots, sizeof(*grown.by_slot));
+		grown.by_name = calloc(grown.n_slots, sizeof(*grown.by_name));
+		if (!grown.by_slot || !grown.by_name) {
+			free(grown.by_slot);
+			free(grown.by_name);
+			return false;
+		}
+		// the variables are numbered 0 ... n_keys - 1: place them again in that order
+		for (uint32_t i = 0; i < ix->n_keys; i++) {
+			_varindex_place(&grown, vars, symbols, i);
+		}
+		free(ix->by_slot);
+		free(ix->by_name);
+		*ix = grown;
+	}
+	_varindex_place(ix, vars, symbols, local);
+	ix->n_keys += 1;
+	return true;
+}
+
+static inline void varindex_destroy(VarIndex *ix)
+{
+	free(ix->by_slot);
+	free(ix->by_name);
+	*ix = (VarIndex) { 0 };
+}
+
+#endif /* end of __VARINDEX_H__ */
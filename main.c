@@ -1,10 +1,81 @@
+#include <fcntl.h>
+#include <unistd.h>
+
 #include "headers/tokenizer.h"
 #include "headers/ExpressionTree.h"
+#include "headers/batch.h"
+#include "headers/stats.h"
+#include "headers/column.h"
+#include "headers/server.h"
 
 static long getline(char **lineptr, size_t *buff_size);
+static int expr_main(int argc, char **argv);
+static int batch_main(char const *mode, char const *in_path, char const *out_path,
+		      size_t n_threads);
+static int emit_main(char const *format_name, char const *in_path, char const *out_path);
+static int columns_main(char const *expression, char const *out_path, char *const *bindings,
+			size_t n_bindings);
+static int serve_main(char const *path);
+
+int main(int argc, char **argv)
+{
+	// --stats[=json] in front of any mode reports the parse statistics on stderr at exit
+	if (argc > 1 && (strcmp(argv[1], "--stats") == 0 || strcmp(argv[1], "--stats=json") == 0)) {
+		bool json = argv[1][7] == '=';
+		argv[1] = argv[0];
+		ParseStats stats = {0};
+		stats_attach(&stats);
+		int status = expr_main(argc - 1, argv + 1);
+		stats_attach(NULL);
+		if (json) {
+			stats_write_json(stderr, &stats);
+		} else {
+			stats_write_text(stderr, &stats);
+		}
+		return status;
+	}
+	return expr_main(argc, argv);
+}
 
-int main(void)
+static int expr_main(int argc, char **argv)
 {
+	if (argc > 1) {
+		if ((strcmp(argv[1], "--batch") == 0 || strcmp(argv[1], "--load-ast") == 0
+		     || strcmp(argv[1], "--stream") == 0)
+		    && (argc == 3 || argc == 4)) {
+			return batch_main(argv[1], argv[2], (argc == 4) ? argv[3] : "parseTree.txt", 0);
+		}
+		if (strcmp(argv[1], "--save-ast") == 0 && argc == 4) {
+			return batch_main(argv[1], argv[2], argv[3], 0);
+		}
+		if (strcmp(argv[1], "--parallel") == 0 && (argc == 4 || argc == 5)
+		    && isdigit(argv[2][0])) {
+			return batch_main(argv[1], argv[3], (argc == 5) ? argv[4] : "parseTree.txt",
+					  strtoul(argv[2], NULL, 10));
+		}
+		if (strcmp(argv[1], "--emit") == 0 && (argc == 4 || argc == 5)) {
+			return emit_main(argv[2], argv[3], (argc == 5) ? argv[4] : "parseTree.txt");
+		}
+		if (strcmp(argv[1], "--columns") == 0 && argc >= 4) {
+			return columns_main(argv[2], argv[3], argv + 4, argc - 4);
+		}
+		if (strcmp(argv[1], "--serve") == 0 && argc == 3) {
+			return serve_main(argv[2]);
+		}
+		fprintf(stderr, "usage: %s [--stats[=json]] [mode]   (mode as below, interactive if none)\n"
+				"       %s [--batch <input file> [output file]]\n"
+				"       %s [--stream <input file, - for stdin> [output file]]\n"
+				"       %s [--parallel <threads, 0 for all cpus> <input file> [output file]]\n"
+				"       %s [--save-ast <input file> <ast file>]\n"
+				"       %s [--load-ast <ast file> [output file]]\n"
+				"       %s [--emit <tree|sexpr|rpn|json> <input file> [output file]]\n"
+				"       %s [--columns <expression> <result column file> [<name>=<column file>]...]\n"
+				"       %s [--serve <socket path, - for stdin/stdout>]\n",
+				argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0],
+				argv[0]);
+		return EXIT_FAILURE;
+	}
+
 	char *str = NULL;
 	size_t buff_size = 0;
 	long input_size;
@@ -61,6 +132,107 @@ build:
 	return EXIT_SUCCESS;
 }
 
+#define BATCH_OUT_BUF (1 << 20)	// one large stdio buffer for the whole batch output
+static int batch_main(char const *mode, char const *in_path, char const *out_path,
+		      size_t n_threads)
+{
+	/*
+	 * --batch: parse every line of in_path, write all trees to out_path ("-" meaning stdout)
+	 * --parallel: same as --batch on n_threads threads
+	 * --stream: parse all of in_path as one expression, pulled through a bounded window
+	 * --save-ast: parse every line of in_path, save the trees as an AST image to out_path
+	 * --load-ast: map the AST image in_path, write all trees to out_path
+	 * and report throughput on stderr
+	 */
+	bool save = strcmp(mode, "--save-ast") == 0;
+	FILE *out = strcmp(out_path, "-") == 0 ? stdout : fopen(out_path, save ? "wb" : "w");
+	if (!out) {
+		perror(out_path);
+		return EXIT_FAILURE;
+	}
+	static char out_buf[BATCH_OUT_BUF];
+	setvbuf(out, out_buf, _IOFBF, sizeof(out_buf));
+
+	BatchReport report;
+	int status = save ? batch_save_ast(in_path, out, &report)
+		   : (strcmp(mode, "--load-ast") == 0) ? batch_print_ast(in_path, out, &report)
+		   : (strcmp(mode, "--stream") == 0) ? batch_parse_stream(in_path, out, &report)
+		   : (strcmp(mode, "--parallel") == 0)
+		     ? batch_parse_file_parallel(in_path, out, n_threads, &report)
+		   : batch_parse_file(in_path, out, &report);
+	if (status < 0) {
+		perror(in_path);
+	} else {
+		batch_report_display(stderr, &report);
+	}
+
+	if (out != stdout) {
+		fclose(out);
+	}
+	return (status < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int emit_main(char const *format_name, char const *in_path, char const *out_path)
+{
+	// --emit: parse every line of in_path, write the trees in the named format (emit.h) to
+	// out_path ("-" meaning stdout) and report throughput on stderr
+	enum emit_format_t format;
+	if (emit_format_parse(format_name, &format) < 0) {
+		fprintf(stderr, "%s: unknown format, expected tree, sexpr, rpn or json\n", format_name);
+		return EXIT_FAILURE;
+	}
+	int fd = strcmp(out_path, "-") == 0 ? STDOUT_FILENO
+					    : open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(out_path);
+		return EXIT_FAILURE;
+	}
+	BatchReport report;
+	int status = batch_emit_file(in_path, fd, format, &report);
+	if (status < 0) {
+		perror(in_path);
+	} else {
+		batch_report_display(stderr, &report);
+	}
+	if (fd != STDOUT_FILENO) {
+		close(fd);
+	}
+	return (status < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int columns_main(char const *expression, char const *out_path, char *const *bindings,
+			size_t n_bindings)
+{
+	// --columns: evaluate expression over the column files bound to its variables, write the
+	// result column to out_path and report throughput on stderr
+	FILE *out = fopen(out_path, "wb");
+	if (!out) {
+		perror(out_path);
+		return EXIT_FAILURE;
+	}
+	ColumnReport report;
+	int status = column_evaluate_files(expression, bindings, n_bindings, out, &report);
+	if (status == 0) {
+		column_report_display(stderr, &report);
+	}
+	fclose(out);
+	return (status < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int serve_main(char const *path)
+{
+	// --serve: answer requests (server.h) on a Unix socket until SIGINT/SIGTERM, or on
+	// stdin/stdout until stdin ends, and report on stderr
+	ServerReport report;
+	int status = strcmp(path, "-") == 0 ? server_serve(STDIN_FILENO, STDOUT_FILENO, &report)
+					    : server_listen(path, &report);
+	if (status < 0) {
+		perror(path);
+	}
+	server_report_display(stderr, &report);
+	return (status < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 #define BUF_DEFAULT 512
 static long getline(char **lineptr, size_t *buff_size)
 {
@@ -0,0 +1,84 @@
+#include "../headers/arena.h"
+
+#define NODEARENA_MAX_SLAB (1 << 16)	// stop doubling slabs past this many nodes
+
+static inline NodeSlab *_next_slab(NodeArena *arena);
+
+void nodearena_init(NodeArena *arena, size_t slab_nodes)
+{
+	assert(arena && "parameter arena must be a valid NodeArena *");
+	*arena = (NodeArena) {
+		.slab_nodes = (slab_nodes > 0) ? slab_nodes : NODEARENA_DEFAULT_SLAB
+	};
+}
+
+ASTNode *nodearena_alloc(NodeArena *arena)
+{
+	// returns a zeroed node, or NULL if a new slab was needed but could not be malloc'd
+	assert(arena && "parameter arena must be a valid NodeArena *");
+	if (!arena->curr || arena->used == arena->curr->capacity) {
+		NodeSlab *slab = _next_slab(arena);
+		if (!slab) {
+			return NULL;
+		}
+		arena->curr = slab;
+		arena->used = 0;
+	}
+	ASTNode *node = &arena->curr->nodes[arena->used++];
+	*node = (ASTNode) { 0 };
+	arena->n_nodes += 1;
+	return node;
+}
+
+void nodearena_reset(NodeArena *arena)
+{
+	// release every node at once, slabs are rewound (not freed) for the next tree
+	assert(arena && "parameter arena must be a valid NodeArena *");
+	arena->curr = arena->slabs;
+	arena->used = 0;
+	arena->n_nodes = 0;
+	arena->n_resets += 1;
+}
+
+void nodearena_destroy(NodeArena *arena)
+{
+	assert(arena && "parameter arena must be a valid NodeArena *");
+	NodeSlab *slab = arena->slabs;
+	while (slab) {
+		NodeSlab *next = slab->next;
+		free(slab);
+		slab = next;
+	}
+	*arena = (NodeArena) { 0 };
+}
+
+static inline NodeSlab *_next_slab(NodeArena *arena)
+{
+	// reuse the slab after curr if a previous tree already grew the arena that far
+	if (arena->curr && arena->curr->next) {
+		return arena->curr->next;
+	}
+	if (!arena->curr && arena->slabs) {
+		return arena->slabs;
+	}
+
+	size_t capacity = arena->slab_nodes;
+	NodeSlab *slab = malloc(sizeof(*slab) + sizeof(slab->nodes[0]) * capacity);
+	if (!slab) {
+		return NULL;
+	}
+	slab->next = NULL;
+	slab->capacity = capacity;
+	arena->n_mallocs += 1;
+	if (arena->slab_nodes < NODEARENA_MAX_SLAB) {
+		arena->slab_nodes *= 2;
+	}
+
+	// append after curr (the last slab in the list)
+	if (arena->curr) {
+		arena->curr->next = slab;
+	} else {
+		arena->slabs = slab;
+	}
+	return slab;
+}
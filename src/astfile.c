@@ -0,0 +1,433 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../headers/astfile.h"
+#include "../headers/nodemap.h"
+
+#define INLINE_FRAMES 64
+#define ALIGN_UP(n, a) (((n) + (a) - 1) / (a) * (a))
+#define OFFSET_TO_PTR(type, offset) ((type)(uintptr_t)(offset))	// offsets live in pointer fields
+#define PTR_TO_OFFSET(ptr) ((uint64_t)(uintptr_t)(ptr))
+
+/* Writer: the image is assembled in memory, since the string table goes after every node */
+typedef struct {
+	ASTNode *nodes;		/* records, pointer fields holding file offsets */
+	size_t n_nodes;
+	size_t nodes_cap;
+	uint64_t nodes_offset;
+	char *strings;
+	size_t strings_size;
+	size_t strings_cap;
+	size_t *slots;		/* interning hash set: string table offset + 1, 0 meant empty */
+	size_t n_slots;
+	size_t n_interned;
+	NodeMap written;	/* shared node -> offset, a DAG is written as a DAG */
+} Writer;
+
+static inline int _append_tree(Writer *w, ExpressionTree root, uint64_t *offset);
+static inline int _intern(Writer *w, char const *str, size_t length, size_t *offset);
+static inline uint8_t _byte_order(void);
+static inline bool _relocate(char *base, size_t size);
+static inline bool _relocate_node(char *base, AstFileHeader const *header, uint64_t limit,
+				  ASTNode **slot);
+static inline bool _relocate_string(char *base, AstFileHeader const *header, Token *token);
+
+int astfile_write(FILE *fp, ExpressionTree const *roots, uint8_t const *statuses, size_t n_roots)
+{
+	/*
+	 * - Returns 0 on success, -1 on failure (out of memory or a write error).
+	 * - roots[i] may be NULL, it is loaded back as NULL. statuses[i] (enum astfile_status_t)
+	 *   must be ASTFILE_OK exactly where roots[i] is not NULL; statuses == NULL: ASTFILE_ERROR
+	 *   for every NULL root.
+	 */
+	assert(fp && "parameter fp must be a valid FILE *");
+	assert((roots || n_roots == 0) && "roots must hold n_roots trees");
+
+	int status = -1;
+	uint64_t statuses_offset = sizeof(AstFileHeader) + n_roots * sizeof(ExpressionTree);
+	Writer w = {.nodes_offset = ALIGN_UP(statuses_offset + n_roots, _Alignof(ASTNode))};
+	ExpressionTree *root_table = calloc(n_roots + 1, sizeof(*root_table));
+	uint8_t *status_table = malloc(n_roots + 1);
+	if (!root_table || !status_table) {
+		goto cleanup;
+	}
+	for (size_t i = 0; i < n_roots; i++) {
+		uint64_t offset = 0;
+		if (roots[i] && _append_tree(&w, roots[i], &offset) < 0) {
+			goto cleanup;
+		}
+		root_table[i] = OFFSET_TO_PTR(ExpressionTree, offset);
+		status_table[i] = statuses ? statuses[i] : roots[i] ? ASTFILE_OK : ASTFILE_ERROR;
+		assert((status_table[i] == ASTFILE_OK) == (roots[i] != NULL)
+		       && "statuses[i] must be ASTFILE_OK exactly where roots[i] is a tree");
+	}
+
+	// token strings were recorded relative to the string table (+ 1), which starts after the nodes
+	uint64_t strings_offset = w.nodes_offset + w.n_nodes * sizeof(ASTNode);
+	for (ASTNode *rec = w.nodes; rec < w.nodes + w.n_nodes; rec++) {
+		uint64_t relative = PTR_TO_OFFSET(rec->token.token_string);
+		if (relative) {
+			rec->token.token_string = OFFSET_TO_PTR(char const *,
+								strings_offset + relative - 1);
+		}
+	}
+
+	AstFileHeader header = {
+		.magic = ASTFILE_MAGIC,
+		.version = ASTFILE_VERSION,
+		.node_size = sizeof(ASTNode),
+		.pointer_size = sizeof(void *),
+		.byte_order = _byte_order(),
+		.file_size = strings_offset + w.strings_size,
+		.n_roots = n_roots,
+		.roots_offset = sizeof(AstFileHeader),
+		.statuses_offset = statuses_offset,
+		.n_nodes = w.n_nodes,
+		.nodes_offset = w.nodes_offset,
+		.strings_offset = strings_offset,
+		.strings_size = w.strings_size
+	};
+	static char const padding[_Alignof(ASTNode)] = { 0 };
+	size_t n_padding = w.nodes_offset - statuses_offset - n_roots;
+	if (fwrite(&header, sizeof(header), 1, fp) != 1
+	    || fwrite(root_table, sizeof(*root_table), n_roots, fp) != n_roots
+	    || fwrite(status_table, 1, n_roots, fp) != n_roots
+	    || fwrite(padding, 1, n_padding, fp) != n_padding
+	    || fwrite(w.nodes, sizeof(*w.nodes), w.n_nodes, fp) != w.n_nodes
+	    || fwrite(w.strings, 1, w.strings_size, fp) != w.strings_size
+	    || fflush(fp) != 0) {
+		goto cleanup;
+	}
+	status = 0;
+
+cleanup:
+	free(root_table);
+	free(status_table);
+	free(w.nodes);
+	free(w.strings);
+	free(w.slots);
+	nodemap_destroy(&w.written);
+	return status;
+}
+
+int astfile_load(char const *path, AstImage *image)
+{
+	/*
+	 * - Returns 0 on success, -1 on failure with errno set (EINVAL: not an image written by
+	 *   this build of the program, or a corrupt one).
+	 * - The image is mapped copy-on-write, only pages holding nodes are dirtied by relocation,
+	 *   and it is made read-only afterwards.
+	 */
+	assert(path && "parameter path must be a valid file path");
+	assert(image && "parameter image must be a valid AstImage *");
+
+	*image = (AstImage) { 0 };
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	size_t size = st.st_size;
+	if (size < sizeof(AstFileHeader)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	char *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);	// the mapping stays valid after closing the descriptor
+	if (base == MAP_FAILED) {
+		return -1;
+	}
+
+	if (!_relocate(base, size)) {
+		munmap(base, size);
+		errno = EINVAL;
+		return -1;
+	}
+	mprotect(base, size, PROT_READ);
+
+	AstFileHeader const *header = (AstFileHeader const *)base;
+	*image = (AstImage) {
+		.base = base,
+		.size = size,
+		.roots = (ExpressionTree const *)(base + header->roots_offset),
+		.statuses = (uint8_t const *)(base + header->statuses_offset),
+		.n_roots = header->n_roots,
+		.n_nodes = header->n_nodes
+	};
+	return 0;
+}
+
+void astfile_unload(AstImage *image)
+{
+	assert(image && "parameter image must be a valid AstImage *");
+	if (image->base) {
+		munmap(image->base, image->size);
+	}
+	*image = (AstImage) { 0 };
+}
+
+static inline int _append_tree(Writer *w, ExpressionTree root, uint64_t *offset)
+{
+	/*
+	 * append root's nodes in post-order, so a node's children are always written before (at a
+	 * lower offset than) the node itself, which is what makes a loaded image acyclic
+	 */
+	typedef struct {ExpressionTree node; bool children_done;} WriteFrame;
+	WriteFrame inline_frames[INLINE_FRAMES];
+	WriteFrame *frames = inline_frames;
+	size_t capacity = INLINE_FRAMES, size = 0;
+	uint64_t inline_offsets[INLINE_FRAMES];	// offsets of finished subtrees
+	uint64_t *offsets = inline_offsets;
+	size_t offsets_cap = INLINE_FRAMES, n_offsets = 0;
+
+	int status = 0;
+	frames[size++] = (WriteFrame) {root, false};
+	while (size > 0) {
+		WriteFrame *top = &frames[size - 1];
+		ExpressionTree node = top->node;
+		size_t written;
+		if (!top->children_done && node->shared && nodemap_get(&w->written, node, &written)) {
+			// hash-consed subtree written before (by this tree or an earlier one)
+			if (!stack_reserve((void **)&offsets, &offsets_cap, n_offsets + 1,
+					   sizeof(*offsets), inline_offsets)) {
+				status = -1;
+				break;
+			}
+			offsets[n_offsets++] = written;
+			size--;
+			continue;
+		}
+		if (!top->children_done) {
+			top->children_done = true;
+			if (!stack_reserve((void **)&frames, &capacity, size + 2, sizeof(*frames),
+					   inline_frames)) {
+				status = -1;
+				break;
+			}
+			if (node->binary.right) {
+				frames[size++] = (WriteFrame) {node->binary.right, false};
+			}
+			if (node->binary.left) {
+				frames[size++] = (WriteFrame) {node->binary.left, false};
+			}
+			continue;
+		}
+		size--;
+
+		size_t string = 0;
+		if (node->token.token_string
+		    && _intern(w, node->token.token_string, node->token.length, &string) < 0) {
+			status = -1;
+			break;
+		}
+		if (!stack_reserve((void **)&w->nodes, &w->nodes_cap, w->n_nodes + 1,
+				   sizeof(*w->nodes), NULL)
+		    || !stack_reserve((void **)&offsets, &offsets_cap, n_offsets + 1, sizeof(*offsets),
+				      inline_offsets)) {
+			status = -1;
+			break;
+		}
+
+		ASTNode *rec = &w->nodes[w->n_nodes];
+		memset(rec, 0, sizeof(*rec));	// padding bytes end up in the file too
+		rec->token.type = node->token.type;
+		rec->token.length = node->token.length;
+		rec->token.token_string = OFFSET_TO_PTR(char const *,
+							node->token.token_string ? string + 1 : 0);
+		rec->value = node->value;
+		rec->slot = node->slot;
+		rec->postfix = node->postfix;
+		rec->prefix = node->prefix;
+		rec->shared = node->shared;
+		rec->pure = node->pure;
+		if (node->binary.right) {
+			rec->binary.right = OFFSET_TO_PTR(ASTNode *, offsets[--n_offsets]);
+		}
+		if (node->binary.left) {
+			rec->binary.left = OFFSET_TO_PTR(ASTNode *, offsets[--n_offsets]);
+		}
+		offsets[n_offsets++] = w->nodes_offset + w->n_nodes * sizeof(ASTNode);
+		if (node->shared && !nodemap_put(&w->written, node, offsets[n_offsets - 1])) {
+			status = -1;
+			break;
+		}
+		w->n_nodes += 1;
+	}
+
+	if (status == 0) {
+		*offset = offsets[0];
+	}
+	stack_release(frames, inline_frames);
+	stack_release(offsets, inline_offsets);
+	return status;
+}
+
+static inline int _intern(Writer *w, char const *str, size_t length, size_t *offset)
+{
+	// find str[0...length - 1] in the string table or add it (null-terminated), FNV-1a hashed
+	if (2 * (w->n_interned + 1) > w->n_slots) {
+		size_t n_slots = w->n_slots ? 2 * w->n_slots : 256;
+		size_t *slots = calloc(n_slots, sizeof(*slots));
+		if (!slots) {
+			return -1;
+		}
+		for (size_t i = 0; i < w->n_slots; i++) {
+			if (!w->slots[i]) {
+				continue;
+			}
+			char const *s = w->strings + w->slots[i] - 1;
+			uint64_t hash = 14695981039346656037ULL;
+			for (; *s; s++) {
+				hash = (hash ^ (unsigned char)*s) * 1099511628211ULL;
+			}
+			size_t j = hash & (n_slots - 1);
+			while (slots[j]) {
+				j = (j + 1) & (n_slots - 1);
+			}
+			slots[j] = w->slots[i];
+		}
+		free(w->slots);
+		w->slots = slots;
+		w->n_slots = n_slots;
+	}
+
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < length; i++) {
+		hash = (hash ^ (unsigned char)str[i]) * 1099511628211ULL;
+	}
+	size_t j = hash & (w->n_slots - 1);
+	for (; w->slots[j]; j = (j + 1) & (w->n_slots - 1)) {
+		char const *s = w->strings + w->slots[j] - 1;
+		if (memcmp(s, str, length) == 0 && s[length] == '\0') {
+			*offset = w->slots[j] - 1;
+			return 0;
+		}
+	}
+
+	if (!stack_reserve((void **)&w->strings, &w->strings_cap, w->strings_size + length + 1, 1,
+			   NULL)) {
+		return -1;
+	}
+	memcpy(w->strings + w->strings_size, str, length);
+	w->strings[w->strings_size + length] = '\0';
+	*offset = w->strings_size;
+	w->strings_size += length + 1;
+	w->slots[j] = *offset + 1;
+	w->n_interned += 1;
+	return 0;
+}
+
+static inline uint8_t _byte_order(void)
+{
+	uint16_t probe = 1;
+	return (*(uint8_t *)&probe == 1) ? 1 : 2;
+}
+
+static inline bool _relocate(char *base, size_t size)
+{
+	/*
+	 * check every section and offset of the image at base before turning offsets into pointers,
+	 * nothing outside of the mapping can be reached from a relocated image
+	 */
+	AstFileHeader const *header = (AstFileHeader const *)base;
+	if (memcmp(header->magic, ASTFILE_MAGIC, sizeof(header->magic)) != 0
+	    || header->version != ASTFILE_VERSION
+	    || header->node_size != sizeof(ASTNode)
+	    || header->pointer_size != sizeof(void *)
+	    || header->byte_order != _byte_order()
+	    || header->file_size != size) {
+		return false;
+	}
+	if (header->roots_offset < sizeof(AstFileHeader) || header->roots_offset > size
+	    || header->roots_offset % _Alignof(ExpressionTree) != 0
+	    || header->n_roots > (size - header->roots_offset) / sizeof(ExpressionTree)) {
+		return false;
+	}
+	uint64_t roots_end = header->roots_offset + header->n_roots * sizeof(ExpressionTree);
+	if (header->statuses_offset < roots_end || header->statuses_offset > size
+	    || header->n_roots > size - header->statuses_offset) {
+		return false;
+	}
+	uint64_t statuses_end = header->statuses_offset + header->n_roots;
+	if (header->nodes_offset < statuses_end || header->nodes_offset > size
+	    || header->nodes_offset % _Alignof(ASTNode) != 0
+	    || header->n_nodes > (size - header->nodes_offset) / sizeof(ASTNode)) {
+		return false;
+	}
+	uint64_t nodes_end = header->nodes_offset + header->n_nodes * sizeof(ASTNode);
+	if (header->strings_offset < nodes_end || header->strings_offset > size
+	    || header->strings_size > size - header->strings_offset) {
+		return false;
+	}
+
+	ASTNode *nodes = (ASTNode *)(base + header->nodes_offset);
+	for (size_t i = 0; i < header->n_nodes; i++) {
+		// a child must come before its parent
+		uint64_t self = header->nodes_offset + i * sizeof(ASTNode);
+		unsigned char flags[4];	// read as bytes, not every byte is a valid bool
+		memcpy(&flags[0], &nodes[i].postfix, 1);
+		memcpy(&flags[1], &nodes[i].prefix, 1);
+		memcpy(&flags[2], &nodes[i].shared, 1);
+		memcpy(&flags[3], &nodes[i].pure, 1);
+		if ((unsigned)nodes[i].token.type > TOK_DEC
+		    || flags[0] > 1 || flags[1] > 1 || flags[2] > 1 || flags[3] > 1
+		    || !_relocate_node(base, header, self, &nodes[i].binary.left)
+		    || !_relocate_node(base, header, self, &nodes[i].binary.right)
+		    || !_relocate_string(base, header, &nodes[i].token)) {
+			return false;
+		}
+	}
+	ExpressionTree *roots = (ExpressionTree *)(base + header->roots_offset);
+	uint8_t const *statuses = (uint8_t const *)(base + header->statuses_offset);
+	for (size_t i = 0; i < header->n_roots; i++) {
+		// a tree exactly where the status says one was built
+		if (statuses[i] > ASTFILE_ERROR || (statuses[i] == ASTFILE_OK) != (roots[i] != NULL)
+		    || !_relocate_node(base, header, nodes_end, &roots[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static inline bool _relocate_node(char *base, AstFileHeader const *header, uint64_t limit,
+				  ASTNode **slot)
+{
+	// *slot: 0 or the offset of a node record below limit
+	uint64_t offset = PTR_TO_OFFSET(*slot);
+	if (offset == 0) {
+		return true;
+	}
+	if (offset < header->nodes_offset || offset >= limit
+	    || (offset - header->nodes_offset) % sizeof(ASTNode) != 0) {
+		return false;
+	}
+	*slot = (ASTNode *)(base + offset);
+	return true;
+}
+
+static inline bool _relocate_string(char *base, AstFileHeader const *header, Token *token)
+{
+	// token_string: 0 or the offset of a null-terminated string of token->length characters
+	uint64_t offset = PTR_TO_OFFSET(token->token_string);
+	if (offset == 0) {
+		return true;
+	}
+	uint64_t strings_end = header->strings_offset + header->strings_size;
+	if (offset < header->strings_offset || offset >= strings_end
+	    || token->length >= strings_end - offset
+	    || memchr(base + offset, '\0', token->length + 1) != base + offset + token->length) {
+		return false;
+	}
+	token->token_string = base + offset;
+	return true;
+}
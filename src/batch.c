@@ -0,0 +1,811 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../headers/batch.h"
+#include "../headers/tokenizer.h"
+#include "../headers/ExpressionTree.h"
+#include "../headers/arena.h"
+#include "../headers/astfile.h"
+#include "../headers/emit.h"
+#include "../headers/hashcons.h"
+#include "../headers/symtab.h"
+#include "../headers/stats.h"
+
+#define BATCH_CHUNK (1 << 18)	// bytes of input per chunk (rounded up to the end of a line)
+#define BATCH_WINDOW 4		// chunks in flight per worker, bounds the reorder buffer
+
+/* BatchChunk: a task of the parallel batch, whole lines of the input and their output */
+typedef struct {
+	char const *start;
+	size_t length;
+	size_t first_line;	/* lines of the input before this chunk */
+	char *text;		/* output of the chunk (open_memstream) */
+	size_t text_size;
+	char *errors;		/* diagnostics of its lines, to stderr in input order as well */
+	size_t errors_size;
+	bool done;		/* guarded by BatchPool.lock */
+	bool failed;		/* out of memory while buffering the output */
+} BatchChunk;
+
+/* ChunkQueue: chunk numbers queued for one worker, oldest first (a ring of n_window entries) */
+typedef struct {
+	pthread_mutex_t lock;
+	size_t *ids;
+	size_t head;
+	size_t size;
+} ChunkQueue;
+
+typedef struct BatchPool BatchPool;
+
+/* BatchWorker: a thread of the pool and its own scratch memory and counters */
+typedef struct {
+	BatchPool *pool;
+	size_t id;
+	pthread_t thread;
+	NodeArena arena;
+	Tokenizer tkz;		/* refilled line after line (tokenizer_tokenize_into) */
+	BatchReport report;
+	ParseStats stats;
+} BatchWorker;
+
+struct BatchPool {
+	BatchChunk *window;	/* reorder buffer: chunk i lives in window[i % n_window] */
+	size_t n_window;
+	ChunkQueue *queues;	/* queues[i] belongs to workers[i], the others steal from it */
+	BatchWorker *workers;
+	size_t n_workers;
+	ParseStats *stats;	/* attached by the caller, the workers' stats are merged into it */
+	pthread_mutex_t lock;	/* guards n_queued, closing and every chunk's done flag */
+	pthread_cond_t work;	/* signaled when a chunk is queued or the pool closes */
+	pthread_cond_t done;	/* signaled when a chunk is done */
+	size_t n_queued;	/* chunks queued and not taken yet */
+	bool closing;
+};
+
+static inline int _pool_start(BatchPool *pool, size_t n_threads);
+static inline void _pool_stop(BatchPool *pool, BatchReport *report);
+static void *_worker_main(void *arg);
+static inline void _push_chunk(BatchPool *pool, size_t id);
+static inline bool _take_chunk(BatchPool *pool, BatchWorker *worker, size_t *id);
+static inline bool _queue_pop(ChunkQueue *queue, size_t n_window, size_t *id);
+static inline void _parse_chunk(BatchChunk *chunk, BatchWorker *worker);
+static inline char const *_chunk_end(char const *start, char const *input_end);
+static inline size_t _count_lines(char const *start, char const *end);
+static inline int _map_input(char const *in_path, char const **input, size_t *size);
+static inline char const *_next_line(char const *line, char const *input_end, size_t *length);
+static inline void _parse_line(FILE *out, char const *line, size_t length, Tokenizer *tkz,
+			       BuildOptions const *opts, BatchReport *report);
+static inline void _emit_line(Emitter *em, enum emit_format_t format, char const *line,
+			      size_t length, Tokenizer *tkz, BuildOptions const *opts,
+			      BatchReport *report);
+static inline ExpressionTree _build_line(char const *line, size_t length, Tokenizer *tkz,
+					 BuildOptions const *opts, BatchReport *report);
+static inline double _elapsed(struct timespec start);
+
+int batch_parse_file(char const *in_path, FILE *out, BatchReport *report)
+{
+	/*
+	 * - Returns 0 on success, -1 if the input file cannot be opened/mapped (errno is kept).
+	 * - Lines are split on '\n', a trailing '\r' and other trailing whitespace are ignored.
+	 * - out is written through stdio only, give it a large buffer (setvbuf) before calling.
+	 */
+	assert(in_path && "parameter in_path must be a valid file path");
+	assert(out && "parameter out must be a valid FILE *");
+	assert(report && "parameter report must be a valid BatchReport *");
+
+	*report = (BatchReport) { 0 };
+	char const *input = NULL;
+	size_t size = 0;
+	if (_map_input(in_path, &input, &size) < 0) {
+		return -1;
+	}
+
+	// every line's tree is built in the same arena, which is rewound after the tree is printed,
+	// from tokens in the same arrays
+	NodeArena arena;
+	nodearena_init(&arena, NODEARENA_DEFAULT_SLAB);
+	Tokenizer tkz = { 0 };
+	BuildOptions opts = {.arena = &arena};
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	char const *input_end = input + size;
+	for (char const *line = input, *next; line < input_end; line = next) {
+		size_t length;
+		next = _next_line(line, input_end, &length);
+		_parse_line(out, line, length, &tkz, &opts, report);
+	}
+	fflush(out);
+
+	report->seconds = _elapsed(start);
+	report->n_bytes = size;
+	report->n_mallocs = arena.n_mallocs + tkz.n_mallocs;
+
+	tokenizer_distroy(&tkz);
+	nodearena_destroy(&arena);
+
+	if (input) {
+		munmap((void *)input, size);
+	}
+	return 0;
+}
+
+int batch_emit_file(char const *in_path, int fd, enum emit_format_t format, BatchReport *report)
+{
+	/*
+	 * - Returns 0 on success, -1 if the input file cannot be opened/mapped or fd cannot be
+	 *   written (errno is kept).
+	 * - Lines are split as batch_parse_file's. In EMIT_TREE the output is the same bytes as
+	 *   batch_parse_file's, in the other formats line n of the output is the tree of line n of
+	 *   the input: empty if there is none ("null" in EMIT_JSON).
+	 * - fd is written through an Emitter in blocks of EMIT_BLOCK bytes, no stdio on the way.
+	 */
+	assert(in_path && "parameter in_path must be a valid file path");
+	assert(report && "parameter report must be a valid BatchReport *");
+
+	*report = (BatchReport) { 0 };
+	char const *input = NULL;
+	size_t size = 0;
+	if (_map_input(in_path, &input, &size) < 0) {
+		return -1;
+	}
+
+	NodeArena arena;
+	nodearena_init(&arena, NODEARENA_DEFAULT_SLAB);
+	Tokenizer tkz = { 0 };
+	BuildOptions opts = {.arena = &arena};
+	Emitter em;
+	emitter_init(&em, fd, NULL, 0);
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	char const *input_end = input + size;
+	for (char const *line = input, *next; line < input_end && !em.error; line = next) {
+		size_t length;
+		next = _next_line(line, input_end, &length);
+		_emit_line(&em, format, line, length, &tkz, &opts, report);
+	}
+	int status = emitter_flush(&em);
+
+	report->seconds = _elapsed(start);
+	report->n_bytes = size;
+	report->n_mallocs = arena.n_mallocs + tkz.n_mallocs;
+	report->n_writes = em.n_writes;
+
+	int error = errno;
+	emitter_destroy(&em);
+	tokenizer_distroy(&tkz);
+	nodearena_destroy(&arena);
+
+	if (input) {
+		munmap((void *)input, size);
+	}
+	errno = error;
+	return status;
+}
+
+int batch_parse_file_parallel(char const *in_path, FILE *out, size_t n_threads,
+			      BatchReport *report)
+{
+	/*
+	 * - Same output and return values as batch_parse_file, n_threads == 0 meaning one thread
+	 *   per online CPU. errno is ENOMEM if the output of a chunk could not be buffered.
+	 * - The calling thread cuts the input into chunks and queues them round-robin, a worker
+	 *   takes the oldest chunk of its own queue and steals the oldest of another queue when
+	 *   its own is empty. Each chunk is printed into its own buffer (its diagnostics into
+	 *   another one), the calling thread writes the buffers out in input order as they
+	 *   complete (at most n_window chunks in flight): out and stderr get what
+	 *   batch_parse_file writes to them.
+	 * - Falls back to batch_parse_file if no thread can be started.
+	 */
+	assert(in_path && "parameter in_path must be a valid file path");
+	assert(out && "parameter out must be a valid FILE *");
+	assert(report && "parameter report must be a valid BatchReport *");
+
+	if (n_threads == 0) {
+		long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		n_threads = (n_cpus > 0) ? n_cpus : 1;
+	}
+	BatchPool pool;
+	if (_pool_start(&pool, n_threads) < 0) {
+		return batch_parse_file(in_path, out, report);
+	}
+
+	*report = (BatchReport) { 0 };
+	char const *input = NULL;
+	size_t size = 0;
+	if (_map_input(in_path, &input, &size) < 0) {
+		int saved = errno;
+		_pool_stop(&pool, report);
+		*report = (BatchReport) { 0 };
+		errno = saved;
+		return -1;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	int status = 0;
+	char const *input_end = input + size, *cursor = input;
+	size_t n_lines = 0, next_id = 0, next_write = 0;
+	while (cursor < input_end || next_write < next_id) {
+		// keep the window full
+		while (cursor < input_end && next_id < next_write + pool.n_window) {
+			char const *end = _chunk_end(cursor, input_end);
+			pool.window[next_id % pool.n_window] = (BatchChunk) {
+				.start = cursor,
+				.length = end - cursor,
+				.first_line = n_lines
+			};
+			n_lines += _count_lines(cursor, end);
+			cursor = end;
+			_push_chunk(&pool, next_id++);
+		}
+
+		// write the oldest chunk out once it is done
+		BatchChunk *chunk = &pool.window[next_write % pool.n_window];
+		pthread_mutex_lock(&pool.lock);
+		while (!chunk->done) {
+			pthread_cond_wait(&pool.done, &pool.lock);
+		}
+		pthread_mutex_unlock(&pool.lock);
+		if (chunk->failed) {
+			status = -1;
+		} else if (status == 0) {
+			fwrite(chunk->text, 1, chunk->text_size, out);
+			fwrite(chunk->errors, 1, chunk->errors_size, stderr);
+		}
+		free(chunk->text);
+		free(chunk->errors);
+		next_write += 1;
+	}
+	fflush(out);
+
+	_pool_stop(&pool, report);
+	report->seconds = _elapsed(start);
+	report->n_bytes = size;
+
+	if (input) {
+		munmap((void *)input, size);
+	}
+	if (status < 0) {
+		errno = ENOMEM;
+	}
+	return status;
+}
+
+int batch_parse_stream(char const *in_path, FILE *out, BatchReport *report)
+{
+	/*
+	 * - Parses the whole of in_path ("-" meaning stdin) as one expression, newlines are
+	 *   whitespace like any other. It counts as line 1: out gets the status header of
+	 *   batch_parse_file and the tree, the same bytes as batch_parse_file on a one-line input.
+	 * - Returns 0 on success, -1 if the input file cannot be opened or read (errno is kept).
+	 */
+	assert(in_path && "parameter in_path must be a valid file path");
+	assert(out && "parameter out must be a valid FILE *");
+	assert(report && "parameter report must be a valid BatchReport *");
+
+	*report = (BatchReport) { 0 };
+	bool is_stdin = strcmp(in_path, "-") == 0;
+	int fd = is_stdin ? STDIN_FILENO : open(in_path, O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	NodeArena arena;
+	nodearena_init(&arena, NODEARENA_DEFAULT_SLAB);
+	SymbolTable symbols;
+	symtab_init(&symbols);
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	TokenStream ts;
+	ExpressionTree root = NULL;
+	report->n_lines = 1;
+	if (tokenstream_init(&ts, fd, TOKENSTREAM_DEFAULT_WINDOW) && ts.token.type == TOK_EOF) {
+		report->n_empty = 1;
+		fprintf(out, "line 1: empty\n");
+	} else if ((root = expressiontree_build_tree_stream(&ts, &(BuildOptions) {
+				.arena = &arena, .symbols = &symbols}))) {
+		report->n_ok = 1;
+		fprintf(out, "line 1: ok\n");
+		expressiontree_print_to_file(out, 0, root);
+	} else {
+		report->n_failed = 1;
+		fprintf(out, "line 1: error\n");
+	}
+	fflush(out);
+	int error = ts.error;
+
+	report->seconds = _elapsed(start);
+	report->n_bytes = ts.offset + ts.size;
+	report->n_mallocs = arena.n_mallocs;
+
+	tokenstream_destroy(&ts);
+	symtab_destroy(&symbols);
+	nodearena_destroy(&arena);
+	if (!is_stdin) {
+		close(fd);
+	}
+	if (error) {
+		errno = error;
+		return -1;
+	}
+	return 0;
+}
+
+int batch_save_ast(char const *in_path, FILE *ast_out, BatchReport *report)
+{
+	/*
+	 * - Returns 0 on success, -1 if the input file cannot be opened/mapped or the image cannot
+	 *   be written (errno is kept).
+	 * - Line n's tree is root n - 1 of the image, NULL for an empty or invalid line (its
+	 *   status in the image tells which).
+	 */
+	assert(in_path && "parameter in_path must be a valid file path");
+	assert(ast_out && "parameter ast_out must be a valid FILE *");
+	assert(report && "parameter report must be a valid BatchReport *");
+
+	*report = (BatchReport) { 0 };
+	char const *input = NULL;
+	size_t size = 0;
+	if (_map_input(in_path, &input, &size) < 0) {
+		return -1;
+	}
+
+	// every tree is hash-consed into one DAG, a subexpression repeated across the file is
+	// stored once (in memory and in the image)
+	HashCons hc;
+	hashcons_init(&hc);
+	BuildOptions opts = {.hashcons = &hc};
+	Tokenizer tkz = { 0 };
+	ExpressionTree *roots = NULL;
+	uint8_t *statuses = NULL;
+	size_t roots_cap = 0, statuses_cap = 0;
+	int status = 0;
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	char const *input_end = input + size;
+	for (char const *line = input, *next; line < input_end; line = next) {
+		size_t length;
+		next = _next_line(line, input_end, &length);
+		if (!stack_reserve((void **)&roots, &roots_cap, report->n_lines + 1, sizeof(*roots),
+				   NULL)
+		    || !stack_reserve((void **)&statuses, &statuses_cap, report->n_lines + 1, 1, NULL)) {
+			status = -1;
+			break;
+		}
+		size_t i = report->n_lines, n_empty = report->n_empty;
+		roots[i] = _build_line(line, length, &tkz, &opts, report);
+		statuses[i] = roots[i] ? ASTFILE_OK
+			      : (report->n_empty > n_empty) ? ASTFILE_EMPTY : ASTFILE_ERROR;
+	}
+	if (status == 0) {
+		status = astfile_write(ast_out, roots, statuses, report->n_lines);
+	}
+
+	report->seconds = _elapsed(start);
+	report->n_bytes = size;
+	report->n_mallocs = hc.nodes.n_mallocs + tkz.n_mallocs;
+
+	free(roots);
+	free(statuses);
+	tokenizer_distroy(&tkz);
+	hashcons_destroy(&hc);
+	if (input) {
+		munmap((void *)input, size);
+	}
+	return status;
+}
+
+int batch_print_ast(char const *ast_path, FILE *out, BatchReport *report)
+{
+	/*
+	 * - Prints the trees of an image written by batch_save_ast, in the format of
+	 *   batch_parse_file: the same bytes and counts as the batch run over the saved input.
+	 * - Returns 0 on success, -1 if the image cannot be loaded (errno is kept).
+	 */
+	assert(ast_path && "parameter ast_path must be a valid file path");
+	assert(out && "parameter out must be a valid FILE *");
+	assert(report && "parameter report must be a valid BatchReport *");
+
+	*report = (BatchReport) { 0 };
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	AstImage image;
+	if (astfile_load(ast_path, &image) < 0) {
+		return -1;
+	}
+	for (size_t i = 0; i < image.n_roots; i++) {
+		report->n_lines += 1;
+		if (image.roots[i]) {
+			fprintf(out, "line %zu: ok\n", report->n_lines);
+			expressiontree_print_to_file(out, 0, image.roots[i]);
+			report->n_ok += 1;
+		} else if (image.statuses[i] == ASTFILE_EMPTY) {
+			fprintf(out, "line %zu: empty\n", report->n_lines);
+			report->n_empty += 1;
+		} else {
+			fprintf(out, "line %zu: error\n", report->n_lines);
+			report->n_failed += 1;
+		}
+	}
+	fflush(out);
+
+	report->seconds = _elapsed(start);
+	report->n_bytes = image.size;
+	astfile_unload(&image);
+	return 0;
+}
+
+void batch_report_display(FILE *fp, BatchReport const *report)
+{
+	assert(fp && report);
+	double rate = (report->seconds > 0) ? report->n_lines / report->seconds : 0;
+	fprintf(fp, "%zu lines (%zu ok, %zu empty, %zu failed), %zu bytes in %.3f s: "
+		    "%.0f lines/sec, %zu scratch mallocs",
+		report->n_lines, report->n_ok, report->n_empty, report->n_failed,
+		report->n_bytes, report->seconds, rate, report->n_mallocs);
+	if (report->n_threads > 0) {
+		fprintf(fp, ", %zu threads (%zu steals)", report->n_threads, report->n_steals);
+	}
+	if (report->n_writes > 0) {
+		fprintf(fp, ", %zu writes", report->n_writes);
+	}
+	fputc('\n', fp);
+}
+
+static inline int _pool_start(BatchPool *pool, size_t n_threads)
+{
+	// start up to n_threads workers, -1 if none could be started
+	*pool = (BatchPool) {
+		.n_window = BATCH_WINDOW * n_threads,
+		.window = calloc(BATCH_WINDOW * n_threads, sizeof(*pool->window)),
+		.queues = calloc(n_threads, sizeof(*pool->queues)),
+		.workers = calloc(n_threads, sizeof(*pool->workers)),
+		.stats = stats_attached()
+	};
+	if (!pool->window || !pool->queues || !pool->workers) {
+		free(pool->window);
+		free(pool->queues);
+		free(pool->workers);
+		return -1;
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	// queues are created before any worker runs, a worker may steal from all of them
+	size_t n_queues = 0;
+	for (; n_queues < n_threads; n_queues++) {
+		ChunkQueue *queue = &pool->queues[n_queues];
+		if (!(queue->ids = malloc(pool->n_window * sizeof(*queue->ids)))) {
+			break;
+		}
+		pthread_mutex_init(&queue->lock, NULL);
+	}
+	// workers wait for the lock before they look at n_workers, final once it is released
+	pthread_mutex_lock(&pool->lock);
+	for (; pool->n_workers < n_queues; pool->n_workers++) {
+		BatchWorker *worker = &pool->workers[pool->n_workers];
+		*worker = (BatchWorker) {.pool = pool, .id = pool->n_workers};
+		nodearena_init(&worker->arena, NODEARENA_DEFAULT_SLAB);
+		if (pthread_create(&worker->thread, NULL, _worker_main, worker) != 0) {
+			nodearena_destroy(&worker->arena);
+			break;
+		}
+	}
+	// chunks only go to the queues of running workers
+	for (size_t i = pool->n_workers; i < n_queues; i++) {
+		pthread_mutex_destroy(&pool->queues[i].lock);
+		free(pool->queues[i].ids);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	if (pool->n_workers == 0) {
+		_pool_stop(pool, NULL);
+		return -1;
+	}
+	return 0;
+}
+
+static inline void _pool_stop(BatchPool *pool, BatchReport *report)
+{
+	// let the workers finish the queued chunks, join them and sum their counters into report
+	pthread_mutex_lock(&pool->lock);
+	pool->closing = true;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (size_t i = 0; i < pool->n_workers; i++) {
+		BatchWorker *worker = &pool->workers[i];
+		pthread_join(worker->thread, NULL);
+		if (report) {
+			report->n_lines += worker->report.n_lines;
+			report->n_ok += worker->report.n_ok;
+			report->n_empty += worker->report.n_empty;
+			report->n_failed += worker->report.n_failed;
+			report->n_steals += worker->report.n_steals;
+			report->n_mallocs += worker->arena.n_mallocs + worker->tkz.n_mallocs;
+		}
+		if (pool->stats) {
+			stats_merge(pool->stats, &worker->stats);
+		}
+		nodearena_destroy(&worker->arena);
+		tokenizer_distroy(&worker->tkz);
+		pthread_mutex_destroy(&pool->queues[i].lock);
+		free(pool->queues[i].ids);
+	}
+	if (report) {
+		report->n_threads = pool->n_workers;
+	}
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->work);
+	pthread_cond_destroy(&pool->done);
+	free(pool->window);
+	free(pool->queues);
+	free(pool->workers);
+}
+
+static void *_worker_main(void *arg)
+{
+	BatchWorker *worker = arg;
+	BatchPool *pool = worker->pool;
+	pthread_mutex_lock(&pool->lock);	// held by _pool_start until every worker is started
+	pthread_mutex_unlock(&pool->lock);
+	if (pool->stats) {
+		stats_attach(&worker->stats);
+	}
+	while (1) {
+		size_t id;
+		if (!_take_chunk(pool, worker, &id)) {
+			// nothing to take: sleep until a chunk is queued, leave once the pool closes
+			pthread_mutex_lock(&pool->lock);
+			while (pool->n_queued == 0 && !pool->closing) {
+				pthread_cond_wait(&pool->work, &pool->lock);
+			}
+			bool stop = pool->n_queued == 0;
+			pthread_mutex_unlock(&pool->lock);
+			if (stop) {
+				break;
+			}
+			continue;
+		}
+
+		BatchChunk *chunk = &pool->window[id % pool->n_window];
+		_parse_chunk(chunk, worker);
+
+		pthread_mutex_lock(&pool->lock);
+		chunk->done = true;
+		pthread_cond_signal(&pool->done);	// only the writer waits on it
+		pthread_mutex_unlock(&pool->lock);
+	}
+	return NULL;
+}
+
+static inline void _push_chunk(BatchPool *pool, size_t id)
+{
+	// queue chunk id for worker id % n_workers (never full: at most n_window chunks in flight)
+	ChunkQueue *queue = &pool->queues[id % pool->n_workers];
+	pthread_mutex_lock(&queue->lock);
+	queue->ids[(queue->head + queue->size) % pool->n_window] = id;
+	queue->size += 1;
+	pthread_mutex_unlock(&queue->lock);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->n_queued += 1;
+	pthread_cond_signal(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static inline bool _take_chunk(BatchPool *pool, BatchWorker *worker, size_t *id)
+{
+	// the oldest chunk of the worker's own queue, else the oldest one of another queue
+	bool taken = _queue_pop(&pool->queues[worker->id], pool->n_window, id);
+	for (size_t i = 1; !taken && i < pool->n_workers; i++) {
+		ChunkQueue *victim = &pool->queues[(worker->id + i) % pool->n_workers];
+		if ((taken = _queue_pop(victim, pool->n_window, id))) {
+			worker->report.n_steals += 1;
+		}
+	}
+	if (taken) {
+		pthread_mutex_lock(&pool->lock);
+		pool->n_queued -= 1;
+		pthread_mutex_unlock(&pool->lock);
+	}
+	return taken;
+}
+
+static inline bool _queue_pop(ChunkQueue *queue, size_t n_window, size_t *id)
+{
+	pthread_mutex_lock(&queue->lock);
+	bool popped = queue->size > 0;
+	if (popped) {
+		*id = queue->ids[queue->head];
+		queue->head = (queue->head + 1) % n_window;
+		queue->size -= 1;
+	}
+	pthread_mutex_unlock(&queue->lock);
+	return popped;
+}
+
+static inline void _parse_chunk(BatchChunk *chunk, BatchWorker *worker)
+{
+	// print every line of chunk into its own buffer, numbered from chunk->first_line + 1
+	FILE *fp = open_memstream(&chunk->text, &chunk->text_size);
+	FILE *errors = open_memstream(&chunk->errors, &chunk->errors_size);
+	if (!fp || !errors) {
+		if (fp) {
+			fclose(fp);
+		}
+		if (errors) {
+			fclose(errors);
+		}
+		chunk->failed = true;
+		return;
+	}
+	BatchReport counts = {.n_lines = chunk->first_line};
+	BuildOptions opts = {.arena = &worker->arena, .errors = errors};
+	char const *chunk_end = chunk->start + chunk->length;
+	for (char const *line = chunk->start, *next; line < chunk_end; line = next) {
+		size_t length;
+		next = _next_line(line, chunk_end, &length);
+		_parse_line(fp, line, length, &worker->tkz, &opts, &counts);
+	}
+	chunk->failed = ferror(fp) || ferror(errors);
+	if (fclose(fp) != 0 || fclose(errors) != 0) {
+		chunk->failed = true;
+	}
+
+	worker->report.n_lines += counts.n_lines - chunk->first_line;
+	worker->report.n_ok += counts.n_ok;
+	worker->report.n_empty += counts.n_empty;
+	worker->report.n_failed += counts.n_failed;
+}
+
+static inline char const *_chunk_end(char const *start, char const *input_end)
+{
+	// end of the chunk starting at start: BATCH_CHUNK bytes, then up to the end of the line
+	if ((size_t)(input_end - start) <= BATCH_CHUNK) {
+		return input_end;
+	}
+	char const *eol = memchr(start + BATCH_CHUNK, '\n', input_end - (start + BATCH_CHUNK));
+	return eol ? eol + 1 : input_end;
+}
+
+static inline size_t _count_lines(char const *start, char const *end)
+{
+	// lines in [start, end) as _next_line splits them (the last one may lack its '\n')
+	size_t n_lines = 0;
+	for (char const *p = start; p < end && (p = memchr(p, '\n', end - p)); p++) {
+		n_lines += 1;
+	}
+	return n_lines + (end > start && end[-1] != '\n');
+}
+
+static inline int _map_input(char const *in_path, char const **input, size_t *size)
+{
+	// map in_path read-only (an empty file is left unmapped: *input == NULL)
+	int fd = open(in_path, O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	*input = NULL;
+	*size = st.st_size;
+	if (*size > 0) {
+		void *mapped = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped == MAP_FAILED) {
+			close(fd);
+			return -1;
+		}
+		posix_madvise(mapped, *size, POSIX_MADV_SEQUENTIAL);
+		*input = mapped;
+	}
+	close(fd);	// the mapping stays valid after closing the descriptor
+	return 0;
+}
+
+static inline char const *_next_line(char const *line, char const *input_end, size_t *length)
+{
+	// length of the line starting at line without its trailing whitespace, returns the next line
+	char const *eol = memchr(line, '\n', input_end - line);
+	if (!eol) {
+		eol = input_end;	// last line without a '\n'
+	}
+	*length = eol - line;
+	while (*length > 0 && isspace((unsigned char)line[*length - 1])) {
+		(*length)--;
+	}
+	return eol + 1;
+}
+
+static inline void _parse_line(FILE *out, char const *line, size_t length, Tokenizer *tkz,
+			       BuildOptions const *opts, BatchReport *report)
+{
+	// the status header and tree of one line, built in opts->arena (rewound after)
+	size_t n_empty = report->n_empty;
+	ExpressionTree root = _build_line(line, length, tkz, opts, report);
+	if (root) {
+		fprintf(out, "line %zu: ok\n", report->n_lines);
+		expressiontree_print_to_file(out, 0, root);
+	} else if (report->n_empty > n_empty) {
+		fprintf(out, "line %zu: empty\n", report->n_lines);
+	} else {
+		fprintf(out, "line %zu: error\n", report->n_lines);
+	}
+	nodearena_reset(opts->arena);
+}
+
+static inline void _emit_line(Emitter *em, enum emit_format_t format, char const *line,
+			      size_t length, Tokenizer *tkz, BuildOptions const *opts,
+			      BatchReport *report)
+{
+	size_t n_empty = report->n_empty;
+	ExpressionTree root = _build_line(line, length, tkz, opts, report);
+	if (format == EMIT_TREE) {
+		// the status header of _parse_line
+		char header[64];
+		char const *status = root ? "ok" : (report->n_empty > n_empty) ? "empty" : "error";
+		int n = snprintf(header, sizeof(header), "line %zu: %s\n", report->n_lines, status);
+		emitter_text(em, header, n);
+	}
+	if (root) {
+		emitter_tree(em, root, format, 0);
+	} else if (format == EMIT_JSON) {
+		emitter_text(em, "null\n", 5);
+	} else if (format != EMIT_TREE) {
+		emitter_text(em, "\n", 1);
+	}
+	nodearena_reset(opts->arena);
+}
+
+static inline ExpressionTree _build_line(char const *line, size_t length, Tokenizer *tkz,
+					 BuildOptions const *opts, BatchReport *report)
+{
+	/*
+	 * - Tree of one line built as opts says (NULL if the line is empty or invalid), counted in
+	 *   report.
+	 * - The tokens go to tkz's arrays, kept from one line to the next: once they fit the
+	 *   longest line, lexing a line allocates nothing.
+	 */
+	report->n_lines += 1;
+	ExpressionTree root = NULL;
+	if (!tokenizer_tokenize_into(tkz, line, length)) {
+		report->n_failed += 1;	// out of memory
+	} else if (tkz->n_tokens == 1) {
+		// nothing but the TOK_EOF token
+		report->n_empty += 1;
+	} else if ((root = expressiontree_build_tree_opts(tkz, opts))) {
+		report->n_ok += 1;
+	} else {
+		report->n_failed += 1;
+	}
+	return root;
+}
+
+static inline double _elapsed(struct timespec start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
@@ -0,0 +1,378 @@
+#include "../headers/bytecode.h"
+#include "../headers/stack.h"
+#include "../headers/nodemap.h"
+#include "../headers/varindex.h"
+
+#define INLINE_WALK 64	// frames kept on the C stack before the compiler's walk moves to the heap
+
+typedef struct {
+	Program *prog;
+	size_t code_cap, consts_cap, vars_cap;
+	size_t depth;		/* current VM stack depth at the end of the emitted code */
+	bool cse;		/* compiling a pure DAG: shared subexpressions are computed once */
+	NodeMap temps;		/* shared node -> temporary holding its value */
+	VarIndex index;		/* variables that have a slot already */
+} Compiler;
+
+static inline eval_status_t _compile(Compiler *cmp, ExpressionTree node);
+static inline eval_status_t _emit(Compiler *cmp, enum opcode_t op, uint32_t arg);
+static inline eval_status_t _const_idx(Compiler *cmp, long value, uint32_t *idx);
+static inline eval_status_t _var_slot(Compiler *cmp, ExpressionTree var, uint32_t *slot);
+static inline bool _reserve(void **array, size_t *capacity, size_t size, size_t elem_size);
+
+eval_status_t bytecode_compile(ExpressionTree root, Program *prog)
+{
+	/*
+	 * - On success prog holds a Program to be released with bytecode_destroy.
+	 * - On failure prog is left empty (nothing to release).
+	 */
+	assert(prog && "parameter prog must be a valid Program *");
+	*prog = (Program) { 0 };
+	Compiler cmp = {.prog = prog, .cse = root && root->pure};
+	eval_status_t status = _compile(&cmp, root);
+	nodemap_destroy(&cmp.temps);
+	varindex_destroy(&cmp.index);
+	if (status != EVAL_OK) {
+		bytecode_destroy(prog);
+	}
+	return status;
+}
+
+void bytecode_destroy(Program *prog)
+{
+	assert(prog && "parameter prog must be a valid Program *");
+	free(prog->code);
+	free(prog->consts);
+	free(prog->vars);
+	free(prog->symbols);
+	*prog = (Program) { 0 };
+}
+
+eval_status_t bytecode_bind(Program const *prog, Binding const *bindings, size_t n_bindings,
+			    long *vars)
+{
+	// fill vars[0 ... prog->n_vars - 1] from named bindings
+	assert(prog && vars);
+	assert((bindings || n_bindings == 0) && "bindings must hold n_bindings Bindings");
+	for (size_t slot = 0; slot < prog->n_vars; slot++) {
+		Token var = prog->vars[slot];
+		Binding const *b = bindings;
+		while (b < bindings + n_bindings &&
+		       (strncmp(b->name, var.token_string, var.length) != 0 || b->name[var.length])) {
+			b++;
+		}
+		if (b == bindings + n_bindings) {
+			return EVAL_UNBOUND_VAR;
+		}
+		vars[slot] = b->value;
+	}
+	return EVAL_OK;
+}
+
+eval_status_t bytecode_bind_slots(Program const *prog, long const *values, size_t n_values,
+				  long *vars)
+{
+	// fill vars[0 ... prog->n_vars - 1] from values[symbol table slot] (prog compiled from an
+	// interned tree)
+	assert(prog && vars);
+	assert((values || n_values == 0) && "values must hold n_values values");
+	for (size_t slot = 0; slot < prog->n_vars; slot++) {
+		if (prog->symbols[slot] >= n_values) {
+			return EVAL_UNBOUND_VAR;
+		}
+		vars[slot] = values[prog->symbols[slot]];
+	}
+	return EVAL_OK;
+}
+
+void vm_init(VM *vm)
+{
+	assert(vm && "parameter vm must be a valid VM *");
+	*vm = (VM) { 0 };
+}
+
+eval_status_t vm_run(VM *vm, Program const *prog, long *vars, long *result)
+{
+	/*
+	 * Runs prog against vars (prog->n_vars slots, updated in place by '++'/'--').
+	 * The top of the stack lives in `top`, vm->stack only holds the values below it (followed
+	 * by the temporaries).
+	 */
+	assert(vm && prog && result);
+	assert((vars || prog->n_vars == 0) && "vars must hold prog->n_vars values");
+	if (vm->capacity < prog->max_stack + prog->n_temps) {
+		long *stack = realloc(vm->stack, sizeof(*stack) * (prog->max_stack + prog->n_temps));
+		if (!stack) {
+			return EVAL_NO_MEMORY;
+		}
+		vm->stack = stack;
+		vm->capacity = prog->max_stack + prog->n_temps;
+	}
+
+	long const *consts = prog->consts;
+	long *temps = vm->stack + prog->max_stack;
+	long *sp = vm->stack;
+	long top = 0;
+	for (Instr const *ip = prog->code; ip < prog->code + prog->n_code; ip++) {
+		switch ((enum opcode_t)ip->op) {
+		case OP_CONST:
+			*sp++ = top;
+			top = consts[ip->arg];
+			break;
+		case OP_LOAD:
+			*sp++ = top;
+			top = vars[ip->arg];
+			break;
+		case OP_ADD: top = eval_add(*--sp, top); break;
+		case OP_SUB: top = eval_sub(*--sp, top); break;
+		case OP_MUL: top = eval_mul(*--sp, top); break;
+		case OP_DIV:
+			if (eval_div(sp[-1], top, &top) != EVAL_OK) {
+				return EVAL_DIV_BY_ZERO;
+			}
+			sp--;
+			break;
+		case OP_MOD:
+			if (eval_mod(sp[-1], top, &top) != EVAL_OK) {
+				return EVAL_DIV_BY_ZERO;
+			}
+			sp--;
+			break;
+		case OP_NEG: top = eval_sub(0, top); break;
+		case OP_INC: top = eval_add(top, 1); break;
+		case OP_DEC: top = eval_sub(top, 1); break;
+		case OP_PRE_INC:
+			*sp++ = top;
+			top = vars[ip->arg] = eval_add(vars[ip->arg], 1);
+			break;
+		case OP_PRE_DEC:
+			*sp++ = top;
+			top = vars[ip->arg] = eval_sub(vars[ip->arg], 1);
+			break;
+		case OP_POST_INC:
+			*sp++ = top;
+			top = vars[ip->arg];
+			vars[ip->arg] = eval_add(top, 1);
+			break;
+		case OP_POST_DEC:
+			*sp++ = top;
+			top = vars[ip->arg];
+			vars[ip->arg] = eval_sub(top, 1);
+			break;
+		case OP_TEE:
+			temps[ip->arg] = top;
+			break;
+		case OP_TEMP:
+			*sp++ = top;
+			top = temps[ip->arg];
+			break;
+		}
+	}
+	*result = top;
+	return EVAL_OK;
+}
+
+void vm_destroy(VM *vm)
+{
+	assert(vm && "parameter vm must be a valid VM *");
+	free(vm->stack);
+	*vm = (VM) { 0 };
+}
+
+static inline eval_status_t _compile(Compiler *cmp, ExpressionTree root)
+{
+	/*
+	 * post-order: emit the operands (left to right), then the operator.
+	 * The walk runs on an explicit stack, a node is visited twice: once to push its operands
+	 * and once, after they are compiled, to emit its own instruction.
+	 */
+	typedef struct {ExpressionTree node; bool operands_done;} CompileFrame;
+	CompileFrame inline_frames[INLINE_WALK];
+	CompileFrame *frames = inline_frames;
+	size_t capacity = INLINE_WALK, size = 0;
+
+	eval_status_t status = EVAL_OK;
+	frames[size++] = (CompileFrame) {root, false};
+	while (size > 0 && status == EVAL_OK) {
+		CompileFrame *top = &frames[size - 1];
+		ExpressionTree node = top->node;
+		if (!node) {
+			status = EVAL_MALFORMED;
+			break;
+		}
+
+		uint32_t arg;
+		size_t temp;
+		bool is_var_incdec = (node->token.type == TOK_INC || node->token.type == TOK_DEC) &&
+				     node->unary.operand && node->unary.operand->token.type == TOK_VAR;
+		if (!top->operands_done) {
+			// first visit: leaves are emitted right away, operators push their operands
+			top->operands_done = true;
+			if (cmp->cse && node->shared && nodemap_get(&cmp->temps, node, &temp)) {
+				// a later occurrence of a shared subexpression: reuse its value
+				status = _emit(cmp, OP_TEMP, temp);
+				size--;
+				continue;
+			}
+			switch (node->token.type) {
+			case TOK_LIT:
+				if ((status = _const_idx(cmp, node->value, &arg)) == EVAL_OK) {
+					status = _emit(cmp, OP_CONST, arg);
+				}
+				size--;
+				continue;
+			case TOK_VAR:
+				if ((status = _var_slot(cmp, node, &arg)) == EVAL_OK) {
+					status = _emit(cmp, OP_LOAD, arg);
+				}
+				size--;
+				continue;
+			case TOK_ADD: case TOK_MINUS: case TOK_MULT: case TOK_DIV: case TOK_MOD:
+			case TOK_INC: case TOK_DEC:
+				break;
+			default:
+				status = EVAL_MALFORMED;
+				continue;
+			}
+			if (is_var_incdec) {
+				continue;	// '++'/'--' on a variable is a single instruction
+			}
+			if (!stack_reserve((void **)&frames, &capacity, size + 2, sizeof(*frames),
+					   inline_frames)) {
+				status = EVAL_NO_MEMORY;
+				continue;
+			}
+			if (astnode_is_unary(node)) {
+				frames[size++] = (CompileFrame) {node->unary.operand, false};
+			} else {
+				// right is pushed first so that left is compiled first
+				frames[size++] = (CompileFrame) {node->binary.right, false};
+				frames[size++] = (CompileFrame) {node->binary.left, false};
+			}
+			continue;
+		}
+
+		// second visit: the operands are on the VM stack, emit the operator
+		size--;
+		enum opcode_t op;
+		switch (node->token.type) {
+		case TOK_INC: case TOK_DEC:
+			if (is_var_incdec) {
+				// one instruction that updates the variable's slot
+				if ((status = _var_slot(cmp, node->unary.operand, &arg)) == EVAL_OK) {
+					op = (node->token.type == TOK_INC) ?
+						(node->postfix ? OP_POST_INC : OP_PRE_INC) :
+						(node->postfix ? OP_POST_DEC : OP_PRE_DEC);
+					status = _emit(cmp, op, arg);
+				}
+			} else if (!node->postfix) {
+				// postfix on a plain value yields the value itself
+				status = _emit(cmp, (node->token.type == TOK_INC) ? OP_INC : OP_DEC, 0);
+			}
+			continue;
+		case TOK_ADD:   op = OP_ADD; break;
+		case TOK_MINUS: op = OP_SUB; break;
+		case TOK_MULT:  op = OP_MUL; break;	// explicit and implicit multiplication alike
+		case TOK_DIV:   op = OP_DIV; break;
+		case TOK_MOD:   op = OP_MOD; break;
+		default:        op = OP_ADD; break;	// not reached, filtered on the first visit
+		}
+		if (astnode_is_unary(node)) {
+			// unary '+' compiles to nothing
+			if (node->token.type == TOK_MINUS) {
+				status = _emit(cmp, OP_NEG, 0);
+			}
+		} else {
+			status = _emit(cmp, op, 0);
+		}
+		if (status == EVAL_OK && cmp->cse && node->shared) {
+			// first occurrence of a shared subexpression: keep its value for the others
+			temp = cmp->prog->n_temps++;
+			status = nodemap_put(&cmp->temps, node, temp) ? _emit(cmp, OP_TEE, temp)
+								      : EVAL_NO_MEMORY;
+		}
+	}
+	stack_release(frames, inline_frames);
+	return status;
+}
+
+static inline eval_status_t _emit(Compiler *cmp, enum opcode_t op, uint32_t arg)
+{
+	Program *prog = cmp->prog;
+	if (!_reserve((void **)&prog->code, &cmp->code_cap, prog->n_code + 1, sizeof(*prog->code))) {
+		return EVAL_NO_MEMORY;
+	}
+	prog->code[prog->n_code++] = (Instr) {.op = op, .arg = arg};
+
+	// track the stack depth: loads push, binary operators pop, the rest works on the top
+	switch (op) {
+	case OP_CONST: case OP_LOAD: case OP_TEMP:
+	case OP_PRE_INC: case OP_PRE_DEC: case OP_POST_INC: case OP_POST_DEC:
+		cmp->depth += 1;
+		break;
+	case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+		cmp->depth -= 1;
+		break;
+	default:
+		break;
+	}
+	if (cmp->depth > prog->max_stack) {
+		prog->max_stack = cmp->depth;
+	}
+	return EVAL_OK;
+}
+
+static inline eval_status_t _const_idx(Compiler *cmp, long value, uint32_t *idx)
+{
+	Program *prog = cmp->prog;
+	if (!_reserve((void **)&prog->consts, &cmp->consts_cap, prog->n_consts + 1,
+		      sizeof(*prog->consts))) {
+		return EVAL_NO_MEMORY;
+	}
+	prog->consts[prog->n_consts] = value;
+	*idx = prog->n_consts++;
+	return EVAL_OK;
+}
+
+static inline eval_status_t _var_slot(Compiler *cmp, ExpressionTree var, uint32_t *slot)
+{
+	// variables get slots in order of first appearance
+	Program *prog = cmp->prog;
+	long found = varindex_find(&cmp->index, prog->vars, prog->symbols, var->token, var->slot);
+	if (found >= 0) {
+		*slot = found;
+		return EVAL_OK;
+	}
+	size_t vars_cap = cmp->vars_cap;
+	if (!_reserve((void **)&prog->vars, &vars_cap, prog->n_vars + 1, sizeof(*prog->vars))
+	    || !_reserve((void **)&prog->symbols, &cmp->vars_cap, prog->n_vars + 1,
+			 sizeof(*prog->symbols))) {
+		return EVAL_NO_MEMORY;
+	}
+	prog->vars[prog->n_vars] = var->token;
+	prog->symbols[prog->n_vars] = var->slot;
+	if (!varindex_add(&cmp->index, prog->vars, prog->symbols, prog->n_vars)) {
+		return EVAL_NO_MEMORY;
+	}
+	*slot = prog->n_vars++;
+	return EVAL_OK;
+}
+
+static inline bool _reserve(void **array, size_t *capacity, size_t size, size_t elem_size)
+{
+	// make room for size elements in *array, doubling its capacity when it is full
+	if (size <= *capacity) {
+		return true;
+	}
+	size_t new_cap = (*capacity) ? *capacity * 2 : 16;
+	while (new_cap < size) {
+		new_cap *= 2;
+	}
+	void *grown = realloc(*array, new_cap * elem_size);
+	if (!grown) {
+		return false;
+	}
+	*array = grown;
+	*capacity = new_cap;
+	return true;
+}
@@ -0,0 +1,330 @@
+#define _POSIX_C_SOURCE 200809L	// pthread_rwlock_t
+
+#include <pthread.h>
+
+#include "../headers/cache.h"
+
+#define CACHE_SHARDS 16	// a power of 2
+
+typedef struct {
+	pthread_rwlock_t lock;
+	CacheEntry **buckets;
+	size_t n_buckets;		/* a power of 2 */
+	CacheEntry **clock;		/* CLOCK ring: every entry of the shard */
+	size_t n_entries;
+	size_t clock_cap;
+	size_t hand;
+	size_t bytes;
+	size_t max_bytes;
+
+	// counters
+	atomic_size_t n_hits;
+	atomic_size_t n_misses;
+	atomic_size_t n_evictions;
+} CacheShard;
+
+struct ParseCache {
+	CacheShard shards[CACHE_SHARDS];
+	FILE *errors;	/* where a miss on an invalid expression is reported (BuildOptions.errors) */
+};
+
+#define INLINE_KEY 256	// keys up to this long are normalized on the C stack
+
+static inline uint64_t _hash(char const *key, size_t length);
+static inline CacheShard *_shard(ParseCache *cache, uint64_t hash);
+static inline CacheEntry *_find(CacheShard *shard, uint64_t hash, char const *key, size_t length);
+static inline CacheEntry *_build_entry(ParseCache *cache, char const *key, size_t length,
+				       uint64_t hash);
+static inline bool _insert(CacheShard *shard, CacheEntry *entry);
+static inline bool _grow_buckets(CacheShard *shard);
+static inline void _evict(CacheShard *shard);
+static inline void _free_entry(CacheEntry *entry);
+
+ParseCache *parsecache_create(size_t max_bytes, FILE *errors)
+{
+	// errors: NULL meant stderr. Returns NULL if out of memory or the shard locks cannot be
+	// initialized
+	ParseCache *cache = malloc(sizeof(*cache));
+	if (!cache) {
+		return NULL;
+	}
+	cache->errors = errors;
+	for (size_t i = 0; i < CACHE_SHARDS; i++) {
+		CacheShard *shard = &cache->shards[i];
+		memset(shard, 0, sizeof(*shard));
+		shard->max_bytes = max_bytes / CACHE_SHARDS;
+		atomic_init(&shard->n_hits, 0);
+		atomic_init(&shard->n_misses, 0);
+		atomic_init(&shard->n_evictions, 0);
+		if (pthread_rwlock_init(&shard->lock, NULL) != 0) {
+			while (i-- > 0) {
+				pthread_rwlock_destroy(&cache->shards[i].lock);
+			}
+			free(cache);
+			return NULL;
+		}
+	}
+	return cache;
+}
+
+CacheEntry const *parsecache_get(ParseCache *cache, char const *input, size_t length)
+{
+	/*
+	 * - Returns the entry of input[0...length - 1], parsed and compiled on a miss, or NULL if
+	 *   out of memory. Every entry returned must be given back with parsecache_release.
+	 * - An entry too big for its shard is returned but not cached.
+	 */
+	assert(cache && "parameter cache must be a valid ParseCache *");
+	assert((input || length == 0) && "input must hold length characters");
+
+	char inline_key[INLINE_KEY];
+	char *key = (length <= INLINE_KEY) ? inline_key : malloc(length);
+	if (!key) {
+		return NULL;
+	}
+	size_t key_length = tokenizer_normalize(input, length, key);
+	uint64_t hash = _hash(key, key_length);
+	CacheShard *shard = _shard(cache, hash);
+
+	pthread_rwlock_rdlock(&shard->lock);
+	CacheEntry *entry = _find(shard, hash, key, key_length);
+	if (entry) {
+		atomic_fetch_add_explicit(&entry->refs, 1, memory_order_relaxed);
+		atomic_store_explicit(&entry->referenced, true, memory_order_relaxed);
+	}
+	pthread_rwlock_unlock(&shard->lock);
+
+	if (entry) {
+		atomic_fetch_add_explicit(&shard->n_hits, 1, memory_order_relaxed);
+	} else if ((entry = _build_entry(cache, key, key_length, hash))) {
+		// parsed outside of the lock: publish it, unless another thread got there first
+		atomic_fetch_add_explicit(&shard->n_misses, 1, memory_order_relaxed);
+		pthread_rwlock_wrlock(&shard->lock);
+		CacheEntry *published = _find(shard, hash, key, key_length);
+		if (published) {
+			atomic_fetch_add_explicit(&published->refs, 1, memory_order_relaxed);
+		} else if (_insert(shard, entry)) {
+			atomic_fetch_add_explicit(&entry->refs, 1, memory_order_relaxed);
+		}
+		pthread_rwlock_unlock(&shard->lock);
+		if (published) {
+			_free_entry(entry);
+			entry = published;
+		}
+	}
+
+	if (key != inline_key) {
+		free(key);
+	}
+	return entry;
+}
+
+void parsecache_release(CacheEntry const *entry)
+{
+	// the last reference (the cache's own one is dropped on eviction) frees the entry
+	if (!entry) {
+		return;
+	}
+	CacheEntry *owned = (CacheEntry *)entry;
+	if (atomic_fetch_sub_explicit(&owned->refs, 1, memory_order_acq_rel) == 1) {
+		_free_entry(owned);
+	}
+}
+
+void parsecache_stats(ParseCache *cache, CacheStats *stats)
+{
+	assert(cache && "parameter cache must be a valid ParseCache *");
+	assert(stats && "parameter stats must be a valid CacheStats *");
+	*stats = (CacheStats) { 0 };
+	for (CacheShard *shard = cache->shards; shard < cache->shards + CACHE_SHARDS; shard++) {
+		stats->n_hits += atomic_load_explicit(&shard->n_hits, memory_order_relaxed);
+		stats->n_misses += atomic_load_explicit(&shard->n_misses, memory_order_relaxed);
+		stats->n_evictions += atomic_load_explicit(&shard->n_evictions, memory_order_relaxed);
+		pthread_rwlock_rdlock(&shard->lock);
+		stats->n_entries += shard->n_entries;
+		stats->bytes += shard->bytes;
+		pthread_rwlock_unlock(&shard->lock);
+	}
+}
+
+void parsecache_destroy(ParseCache *cache)
+{
+	// entries still referenced outside of the cache are freed by their last parsecache_release
+	if (!cache) {
+		return;
+	}
+	for (CacheShard *shard = cache->shards; shard < cache->shards + CACHE_SHARDS; shard++) {
+		for (size_t i = 0; i < shard->n_entries; i++) {
+			parsecache_release(shard->clock[i]);
+		}
+		free(shard->clock);
+		free(shard->buckets);
+		pthread_rwlock_destroy(&shard->lock);
+	}
+	free(cache);
+}
+
+static inline uint64_t _hash(char const *key, size_t length)
+{
+	// 8 bytes per multiply-xorshift round, then a final avalanche
+	uint64_t hash = 0x9e3779b97f4a7c15ULL ^ length;
+	for (size_t i = 0; i < length; i += 8) {
+		uint64_t word = 0;
+		memcpy(&word, key + i, (length - i < 8) ? length - i : 8);
+		hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+		hash ^= hash >> 32;
+	}
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+static inline CacheShard *_shard(ParseCache *cache, uint64_t hash)
+{
+	// high bits pick the shard, low bits the bucket within it
+	return &cache->shards[(hash >> 32) & (CACHE_SHARDS - 1)];
+}
+
+static inline CacheEntry *_find(CacheShard *shard, uint64_t hash, char const *key, size_t length)
+{
+	// the caller holds shard->lock
+	if (shard->n_buckets == 0) {
+		return NULL;
+	}
+	for (CacheEntry *entry = shard->buckets[hash & (shard->n_buckets - 1)]; entry;
+	     entry = entry->next) {
+		if (entry->hash == hash && entry->key_length == length
+		    && memcmp(entry->key, key, length) == 0) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+static inline CacheEntry *_build_entry(ParseCache *cache, char const *key, size_t length,
+				       uint64_t hash)
+{
+	/*
+	 * parse and compile key into a new entry holding the caller's reference, or NULL if out of
+	 * memory. The tree is built from the entry's own copy of key, so it outlives the input.
+	 */
+	CacheEntry *entry = calloc(1, sizeof(*entry));
+	if (!entry || !(entry->key = malloc(length + 1))) {
+		free(entry);
+		return NULL;
+	}
+	memcpy(entry->key, key, length);
+	entry->key[length] = '\0';
+	entry->key_length = length;
+	entry->hash = hash;
+	atomic_init(&entry->refs, 1);
+	atomic_init(&entry->referenced, false);
+
+	Tokenizer tkz = tokenizer_tokenize(entry->key, length);
+	if (tkz.n_tokens == 0) {
+		free(entry->key);
+		free(entry);
+		return NULL;
+	}
+	// a tree has at most a node per token plus an implicit '*' per token: one slab fits it
+	nodearena_init(&entry->arena, 2 * tkz.n_tokens);
+	BuildOptions opts = {.arena = &entry->arena, .errors = cache->errors};
+	entry->root = expressiontree_build_tree_opts(&tkz, &opts);
+	tokenizer_distroy(&tkz);
+	entry->compile_status = bytecode_compile(entry->root, &entry->prog);
+
+	entry->bytes = sizeof(*entry) + length + 1;
+	for (NodeSlab *slab = entry->arena.slabs; slab; slab = slab->next) {
+		entry->bytes += sizeof(*slab) + slab->capacity * sizeof(ASTNode);
+	}
+	entry->bytes += entry->prog.n_code * sizeof(Instr) + entry->prog.n_consts * sizeof(long)
+			+ entry->prog.n_vars * sizeof(Token);
+	return entry;
+}
+
+static inline bool _insert(CacheShard *shard, CacheEntry *entry)
+{
+	// add entry to the shard (the caller holds the write lock), evicting to make room for it
+	if (entry->bytes > shard->max_bytes) {
+		return false;
+	}
+	while (shard->bytes + entry->bytes > shard->max_bytes) {
+		_evict(shard);
+	}
+	if ((shard->n_entries >= shard->n_buckets && !_grow_buckets(shard))
+	    || !stack_reserve((void **)&shard->clock, &shard->clock_cap, shard->n_entries + 1,
+			      sizeof(*shard->clock), NULL)) {
+		return false;
+	}
+
+	CacheEntry **bucket = &shard->buckets[entry->hash & (shard->n_buckets - 1)];
+	entry->next = *bucket;
+	*bucket = entry;
+	entry->clock_slot = shard->n_entries;
+	shard->clock[shard->n_entries++] = entry;
+	shard->bytes += entry->bytes;
+	return true;
+}
+
+static inline bool _grow_buckets(CacheShard *shard)
+{
+	size_t n_buckets = shard->n_buckets ? 2 * shard->n_buckets : 64;
+	CacheEntry **buckets = calloc(n_buckets, sizeof(*buckets));
+	if (!buckets) {
+		return false;
+	}
+	for (size_t i = 0; i < shard->n_entries; i++) {
+		CacheEntry *entry = shard->clock[i];
+		CacheEntry **bucket = &buckets[entry->hash & (n_buckets - 1)];
+		entry->next = *bucket;
+		*bucket = entry;
+	}
+	free(shard->buckets);
+	shard->buckets = buckets;
+	shard->n_buckets = n_buckets;
+	return true;
+}
+
+static inline void _evict(CacheShard *shard)
+{
+	/*
+	 * CLOCK: sweep the ring, clearing the bit of entries hit since the last sweep, and evict
+	 * the first entry whose bit is already clear (the caller holds the write lock, so no bit
+	 * gets set meanwhile and the sweep ends within two turns)
+	 */
+	assert(shard->n_entries > 0);
+	CacheEntry *victim;
+	while (1) {
+		if (shard->hand >= shard->n_entries) {
+			shard->hand = 0;
+		}
+		victim = shard->clock[shard->hand];
+		if (!atomic_exchange_explicit(&victim->referenced, false, memory_order_relaxed)) {
+			break;
+		}
+		shard->hand++;
+	}
+
+	CacheEntry **link = &shard->buckets[victim->hash & (shard->n_buckets - 1)];
+	while (*link != victim) {
+		link = &(*link)->next;
+	}
+	*link = victim->next;
+	// the last entry of the ring takes the victim's slot, the hand then looks at it next
+	CacheEntry *last = shard->clock[--shard->n_entries];
+	shard->clock[victim->clock_slot] = last;
+	last->clock_slot = victim->clock_slot;
+	shard->bytes -= victim->bytes;
+
+	atomic_fetch_add_explicit(&shard->n_evictions, 1, memory_order_relaxed);
+	parsecache_release(victim);
+}
+
+static inline void _free_entry(CacheEntry *entry)
+{
+	bytecode_destroy(&entry->prog);
+	nodearena_destroy(&entry->arena);
+	free(entry->key);
+	free(entry);
+}
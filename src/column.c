@@ -0,0 +1,712 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../headers/column.h"
+#include "../headers/tokenizer.h"
+#include "../headers/ExpressionTree.h"
+
+#if defined(__x86_64__) && defined(__linux__) && defined(__GNUC__) && !defined(EXPR_NO_SIMD)
+#define COLUMN_KERNELS __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define COLUMN_KERNELS
+#endif
+
+#define COLUMN_ALIGN 64		// alignment of the values in a column file and of the registers
+#define ALIGN_UP(n, a) (((n) + (a) - 1) / (a) * (a))
+#define LONG_LIMIT 0x1p63	// 2^63 as a double: longs are [-LONG_LIMIT, LONG_LIMIT)
+
+/*
+ * Engine: state of column_evaluate, every register holds COLUMN_BLOCK values.
+ * - stack[k] points to the values of stack slot k: a register, a variable's block or a block
+ *   of a column read in place.
+ * - Each slot owns two registers and holds at most one of them (holds[k]): an operator writes
+ *   its result to the other one, so no kernel ever writes to an operand it reads.
+ * - Every block is a full one: the last rows are copied to zero-padded tail columns first, the
+ *   padding rows are null.
+ */
+typedef struct {
+	CompactTree const *ct;
+	long *regs;		/* 2 * ct->max_stack registers */
+	long *var_regs;		/* ct->n_vars registers: variables not read in place */
+	long const **inputs;	/* per variable: its values for the block */
+	bool *mutated;		/* per variable: the operand of a '++'/'--' */
+	bool divides;		/* the tree has a '/' or '%' */
+	long const **stack;
+	uint8_t *holds;
+	uint8_t valid[COLUMN_BLOCK];		/* no column read is null in this row */
+	uint8_t div_by_zero[COLUMN_BLOCK];	/* this row divided by 0 */
+} Engine;
+
+static inline eval_status_t _run_tail(Engine *e, Column const *const *columns, size_t base,
+				      size_t rows, long *result, uint8_t *validity,
+				      ColumnReport *report);
+static void _run_block(Engine *e, Column const *const *columns, size_t base, size_t rows,
+		       long *result, uint8_t *validity, ColumnReport *report);
+static inline void _load_block(Engine *e, Column const *const *columns, size_t base, size_t rows);
+static inline long *_free_reg(Engine *e, size_t slot);
+static void _kernel_fill(long *restrict out, long value);
+static void _kernel_copy(long *restrict out, long const *restrict in);
+static void _kernel_add(long *restrict out, long const *restrict a, long const *restrict b);
+static void _kernel_sub(long *restrict out, long const *restrict a, long const *restrict b);
+static void _kernel_mul(long *restrict out, long const *restrict a, long const *restrict b);
+static void _kernel_div(long *restrict out, long const *restrict a, long const *restrict b,
+			uint8_t *restrict div_by_zero);
+static void _kernel_mod(long *restrict out, long const *restrict a, long const *restrict b,
+			uint8_t *restrict div_by_zero);
+static void _kernel_negate(long *restrict out, long const *restrict in);
+static void _kernel_step(long *restrict out, long const *restrict in, long step);
+static void _kernel_widen(long *restrict out, int32_t const *restrict in);
+static void _kernel_truncate(long *restrict out, uint8_t *restrict valid,
+			     double const *restrict in);
+static void _kernel_mask(uint8_t *restrict valid, uint8_t const *restrict div_by_zero);
+static void _kernel_select(long *restrict out, long const *restrict values,
+			   uint8_t const *restrict valid);
+static inline void _unpack_bits(uint8_t *valid, uint8_t const *bits);
+static inline size_t _pack_bits(uint8_t *bits, uint8_t const *valid);
+static inline size_t _count_lanes(uint8_t const *valid);
+static inline size_t _width(uint8_t type);
+static inline uint8_t _byte_order(void);
+static inline double _elapsed(struct timespec start);
+
+eval_status_t column_evaluate(CompactTree const *ct, Column const *const *columns, size_t n_rows,
+			      long *result, uint8_t *validity, ColumnReport *report)
+{
+	/*
+	 * - columns[v] binds ct->vars[v], it must hold at least n_rows rows (EVAL_UNBOUND_VAR).
+	 * - Writes the n_rows results to result and their validity bitmap ((n_rows + 7) / 8 bytes,
+	 *   same layout as a column file's) to validity. Division by 0 nulls a row, it is not an
+	 *   error.
+	 */
+	assert(ct && result && validity && report);
+	assert((columns || ct->n_vars == 0) && "columns must hold ct->n_vars columns");
+	*report = (ColumnReport) {.n_rows = n_rows};
+	if (!ct->well_formed) {
+		return EVAL_MALFORMED;
+	}
+	for (size_t v = 0; v < ct->n_vars; v++) {
+		if (!columns[v] || columns[v]->n_rows < n_rows) {
+			return EVAL_UNBOUND_VAR;
+		}
+		report->n_bytes += n_rows * _width(columns[v]->type)
+				   + (columns[v]->validity ? (n_rows + 7) / 8 : 0);
+	}
+
+	Engine e = {
+		.ct = ct,
+		.regs = aligned_alloc(COLUMN_ALIGN, (2 * ct->max_stack + ct->n_vars)
+						    * COLUMN_BLOCK * sizeof(long)),
+		.inputs = malloc((ct->n_vars + 1) * sizeof(*e.inputs)),
+		.mutated = calloc(ct->n_vars + 1, sizeof(*e.mutated)),
+		.stack = malloc(ct->max_stack * sizeof(*e.stack)),
+		.holds = calloc(ct->max_stack, sizeof(*e.holds))
+	};
+	eval_status_t status = EVAL_NO_MEMORY;
+	if (!e.regs || !e.inputs || !e.mutated || !e.stack || !e.holds) {
+		goto cleanup;
+	}
+	e.var_regs = e.regs + 2 * ct->max_stack * COLUMN_BLOCK;
+	for (CompactNode const *node = ct->nodes; node < ct->nodes + ct->n_nodes; node++) {
+		if (node->op >= CT_PRE_INC && node->leaf != COMPACT_NONE) {
+			e.mutated[node->leaf] = true;
+		}
+		e.divides |= node->op == CT_DIV || node->op == CT_MOD;
+	}
+
+	size_t base;
+	for (base = 0; n_rows - base >= COLUMN_BLOCK; base += COLUMN_BLOCK) {
+		_run_block(&e, columns, base, COLUMN_BLOCK, result + base, validity + base / 8, report);
+	}
+	status = (base < n_rows)
+		 ? _run_tail(&e, columns, base, n_rows - base, result, validity, report) : EVAL_OK;
+
+cleanup:
+	free(e.regs);
+	free(e.inputs);
+	free(e.mutated);
+	free(e.stack);
+	free(e.holds);
+	return status;
+}
+
+int column_load(char const *path, Column *column)
+{
+	/*
+	 * - Returns 0 on success, -1 on failure with errno set (EINVAL: not a column file this
+	 *   build can read, or a corrupt one).
+	 * - The file is mapped read-only and read front to back by column_evaluate.
+	 */
+	assert(path && "parameter path must be a valid file path");
+	assert(column && "parameter column must be a valid Column *");
+
+	*column = (Column) { 0 };
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	size_t size = st.st_size;
+	if (size < sizeof(ColumnFileHeader)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	char *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);	// the mapping stays valid after closing the descriptor
+	if (base == MAP_FAILED) {
+		return -1;
+	}
+
+	ColumnFileHeader const *header = (ColumnFileHeader const *)base;
+	size_t width = _width(header->type);
+	uint64_t values_end = header->values_offset + header->n_rows * width;
+	if (memcmp(header->magic, COLUMN_MAGIC, sizeof(header->magic)) != 0
+	    || header->version != COLUMN_VERSION || header->byte_order != _byte_order()
+	    || width == 0 || header->file_size != size
+	    || header->values_offset < sizeof(ColumnFileHeader) || header->values_offset > size
+	    || header->values_offset % width != 0
+	    || header->n_rows > (size - header->values_offset) / width
+	    || (header->validity_offset != 0
+		&& (header->validity_offset < values_end || header->validity_offset > size
+		    || (header->n_rows + 7) / 8 > size - header->validity_offset))) {
+		munmap(base, size);
+		errno = EINVAL;
+		return -1;
+	}
+	posix_madvise(base, size, POSIX_MADV_SEQUENTIAL);
+
+	*column = (Column) {
+		.type = header->type,
+		.n_rows = header->n_rows,
+		.values = base + header->values_offset,
+		.validity = header->validity_offset ? (uint8_t const *)base + header->validity_offset
+						    : NULL,
+		.base = base,
+		.size = size
+	};
+	return 0;
+}
+
+void column_unload(Column *column)
+{
+	assert(column && "parameter column must be a valid Column *");
+	if (column->base) {
+		munmap(column->base, column->size);
+	}
+	*column = (Column) { 0 };
+}
+
+int column_write(FILE *fp, enum column_type_t type, void const *values, uint8_t const *validity,
+		 size_t n_rows)
+{
+	// write a column file, validity NULL if no row is null: 0 on success, -1 on a write error
+	assert(fp && "parameter fp must be a valid FILE *");
+	assert(_width(type) && "type must be an enum column_type_t");
+	assert((values || n_rows == 0) && "values must hold n_rows values");
+
+	size_t width = _width(type);
+	uint64_t values_offset = ALIGN_UP(sizeof(ColumnFileHeader), COLUMN_ALIGN);
+	uint64_t values_end = values_offset + n_rows * width;
+	size_t validity_size = validity ? (n_rows + 7) / 8 : 0;
+	ColumnFileHeader header = {
+		.magic = COLUMN_MAGIC,
+		.version = COLUMN_VERSION,
+		.type = type,
+		.byte_order = _byte_order(),
+		.file_size = values_end + validity_size,
+		.n_rows = n_rows,
+		.values_offset = values_offset,
+		.validity_offset = validity ? values_end : 0
+	};
+	static char const padding[COLUMN_ALIGN] = { 0 };
+	size_t n_padding = values_offset - sizeof(header);
+	if (fwrite(&header, sizeof(header), 1, fp) != 1
+	    || fwrite(padding, 1, n_padding, fp) != n_padding
+	    || (n_rows && fwrite(values, width, n_rows, fp) != n_rows)
+	    || (validity && fwrite(validity, 1, validity_size, fp) != validity_size)
+	    || fflush(fp) != 0) {
+		return -1;
+	}
+	return 0;
+}
+
+int column_evaluate_files(char const *expression, char *const *bindings, size_t n_bindings,
+			  FILE *out, ColumnReport *report)
+{
+	/*
+	 * - Parses expression, binds each of its variables to the column file of its
+	 *   "<name>=<file>" binding (bindings naming no variable of it are ignored), evaluates it
+	 *   and writes the results as a COLUMN_INT64 column file to out.
+	 * - Returns 0 on success, -1 on failure, reported on stderr.
+	 */
+	assert(expression && "parameter expression must be a valid string");
+	assert((bindings || n_bindings == 0) && "bindings must hold n_bindings strings");
+	assert(out && "parameter out must be a valid FILE *");
+	assert(report && "parameter report must be a valid ColumnReport *");
+
+	*report = (ColumnReport) { 0 };
+	int status = -1;
+	Tokenizer tkz = tokenizer_tokenize(expression, strlen(expression));
+	ExpressionTree root = expressiontree_build_tree(&tkz);
+	CompactTree ct = { 0 };
+	Column *columns = NULL;
+	Column const **bound = NULL;
+	long *result = NULL;
+	uint8_t *validity = NULL;
+	if (!root) {
+		goto cleanup;
+	}
+	eval_status_t eval_status = compact_from_tree(root, &ct);
+	if (eval_status != EVAL_OK) {
+		fprintf(stderr, "expression \"%s\": %s\n", expression, eval_status_str(eval_status));
+		goto cleanup;
+	}
+	if (ct.n_vars == 0) {
+		fprintf(stderr, "expression \"%s\" reads no column\n", expression);
+		goto cleanup;
+	}
+	columns = calloc(ct.n_vars, sizeof(*columns));
+	bound = calloc(ct.n_vars, sizeof(*bound));
+	if (!columns || !bound) {
+		perror("calloc");
+		goto cleanup;
+	}
+
+	size_t n_rows = 0;
+	for (size_t v = 0; v < ct.n_vars; v++) {
+		Token name = ct.vars[v];
+		char const *path = NULL;
+		for (size_t b = 0; b < n_bindings && !path; b++) {
+			if (strncmp(bindings[b], name.token_string, name.length) == 0
+			    && bindings[b][name.length] == '=') {
+				path = bindings[b] + name.length + 1;
+			}
+		}
+		if (!path) {
+			fprintf(stderr, "variable \"%.*s\" is not bound to a column\n",
+				(int)name.length, name.token_string);
+			goto cleanup;
+		}
+		if (column_load(path, &columns[v]) < 0) {
+			perror(path);
+			goto cleanup;
+		}
+		if (v > 0 && columns[v].n_rows != n_rows) {
+			fprintf(stderr, "%s: %zu rows, expected %zu\n", path, columns[v].n_rows, n_rows);
+			goto cleanup;
+		}
+		n_rows = columns[v].n_rows;
+		bound[v] = &columns[v];
+	}
+
+	result = malloc((n_rows + 1) * sizeof(*result));
+	validity = malloc((n_rows + 7) / 8 + 1);
+	if (!result || !validity) {
+		perror("malloc");
+		goto cleanup;
+	}
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	eval_status = column_evaluate(&ct, bound, n_rows, result, validity, report);
+	report->seconds = _elapsed(start);
+	if (eval_status != EVAL_OK) {
+		fprintf(stderr, "expression \"%s\": %s\n", expression, eval_status_str(eval_status));
+		goto cleanup;
+	}
+	if (column_write(out, COLUMN_INT64, result, report->n_null ? validity : NULL, n_rows) < 0) {
+		perror("column_write");
+		goto cleanup;
+	}
+	status = 0;
+
+cleanup:
+	for (size_t v = 0; columns && v < ct.n_vars; v++) {
+		column_unload(&columns[v]);
+	}
+	free(columns);
+	free(bound);
+	free(result);
+	free(validity);
+	compact_destroy(&ct);
+	expressiontree_destroy_tree(&root);
+	tokenizer_distroy(&tkz);
+	return status;
+}
+
+void column_report_display(FILE *fp, ColumnReport const *report)
+{
+	assert(fp && report);
+	double seconds = (report->seconds > 0) ? report->seconds : 1e-9;
+	fprintf(fp, "%zu rows (%zu null, %zu divisions by zero), %zu bytes read in %.3f s: "
+		    "%.0f rows/sec, %.2f GB/sec\n",
+		report->n_rows, report->n_null, report->n_div_by_zero, report->n_bytes,
+		report->seconds, report->n_rows / seconds, report->n_bytes / seconds / 1e9);
+}
+
+static inline eval_status_t _run_tail(Engine *e, Column const *const *columns, size_t base,
+				      size_t rows, long *result, uint8_t *validity,
+				      ColumnReport *report)
+{
+	// evaluate the last rows (fewer than COLUMN_BLOCK) as a block of tail columns: their rows
+	// copied to zeroed blocks
+	size_t n_vars = e->ct->n_vars;
+	size_t bits_size = COLUMN_BLOCK / 8;
+	Column *tails = calloc(n_vars + 1, sizeof(*tails));
+	Column const **bound = malloc((n_vars + 1) * sizeof(*bound));
+	long *staging = calloc((n_vars + 1) * COLUMN_BLOCK, sizeof(long));	// values, then result
+	uint8_t *bits = calloc(n_vars + 1, bits_size);
+	eval_status_t status = EVAL_NO_MEMORY;
+	if (!tails || !bound || !staging || !bits) {
+		goto cleanup;
+	}
+	for (size_t v = 0; v < n_vars; v++) {
+		size_t width = _width(columns[v]->type);
+		uint8_t *tail_bits = bits + v * bits_size;
+		memcpy(staging + v * COLUMN_BLOCK, (char const *)columns[v]->values + base * width,
+		       rows * width);
+		if (columns[v]->validity) {
+			memcpy(tail_bits, columns[v]->validity + base / 8, (rows + 7) / 8);
+		}
+		tails[v] = (Column) {
+			.type = columns[v]->type,
+			.n_rows = COLUMN_BLOCK,
+			.values = staging + v * COLUMN_BLOCK,
+			.validity = columns[v]->validity ? tail_bits : NULL
+		};
+		bound[v] = &tails[v];
+	}
+	long *tail_result = staging + n_vars * COLUMN_BLOCK;
+	uint8_t *tail_validity = bits + n_vars * bits_size;
+	_run_block(e, bound, 0, rows, tail_result, tail_validity, report);
+	memcpy(result + base, tail_result, rows * sizeof(*result));
+	memcpy(validity + base / 8, tail_validity, (rows + 7) / 8);
+	status = EVAL_OK;
+
+cleanup:
+	free(tails);
+	free(bound);
+	free(staging);
+	free(bits);
+	return status;
+}
+
+static void _run_block(Engine *e, Column const *const *columns, size_t base, size_t rows,
+		       long *result, uint8_t *validity, ColumnReport *report)
+{
+	// evaluate the COLUMN_BLOCK rows from base on, one kernel per node (rows past the first
+	// `rows` are padding, null)
+	_load_block(e, columns, base, rows);
+	CompactTree const *ct = e->ct;
+	long const **stack = e->stack;
+	size_t depth = 0;
+	for (CompactNode const *node = ct->nodes; node < ct->nodes + ct->n_nodes; node++) {
+		long *out;
+		long *var = (node->op >= CT_PRE_INC && node->leaf != COMPACT_NONE)
+			    ? e->var_regs + node->leaf * COLUMN_BLOCK : NULL;
+		switch ((enum compact_op_t)node->op) {
+		case CT_LIT:
+			out = _free_reg(e, depth);
+			_kernel_fill(out, ct->values[node->leaf]);
+			stack[depth++] = out;
+			break;
+		case CT_VAR:
+			if (!e->mutated[node->leaf]) {
+				stack[depth++] = e->inputs[node->leaf];
+				break;
+			}
+			// a '++'/'--' may update the variable while this value is still on the stack
+			out = _free_reg(e, depth);
+			_kernel_copy(out, e->inputs[node->leaf]);
+			stack[depth++] = out;
+			break;
+		case CT_ADD: case CT_SUB: case CT_MUL: case CT_DIV: case CT_MOD:
+			out = _free_reg(e, depth - 2);
+			long const *a = stack[depth - 2], *b = stack[depth - 1];
+			switch ((enum compact_op_t)node->op) {
+			case CT_ADD: _kernel_add(out, a, b); break;
+			case CT_SUB: _kernel_sub(out, a, b); break;
+			case CT_MUL: _kernel_mul(out, a, b); break;
+			case CT_DIV: _kernel_div(out, a, b, e->div_by_zero); break;
+			default:     _kernel_mod(out, a, b, e->div_by_zero); break;
+			}
+			stack[--depth - 1] = out;
+			break;
+		case CT_POS:
+			break;
+		case CT_NEG:
+			out = _free_reg(e, depth - 1);
+			_kernel_negate(out, stack[depth - 1]);
+			stack[depth - 1] = out;
+			break;
+		case CT_PRE_INC: case CT_PRE_DEC:
+			out = _free_reg(e, depth - 1);
+			_kernel_step(out, stack[depth - 1], (node->op == CT_PRE_INC) ? 1 : -1);
+			if (var) {
+				_kernel_copy(var, out);
+			}
+			stack[depth - 1] = out;
+			break;
+		case CT_POST_INC: case CT_POST_DEC:
+			// the operand's value is the result, only the variable changes
+			if (var) {
+				_kernel_step(var, stack[depth - 1], (node->op == CT_POST_INC) ? 1 : -1);
+			}
+			break;
+		}
+	}
+
+	// store the results, a row being valid if no column it reads is null there and it did not
+	// divide by 0
+	size_t n_valid_inputs = 0;
+	if (e->divides) {
+		n_valid_inputs = _count_lanes(e->valid);
+		_kernel_mask(e->valid, e->div_by_zero);
+	}
+	_kernel_select(result, stack[0], e->valid);
+	size_t n_valid = _pack_bits(validity, e->valid);
+	report->n_null += rows - n_valid;
+	report->n_div_by_zero += e->divides ? n_valid_inputs - n_valid : 0;
+}
+
+static inline void _load_block(Engine *e, Column const *const *columns, size_t base, size_t rows)
+{
+	/*
+	 * point every variable to its values for the block: read in place from an int64 column,
+	 * else converted (or copied) to its register. Marks the rows where a column is null.
+	 */
+	memset(e->valid, 1, rows);
+	memset(e->valid + rows, 0, COLUMN_BLOCK - rows);
+	if (e->divides) {
+		memset(e->div_by_zero, 0, COLUMN_BLOCK);
+	}
+	for (size_t v = 0; v < e->ct->n_vars; v++) {
+		Column const *column = columns[v];
+		long *reg = e->var_regs + v * COLUMN_BLOCK;
+		e->inputs[v] = reg;
+		switch (column->type) {
+		case COLUMN_INT64:
+			if (e->mutated[v]) {
+				_kernel_copy(reg, (long const *)column->values + base);
+			} else {
+				e->inputs[v] = (long const *)column->values + base;
+			}
+			break;
+		case COLUMN_INT32:
+			_kernel_widen(reg, (int32_t const *)column->values + base);
+			break;
+		case COLUMN_DOUBLE:
+			_kernel_truncate(reg, e->valid, (double const *)column->values + base);
+			break;
+		}
+		if (column->validity) {
+			_unpack_bits(e->valid, column->validity + base / 8);	// base % 8 == 0
+		}
+	}
+}
+
+static inline long *_free_reg(Engine *e, size_t slot)
+{
+	// the register of slot that its current value is not in
+	e->holds[slot] ^= 1;
+	return e->regs + (2 * slot + e->holds[slot]) * COLUMN_BLOCK;
+}
+
+/*
+ * Kernels: one operation over the COLUMN_BLOCK values of a block, a loop of a constant number
+ * of iterations over restrict operands, which the compiler vectorizes. Each one is compiled
+ * for every target of COLUMN_KERNELS.
+ */
+COLUMN_KERNELS
+static void _kernel_fill(long *restrict out, long value)
+{
+	for (size_t i = 0; i < COLUMN_BLOCK; i++) {
+		out[i] = value;
+	}
+}
+
+COLUMN_KERNELS
+static void _kernel_copy(long *restrict out, long const *restrict in)
+{
+	for (size_t i = 0; i < COLUMN_BLOCK; i++) {
+		out[i] = in[i];
+	}
+}
+
+COLUMN_KERNELS
+static void _kernel_add(long *restrict out, long const *restrict a, long const *restrict b)
+{
+	for (size_t i = 0; i < COLUMN_BLOCK; i++) {
+		out[i] = eval_add(a[i], b[i]);
+	}
+}
+
+COLUMN_KERNELS
+static void _kernel_sub(long *restrict out, long const *restrict a, long const *restrict b)
+{
+	for (size_t i = 0; i < COLUMN_BLOCK; i++) {
+		out[i] = eval_sub(a[i], b[i]);
+	}
+}
+
+COLUMN_KERNELS
+static void _kernel_mul(long *restrict out, long const *restrict a, long const *restrict b)
+{
+	for (size_t i = 0; i < COLUMN_BLOCK; i++) {
+		out[i] = eval_mul(a[i], b[i]);
+	}
+}
+
+COLUMN_KERNELS
+static void _kernel_div(long *restrict out, long const *restrict a, long const *restrict b,
+			uint8_t *restrict div_by_zero)
+{
+	// a row dividing by 0 is marked and goes on, its result is dropped
+	for (size_t i = 0; i < COLUMN_BLOCK; i++) {
+		div_by_zero[i] |= b[i] == 0;
+		out[i] = (b[i] == 0) ? 0 : (b[i] == -1) ? eval_sub(0, a[i]) : a[i] / b[i];
+	}
+}
+
+COLUMN_KERNELS
+static void _kernel_mod(long *restrict out, long const *restrict a, long const *restrict b,
+			uint8_t *restrict div_by_zero)
+{
+	for (size_t i = 0; i < COLUMN_BLOCK; i++) {
+		div_by_zero[i] |= b[i] == 0;
+		out[i] = (b[i] == 0 || b[i] == -1) ? 0 : a[i] % b[i];
+	}
+}
+
+COLUMN_KERNELS
+static void _kernel_negate(long *restrict out, long const *restrict in)
+{
+	for (size_t i = 0; i < COLUMN_BLOCK; i++) {
+		out[i] = eval_sub(0, in[i]);
+	}
+}
+
+COLUMN_KERNELS
+static void _kernel_step(long *restrict out, long const *restrict in, long step)
+{
+	for (size_t i = 0; i < COLUMN_BLOCK; i++) {
+		out[i] = eval_add(in[i], step);
+	}
+}
+
+COLUMN_KERNELS
+static void _kernel_widen(long *restrict out, int32_t const *restrict in)
+{
+	for (size_t i = 0; i < COLUMN_BLOCK; i++) {
+		out[i] = in[i];
+	}
+}
+
+COLUMN_KERNELS
+static void _kernel_truncate(long *restrict out, uint8_t *restrict valid,
+			     double const *restrict in)
+{
+	// toward zero, a value that is not a number or does not fit a long nulls its row
+	for (size_t i = 0; i < COLUMN_BLOCK; i++) {
+		bool fits = in[i] >= -LONG_LIMIT && in[i] < LONG_LIMIT;	// false for NaN
+		out[i] = fits ? (long)in[i] : 0;
+		valid[i] &= fits;
+	}
+}
+
+COLUMN_KERNELS
+static void _kernel_mask(uint8_t *restrict valid, uint8_t const *restrict div_by_zero)
+{
+	for (size_t i = 0; i < COLUMN_BLOCK; i++) {
+		valid[i] &= div_by_zero[i] ^ 1;
+	}
+}
+
+COLUMN_KERNELS
+static void _kernel_select(long *restrict out, long const *restrict values,
+			   uint8_t const *restrict valid)
+{
+	for (size_t i = 0; i < COLUMN_BLOCK; i++) {
+		out[i] = (long)((unsigned long)values[i] & (0UL - valid[i]));	// 0 if null
+	}
+}
+
+/*
+ * Validity bitmaps to and from one byte (0 or 1) per row, 8 rows per 64-bit word: byte k of a
+ * word is row k, like bit k of a bitmap byte.
+ */
+static inline void _unpack_bits(uint8_t *valid, uint8_t const *bits)
+{
+	// valid[i] &= bit i of bits
+	for (size_t j = 0; j < COLUMN_BLOCK / 8; j++) {
+		uint64_t spread = ((bits[j] * 0x0101010101010101ULL) & 0x8040201008040201ULL)
+				  + 0x7f7f7f7f7f7f7f7fULL;	// bit 7 of byte k: bit k was set
+		spread = (spread >> 7) & 0x0101010101010101ULL;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		spread = __builtin_bswap64(spread);	// row 0 in the first byte
+#endif
+		uint64_t lanes;
+		memcpy(&lanes, valid + 8 * j, sizeof(lanes));
+		lanes &= spread;
+		memcpy(valid + 8 * j, &lanes, sizeof(lanes));
+	}
+}
+
+static inline size_t _pack_bits(uint8_t *bits, uint8_t const *valid)
+{
+	// bits from valid, returns the number of valid rows
+	size_t n_valid = 0;
+	for (size_t j = 0; j < COLUMN_BLOCK / 8; j++) {
+		uint64_t lanes;
+		memcpy(&lanes, valid + 8 * j, sizeof(lanes));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		lanes = __builtin_bswap64(lanes);
+#endif
+		bits[j] = (lanes * 0x0102040810204080ULL) >> 56;	// byte k to bit 56 + k
+		n_valid += (lanes * 0x0101010101010101ULL) >> 56;	// sum of the bytes
+	}
+	return n_valid;
+}
+
+static inline size_t _count_lanes(uint8_t const *valid)
+{
+	size_t n_valid = 0;
+	for (size_t j = 0; j < COLUMN_BLOCK / 8; j++) {
+		uint64_t lanes;
+		memcpy(&lanes, valid + 8 * j, sizeof(lanes));
+		n_valid += (lanes * 0x0101010101010101ULL) >> 56;
+	}
+	return n_valid;
+}
+
+static inline size_t _width(uint8_t type)
+{
+	// bytes per value of a column of type, 0 if type is not an enum column_type_t
+	switch (type) {
+	case COLUMN_INT64:  return sizeof(int64_t);
+	case COLUMN_INT32:  return sizeof(int32_t);
+	case COLUMN_DOUBLE: return sizeof(double);
+	default:	    return 0;
+	}
+}
+
+static inline uint8_t _byte_order(void)
+{
+	uint16_t probe = 1;
+	return (*(uint8_t *)&probe == 1) ? 1 : 2;
+}
+
+static inline double _elapsed(struct timespec start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
@@ -0,0 +1,365 @@
+#include "../headers/compact.h"
+#include "../headers/arena.h"
+#include "../headers/stack.h"
+#include "../headers/varindex.h"
+
+#define INLINE_WALK 64	// frames kept on the C stack before the conversion walk moves to the heap
+
+/* Flattener: state of compact_from_tree, capacities of the CompactTree's arrays */
+typedef struct {
+	CompactTree *ct;
+	size_t nodes_cap, values_cap, vars_cap;
+	VarIndex index;		/* variables numbered so far */
+} Flattener;
+
+static inline eval_status_t _flatten(Flattener *fl, ExpressionTree root);
+static inline eval_status_t _emit(Flattener *fl, ExpressionTree node, uint32_t left,
+				  uint32_t right, uint32_t leaf);
+static inline eval_status_t _leaf_idx(Flattener *fl, ExpressionTree node, uint32_t *idx);
+
+eval_status_t compact_from_tree(ExpressionTree root, CompactTree *ct)
+{
+	/*
+	 * - On success ct holds root flattened, to be released with compact_destroy. Malformed
+	 *   trees (missing operands) convert too, COMPACT_NONE marking the holes.
+	 * - On failure (EVAL_NO_MEMORY, or EVAL_MALFORMED for a node no parse produces) ct is left
+	 *   empty.
+	 * - The tree must have fewer than COMPACT_NONE nodes.
+	 */
+	assert(ct && "parameter ct must be a valid CompactTree *");
+	*ct = (CompactTree) {.well_formed = root != NULL};
+	Flattener fl = {.ct = ct};
+	eval_status_t status = root ? _flatten(&fl, root) : EVAL_OK;
+	varindex_destroy(&fl.index);
+	if (status != EVAL_OK) {
+		compact_destroy(ct);
+	}
+	return status;
+}
+
+ExpressionTree compact_to_tree(CompactTree const *ct, NodeArena *arena)
+{
+	/*
+	 * - Rebuilds the pointer-based tree of ct (nodes from arena, or malloc'd if NULL), NULL if
+	 *   ct is empty or out of memory.
+	 * - The tree is detached like an interned one (symtab.h): literals have no text, operators
+	 *   point to static strings, variables to the names in ct->vars (which must outlive it).
+	 */
+	static char const *spellings[] = {
+		[CT_ADD] = "+", [CT_SUB] = "-", [CT_MUL] = "*", [CT_DIV] = "/", [CT_MOD] = "%",
+		[CT_POS] = "+", [CT_NEG] = "-",
+		[CT_PRE_INC] = "++", [CT_PRE_DEC] = "--", [CT_POST_INC] = "++", [CT_POST_DEC] = "--"
+	};
+	static enum tok_type_t const types[] = {
+		[CT_LIT] = TOK_LIT, [CT_VAR] = TOK_VAR,
+		[CT_ADD] = TOK_ADD, [CT_SUB] = TOK_MINUS, [CT_MUL] = TOK_MULT, [CT_DIV] = TOK_DIV,
+		[CT_MOD] = TOK_MOD, [CT_POS] = TOK_ADD, [CT_NEG] = TOK_MINUS,
+		[CT_PRE_INC] = TOK_INC, [CT_PRE_DEC] = TOK_DEC, [CT_POST_INC] = TOK_INC,
+		[CT_POST_DEC] = TOK_DEC
+	};
+	assert(ct && "parameter ct must be a valid CompactTree *");
+	if (ct->n_nodes == 0) {
+		return NULL;
+	}
+	ExpressionTree *built = malloc(ct->n_nodes * sizeof(*built));
+	if (!built) {
+		return NULL;
+	}
+	size_t i;
+	for (i = 0; i < ct->n_nodes; i++) {
+		CompactNode const *cn = &ct->nodes[i];
+		ExpressionTree node = arena ? nodearena_alloc(arena) : malloc(sizeof(*node));
+		if (!node) {
+			break;
+		}
+		*node = (ASTNode) {
+			.token.type = types[cn->op],
+			.prefix = cn->op == CT_POS || cn->op == CT_NEG
+				  || cn->op == CT_PRE_INC || cn->op == CT_PRE_DEC
+		};
+		switch ((enum compact_op_t)cn->op) {
+		case CT_LIT:
+			node->value = ct->values[cn->leaf];
+			break;
+		case CT_VAR:
+			node->token = ct->vars[cn->leaf];
+			node->value = NAN;
+			node->slot = ct->symbols[cn->leaf];
+			break;
+		case CT_POST_INC: case CT_POST_DEC:
+			node->postfix = true;
+			// fall through
+		default:
+			node->token.token_string = spellings[cn->op];
+			node->token.length = strlen(spellings[cn->op]);
+			node->binary.left = (cn->left != COMPACT_NONE) ? built[cn->left] : NULL;
+			node->binary.right = (cn->right != COMPACT_NONE) ? built[cn->right] : NULL;
+			break;
+		}
+		built[i] = node;
+	}
+	ExpressionTree root = (i == ct->n_nodes) ? built[i - 1] : NULL;
+	if (!root && !arena) {
+		while (i-- > 0) {
+			free(built[i]);
+		}
+	}
+	free(built);
+	return root;
+}
+
+eval_status_t compact_bind_slots(CompactTree const *ct, long const *values, size_t n_values,
+				 long *vars)
+{
+	// fill vars[0 ... ct->n_vars - 1] from values[symbol table slot] (ct made from an interned
+	// tree), as bytecode_bind_slots does
+	assert(ct && vars);
+	assert((values || n_values == 0) && "values must hold n_values values");
+	for (size_t v = 0; v < ct->n_vars; v++) {
+		if (ct->symbols[v] >= n_values) {
+			return EVAL_UNBOUND_VAR;
+		}
+		vars[v] = values[ct->symbols[v]];
+	}
+	return EVAL_OK;
+}
+
+eval_status_t compact_evaluate(CompactTree const *ct, VM *vm, long *vars, long *result)
+{
+	/*
+	 * One pass over the nodes with the semantics of evaluate.h: a leaf pushes its value, an
+	 * operator replaces its operands' values with its own. vars holds ct->n_vars values
+	 * (updated in place by '++'/'--'), vm provides the scratch stack.
+	 */
+	assert(ct && vm && result);
+	assert((vars || ct->n_vars == 0) && "vars must hold ct->n_vars values");
+	if (!ct->well_formed) {
+		return EVAL_MALFORMED;
+	}
+	if (vm->capacity < ct->max_stack) {
+		long *stack = realloc(vm->stack, sizeof(*stack) * ct->max_stack);
+		if (!stack) {
+			return EVAL_NO_MEMORY;
+		}
+		vm->stack = stack;
+		vm->capacity = ct->max_stack;
+	}
+
+	// as in vm_run, the top of the stack lives in `top`, vm->stack holds the values below it
+	long const *values = ct->values;
+	long *sp = vm->stack;
+	long top = 0;
+	for (CompactNode const *node = ct->nodes; node < ct->nodes + ct->n_nodes; node++) {
+		switch ((enum compact_op_t)node->op) {
+		case CT_LIT:
+			*sp++ = top;
+			top = values[node->leaf];
+			break;
+		case CT_VAR:
+			*sp++ = top;
+			top = vars[node->leaf];
+			break;
+		case CT_ADD: top = eval_add(*--sp, top); break;
+		case CT_SUB: top = eval_sub(*--sp, top); break;
+		case CT_MUL: top = eval_mul(*--sp, top); break;
+		case CT_DIV:
+			if (eval_div(sp[-1], top, &top) != EVAL_OK) {
+				return EVAL_DIV_BY_ZERO;
+			}
+			sp--;
+			break;
+		case CT_MOD:
+			if (eval_mod(sp[-1], top, &top) != EVAL_OK) {
+				return EVAL_DIV_BY_ZERO;
+			}
+			sp--;
+			break;
+		case CT_POS: break;
+		case CT_NEG: top = eval_sub(0, top); break;
+		// '++'/'--' on a variable: its value was just pushed by the operand, update the slot
+		case CT_PRE_INC:
+			top = eval_add(top, 1);
+			if (node->leaf != COMPACT_NONE) {
+				vars[node->leaf] = top;
+			}
+			break;
+		case CT_PRE_DEC:
+			top = eval_sub(top, 1);
+			if (node->leaf != COMPACT_NONE) {
+				vars[node->leaf] = top;
+			}
+			break;
+		case CT_POST_INC:
+			if (node->leaf != COMPACT_NONE) {
+				vars[node->leaf] = eval_add(top, 1);
+			}
+			break;
+		case CT_POST_DEC:
+			if (node->leaf != COMPACT_NONE) {
+				vars[node->leaf] = eval_sub(top, 1);
+			}
+			break;
+		}
+	}
+	*result = top;
+	return EVAL_OK;
+}
+
+void compact_destroy(CompactTree *ct)
+{
+	assert(ct && "parameter ct must be a valid CompactTree *");
+	free(ct->nodes);
+	free(ct->values);
+	free(ct->vars);
+	free(ct->symbols);
+	*ct = (CompactTree) { 0 };
+}
+
+static inline eval_status_t _flatten(Flattener *fl, ExpressionTree root)
+{
+	/*
+	 * post-order walk on an explicit stack: a node is visited once to push its operands and
+	 * once more to emit itself, after them. The indices of emitted nodes wait on a separate
+	 * stack for their parent, like values in an evaluation.
+	 */
+	typedef struct {ExpressionTree node; bool operands_done;} FlatFrame;
+	FlatFrame inline_frames[INLINE_WALK];
+	FlatFrame *frames = inline_frames;
+	size_t capacity = INLINE_WALK, size = 0;
+	uint32_t inline_idx[INLINE_WALK];
+	uint32_t *idx = inline_idx;
+	size_t idx_cap = INLINE_WALK, n_idx = 0;
+
+	eval_status_t status = EVAL_OK;
+	frames[size++] = (FlatFrame) {root, false};
+	while (size > 0 && status == EVAL_OK) {
+		FlatFrame *top = &frames[size - 1];
+		ExpressionTree node = top->node;
+		if (!stack_reserve((void **)&idx, &idx_cap, n_idx + 1, sizeof(*idx), inline_idx)) {
+			status = EVAL_NO_MEMORY;
+			break;
+		}
+		if (!node) {
+			// missing operand
+			fl->ct->well_formed = false;
+			idx[n_idx++] = COMPACT_NONE;
+			size--;
+			continue;
+		}
+		bool leaf = node->token.type == TOK_LIT || node->token.type == TOK_VAR;
+		if (!top->operands_done && !leaf) {
+			top->operands_done = true;
+			if (!stack_reserve((void **)&frames, &capacity, size + 2, sizeof(*frames),
+					   inline_frames)) {
+				status = EVAL_NO_MEMORY;
+				continue;
+			}
+			// left is pushed last so it is emitted first
+			if (!astnode_is_unary(node)) {
+				frames[size++] = (FlatFrame) {node->binary.right, false};
+			}
+			frames[size++] = (FlatFrame) {node->binary.left, false};
+			continue;
+		}
+
+		// leaf, or second visit: the operands' indices are on top of idx
+		size--;
+		uint32_t left = COMPACT_NONE, right = COMPACT_NONE, leaf_idx = COMPACT_NONE;
+		if (!leaf) {
+			if (!astnode_is_unary(node)) {
+				right = idx[--n_idx];
+			}
+			left = idx[--n_idx];
+		}
+		status = _leaf_idx(fl, node, &leaf_idx);
+		if (status == EVAL_OK) {
+			status = _emit(fl, node, left, right, leaf_idx);
+			idx[n_idx++] = fl->ct->n_nodes - 1;
+			// evaluating holds one value per subtree waiting for its parent, as idx does
+			if (n_idx > fl->ct->max_stack) {
+				fl->ct->max_stack = n_idx;
+			}
+		}
+	}
+	stack_release(frames, inline_frames);
+	stack_release(idx, inline_idx);
+	return status;
+}
+
+static inline eval_status_t _emit(Flattener *fl, ExpressionTree node, uint32_t left,
+				  uint32_t right, uint32_t leaf)
+{
+	// append node, its operands already emitted
+	CompactTree *ct = fl->ct;
+	if (ct->n_nodes + 1 >= COMPACT_NONE
+	    || !stack_reserve((void **)&ct->nodes, &fl->nodes_cap, ct->n_nodes + 1,
+			      sizeof(*ct->nodes), NULL)) {
+		return EVAL_NO_MEMORY;
+	}
+	uint8_t op;
+	switch (node->token.type) {
+	case TOK_LIT:   op = CT_LIT; break;
+	case TOK_VAR:   op = CT_VAR; break;
+	case TOK_ADD:   op = astnode_is_unary(node) ? CT_POS : CT_ADD; break;
+	case TOK_MINUS: op = astnode_is_unary(node) ? CT_NEG : CT_SUB; break;
+	case TOK_MULT:  op = CT_MUL; break;
+	case TOK_DIV:   op = CT_DIV; break;
+	case TOK_MOD:   op = CT_MOD; break;
+	case TOK_INC:   op = node->postfix ? CT_POST_INC : CT_PRE_INC; break;
+	case TOK_DEC:   op = node->postfix ? CT_POST_DEC : CT_PRE_DEC; break;
+	default:
+		return EVAL_MALFORMED;
+	}
+	ct->nodes[ct->n_nodes++] = (CompactNode) {
+		.op = op,
+		.left = left,
+		.right = right,
+		.leaf = leaf
+	};
+	return EVAL_OK;
+}
+
+static inline eval_status_t _leaf_idx(Flattener *fl, ExpressionTree node, uint32_t *idx)
+{
+	// side table index of a leaf, or the variable a '++'/'--' updates (COMPACT_NONE if none)
+	CompactTree *ct = fl->ct;
+	switch (node->token.type) {
+	case TOK_LIT:
+		if (!stack_reserve((void **)&ct->values, &fl->values_cap, ct->n_values + 1,
+			      sizeof(*ct->values), NULL)) {
+			return EVAL_NO_MEMORY;
+		}
+		ct->values[ct->n_values] = node->value;
+		*idx = ct->n_values++;
+		return EVAL_OK;
+	case TOK_INC: case TOK_DEC:
+		if (!node->unary.operand || node->unary.operand->token.type != TOK_VAR) {
+			return EVAL_OK;
+		}
+		node = node->unary.operand;
+		// fall through
+	case TOK_VAR:
+		break;
+	default:
+		return EVAL_OK;
+	}
+	// variables are numbered in order of first appearance
+	long found = varindex_find(&fl->index, ct->vars, ct->symbols, node->token, node->slot);
+	if (found >= 0) {
+		*idx = found;
+		return EVAL_OK;
+	}
+	size_t vars_cap = fl->vars_cap;	// vars and symbols grow together
+	if (!stack_reserve((void **)&ct->vars, &vars_cap, ct->n_vars + 1, sizeof(*ct->vars), NULL)
+	    || !stack_reserve((void **)&ct->symbols, &fl->vars_cap, ct->n_vars + 1,
+			      sizeof(*ct->symbols), NULL)) {
+		return EVAL_NO_MEMORY;
+	}
+	ct->vars[ct->n_vars] = node->token;
+	ct->symbols[ct->n_vars] = node->slot;
+	if (!varindex_add(&fl->index, ct->vars, ct->symbols, ct->n_vars)) {
+		return EVAL_NO_MEMORY;
+	}
+	*idx = ct->n_vars++;
+	return EVAL_OK;
+}
@@ -0,0 +1,151 @@
+#include "../headers/document.h"
+
+#define DOCUMENT_MIN_GARBAGE 4096	// dead nodes always tolerated before parsing from scratch
+
+static inline ExpressionTree _reparse(Document *doc, bool from_scratch);
+static inline bool _memo_reserve(ParseMemo *memo, size_t capacity);
+static inline bool _memo_splice(ParseMemo *memo, size_t n_tokens, TokenSplice const *splice);
+
+ExpressionTree document_open(Document *doc, char const *text, size_t length, SymbolTable *symbols,
+			     FILE *errors)
+{
+	/*
+	 * - Parses text from scratch and returns its tree (NULL if it does not parse).
+	 * - text must stay valid until the next document_edit, the tree until then as well.
+	 * - The caller must document_close doc, even if no tree was built.
+	 * - A version that does not parse is reported to errors (NULL: stderr), this one and the
+	 *   next ones alike.
+	 */
+	assert(doc && text && symbols);
+	*doc = (Document) {.symbols = symbols, .errors = errors};
+	nodearena_init(&doc->arena, NODEARENA_DEFAULT_SLAB);
+	doc->tkz = tokenizer_tokenize(text, length);
+	return _reparse(doc, true);
+}
+
+ExpressionTree document_edit(Document *doc, char const *text, size_t length, TextEdit const *edit)
+{
+	/*
+	 * - text is the whole new text, edit what changed from the previous one.
+	 * - Returns the tree of text (NULL if it does not parse). The previous tree is no longer
+	 *   valid.
+	 */
+	assert(doc && text && edit);
+	doc->n_edits++;
+	size_t n_tokens = doc->tkz.n_tokens;
+	TokenSplice splice;
+	if (!tokenizer_relex(&doc->tkz, text, length, edit, &splice)) {
+		// no previous tokens (or edit does not match them): start over
+		tokenizer_distroy(&doc->tkz);
+		doc->tkz = tokenizer_tokenize(text, length);
+		return _reparse(doc, true);
+	}
+	if (!_memo_splice(&doc->memo, n_tokens, &splice)) {
+		return _reparse(doc, true);
+	}
+	return _reparse(doc, false);
+}
+
+void document_close(Document *doc)
+{
+	assert(doc && "parameter doc must be a valid Document *");
+	tokenizer_distroy(&doc->tkz);
+	nodearena_destroy(&doc->arena);
+	free(doc->memo.roots);
+	free(doc->memo.spans);
+	free(doc->memo.bps);
+	*doc = (Document) { 0 };
+}
+
+static inline ExpressionTree _reparse(Document *doc, bool from_scratch)
+{
+	// parse the current tokens, from scratch once dead nodes outnumber the live ones
+	size_t n_garbage = doc->arena.n_nodes - doc->n_full_nodes;
+	from_scratch = from_scratch || n_garbage > doc->n_full_nodes + DOCUMENT_MIN_GARBAGE;
+	ParseMemo *memo = &doc->memo;
+	if (from_scratch) {
+		nodearena_reset(&doc->arena);
+		if (!_memo_reserve(memo, doc->tkz.n_tokens)) {
+			doc->root = NULL;
+			return NULL;
+		}
+		memset(memo->bps, -1, doc->tkz.n_tokens * sizeof(*memo->bps));
+		memo->dirty = false;
+		doc->n_full_parses++;
+	}
+	if (doc->tkz.n_tokens == 0) {
+		doc->root = NULL;
+		return NULL;
+	}
+	doc->root = expressiontree_build_tree_opts(&doc->tkz, &(BuildOptions) {
+		.arena = &doc->arena,
+		.symbols = doc->symbols,
+		.errors = doc->errors,
+		.memo = memo
+	});
+	if (from_scratch) {
+		doc->n_full_nodes = doc->arena.n_nodes;
+	}
+	return doc->root;
+}
+
+static inline bool _memo_reserve(ParseMemo *memo, size_t capacity)
+{
+	// grow every array to capacity (never shrinks), the arrays are left untouched on failure
+	if (capacity <= memo->capacity) {
+		return true;
+	}
+	capacity = (capacity < 2 * memo->capacity) ? 2 * memo->capacity : capacity;
+	void *roots = realloc(memo->roots, capacity * sizeof(*memo->roots));
+	if (roots) {
+		memo->roots = roots;
+	}
+	void *spans = realloc(memo->spans, capacity * sizeof(*memo->spans));
+	if (spans) {
+		memo->spans = spans;
+	}
+	void *bps = realloc(memo->bps, capacity * sizeof(*memo->bps));
+	if (bps) {
+		memo->bps = bps;
+	}
+	if (!roots || !spans || !bps) {
+		return false;
+	}
+	memo->capacity = capacity;
+	return true;
+}
+
+static inline bool _memo_splice(ParseMemo *memo, size_t n_tokens, TokenSplice const *splice)
+{
+	/*
+	 * Apply splice to the memo as tokenizer_relex applied it to the tokens: the entries of the
+	 * replaced tokens go, the new tokens have none, the later ones move along with their
+	 * tokens. The changed tokens join the dirty range (the edits since the last good parse).
+	 */
+	size_t first = splice->first;
+	size_t n_new = n_tokens - splice->n_removed + splice->n_added;
+	if (!_memo_reserve(memo, n_new)) {
+		return false;
+	}
+	size_t from = first + splice->n_removed, to = first + splice->n_added;
+	memmove(memo->roots + to, memo->roots + from, (n_tokens - from) * sizeof(*memo->roots));
+	memmove(memo->spans + to, memo->spans + from, (n_tokens - from) * sizeof(*memo->spans));
+	memmove(memo->bps + to, memo->bps + from, (n_tokens - from) * sizeof(*memo->bps));
+	memset(memo->bps + first, -1, splice->n_added * sizeof(*memo->bps));
+
+	if (splice->n_removed == 0 && splice->n_added == 0) {
+		return true;	// only whitespace moved
+	}
+	if (!memo->dirty) {
+		memo->dirty_start = first;
+		memo->dirty_end = to;
+		memo->dirty = true;
+		return true;
+	}
+	// the pending range, seen through this splice
+	size_t end = memo->dirty_end;
+	end = (end <= first) ? end : (end >= from) ? end - splice->n_removed + splice->n_added : to;
+	memo->dirty_start = (memo->dirty_start < first) ? memo->dirty_start : first;
+	memo->dirty_end = (end > to) ? end : to;
+	return true;
+}
@@ -0,0 +1,423 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <unistd.h>
+
+#include "../headers/emit.h"
+#include "../headers/stats.h"
+
+#define INLINE_FRAMES 64	// frames kept on the C stack before a walk's stack moves to the heap
+#define LONG_DIGITS 20		// digits of the largest unsigned long, sign excluded
+
+/* EmitFrame: a node still to be emitted, state tells what of it is left (see emitter_tree) */
+typedef struct {
+	ExpressionTree node;
+	int depth;
+	int state;
+} EmitFrame;
+
+enum emit_state_t {EMIT_OPEN, EMIT_BETWEEN, EMIT_CLOSE};
+
+static char const *_tree_symbols[] = {
+	[TOK_ADD]   = "+",
+	[TOK_MINUS] = "-",
+	[TOK_MULT]  = "*",
+	[TOK_DIV]   = "/",
+	[TOK_MOD]   = "%",
+	[TOK_INC]   = "++",
+	[TOK_DEC]   = "--"
+};
+
+static inline void _put(Emitter *em, char const *text, size_t length);
+static inline void _put_char(Emitter *em, char ch);
+static inline void _put_str(Emitter *em, char const *text);
+static inline void _put_long(Emitter *em, long value);
+static inline void _put_leaf(Emitter *em, ASTNode const *node, bool json);
+static inline char const *_op_name(ASTNode const *node);
+static void _put_slow(Emitter *em, char const *text, size_t length, char fill);
+static bool _make_room(Emitter *em, size_t length);
+static int _write(Emitter *em);
+
+void emitter_init(Emitter *em, int fd, char *buf, size_t capacity)
+{
+	/*
+	 * - Emit to fd (-1: to memory) through buf[0 ... capacity - 1], or through a buffer of
+	 *   EMIT_BLOCK bytes malloc'd on first use if buf is NULL or smaller than EMIT_MIN_BUFFER.
+	 * - fd belongs to the caller, it is neither closed nor flushed by emitter_destroy.
+	 */
+	assert(em && "parameter em must be a valid Emitter *");
+	bool usable = buf && capacity >= EMIT_MIN_BUFFER;
+	*em = (Emitter) {
+		.buf = usable ? buf : NULL,
+		.capacity = usable ? capacity : 0,
+		.fd = fd
+	};
+}
+
+void emitter_init_file(Emitter *em, FILE *fp, char *buf, size_t capacity)
+{
+	// as emitter_init, to a stdio stream: every block goes out in one fwrite
+	emitter_init(em, -1, buf, capacity);
+	em->fp = fp;
+}
+
+int emitter_tree(Emitter *em, ExpressionTree root, enum emit_format_t format, int depth)
+{
+	/*
+	 * - Appends root in format, depth being the indentation EMIT_TREE starts at (as
+	 *   expressiontree_print_to_file's). Blocks are written once the buffer is full, what is
+	 *   left stays in the buffer until emitter_flush.
+	 * - One walk over an explicit stack: an operator is opened (EMIT_OPEN), then its operands
+	 *   are emitted, with EMIT_BETWEEN between them for JSON's "right" key, then it is closed
+	 *   (EMIT_CLOSE: ')' in EMIT_SEXPR, the operator itself in EMIT_RPN, '}' in EMIT_JSON).
+	 * - Returns 0, or -1 with errno set if a write failed or memory ran out (now or before).
+	 */
+	assert(em && "parameter em must be a valid Emitter *");
+	STATS_BEGIN(start);
+	EmitFrame inline_frames[INLINE_FRAMES];
+	EmitFrame *frames = em->frames ? em->frames : inline_frames;
+	size_t capacity = em->frames ? em->frames_capacity : INLINE_FRAMES, size = 0;
+	bool spaced = false;	// EMIT_SEXPR/EMIT_RPN: the next atom needs a space in front
+
+	if (root) {
+		frames[size++] = (EmitFrame) {root, depth, EMIT_OPEN};
+	}
+	while (size > 0 && !em->error) {
+		EmitFrame top = frames[--size];
+		ASTNode const *node = top.node;
+		ExpressionTree left = node->binary.left;
+		ExpressionTree right = node->binary.right;
+		if (!stack_reserve((void **)&frames, &capacity, size + 4, sizeof(*frames), inline_frames)) {
+			em->error = ENOMEM;
+			break;
+		}
+		bool leaf = node->token.type == TOK_VAR || node->token.type == TOK_LIT;
+
+		switch (format) {
+		case EMIT_TREE:
+			// "%*s%*s" of " " and "|__" padded to depth: depth spaces, depth - 3 more, "|__"
+			if (top.depth > 0) {
+				_put_slow(em, NULL, top.depth + ((top.depth > 3) ? top.depth - 3 : 0), ' ');
+				_put(em, "|__", 3);
+			}
+			_put_char(em, '"');
+			if (leaf) {
+				_put_leaf(em, node, false);
+			} else {
+				_put_str(em, _tree_symbols[node->token.type]);
+			}
+			_put(em, "\"\n", 2);
+			// children are pushed right first so the left subtree is printed first
+			if (right) {
+				frames[size++] = (EmitFrame) {right, top.depth + 1, EMIT_OPEN};
+			}
+			if (left) {
+				frames[size++] = (EmitFrame) {left, top.depth + 1, EMIT_OPEN};
+			}
+			continue;
+
+		case EMIT_SEXPR: case EMIT_RPN:
+			// a space in front of every atom: leaves, '(' + operator (EMIT_SEXPR) or operator
+			// (EMIT_RPN, once its operands are out)
+			if (leaf || (top.state == EMIT_OPEN) == (format == EMIT_SEXPR)) {
+				if (spaced) {
+					_put_char(em, ' ');
+				}
+				spaced = true;
+			}
+			if (leaf) {
+				_put_leaf(em, node, false);
+			} else if (top.state == EMIT_CLOSE) {
+				if (format == EMIT_SEXPR) {
+					_put_char(em, ')');
+				} else {
+					_put_str(em, _op_name(node));
+				}
+			} else {
+				if (format == EMIT_SEXPR) {
+					_put_char(em, '(');
+					_put_str(em, _op_name(node));
+				}
+				frames[size++] = (EmitFrame) {top.node, top.depth, EMIT_CLOSE};
+				if (right) {
+					frames[size++] = (EmitFrame) {right, top.depth + 1, EMIT_OPEN};
+				}
+				if (left) {
+					frames[size++] = (EmitFrame) {left, top.depth + 1, EMIT_OPEN};
+				}
+			}
+			break;
+
+		case EMIT_JSON:
+			if (leaf) {
+				_put_leaf(em, node, true);
+			} else if (top.state == EMIT_CLOSE) {
+				_put_char(em, '}');
+			} else if (top.state == EMIT_BETWEEN) {
+				_put(em, ",\"right\":", 9);
+			} else {
+				_put(em, "{\"op\":\"", 7);
+				_put_str(em, _op_name(node));
+				_put_char(em, '"');
+				frames[size++] = (EmitFrame) {top.node, top.depth, EMIT_CLOSE};
+				if (right) {
+					frames[size++] = (EmitFrame) {right, top.depth + 1, EMIT_OPEN};
+					if (left) {
+						frames[size++] = (EmitFrame) {top.node, top.depth, EMIT_BETWEEN};
+					} else {
+						_put(em, ",\"right\":", 9);
+					}
+				}
+				if (left) {
+					_put_str(em, astnode_is_unary(node) ? ",\"operand\":" : ",\"left\":");
+					frames[size++] = (EmitFrame) {left, top.depth + 1, EMIT_OPEN};
+				}
+			}
+			break;
+		}
+	}
+	if (root && format != EMIT_TREE) {
+		_put_char(em, '\n');
+	}
+	if (frames != inline_frames) {
+		// a heap stack is kept: dumping many deep trees allocates once, not once per tree
+		em->frames = frames;
+		em->frames_capacity = capacity;
+	}
+	STATS_END(STATS_PRINT, start);
+	if (em->error) {
+		errno = em->error;
+		return -1;
+	}
+	return 0;
+}
+
+int emitter_text(Emitter *em, char const *text, size_t length)
+{
+	// appends text[0 ... length - 1] as it is, 0 or -1 with errno set (as emitter_tree)
+	assert(em && "parameter em must be a valid Emitter *");
+	if (length > 0) {
+		_put(em, text, length);	// nothing to copy into a buffer that may not exist yet
+	}
+	if (em->error) {
+		errno = em->error;
+		return -1;
+	}
+	return 0;
+}
+
+int emitter_flush(Emitter *em)
+{
+	// write what the buffer holds (nothing to do in memory), 0 or -1 with errno set
+	assert(em && "parameter em must be a valid Emitter *");
+	if (!em->error && (em->fd >= 0 || em->fp) && em->size > 0) {
+		_write(em);
+	}
+	if (em->error) {
+		errno = em->error;
+		return -1;
+	}
+	return 0;
+}
+
+void emitter_destroy(Emitter *em)
+{
+	// release the buffer if the emitter malloc'd it and the walk stack, unflushed bytes are dropped
+	assert(em && "parameter em must be a valid Emitter *");
+	if (em->owned) {
+		free(em->buf);
+	}
+	free(em->frames);
+	*em = (Emitter) {.fd = -1};
+}
+
+int emit_format_parse(char const *name, enum emit_format_t *format)
+{
+	// the format called name ("tree", "sexpr", "rpn" or "json"), -1 if none is
+	static char const *names[] = {
+		[EMIT_TREE] = "tree",
+		[EMIT_SEXPR] = "sexpr",
+		[EMIT_RPN] = "rpn",
+		[EMIT_JSON] = "json"
+	};
+	for (size_t i = 0; i < sizeof(names) / sizeof(*names); i++) {
+		if (strcmp(name, names[i]) == 0) {
+			*format = i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static inline void _put(Emitter *em, char const *text, size_t length)
+{
+	if (em->capacity - em->size >= length) {
+		memcpy(em->buf + em->size, text, length);
+		em->size += length;
+		return;
+	}
+	_put_slow(em, text, length, 0);
+}
+
+static inline void _put_char(Emitter *em, char ch)
+{
+	if (em->size < em->capacity) {
+		em->buf[em->size++] = ch;
+		return;
+	}
+	_put_slow(em, &ch, 1, 0);
+}
+
+static inline void _put_str(Emitter *em, char const *text)
+{
+	_put(em, text, strlen(text));
+}
+
+static inline void _put_long(Emitter *em, long value)
+{
+	// as "%ld": digits written backwards into a scratch buffer, then copied at once
+	char digits[LONG_DIGITS + 1];
+	char *p = digits + sizeof(digits);
+	unsigned long magnitude = (value < 0) ? 0UL - (unsigned long)value : (unsigned long)value;
+	do {
+		*--p = '0' + magnitude % 10;
+		magnitude /= 10;
+	} while (magnitude > 0);
+	if (value < 0) {
+		*--p = '-';
+	}
+	_put(em, p, digits + sizeof(digits) - p);
+}
+
+static inline void _put_leaf(Emitter *em, ASTNode const *node, bool json)
+{
+	// a variable or literal as spelled in the input (folded literals: their value)
+	Token const *token = &node->token;
+	if (token->type == TOK_LIT && !token->token_string) {
+		if (json) {
+			_put(em, "{\"lit\":", 7);
+		}
+		_put_long(em, node->value);	// folded by expressiontree_simplify
+	} else if (!json) {
+		_put(em, token->token_string, token->length);
+	} else if (token->type == TOK_VAR) {
+		_put(em, "{\"var\":\"", 8);
+		_put(em, token->token_string, token->length);
+		_put_char(em, '"');
+	} else {
+		// JSON numbers have no leading zeros
+		size_t skip = 0;
+		while (skip + 1 < token->length && token->token_string[skip] == '0') {
+			skip++;
+		}
+		_put(em, "{\"lit\":", 7);
+		_put(em, token->token_string + skip, token->length - skip);
+	}
+	if (json) {
+		_put_char(em, '}');
+	}
+}
+
+static inline char const *_op_name(ASTNode const *node)
+{
+	// operators of EMIT_SEXPR, EMIT_RPN and EMIT_JSON: unary ones are told apart
+	if (!astnode_is_unary(node)) {
+		return _tree_symbols[node->token.type];
+	}
+	switch (node->token.type) {
+	case TOK_ADD:   return "pos";
+	case TOK_MINUS: return "neg";
+	case TOK_INC:   return node->postfix ? "post++" : "pre++";
+	default:        return node->postfix ? "post--" : "pre--";
+	}
+}
+
+static void _put_slow(Emitter *em, char const *text, size_t length, char fill)
+{
+	// text[0 ... length - 1] (text NULL: length times fill) across as many blocks as it takes
+	while (length > 0 && _make_room(em, 1)) {
+		size_t n = em->capacity - em->size;
+		n = (n < length) ? n : length;
+		if (text) {
+			memcpy(em->buf + em->size, text, n);
+			text += n;
+		} else {
+			memset(em->buf + em->size, fill, n);
+		}
+		em->size += n;
+		length -= n;
+	}
+}
+
+static bool _make_room(Emitter *em, size_t length)
+{
+	// room for length more bytes: flush a full block, or grow the buffer in memory
+	if (em->error) {
+		return false;
+	}
+	if (!em->buf) {
+		size_t capacity = (length > EMIT_BLOCK) ? length : EMIT_BLOCK;
+		if (!(em->buf = malloc(capacity))) {
+			em->error = ENOMEM;
+			return false;
+		}
+		em->capacity = capacity;
+		em->owned = true;
+	}
+	if (em->capacity - em->size >= length) {
+		return true;
+	}
+	if (em->fd >= 0 || em->fp) {
+		if (_write(em) < 0) {
+			return false;
+		}
+		if (em->capacity >= length) {
+			return true;
+		}
+	}
+	size_t capacity = 2 * em->capacity;
+	capacity = (capacity - em->size < length) ? em->size + length : capacity;
+	char *buf = em->owned ? realloc(em->buf, capacity) : malloc(capacity);
+	if (!buf) {
+		em->error = ENOMEM;
+		return false;
+	}
+	if (!em->owned) {
+		memcpy(buf, em->buf, em->size);
+	}
+	em->buf = buf;
+	em->capacity = capacity;
+	em->owned = true;
+	return true;
+}
+
+static int _write(Emitter *em)
+{
+	// the whole buffer to fd (partial writes resumed) or fp, -1 and em->error set on failure
+	size_t done = 0;
+	if (em->fd >= 0) {
+		while (done < em->size) {
+			ssize_t n = write(em->fd, em->buf + done, em->size - done);
+			em->n_writes++;
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			if (n < 0) {
+				em->error = errno;
+				return -1;
+			}
+			done += n;
+			em->n_written += n;
+		}
+	} else {
+		done = fwrite(em->buf, 1, em->size, em->fp);
+		em->n_writes++;
+		em->n_written += done;
+		if (done < em->size) {
+			em->error = errno ? errno : EIO;
+			return -1;
+		}
+	}
+	em->size = 0;
+	return 0;
+}
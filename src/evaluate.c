@@ -0,0 +1,224 @@
+#include "../headers/evaluate.h"
+#include "../headers/stack.h"
+
+#define INLINE_WALK 64	// frames kept on the C stack before an evaluation walk moves to the heap
+
+/* Env: variables looked up by name in bindings, or by slot in vars (bindings == NULL) */
+typedef struct {
+	Binding *bindings;
+	size_t n_bindings;
+	long *vars;
+	size_t n_vars;
+} Env;
+
+static inline bool _well_formed(ExpressionTree node);
+static inline eval_status_t _eval(ExpressionTree node, Env *env, long *result);
+static inline long *_lookup(Env *env, ExpressionTree var);
+
+char const *eval_status_str(eval_status_t status)
+{
+	static char const *status_str[] = {
+		[EVAL_OK]          = "ok",
+		[EVAL_DIV_BY_ZERO] = "division by zero",
+		[EVAL_UNBOUND_VAR] = "unbound variable",
+		[EVAL_MALFORMED]   = "malformed expression tree",
+		[EVAL_NO_MEMORY]   = "out of memory"
+	};
+	return status_str[status];
+}
+
+eval_status_t expressiontree_evaluate(ExpressionTree root, Binding *bindings, size_t n_bindings,
+				      long *result)
+{
+	assert(result && "parameter result must be a valid long *");
+	assert((bindings || n_bindings == 0) && "bindings must hold n_bindings Bindings");
+	if (!_well_formed(root)) {
+		// reject malformed trees up front, like bytecode_compile does, so every evaluator
+		// reports the same status for them
+		return EVAL_MALFORMED;
+	}
+	Env env = {.bindings = bindings, .n_bindings = n_bindings};
+	return _eval(root, &env, result);
+}
+
+eval_status_t expressiontree_evaluate_slots(ExpressionTree root, long *vars, size_t n_vars,
+					    long *result)
+{
+	// root must be an interned tree (symtab.h): vars[slot] is the value of the variable at slot
+	assert(result && "parameter result must be a valid long *");
+	assert((vars || n_vars == 0) && "vars must hold n_vars values");
+	if (!_well_formed(root)) {
+		return EVAL_MALFORMED;
+	}
+	Env env = {.vars = vars, .n_vars = n_vars};
+	return _eval(root, &env, result);
+}
+
+static inline bool _well_formed(ExpressionTree root)
+{
+	// every operator has all of its operands (any order of visit will do)
+	ExpressionTree inline_nodes[INLINE_WALK];
+	ExpressionTree *nodes = inline_nodes;
+	size_t capacity = INLINE_WALK, size = 0;
+
+	bool ok = true;
+	nodes[size++] = root;
+	while (size > 0 && ok) {
+		ExpressionTree node = nodes[--size];
+		if (!node) {
+			ok = false;
+			break;
+		}
+		switch (node->token.type) {
+		case TOK_LIT: case TOK_VAR:
+			continue;
+		case TOK_ADD: case TOK_MINUS: case TOK_MULT: case TOK_DIV: case TOK_MOD:
+		case TOK_INC: case TOK_DEC:
+			break;
+		default:
+			ok = false;
+			continue;
+		}
+		if (!stack_reserve((void **)&nodes, &capacity, size + 2, sizeof(*nodes), inline_nodes)) {
+			ok = false;	// reported as malformed, the tree is too big to check anyway
+			break;
+		}
+		nodes[size++] = node->binary.left;	// also unary.operand
+		if (!astnode_is_unary(node)) {
+			nodes[size++] = node->binary.right;
+		}
+	}
+	stack_release(nodes, inline_nodes);
+	return ok;
+}
+
+static inline eval_status_t _eval(ExpressionTree root, Env *env, long *result)
+{
+	/*
+	 * post-order walk on an explicit stack: a node is visited once to push its operands and
+	 * once more to combine their values, which wait on a separate value stack.
+	 */
+	typedef struct {ExpressionTree node; bool operands_done;} EvalFrame;
+	EvalFrame inline_frames[INLINE_WALK];
+	EvalFrame *frames = inline_frames;
+	size_t capacity = INLINE_WALK, size = 0;
+	long inline_values[INLINE_WALK];
+	long *values = inline_values;
+	size_t values_cap = INLINE_WALK, n_values = 0;
+
+	eval_status_t status = EVAL_OK;
+	frames[size++] = (EvalFrame) {root, false};
+	while (size > 0 && status == EVAL_OK) {
+		EvalFrame *top = &frames[size - 1];
+		ExpressionTree node = top->node;
+		ExpressionTree operand = node->unary.operand;
+		long *var = NULL;
+		long lhs, rhs;
+
+		if (!stack_reserve((void **)&values, &values_cap, n_values + 1, sizeof(*values),
+				   inline_values)) {
+			status = EVAL_NO_MEMORY;
+			break;
+		}
+
+		if (!top->operands_done) {
+			top->operands_done = true;
+			switch (node->token.type) {
+			// leaves
+			case TOK_LIT:
+				values[n_values++] = node->value;
+				size--;
+				continue;
+			case TOK_VAR:
+				if (!(var = _lookup(env, node))) {
+					status = EVAL_UNBOUND_VAR;
+					continue;
+				}
+				values[n_values++] = *var;
+				size--;
+				continue;
+			case TOK_INC: case TOK_DEC:
+				if (operand->token.type != TOK_VAR) {
+					break;
+				}
+				// '++'/'--' on a variable update its binding
+				if (!(var = _lookup(env, operand))) {
+					status = EVAL_UNBOUND_VAR;
+					continue;
+				}
+				lhs = *var;
+				*var = eval_add(lhs, (node->token.type == TOK_INC) ? 1 : -1);
+				values[n_values++] = node->postfix ? lhs : *var;
+				size--;
+				continue;
+			default:
+				break;
+			}
+			// operators: operands are evaluated left to right, so left is pushed last
+			if (!stack_reserve((void **)&frames, &capacity, size + 2, sizeof(*frames),
+					   inline_frames)) {
+				status = EVAL_NO_MEMORY;
+				continue;
+			}
+			if (!astnode_is_unary(node)) {
+				frames[size++] = (EvalFrame) {node->binary.right, false};
+			}
+			frames[size++] = (EvalFrame) {node->binary.left, false};
+			continue;
+		}
+
+		// second visit: operand values are on top of the value stack
+		size--;
+		if (astnode_is_unary(node)) {
+			lhs = values[n_values - 1];
+			switch (node->token.type) {
+			case TOK_INC: case TOK_DEC:	// on anything but a variable: only a value
+				if (!node->postfix) {
+					lhs = eval_add(lhs, (node->token.type == TOK_INC) ? 1 : -1);
+				}
+				break;
+			case TOK_MINUS:
+				lhs = eval_sub(0, lhs);
+				break;
+			default:
+				break;
+			}
+			values[n_values - 1] = lhs;
+			continue;
+		}
+
+		rhs = values[--n_values];
+		lhs = values[n_values - 1];
+		switch (node->token.type) {
+		case TOK_ADD:   lhs = eval_add(lhs, rhs); break;
+		case TOK_MINUS: lhs = eval_sub(lhs, rhs); break;
+		case TOK_MULT:  lhs = eval_mul(lhs, rhs); break;
+		case TOK_DIV:   status = eval_div(lhs, rhs, &lhs); break;
+		case TOK_MOD:   status = eval_mod(lhs, rhs, &lhs); break;
+		default:        status = EVAL_MALFORMED; break;
+		}
+		values[n_values - 1] = lhs;
+	}
+
+	if (status == EVAL_OK) {
+		*result = values[0];
+	}
+	stack_release(frames, inline_frames);
+	stack_release(values, inline_values);
+	return status;
+}
+
+static inline long *_lookup(Env *env, ExpressionTree var)
+{
+	// the value of variable var, NULL if it has no binding
+	if (!env->bindings) {
+		return (var->slot < env->n_vars) ? &env->vars[var->slot] : NULL;
+	}
+	Token name = var->token;
+	for (Binding *b = env->bindings; b < env->bindings + env->n_bindings; b++) {
+		if (strncmp(b->name, name.token_string, name.length) == 0 && b->name[name.length] == '\0') {
+			return &b->value;
+		}
+	}
+	return NULL;
+}
@@ -1,16 +1,37 @@
+#include <errno.h>
+
 #include "../headers/ExpressionTree.h"
 #include "../headers/stack.h"
 #include "../headers/Parser.h"
+#include "../headers/arena.h"
+#include "../headers/hashcons.h"
+#include "../headers/simplify.h"
+#include "../headers/symtab.h"
+#include "../headers/stats.h"
+#include "../headers/document.h"
+#include "../headers/literal.h"
+#include "../headers/emit.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define INLINE_FRAMES 64	// frames kept on the C stack before a walk's stack moves to the heap
+#define EMIT_PRINT_BUFFER 8192	// expressiontree_print_to_file's buffer, on the C stack
 
-typedef char precedence_t;
+typedef signed char precedence_t;	// -1: the token has no binding power there
 typedef struct {precedence_t lbp, rbp;} binding_power_t;
 
 // static helpers 
 // common helper
-static inline ExpressionTree _alloc_node();
+static inline ExpressionTree _alloc_node(Parser *parser);
+static inline ExpressionTree _build_tree(Tokenizer *tkz, BuildOptions const *opts);
+static inline ExpressionTree _finish_tree(Parser *parser, BuildOptions const *opts,
+					 ExpressionTree root, bool over_budget);
+static inline void _report_unexpected(Parser *parser, FILE *err);
 
 // lexical error handling
-static inline int _expr_error_idx(Token *expr, size_t length);
+static inline ptrdiff_t _expr_error_idx(uint8_t const *types, size_t length);
 
 // binding power assignment
 static inline binding_power_t _assign_bp(Token token);
@@ -18,123 +39,358 @@ static inline binding_power_t _assign_prefix(Token token);
 static inline binding_power_t _assign_infix(Token token);
 
 // expression parsing
-static inline ExpressionTree _parse_expr(Parser *parser, precedence_t curr_bp);
-static inline ExpressionTree _parse_atom(Parser *parser, precedence_t curr_bp);
-static inline ExpressionTree _parse_prefix(Parser *parser, precedence_t curr_bp);
+static inline ExpressionTree _parse(Parser *parser, size_t max_depth, bool *over_budget);
 static inline ExpressionTree _parse_postfix(Parser *parser, ExpressionTree lhs);
+static inline void _detach(Parser *parser, ExpressionTree node);
+
+// subtree reuse (document.h)
+static inline bool _memo_reuse(Parser *parser, precedence_t bp, ExpressionTree *ret);
+static inline void _memo_record(ParseMemo *memo, size_t start, size_t end, precedence_t bp,
+				ExpressionTree root);
+static inline void _memo_clear(ParseMemo *memo, size_t from, size_t to);
 
 // main apis
 ExpressionTree expressiontree_build_tree(Tokenizer *tkz)
+{
+	return expressiontree_build_tree_arena(tkz, NULL);
+}
+
+ExpressionTree expressiontree_build_tree_arena(Tokenizer *tkz, NodeArena *arena)
+{
+	/*
+	 * - arena == NULL: every node is malloc'd, release the tree with expressiontree_destroy_tree
+	 * - otherwise nodes are bump-allocated from arena, the tree lives until nodearena_reset
+	 */
+	return expressiontree_build_tree_opts(tkz, &(BuildOptions) {.arena = arena});
+}
+
+ExpressionTree expressiontree_build_tree_opts(Tokenizer *tkz, BuildOptions const *opts)
 {
 	assert(tkz && "parameter tkz must be a valid Tokenizer *");
+	assert(opts && "parameter opts must be a valid BuildOptions *");
+	assert((!opts->memo || (opts->arena && opts->symbols && !opts->hashcons && !opts->simplify))
+	       && "a memo needs an arena and symbols, and no hashcons or simplify");
+	ExpressionTree root = _build_tree(tkz, opts);
+	STATS_ADD(n_trees, root != NULL);
+	STATS_ADD(n_rejected, root == NULL);
+	return root;
+}
+
+ExpressionTree expressiontree_build_tree_stream(TokenStream *ts, BuildOptions const *opts)
+{
+	/*
+	 * - Builds the tree of the whole input of ts, pulling each token when the parser gets to
+	 *   it: no token array, no copy of the input. Besides the tree, memory is the stream's
+	 *   window and the parser's stack (as deep as the expression is nested).
+	 * - Needs opts->symbols: each node is detached from the window as soon as it is built
+	 *   (symtab.h). Excludes memo.
+	 * - There is no validation pass, an invalid token or unpaired parenthesis is reported when
+	 *   the parser reaches it.
+	 */
+	assert(ts && "parameter ts must be a valid TokenStream *");
+	assert(opts && opts->symbols && !opts->memo && "streaming needs symbols and no memo");
+	FILE *err = opts->errors ? opts->errors : stderr;
+	Parser parser = parser_init_stream(ts);
+	parser.arena = opts->hashcons ? &opts->hashcons->scratch : opts->arena;
+	parser.symbols = opts->symbols;
+	if (opts->max_nodes) {
+		parser.nodes_left = opts->max_nodes;
+	}
+	bool over_budget = false;
+	STATS_BEGIN(parse_start);
+	ExpressionTree root = _parse(&parser, opts->max_depth ? opts->max_depth : SIZE_MAX,
+				     &over_budget);
+	STATS_END(STATS_PARSE, parse_start);
+	if (root && !parser_parse_completed(&parser)) {
+		// a ')' without its '(', or an invalid token, ended the expression early
+		parser.unexpected = true;
+	}
+	if (ts->error || parser.unexpected) {
+		if (root && !parser.arena) {
+			expressiontree_destroy_tree(&root);
+		}
+		root = NULL;
+	}
+	if (ts->error) {
+		fprintf(err, "error reading the expression: %s\n", strerror(ts->error));
+		fprintf(err, "no parse tree was built.\n");
+		if (opts->hashcons) {
+			nodearena_reset(&opts->hashcons->scratch);
+		}
+	} else {
+		root = _finish_tree(&parser, opts, root, over_budget);
+	}
+	STATS_ADD(n_trees, root != NULL);
+	STATS_ADD(n_rejected, root == NULL);
+	return root;
+}
+
+static inline ExpressionTree _build_tree(Tokenizer *tkz, BuildOptions const *opts)
+{
+	FILE *err = opts->errors ? opts->errors : stderr;
+	if (tkz->n_tokens == 0) {
+		fprintf(err, "expression was not tokenized (too long or out of memory)\n");
+		fprintf(err, "no parse tree was built.\n");
+		return NULL;
+	}
 	// handle lexing errors
-	int error = _expr_error_idx(tkz->tokens, tkz->n_tokens);
-	if (error != tkz->n_tokens) {
-		char const *expr = tkz->tokens[0].token_string;
-                int expr_len = tkz->tokens[tkz->n_tokens - 1].token_string +
-                               tkz->tokens[tkz->n_tokens - 1].length - expr;
-
-		if (error > -1) {
-			fprintf(stderr, "expression \"%.*s\" contains invalid token \"%.*s\"\n",
+	STATS_BEGIN(validate_start);
+	ptrdiff_t error = expressiontree_validate(tkz);
+	STATS_END(STATS_VALIDATE, validate_start);
+	if (error < 0 || (size_t)error < tkz->n_tokens) {
+		char const *expr = tkz->input + tkz->offsets[0];
+                int expr_len = tkz->offsets[tkz->n_tokens - 1] - tkz->offsets[0];
+
+		if (error >= 0) {
+			fprintf(err, "expression \"%.*s\" contains invalid token \"%.*s\"\n",
 					expr_len, expr,
-					(int)tkz->tokens[error].length, tkz->tokens[error].token_string);
+					(int)tkz->lengths[error], tkz->input + tkz->offsets[error]);
 		} else {
-			fprintf(stderr, "expression \"%.*s\" has invalid pairs of parentheses\n",
+			fprintf(err, "expression \"%.*s\" has invalid pairs of parentheses\n",
 					expr_len, expr);
 		}
-		fprintf(stderr, "no parse tree was built.\n");
+		fprintf(err, "no parse tree was built.\n");
 		return NULL;
 	}
 	// actual parsing
 	Parser parser = parser_init(tkz);
-	ExpressionTree root = _parse_expr(&parser, 0);
-	return root;
+	parser.arena = opts->hashcons ? &opts->hashcons->scratch : opts->arena;
+	if (opts->max_nodes) {
+		parser.nodes_left = opts->max_nodes;
+	}
+	if (opts->memo) {
+		parser.memo = opts->memo;
+		parser.memo->visited = 0;
+		parser.symbols = opts->symbols;
+	}
+	bool over_budget = false;
+	STATS_BEGIN(parse_start);
+	ExpressionTree root = _parse(&parser, opts->max_depth ? opts->max_depth : SIZE_MAX,
+				     &over_budget);
+	STATS_END(STATS_PARSE, parse_start);
+	if (opts->memo) {
+		// the memo now holds the calls of this tree, or nothing if the parse failed half-way
+		if (root) {
+			_memo_clear(opts->memo, opts->memo->visited, tkz->n_tokens);
+			opts->memo->dirty = false;
+		} else {
+			_memo_clear(opts->memo, 0, tkz->n_tokens);
+		}
+	}
+	return _finish_tree(&parser, opts, root, over_budget);
 }
 
-static char const *operatorSymbolLUT[] = {
-	[TOK_ADD] 	= "+",
-	[TOK_MINUS]	= "-",
-	[TOK_MULT]	= "*",
-	[TOK_DIV]	= "/",
-	[TOK_MOD]	= "%",
-	[TOK_INC]	= "++",
-	[TOK_DEC]	= "--"
-};
-void expressiontree_print_to_file(FILE *fp, int depth, ExpressionTree root)
+static inline ExpressionTree _finish_tree(Parser *parser, BuildOptions const *opts,
+					 ExpressionTree root, bool over_budget)
 {
-	assert(fp);
-	if (root) {
-		// %*s (pad * of spaces in front of string s), %.*s (print at most * characters of string)
-		if (depth > 0) {
-			fprintf(fp, "%*s%*s",
-				depth, " ",
-				depth, "|__");
+	// report why parsing failed, or simplify/intern/hash-cons the tree as opts says
+	FILE *err = opts->errors ? opts->errors : stderr;
+	if (parser->unexpected) {
+		_report_unexpected(parser, err);
+		fprintf(err, "no parse tree was built.\n");
+		if (opts->hashcons) {
+			nodearena_reset(&opts->hashcons->scratch);
 		}
-
-		if (root->token.type == TOK_VAR || root->token.type == TOK_LIT ) {
-			fprintf(fp, "\"%.*s\"\n", (int)root->token.length, root->token.token_string);
-		} else {
-			fprintf(fp, "\"%s\"\n", operatorSymbolLUT[root->token.type]);
+		return NULL;
+	}
+	if (parser->failed || over_budget) {
+		fprintf(err, (over_budget || parser->nodes_left == 0) ?
+				"expression exceeds the parse budget (depth %zu, nodes %zu)\n" :
+				"out of memory while parsing the expression\n",
+			opts->max_depth, opts->max_nodes);
+		fprintf(err, "no parse tree was built.\n");
+		if (opts->hashcons) {
+			nodearena_reset(&opts->hashcons->scratch);
+		}
+		return NULL;
+	}
+	if (opts->simplify) {
+		root = expressiontree_simplify(root, parser->arena);
+	}
+	if (opts->symbols && !parser->symbols && !symtab_intern_tree(opts->symbols, root) && root) {
+		fprintf(err, "out of memory while interning the expression's variables\n");
+		fprintf(err, "no parse tree was built.\n");
+		if (opts->hashcons) {
+			nodearena_reset(&opts->hashcons->scratch);
+		} else if (!parser->arena) {
+			expressiontree_destroy_tree(&root);
 		}
+		return NULL;
+	}
+	if (opts->hashcons) {
+		// the tree only lives in the scratch arena until its nodes are interned
+		ExpressionTree dag = hashcons_intern(opts->hashcons, root);
+		nodearena_reset(&opts->hashcons->scratch);
+		if (!dag && root) {
+			fprintf(err, "out of memory while parsing the expression\n");
+			fprintf(err, "no parse tree was built.\n");
+		}
+		return dag;
+	}
+	return root;
+}
+
+static inline void _report_unexpected(Parser *parser, FILE *err)
+{
+	// the token the parser stopped on, after the whole expression (streamed: its position)
+	Token tok = parser_peek(parser);
+	if (parser->stream) {
+		fprintf(err, "input at byte %zu", tokenstream_offset(parser->stream));
+	} else {
+		Tokenizer const *tkz = parser->tkz;
+		fprintf(err, "expression \"%.*s\"",
+			(int)(tkz->offsets[tkz->n_tokens - 1] - tkz->offsets[0]),
+			tkz->input + tkz->offsets[0]);
+	}
+	if (tok.type == TOK_EOF) {
+		fprintf(err, " ends unexpectedly\n");
+	} else if (tok.type == TOK_LIT) {
+		fprintf(err, " has a literal \"%.*s\" too large for a long\n", (int)tok.length,
+			tok.token_string);
+	} else if (tok.type == TOK_ERROR) {
+		fprintf(err, " contains invalid token \"%.*s\"\n", (int)tok.length, tok.token_string);
+	} else {
+		fprintf(err, " has an unexpected token \"%.*s\"\n", (int)tok.length,
+			tok.token_string);
+	}
+}
+
+ptrdiff_t expressiontree_validate(Tokenizer const *tkz)
+{
+	/*
+	 * Token-level checks done before parsing (ptrdiff_t: up to TOKENIZER_MAX_INPUT tokens):
+	 * - returns tkz->n_tokens if the tokens may form an expression
+	 * - the index of the first TOK_ERROR token
+	 * - -1 if the parentheses do not pair up
+	 * whichever error comes first (a ')' closing nothing is found where it stands, a '(' left
+	 * open only at the end)
+	 */
+	assert(tkz && tkz->n_tokens > 0 && "parameter tkz must be a valid, non-empty Tokenizer *");
+	return _expr_error_idx(tkz->types, tkz->n_tokens);
+}
 
-		expressiontree_print_to_file(fp, depth + 1, root->binary.left);
-		expressiontree_print_to_file(fp, depth + 1, root->binary.right);
+void expressiontree_print_to_file(FILE *fp, int depth, ExpressionTree root)
+{
+	// the EMIT_TREE format of emit.h, written to fp in blocks of EMIT_PRINT_BUFFER bytes
+	assert(fp);
+	char buf[EMIT_PRINT_BUFFER];
+	Emitter em;
+	emitter_init_file(&em, fp, buf, sizeof(buf));
+	if (emitter_tree(&em, root, EMIT_TREE, depth) < 0 && errno == ENOMEM) {
+		fprintf(stderr, "out of memory while printing the expression tree\n");
 	}
+	emitter_flush(&em);
+	emitter_destroy(&em);
 }
 
 void expressiontree_destroy_tree(ExpressionTree *root)
 {
-	// freeing tree via a post order tree walk
+	/*
+	 * free the tree in constant space: while the current node has a left child, rotate that
+	 * child up (the node becomes its right child), so the left spine is flattened into a
+	 * chain of right children that is freed one node at a time.
+	 * (unary nodes keep their operand in binary.left, so they are handled alike)
+	 */
 	assert(root && "arg root must be a valid ExpressionTree * (ASTNode **)");
-	if (*root) {
-		// recursively free the tree (treating ExpressionTree as regular Binary Tree)
-		expressiontree_destroy_tree(&(*root)->binary.left);
-		expressiontree_destroy_tree(&(*root)->binary.right);
-		free(*root);
-		*root = NULL;
+	STATS_BEGIN(start);
+	ExpressionTree node = *root;
+	while (node) {
+		if (node->binary.left) {
+			ExpressionTree left = node->binary.left;
+			node->binary.left = left->binary.right;
+			left->binary.right = node;
+			node = left;
+		} else {
+			ExpressionTree right = node->binary.right;
+			free(node);
+			node = right;
+		}
 	}
+	*root = NULL;
+	STATS_END(STATS_DESTROY, start);
 }
 
-static inline ExpressionTree _alloc_node()
+static inline ExpressionTree _alloc_node(Parser *parser)
 {
-        ExpressionTree node = malloc(sizeof(*node));
+        // returns NULL and sets parser->failed when out of memory or out of node budget
+        if (parser->nodes_left == 0) {
+                parser->failed = true;
+                return NULL;
+        }
+        ExpressionTree node = NULL;
+        if (parser->arena) {
+                node = nodearena_alloc(parser->arena);  // already zeroed
+        } else if ((node = malloc(sizeof(*node)))) {
+                *node = (ASTNode) { 0 };        // zero out allocated struct to prevent uninit. memory access
+        }
         if (!node) {
-                panic("malloc failed when allocating ASTNode");
+                parser->failed = true;
+                return NULL;
         }
-        *node = (ASTNode) { 0 };        // zero out allocated struct to prevent uninit. memory access
+        parser->nodes_left -= 1;
+        STATS_ADD(n_nodes, 1);
         return node;
 }
 
-static inline int _expr_error_idx(Token *expr, size_t length)
+static inline ptrdiff_t _expr_error_idx(uint8_t const *types, size_t length)
 {
-	// look for error tokens and track the number of '(' and ')'
-	if (expr[0].type == TOK_RPAREN) {
-		// no expression should start with a ')'
-		return -1;
+	/*
+	 * One scan over the token types, nothing allocated: the nesting depth is a running sum of
+	 * +1 per '(' and -1 per ')'. The first error in token order is reported: a TOK_ERROR
+	 * (its index) or a ')' with no '(' left to close (-1). '(' still open at the end: -1.
+	 */
+	size_t i = 0;
+	long depth = 0;
+#ifdef __SSE2__
+	/*
+	 * 16 types at a time: blocks without a parenthesis or an error token are skipped after one
+	 * compare, otherwise the block's depths are the prefix sum of its ±1 (4 shift-and-add steps).
+	 */
+	__m128i const error = _mm_set1_epi8(TOK_ERROR);
+	__m128i const lparen = _mm_set1_epi8(TOK_LPAREN), rparen = _mm_set1_epi8(TOK_RPAREN);
+	for (; i + 16 <= length; i += 16) {
+		__m128i v = _mm_loadu_si128((__m128i const *)(types + i));
+		__m128i open = _mm_cmpeq_epi8(v, lparen), close = _mm_cmpeq_epi8(v, rparen);
+		unsigned errors = _mm_movemask_epi8(_mm_cmpeq_epi8(v, error));
+		unsigned opens = _mm_movemask_epi8(open);
+		if (!(errors | opens | _mm_movemask_epi8(close))) {
+			continue;
+		}
+		STATS_ADD(n_parens, __builtin_popcount(opens));
+		__m128i step = _mm_sub_epi8(close, open);	// lanes are -1 (true) or 0
+		step = _mm_add_epi8(step, _mm_slli_si128(step, 1));
+		step = _mm_add_epi8(step, _mm_slli_si128(step, 2));
+		step = _mm_add_epi8(step, _mm_slli_si128(step, 4));
+		step = _mm_add_epi8(step, _mm_slli_si128(step, 8));	// |depth change| <= 16
+		unsigned negative = 0;
+		if (depth < 16) {
+			negative = _mm_movemask_epi8(_mm_cmplt_epi8(step, _mm_set1_epi8(-depth)));
+		}
+		if (errors | negative) {
+			unsigned first = __builtin_ctz(errors | negative);
+			return (negative & (1u << first)) ? -1 : (ptrdiff_t)(i + first);
+		}
+		depth += (signed char)(_mm_extract_epi16(step, 7) >> 8);
 	}
-
-	StackFrame *stack = NULL;
-	for (Token *tok = expr; tok < expr + length; tok++) {
-		switch (tok->type) {
+#endif
+	for (; i < length; i++) {
+		switch (types[i]) {
 		case TOK_ERROR:
-			return tok - expr;
+			return (ptrdiff_t)i;
 		case TOK_LPAREN:
-			push(&stack, tok);
+			STATS_ADD(n_parens, 1);
+			depth++;
 			break;
 		case TOK_RPAREN:
-			pop(&stack);
+			if (--depth < 0) {
+				return -1;
+			}
 			break;
 		default:
 			break;
 		}
 	}
-
-	bool good_paren = is_empty(stack);
-	while (!is_empty(stack)) {
-		pop(&stack);
-	}
-
-	return good_paren ? length : -1;
+	return depth == 0 ? (ptrdiff_t)length : -1;
 }
 
 static inline binding_power_t _assign_bp(Token token)
@@ -154,8 +410,8 @@ static inline binding_power_t _assign_prefix(Token token)
                 return (binding_power_t) {.lbp = 0, .rbp = 6};
         case TOK_INC: case TOK_DEC:
                 return (binding_power_t) {.lbp = 0, .rbp = 8};
-        default:
-		panic("bad token passed to _assign_prefix");
+        default:	// ')', EOF, ...: cannot start an operand
+                return (binding_power_t) {.lbp = -1, .rbp = -1};
 	}
 }
 
@@ -169,151 +425,277 @@ static inline binding_power_t _assign_infix(Token token)
         // implicit multiplication treated like regular multiplication
                 return (binding_power_t) {.lbp = 3, .rbp = 4};
         default:
-		panic("bad token passed to _assign_infix");
+                return (binding_power_t) {.lbp = -1, .rbp = -1};
         }
 }
 
-static inline ExpressionTree _parse_expr(Parser *parser, precedence_t curr_bp)
+/*
+ * The Pratt parser runs on an explicit stack of continuation frames instead of the C stack.
+ * It is the recursive descent
+ *	expr   := prefix (op expr | atom | postfix)*	(while op binds tighter than curr_bp)
+ *	prefix := op prefix | atom | EOF
+ *	atom   := (TOK_LIT | TOK_VAR | '(' expr) postfix
+ * unrolled: a "call" pushes a frame recording what to do with the result, a "return" hands `ret`
+ * to the frame on top. Trees come out exactly as the recursive functions built them.
+ */
+enum frame_kind_t {
+	FRAME_EXPR,		/* expr loop, waiting for the prefix that starts it (lhs) */
+	FRAME_EXPR_RHS,		/* expr loop, waiting for the right operand of lhs */
+	FRAME_EXPR_ATOM,	/* expr loop, waiting for the right operand of op (implicit '*') */
+	FRAME_PREFIX,		/* prefix operator node, waiting for its operand */
+	FRAME_PAREN		/* '(' expr, waiting for the expr */
+};
+
+typedef struct {
+	enum frame_kind_t kind;
+	precedence_t bp;	/* FRAME_EXPR*: binding power the expr loop was called with */
+	ExpressionTree lhs;	/* FRAME_EXPR*: left-hand side so far, FRAME_PREFIX: operator node */
+	ExpressionTree op;	/* FRAME_EXPR_ATOM: implicit '*' node, op->binary.left == lhs */
+	size_t start;		/* FRAME_EXPR*: token the expr starts at */
+} ParseFrame;
+
+enum parse_step_t {STEP_EXPR, STEP_PREFIX, STEP_ATOM, STEP_RETURN};
+
+static inline ExpressionTree _parse(Parser *parser, size_t max_depth, bool *over_budget)
 {
-	/*      Entry point of all forms expression parsing, assume infix by default.
-	 *  			expr := expr op expr
-	 *  1) Build up the first expr on the rhs of the above rule, and store it in lhs
-         *      - parser is advanced and pointing to op after this
-         *  2) parse the op node, and recursively parse the last expr
-         *  3) return lhs when no tokens are left
-	 */ 
-	assert(parser && "parameter parser must be a valid Parser *");
-
-	ExpressionTree lhs = _parse_prefix(parser, curr_bp);
-        // lhs should be completely parsed at this stage, and parser->curr[0] should now be an
-        // operator or a ')'
-        while (1) {
-                Token tok = parser_peek(parser);
-                switch (tok.type) {
-                case TOK_EOF: case TOK_ERROR: case TOK_RPAREN:
-                        // Base cases
-                        // ')' means end of a nested expression, return
-                        goto exit;
-                case TOK_ADD: case TOK_MINUS:
-                case TOK_MULT: case TOK_DIV: case TOK_MOD:
-                case TOK_LIT: case TOK_VAR: case TOK_LPAREN:
-                case TOK_INC: case TOK_DEC:
-                        break;
-                default:
-                        panic("Invalid operator token in _parse_expr");
-                }
+	ParseFrame inline_frames[INLINE_FRAMES];
+	ParseFrame *frames = inline_frames;
+	size_t capacity = INLINE_FRAMES, depth = 0;
 
-                // now tok **must** be an operator, decide its relative position in the tree
-                binding_power_t bp = _assign_bp(tok);   
-                if (curr_bp >= bp.lbp) {
-                        // curr_bp ≥ bp.lbp meant current lhs resides lower in the tree, so return
-                        break;
-                }
+	enum parse_step_t step = STEP_EXPR;
+	precedence_t curr_bp = 0;	// argument of the pending call
+	ExpressionTree ret = NULL;	// value of the latest return
+	ExpressionTree node = NULL;
+	binding_power_t bp;
+	Token tok;
 
-                // make an op node
-                ExpressionTree op = _alloc_node();
-                *op = (ASTNode) {
-                        .token = tok,
-                        .value = 0,
-                        .binary.left = lhs
-                };
+#define PUSH_FRAME(...) do { \
+		if (depth == max_depth) { \
+			*over_budget = true; \
+			goto abort; \
+		} \
+		if (!stack_reserve((void **)&frames, &capacity, depth + 1, sizeof(*frames), \
+				   inline_frames)) { \
+			parser->failed = true; \
+			goto abort; \
+		} \
+		frames[depth++] = (ParseFrame) {__VA_ARGS__}; \
+		STATS_ADD(n_parse_frames, 1); \
+		STATS_MAX(max_depth, depth); \
+	} while (0)
 
-                switch (tok.type) {
-                case TOK_LIT: case TOK_VAR: case TOK_LPAREN:    // implicit multiplication
-                        op->token = (Token) {.type = TOK_MULT, .token_string = "*", .length = 1};
-                        op->binary.right = _parse_atom(parser, bp.rbp);
-                        lhs = op;
-                        tok = parser_peek(parser);
-                        continue;
-                case TOK_INC: case TOK_DEC:     // (lhs op) is a postfix expression
-                        lhs = _parse_postfix(parser, op);
-                        tok = parser_peek(parser);
-                        continue;
-                default:        // regular binary operators
-                        break;
-                } 
+	while (1) {
+		if (parser->failed) {
+			goto abort;
+		}
+		switch (step) {
+		case STEP_EXPR:
+			// expr: parse the prefix that starts it, then loop over operators
+			if (parser->memo && _memo_reuse(parser, curr_bp, &ret)) {
+				step = STEP_RETURN;
+				continue;
+			}
+			PUSH_FRAME(.kind = FRAME_EXPR, .bp = curr_bp, .start = parser->curr);
+			step = STEP_PREFIX;
+			continue;
 
-                // recursively build expr on the right
-                lhs = op;
-                parser_advance(parser);
-                lhs->binary.right = _parse_expr(parser, bp.rbp);
-	}
-exit:
-	return lhs;
-}
+		case STEP_PREFIX:
+			tok = parser_peek(parser);
+			switch (tok.type) {
+			case TOK_EOF:
+				ret = NULL;
+				step = STEP_RETURN;
+				continue;
+			case TOK_LIT: case TOK_VAR: case TOK_LPAREN:
+				step = STEP_ATOM;
+				continue;
+			case TOK_ADD: case TOK_MINUS: case TOK_INC: case TOK_DEC:
+				node = _alloc_node(parser);
+				if (!node) {
+					continue;
+				}
+				node->token = tok;
+				node->value = 0;
+				node->prefix = true;
+				_detach(parser, node);
 
-static inline ExpressionTree _parse_atom(Parser *parser, precedence_t curr_bp)
-{
-	/*
-	 *   Atom := TOK_LIT | TOK_VAR | '(' expr ')'
-	 *     -  makes call to _parse_expr, which could call _parse_atom (indirectly recursive)
-	 */
-	ExpressionTree node = NULL;
-        Token tok = parser_peek(parser);
-	switch (tok.type) {
-	// base cases: EOF | TOK_VAR | TOK_LIT
-	case TOK_EOF:
-		break;
-	case TOK_VAR: case TOK_LIT:
-		node = _alloc_node();
-		node->token = tok;
-		node->value = (node->token.type == TOK_LIT) ? atol(node->token.token_string) : NAN;
-                // technically don't need following inits, but do it to show we are making leaf nodes
-		node->binary.left  = NULL; 
-		node->binary.right = NULL; 
-		break;
-	case TOK_LPAREN:
-        // (indirectly) recursive case: 
-		parser_advance(parser);
-		node = _parse_expr(parser, 0);
-		break;
-	default:
-		panic("expecting TOK_VAR|TOK_LIT|'(' as the first token in _parse_atom");
-	}
-        // recall postfix := Atom+['++'|'--']*
-        node = _parse_postfix(parser, node);  // parser will be past any postfix expression after this
-        // NEVER advance the parser past the ')' in this function, this extra advancement disturbs
-        // the grouping of parenthesized expressions. Leave the task to the callers (_parse_expr)
-	return node;
-}
+				parser_advance(parser);
+				bp = _assign_prefix(parser_peek(parser));
+				if (bp.lbp < 0) {
+					// the operand is missing: '-' at the end, '(-)', ...
+					parser->failed = parser->unexpected = true;
+					ret = node;	// released by the abort path
+					continue;
+				}
+				// the prefix after it is its operand, also where an operand of a tighter
+				// operator starts ('2 * -3', 'a + ++b'): the operator never goes childless
+				ret = node;	// released by the abort path if the push fails
+				PUSH_FRAME(.kind = FRAME_PREFIX, .lhs = node);
+				ret = NULL;
+				curr_bp = bp.lbp;
+				step = STEP_PREFIX;
+				continue;
+			default:	// ')' where an operand should start: '()', ...
+				parser->failed = parser->unexpected = true;
+				continue;
+			}
 
-static inline ExpressionTree _parse_prefix(Parser *parser, precedence_t curr_bp)
-{
-        /* Dedicated function to parse prefix expressions 
-         *           prefix := op prefix |  Atom |  EOF
-         */
-        assert(parser && "parameter parser needs to be a valid Parser *");
+		case STEP_ATOM:
+			tok = parser_peek(parser);
+			switch (tok.type) {
+			case TOK_VAR: case TOK_LIT:
+				node = _alloc_node(parser);
+				if (!node) {
+					continue;
+				}
+				node->token = tok;
+				node->value = NAN;
+				if (tok.type == TOK_LIT && literal_decode(tok.token_string, tok.length,
+									  &node->value) != LITERAL_OK) {
+					// the literal does not fit a long
+					parser->failed = parser->unexpected = true;
+					ret = node;	// released by the abort path
+					continue;
+				}
+				_detach(parser, node);
+				// recall postfix := Atom+['++'|'--']*
+				ret = _parse_postfix(parser, node);
+				step = STEP_RETURN;
+				continue;
+			case TOK_LPAREN:
+				parser_advance(parser);
+				PUSH_FRAME(.kind = FRAME_PAREN);
+				curr_bp = 0;
+				step = STEP_EXPR;
+				continue;
+			default:
+				parser->failed = parser->unexpected = true;
+				continue;
+			}
 
-        ExpressionTree node = NULL;
-        binding_power_t bp = (binding_power_t) { 0 };
-        Token token = parser_peek(parser);
-	switch (token.type) {
-        // base cases
-        case TOK_EOF:
-                break;
-        case TOK_LIT: case TOK_VAR: case TOK_LPAREN:
-                node = _parse_atom(parser, curr_bp);
-                break;
-        // recursive cases
-	case TOK_ADD: case TOK_MINUS: case TOK_INC: case TOK_DEC:
-		node = _alloc_node();
-		node->token = token;
-		node->value = 0;
-
-		parser_advance(parser);
-                token = parser_peek(parser);
-                bp = _assign_prefix(token);
-                if (curr_bp <= bp.rbp) { 
-                        // the next token's precedence (bp) ≥ current token's precedence:
-                        // means it resides lower in the tree, recursively build it.
-                        node->unary.operand = _parse_prefix(parser, bp.lbp);
-                }
-		break;
-	default:
-		panic("bad token in _parse_prefix");
+		case STEP_RETURN:
+			break;
+		}
+
+		// STEP_RETURN: hand ret to the frame on top
+		if (depth == 0) {
+			break;
+		}
+		ParseFrame *frame = &frames[depth - 1];
+		switch (frame->kind) {
+		case FRAME_PREFIX:
+			frame->lhs->unary.operand = ret;
+			ret = frame->lhs;
+			depth--;
+			continue;
+		case FRAME_PAREN:
+			// the parser still refers to ')', _parse_postfix moves past it (and any '++'/'--')
+			depth--;
+			if (parser_peek(parser).type != TOK_RPAREN) {
+				// '(' never closed: only seen while streaming (the tokens are validated)
+				parser->failed = parser->unexpected = true;
+				continue;
+			}
+			ret = _parse_postfix(parser, ret);
+			continue;
+		case FRAME_EXPR:
+			frame->lhs = ret;
+			break;
+		case FRAME_EXPR_RHS:
+			if (!ret) {
+				// nothing after an infix operator: 'a -', '(a *)', ...
+				parser->failed = parser->unexpected = true;
+				continue;
+			}
+			frame->lhs->binary.right = ret;
+			break;
+		case FRAME_EXPR_ATOM:
+			frame->op->binary.right = ret;
+			frame->lhs = frame->op;
+			frame->op = NULL;
+			break;
+		}
+
+		// expr loop: lhs is complete, parser->curr should now be an operator or a ')'
+		frame->kind = FRAME_EXPR;
+		ret = NULL;
+		while (step == STEP_RETURN && !parser->failed) {
+			tok = parser_peek(parser);
+			switch (tok.type) {
+			case TOK_EOF: case TOK_ERROR: case TOK_RPAREN:
+				// ')' means end of a nested expression, return
+				bp.lbp = frame->bp;
+				break;
+			case TOK_ADD: case TOK_MINUS:
+			case TOK_MULT: case TOK_DIV: case TOK_MOD:
+			case TOK_LIT: case TOK_VAR: case TOK_LPAREN:
+			case TOK_INC: case TOK_DEC:
+				// tok **must** be an operator, decide its relative position in the tree
+				bp = _assign_bp(tok);
+				break;
+			default:
+				parser->failed = parser->unexpected = true;
+				continue;
+			}
+			if (frame->bp >= bp.lbp) {
+				// current lhs resides lower in the tree, return it
+				ret = frame->lhs;
+				if (parser->memo) {
+					_memo_record(parser->memo, frame->start, parser->curr, frame->bp, ret);
+				}
+				depth--;
+				break;
+			}
+
+			// make an op node
+			ExpressionTree op = _alloc_node(parser);
+			if (!op) {
+				break;
+			}
+			*op = (ASTNode) {
+				.token = tok,
+				.value = 0,
+				.binary.left = frame->lhs
+			};
+			_detach(parser, op);
+
+			switch (tok.type) {
+			case TOK_LIT: case TOK_VAR: case TOK_LPAREN:	// implicit multiplication
+				op->token = (Token) {.type = TOK_MULT, .token_string = "*", .length = 1};
+				frame->kind = FRAME_EXPR_ATOM;
+				frame->op = op;
+				curr_bp = bp.rbp;
+				step = STEP_ATOM;
+				break;
+			case TOK_INC: case TOK_DEC:	// (lhs op) is a postfix expression
+				op->postfix = true;
+				frame->lhs = _parse_postfix(parser, op);
+				break;
+			default:	// regular binary operators, build the expr on the right
+				frame->lhs = op;
+				frame->kind = FRAME_EXPR_RHS;
+				parser_advance(parser);
+				curr_bp = bp.rbp;
+				step = STEP_EXPR;
+				break;
+			}
+		}
 	}
+#undef PUSH_FRAME
+
+	stack_release(frames, inline_frames);
+	return ret;
 
-	return node;
+abort:
+	// every node built so far hangs off a frame or ret
+	if (!parser->arena) {
+		expressiontree_destroy_tree(&ret);
+		for (ParseFrame *frame = frames; frame < frames + depth; frame++) {
+			expressiontree_destroy_tree(frame->op ? &frame->op : &frame->lhs);
+		}
+	}
+	stack_release(frames, inline_frames);
+	return NULL;
 }
 
 static inline ExpressionTree _parse_postfix(Parser *parser, ExpressionTree lhs)
@@ -340,14 +722,72 @@ static inline ExpressionTree _parse_postfix(Parser *parser, ExpressionTree lhs)
                 if (tok.type != TOK_INC && tok.type != TOK_DEC) {
                         break;
                 }
-                ExpressionTree top_op = _alloc_node();  // this node is going "above" original lhs,
+                ExpressionTree top_op = _alloc_node(parser);  // this node is going "above" original lhs,
                                                         // thus called `top_op`
+                if (!top_op) {
+                        break;  // parser->failed is set, lhs is still a complete subtree
+                }
                 *top_op = (ASTNode) {
                         .token = tok,
                         .value = 0,
+                        .postfix = true,
                         .unary.operand = lhs
                 };
+                _detach(parser, top_op);
                 lhs = top_op;
         }
         return lhs;
 }
+
+static inline void _detach(Parser *parser, ExpressionTree node)
+{
+	// trees built against a memo or a stream outlive the text: detach every node as soon as
+	// it is made
+	if (parser->symbols && !symtab_intern_node(parser->symbols, node)) {
+		parser->failed = true;
+	}
+}
+
+static inline bool _memo_reuse(Parser *parser, precedence_t bp, ExpressionTree *ret)
+{
+	/*
+	 * An expr with binding power bp starts at parser->curr: take the tree the previous parse
+	 * recorded for it if that call had the same bp and none of its tokens changed since.
+	 * The parser then moves to the token that ended the call, the tokens in between keep their
+	 * entries (calls nested in the reused tree). Every entry the parser walks past otherwise
+	 * belongs to the previous tree only and is cleared.
+	 */
+	ParseMemo *memo = parser->memo;
+	size_t start = parser->curr;
+	_memo_clear(memo, memo->visited, start);
+	size_t end = start + ((memo->bps[start] >= 0) ? memo->spans[start] : 0);
+	if (memo->bps[start] != bp
+	    || (memo->dirty && end >= memo->dirty_start && start < memo->dirty_end)) {
+		_memo_clear(memo, start, start + 1);
+		if (memo->visited <= start) {
+			memo->visited = start + 1;
+		}
+		return false;
+	}
+	*ret = memo->roots[start];
+	parser->curr = end;
+	memo->visited = end;
+	memo->n_reused++;
+	return true;
+}
+
+static inline void _memo_record(ParseMemo *memo, size_t start, size_t end, precedence_t bp,
+				ExpressionTree root)
+{
+	// the expr call that started at start returned root, the token at end stopped it
+	memo->roots[start] = root;
+	memo->spans[start] = end - start;
+	memo->bps[start] = bp;
+}
+
+static inline void _memo_clear(ParseMemo *memo, size_t from, size_t to)
+{
+	if (from < to) {
+		memset(memo->bps + from, -1, (to - from) * sizeof(*memo->bps));
+	}
+}
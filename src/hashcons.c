@@ -0,0 +1,213 @@
+#include "../headers/hashcons.h"
+
+#define INLINE_FRAMES 64
+#define TEXT_CHUNK 4096	// bytes of token text per chunk (longer tokens get a chunk of their own)
+
+static inline uint64_t _node_hash(ASTNode const *node);
+static inline bool _node_equal(ASTNode const *a, ASTNode const *b);
+static inline ASTNode *_lookup_or_add(HashCons *hc, ASTNode const *probe);
+static inline bool _grow_slots(HashCons *hc);
+static inline char const *_copy_text(HashCons *hc, char const *text, size_t length);
+
+void hashcons_init(HashCons *hc)
+{
+	assert(hc && "parameter hc must be a valid HashCons *");
+	*hc = (HashCons) { 0 };
+	nodearena_init(&hc->nodes, NODEARENA_DEFAULT_SLAB);
+	nodearena_init(&hc->scratch, NODEARENA_DEFAULT_SLAB);
+}
+
+ExpressionTree hashcons_intern(HashCons *hc, ExpressionTree root)
+{
+	/*
+	 * - Returns the DAG root standing for the tree root (which is left untouched), or NULL if
+	 *   out of memory.
+	 * - Post-order walk: a node is interned after its children, so that children are already
+	 *   unique and two subtrees are equal exactly when their roots match field by field.
+	 */
+	assert(hc && "parameter hc must be a valid HashCons *");
+	if (!root) {
+		return NULL;
+	}
+	typedef struct {ExpressionTree node; bool children_done;} InternFrame;
+	InternFrame inline_frames[INLINE_FRAMES];
+	InternFrame *frames = inline_frames;
+	size_t capacity = INLINE_FRAMES, size = 0;
+	ASTNode *inline_done[INLINE_FRAMES];	// interned subtrees waiting for their parent
+	ASTNode **done = inline_done;
+	size_t done_cap = INLINE_FRAMES, n_done = 0;
+
+	bool failed = false;
+	frames[size++] = (InternFrame) {root, false};
+	while (size > 0 && !failed) {
+		InternFrame *top = &frames[size - 1];
+		ExpressionTree node = top->node;
+		if (!top->children_done) {
+			top->children_done = true;
+			if (!stack_reserve((void **)&frames, &capacity, size + 2, sizeof(*frames),
+					   inline_frames)) {
+				failed = true;
+				continue;
+			}
+			if (node->binary.right) {
+				frames[size++] = (InternFrame) {node->binary.right, false};
+			}
+			if (node->binary.left) {
+				frames[size++] = (InternFrame) {node->binary.left, false};
+			}
+			continue;
+		}
+		size--;
+
+		ASTNode probe = {
+			.token = node->token,
+			.value = node->value,
+			.postfix = node->postfix,
+			.prefix = node->prefix,
+			.slot = node->slot
+		};
+		if (node->binary.right) {
+			probe.binary.right = done[--n_done];
+		}
+		if (node->binary.left) {
+			probe.binary.left = done[--n_done];
+		}
+		ASTNode *unique = _lookup_or_add(hc, &probe);
+		if (!unique || !stack_reserve((void **)&done, &done_cap, n_done + 1, sizeof(*done),
+					      inline_done)) {
+			failed = true;
+			continue;
+		}
+		done[n_done++] = unique;
+		hc->n_interned += 1;
+	}
+	ASTNode *dag = failed ? NULL : done[0];
+
+	stack_release(frames, inline_frames);
+	stack_release(done, inline_done);
+	return dag;
+}
+
+void hashcons_destroy(HashCons *hc)
+{
+	assert(hc && "parameter hc must be a valid HashCons *");
+	nodearena_destroy(&hc->nodes);
+	nodearena_destroy(&hc->scratch);
+	free(hc->slots);
+	while (hc->chunks) {
+		TextChunk *next = hc->chunks->next;
+		free(hc->chunks);
+		hc->chunks = next;
+	}
+	*hc = (HashCons) { 0 };
+}
+
+static inline uint64_t _node_hash(ASTNode const *node)
+{
+	// children are unique already, their addresses identify them
+	uint64_t hash = 0xcbf29ce484222325ULL ^ ((uint64_t)node->token.type << 8
+							| node->prefix << 1 | node->postfix);
+	hash = (hash ^ (uintptr_t)node->binary.left) * 0x100000001b3ULL;
+	hash = (hash ^ (uintptr_t)node->binary.right) * 0x100000001b3ULL;
+	if (node->token.type == TOK_LIT || node->token.type == TOK_VAR) {
+		hash = (hash ^ (uint64_t)node->value) * 0x100000001b3ULL;
+		for (size_t i = 0; node->token.token_string && i < node->token.length; i++) {
+			hash = (hash ^ (unsigned char)node->token.token_string[i]) * 0x100000001b3ULL;
+		}
+	}
+	return hash ^ (hash >> 29);
+}
+
+static inline bool _node_equal(ASTNode const *a, ASTNode const *b)
+{
+	// operators are told apart by type, fixity and children only ("*" is also implicit '*')
+	if (a->token.type != b->token.type || a->postfix != b->postfix || a->prefix != b->prefix
+	    || a->binary.left != b->binary.left || a->binary.right != b->binary.right) {
+		return false;
+	}
+	if (a->token.type != TOK_LIT && a->token.type != TOK_VAR) {
+		return true;
+	}
+	if (a->value != b->value || a->slot != b->slot || a->token.length != b->token.length
+	    || !a->token.token_string != !b->token.token_string) {
+		return false;
+	}
+	return !a->token.token_string
+	       || memcmp(a->token.token_string, b->token.token_string, a->token.length) == 0;
+}
+
+static inline ASTNode *_lookup_or_add(HashCons *hc, ASTNode const *probe)
+{
+	// the stored node equal to probe, added (with its own copy of the text) if there is none
+	if (2 * (hc->n_distinct + 1) > hc->n_slots && !_grow_slots(hc)) {
+		return NULL;
+	}
+	size_t i = _node_hash(probe) & (hc->n_slots - 1);
+	for (; hc->slots[i]; i = (i + 1) & (hc->n_slots - 1)) {
+		if (_node_equal(hc->slots[i], probe)) {
+			hc->slots[i]->shared = true;
+			return hc->slots[i];
+		}
+	}
+
+	ASTNode *node = nodearena_alloc(&hc->nodes);
+	if (!node) {
+		return NULL;
+	}
+	*node = *probe;
+	if (probe->token.token_string) {
+		node->token.token_string = _copy_text(hc, probe->token.token_string,
+						      probe->token.length);
+		if (!node->token.token_string) {
+			return NULL;	// the node stays unused in the arena
+		}
+	}
+	ASTNode const *left = node->binary.left, *right = node->binary.right;
+	node->pure = (left ? left->pure : true) && (right ? right->pure : true)
+		     && !((node->token.type == TOK_INC || node->token.type == TOK_DEC)
+			  && left && left->token.type == TOK_VAR);
+	hc->slots[i] = node;
+	hc->n_distinct += 1;
+	return node;
+}
+
+static inline bool _grow_slots(HashCons *hc)
+{
+	size_t n_slots = hc->n_slots ? 2 * hc->n_slots : 256;
+	ASTNode **slots = calloc(n_slots, sizeof(*slots));
+	if (!slots) {
+		return false;
+	}
+	for (size_t i = 0; i < hc->n_slots; i++) {
+		if (hc->slots[i]) {
+			size_t j = _node_hash(hc->slots[i]) & (n_slots - 1);
+			while (slots[j]) {
+				j = (j + 1) & (n_slots - 1);
+			}
+			slots[j] = hc->slots[i];
+		}
+	}
+	free(hc->slots);
+	hc->slots = slots;
+	hc->n_slots = n_slots;
+	return true;
+}
+
+static inline char const *_copy_text(HashCons *hc, char const *text, size_t length)
+{
+	// bump-allocate length + 1 bytes (null-terminated copy) out of the newest chunk
+	TextChunk *chunk = hc->chunks;
+	if (!chunk || chunk->size - chunk->used < length + 1) {
+		size_t size = (length + 1 > TEXT_CHUNK) ? length + 1 : TEXT_CHUNK;
+		if (!(chunk = malloc(sizeof(*chunk) + size))) {
+			return NULL;
+		}
+		*chunk = (TextChunk) {.next = hc->chunks, .size = size};
+		hc->chunks = chunk;
+	}
+	char *copy = chunk->text + chunk->used;
+	memcpy(copy, text, length);
+	copy[length] = '\0';
+	chunk->used += length + 1;
+	return copy;
+}
@@ -0,0 +1,416 @@
+#define _DEFAULT_SOURCE	// MAP_ANONYMOUS
+
+#include "../headers/jit.h"
+
+#if defined(__x86_64__) && defined(__linux__) && !defined(EXPR_NO_JIT)
+#define JIT_NATIVE
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+eval_status_t jit_run(JitProgram const *jit, VM *vm, long *vars, long *result)
+{
+	// runs the native code if there is some, the bytecode on vm otherwise
+	assert(jit && result);
+	if (jit->fn) {
+		return jit->fn(vars, result);
+	}
+	assert(vm && "a JitProgram with no native code runs on a VM");
+	return vm_run(vm, &jit->prog, vars, result);
+}
+
+void jit_destroy(JitProgram *jit)
+{
+	assert(jit && "parameter jit must be a valid JitProgram *");
+#ifdef JIT_NATIVE
+	if (jit->code) {
+		munmap(jit->code, jit->code_size);
+	}
+#endif
+	bytecode_destroy(&jit->prog);
+	*jit = (JitProgram) { 0 };
+}
+
+#ifndef JIT_NATIVE
+eval_status_t jit_compile(ExpressionTree root, JitProgram *jit)
+{
+	// no code generator for this target: the bytecode is all there is
+	assert(jit && "parameter jit must be a valid JitProgram *");
+	*jit = (JitProgram) { 0 };
+	return bytecode_compile(root, &jit->prog);
+}
+#else
+
+/*
+ * Code generation, a single pass over the bytecode. The depth of the VM stack before each
+ * instruction is known at compile time, so value i of the stack has a fixed home: register
+ * stack_regs[i] for the first JIT_REGS values, [rsp + 8 * (i - JIT_REGS)] past them. rax, rcx
+ * and rdx are scratch, rdi holds vars and rsi result for the whole function.
+ *
+ * Layout of the code:
+ *	fail:	epilogue returning EVAL_DIV_BY_ZERO	(every '/' and '%' jumps back here)
+ *	entry:	push the callee-saved registers used, reserve the frame (spills, then temps)
+ *		body
+ *		*result = value 0, epilogue returning EVAL_OK
+ */
+
+enum reg_t {RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15};
+
+#define JIT_REGS 9
+static uint8_t const stack_regs[JIT_REGS] = {R8, R9, R10, R11, RBX, R12, R13, R14, R15};
+#define JIT_SCRATCH_REGS 4	// stack_regs[0 ... 3] are caller-saved, the others are pushed
+
+/* Emitter: growing buffer of machine code */
+typedef struct {
+	uint8_t *code;
+	size_t size;
+	size_t capacity;
+	bool failed;		/* out of memory, code is incomplete */
+} Emitter;
+
+/* Frame: where the values of the function live */
+typedef struct {
+	size_t n_regs;		/* stack_regs in use */
+	size_t n_spills;	/* stack values past the registers */
+	size_t n_temps;
+	uint32_t size;		/* bytes reserved below the pushed registers */
+} Frame;
+
+static inline void _byte(Emitter *e, uint8_t byte);
+static inline void _u32(Emitter *e, uint32_t value);
+static inline void _op_rr(Emitter *e, unsigned op, unsigned reg, unsigned rm);
+static inline void _op_rm(Emitter *e, unsigned op, unsigned reg, unsigned base, int32_t disp);
+static inline void _mov_imm(Emitter *e, unsigned reg, long value);
+static inline size_t _jump(Emitter *e, unsigned op);
+static inline void _patch(Emitter *e, size_t at, size_t target);
+static inline void _epilogue(Emitter *e, Frame const *frame, eval_status_t status);
+static inline unsigned _value_reg(size_t i);
+static inline void _load(Emitter *e, unsigned reg, size_t i);
+static inline void _store(Emitter *e, size_t i, unsigned reg);
+static inline int32_t _temp_disp(Frame const *frame, uint32_t temp);
+static inline bool _frame_init(Frame *frame, Program const *prog);
+static inline size_t _lower(Emitter *e, Program const *prog, Frame const *frame);
+
+eval_status_t jit_compile(ExpressionTree root, JitProgram *jit)
+{
+	/*
+	 * - Compiles root to native code, the bytecode is kept in jit->prog (variable slots).
+	 * - Fails like bytecode_compile. If executable memory is refused, jit->fn is left NULL
+	 *   and jit_run uses the VM.
+	 * - The caller must jit_destroy jit after a successful compile.
+	 */
+	assert(jit && "parameter jit must be a valid JitProgram *");
+	*jit = (JitProgram) { 0 };
+	eval_status_t status = bytecode_compile(root, &jit->prog);
+	if (status != EVAL_OK) {
+		return status;
+	}
+	Frame frame;
+	if (!_frame_init(&frame, &jit->prog)) {
+		return EVAL_OK;		// too large to address, run on the VM
+	}
+
+	Emitter e = { 0 };
+	size_t entry = _lower(&e, &jit->prog, &frame);
+	if (e.failed) {
+		free(e.code);
+		bytecode_destroy(&jit->prog);
+		return EVAL_NO_MEMORY;
+	}
+
+	// write the code, then flip the pages to read+exec
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t size = (e.size + page - 1) / page * page;
+	void *code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (code != MAP_FAILED) {
+		memcpy(code, e.code, e.size);
+		if (mprotect(code, size, PROT_READ | PROT_EXEC) == 0) {
+			void *fn = (uint8_t *)code + entry;
+			memcpy(&jit->fn, &fn, sizeof(fn));	// object to function pointer, as dlsym
+			jit->code = code;
+			jit->code_size = size;
+		} else {
+			munmap(code, size);
+		}
+	}
+	free(e.code);
+	return EVAL_OK;
+}
+
+static inline bool _frame_init(Frame *frame, Program const *prog)
+{
+	// deepest stack of prog, false if its spills, temps or variables overflow a disp32
+	size_t depth = 0, max_depth = 0;
+	for (size_t i = 0; i < prog->n_code; i++) {
+		switch ((enum opcode_t)prog->code[i].op) {
+		case OP_CONST: case OP_LOAD: case OP_TEMP:
+		case OP_PRE_INC: case OP_PRE_DEC: case OP_POST_INC: case OP_POST_DEC:
+			depth++;
+			break;
+		case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+			depth--;
+			break;
+		case OP_NEG: case OP_INC: case OP_DEC: case OP_TEE:
+			break;
+		}
+		if (max_depth < depth) {
+			max_depth = depth;
+		}
+	}
+	frame->n_regs = (max_depth < JIT_REGS) ? max_depth : JIT_REGS;
+	frame->n_spills = max_depth - frame->n_regs;
+	frame->n_temps = prog->n_temps;
+	if (frame->n_spills + frame->n_temps > INT32_MAX / 8 || prog->n_vars > INT32_MAX / 8) {
+		return false;
+	}
+	frame->size = 8 * (frame->n_spills + frame->n_temps);
+	return true;
+}
+
+static inline size_t _lower(Emitter *e, Program const *prog, Frame const *frame)
+{
+	// emits the whole function, returns the offset of its entry point
+	size_t fail = e->size;
+	_epilogue(e, frame, EVAL_DIV_BY_ZERO);
+
+	size_t entry = e->size;
+	for (size_t i = JIT_SCRATCH_REGS; i < frame->n_regs; i++) {
+		if (stack_regs[i] >= R8) {
+			_byte(e, 0x41);
+		}
+		_byte(e, 0x50 + (stack_regs[i] & 7));			// push
+	}
+	if (frame->size > 0) {
+		_op_rr(e, 0x81, 5, RSP);				// sub rsp, size
+		_u32(e, frame->size);
+	}
+
+	size_t depth = 0;
+	for (Instr const *ip = prog->code; ip < prog->code + prog->n_code; ip++) {
+		int32_t var = 8 * (int32_t)ip->arg;
+		unsigned top = _value_reg(depth - 1), next = _value_reg(depth);
+		switch ((enum opcode_t)ip->op) {
+		case OP_CONST:
+			_mov_imm(e, next, prog->consts[ip->arg]);
+			_store(e, depth++, next);
+			break;
+		case OP_LOAD:
+			_op_rm(e, 0x8B, next, RDI, var);			// mov next, [rdi + var]
+			_store(e, depth++, next);
+			break;
+		case OP_TEMP:
+			_op_rm(e, 0x8B, next, RSP, _temp_disp(frame, ip->arg));
+			_store(e, depth++, next);
+			break;
+		case OP_PRE_INC: case OP_PRE_DEC:
+			_op_rm(e, 0x83, (ip->op == OP_PRE_INC) ? 0 : 5, RDI, var);	// add/sub [], 1
+			_byte(e, 1);
+			_op_rm(e, 0x8B, next, RDI, var);
+			_store(e, depth++, next);
+			break;
+		case OP_POST_INC: case OP_POST_DEC:
+			_op_rm(e, 0x8B, next, RDI, var);
+			_op_rm(e, 0x83, (ip->op == OP_POST_INC) ? 0 : 5, RDI, var);
+			_byte(e, 1);
+			_store(e, depth++, next);
+			break;
+		case OP_ADD: case OP_SUB: case OP_MUL: {
+			// left op= right, on registers, through rax/rcx if either is spilled
+			unsigned left = _value_reg(depth - 2), right = top;
+			if (left == RAX || right == RAX) {
+				_load(e, RAX, depth - 2);
+				_load(e, RCX, depth - 1);
+				left = RAX;
+				right = RCX;
+			}
+			if (ip->op == OP_MUL) {
+				_op_rr(e, 0x0FAF, left, right);			// imul left, right
+			} else {
+				_op_rr(e, (ip->op == OP_ADD) ? 0x01 : 0x29, right, left);
+			}
+			_store(e, depth - 2, left);
+			depth--;
+			break;
+		}
+		case OP_DIV: case OP_MOD: {
+			_load(e, RAX, depth - 2);
+			_load(e, RCX, depth - 1);
+			_op_rr(e, 0x85, RCX, RCX);				// test rcx, rcx
+			_patch(e, _jump(e, 0x0F84), fail);			// je fail
+			_op_rr(e, 0x83, 7, RCX);				// cmp rcx, -1
+			_byte(e, 0xFF);
+			size_t not_minus_one = _jump(e, 0x0F85);		// jne
+			if (ip->op == OP_DIV) {
+				_op_rr(e, 0xF7, 3, RAX);			// neg rax
+			} else {
+				_op_rr(e, 0x31, RAX, RAX);			// xor rax, rax
+			}
+			size_t done = _jump(e, 0xE9);				// jmp
+			_patch(e, not_minus_one, e->size);
+			_byte(e, 0x48);						// cqo
+			_byte(e, 0x99);
+			_op_rr(e, 0xF7, 7, RCX);				// idiv rcx
+			if (ip->op == OP_MOD) {
+				_op_rr(e, 0x89, RDX, RAX);			// mov rax, rdx
+			}
+			_patch(e, done, e->size);
+			_store(e, depth - 2, RAX);
+			depth--;
+			break;
+		}
+		case OP_NEG: case OP_INC: case OP_DEC:
+			_load(e, top, depth - 1);
+			if (ip->op == OP_NEG) {
+				_op_rr(e, 0xF7, 3, top);			// neg top
+			} else {
+				_op_rr(e, 0x83, (ip->op == OP_INC) ? 0 : 5, top);	// add/sub top, 1
+				_byte(e, 1);
+			}
+			_store(e, depth - 1, top);
+			break;
+		case OP_TEE:
+			_load(e, top, depth - 1);
+			_op_rm(e, 0x89, top, RSP, _temp_disp(frame, ip->arg));
+			break;
+		}
+	}
+
+	_load(e, RAX, 0);
+	_op_rm(e, 0x89, RAX, RSI, 0);						// mov [rsi], rax
+	_epilogue(e, frame, EVAL_OK);
+	return entry;
+}
+
+static inline void _epilogue(Emitter *e, Frame const *frame, eval_status_t status)
+{
+	// return status: release the frame, pop the callee-saved registers
+	_byte(e, 0xB8);								// mov eax, status
+	_u32(e, status);
+	if (frame->size > 0) {
+		_op_rr(e, 0x81, 0, RSP);					// add rsp, size
+		_u32(e, frame->size);
+	}
+	for (size_t i = frame->n_regs; i-- > JIT_SCRATCH_REGS;) {
+		if (stack_regs[i] >= R8) {
+			_byte(e, 0x41);
+		}
+		_byte(e, 0x58 + (stack_regs[i] & 7));			// pop
+	}
+	_byte(e, 0xC3);								// ret
+}
+
+static inline unsigned _value_reg(size_t i)
+{
+	// register holding value i of the stack, rax for the spilled ones (loaded/stored by hand)
+	return (i < JIT_REGS) ? stack_regs[i] : RAX;
+}
+
+static inline void _load(Emitter *e, unsigned reg, size_t i)
+{
+	// reg = value i of the stack
+	if (i >= JIT_REGS) {
+		_op_rm(e, 0x8B, reg, RSP, 8 * (int32_t)(i - JIT_REGS));
+	} else if (reg != stack_regs[i]) {
+		_op_rr(e, 0x89, stack_regs[i], reg);
+	}
+}
+
+static inline void _store(Emitter *e, size_t i, unsigned reg)
+{
+	// value i of the stack = reg
+	if (i >= JIT_REGS) {
+		_op_rm(e, 0x89, reg, RSP, 8 * (int32_t)(i - JIT_REGS));
+	} else if (reg != stack_regs[i]) {
+		_op_rr(e, 0x89, reg, stack_regs[i]);
+	}
+}
+
+static inline int32_t _temp_disp(Frame const *frame, uint32_t temp)
+{
+	return 8 * (int32_t)(frame->n_spills + temp);
+}
+
+static inline void _byte(Emitter *e, uint8_t byte)
+{
+	if (e->size == e->capacity) {
+		size_t capacity = e->capacity ? 2 * e->capacity : 256;
+		uint8_t *code = realloc(e->code, capacity);
+		if (!code) {
+			e->failed = true;
+			return;
+		}
+		e->code = code;
+		e->capacity = capacity;
+	}
+	e->code[e->size++] = byte;
+}
+
+static inline void _u32(Emitter *e, uint32_t value)
+{
+	for (size_t i = 0; i < 4; i++) {
+		_byte(e, value >> (8 * i));
+	}
+}
+
+static inline void _opcode(Emitter *e, unsigned op)
+{
+	if (op > 0xFF) {
+		_byte(e, op >> 8);
+	}
+	_byte(e, op);
+}
+
+static inline void _op_rr(Emitter *e, unsigned op, unsigned reg, unsigned rm)
+{
+	// REX.W op modrm(register rm), reg being a register or an opcode extension
+	_byte(e, 0x48 | ((reg >> 3) << 2) | (rm >> 3));
+	_opcode(e, op);
+	_byte(e, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+static inline void _op_rm(Emitter *e, unsigned op, unsigned reg, unsigned base, int32_t disp)
+{
+	// REX.W op modrm([base + disp32]), reg being a register or an opcode extension
+	_byte(e, 0x48 | ((reg >> 3) << 2) | (base >> 3));
+	_opcode(e, op);
+	_byte(e, 0x80 | ((reg & 7) << 3) | (base & 7));
+	if ((base & 7) == RSP) {
+		_byte(e, 0x24);		// SIB: no index, rsp/r12 base
+	}
+	_u32(e, (uint32_t)disp);
+}
+
+static inline void _mov_imm(Emitter *e, unsigned reg, long value)
+{
+	if (value >= INT32_MIN && value <= INT32_MAX) {
+		_op_rr(e, 0xC7, 0, reg);			// mov reg, imm32 (sign-extended)
+		_u32(e, (uint32_t)value);
+		return;
+	}
+	_byte(e, 0x48 | (reg >> 3));				// movabs reg, imm64
+	_byte(e, 0xB8 + (reg & 7));
+	_u32(e, (uint32_t)value);
+	_u32(e, (uint32_t)((unsigned long)value >> 32));
+}
+
+static inline size_t _jump(Emitter *e, unsigned op)
+{
+	// emits a jump with a rel32 to be patched, returns where the rel32 is
+	_opcode(e, op);
+	size_t at = e->size;
+	_u32(e, 0);
+	return at;
+}
+
+static inline void _patch(Emitter *e, size_t at, size_t target)
+{
+	if (e->failed) {
+		return;
+	}
+	uint32_t rel = (uint32_t)(target - (at + 4));
+	for (size_t i = 0; i < 4; i++) {
+		e->code[at + i] = rel >> (8 * i);
+	}
+}
+
+#endif /* JIT_NATIVE */
@@ -0,0 +1,110 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "../headers/literal.h"
+
+#define SWAR_DIGITS 8			// digits per 64-bit word
+#define SWAR_SCALE 100000000ULL		// 10^SWAR_DIGITS
+#define U64_DIGITS 19			// any 19-digit number fits a uint64_t (10^19 - 1 < 2^64)
+#define U128_DIGITS 39			// 2^128 - 1 has 39 digits
+
+static inline uint64_t _swar8(char const *p);
+static inline uint64_t _decode_u64(char const *digits, size_t length);
+static inline size_t _skip_zeros(char const **digits, size_t length);
+static inline uint64_t _mul_wide(uint64_t a, uint64_t b, uint64_t *hi);
+
+literal_status_t literal_decode(char const *digits, size_t length, long *value)
+{
+	// value of digits[0 ... length - 1] (all of them [0-9]) as a long
+	length = _skip_zeros(&digits, length);
+	if (length > U64_DIGITS) {
+		return LITERAL_OVERFLOW;
+	}
+	uint64_t v = _decode_u64(digits, length);
+	if (v > LONG_MAX) {
+		return LITERAL_OVERFLOW;
+	}
+	*value = (long)v;
+	return LITERAL_OK;
+}
+
+literal_status_t literal_decode_128(char const *digits, size_t length, Literal128 *value)
+{
+	// same as literal_decode, as an unsigned 128-bit value: U64_DIGITS digits at a time
+	length = _skip_zeros(&digits, length);
+	if (length > U128_DIGITS) {
+		return LITERAL_OVERFLOW;
+	}
+	size_t head = length % (2 * SWAR_DIGITS);
+	Literal128 v = {.hi = 0, .lo = _decode_u64(digits, head)};
+	for (size_t i = head; i < length; i += 2 * SWAR_DIGITS) {
+		// v = v * 10^16 + next 16 digits
+		uint64_t carry, hi_hi;
+		uint64_t lo = _mul_wide(v.lo, SWAR_SCALE * SWAR_SCALE, &carry);
+		uint64_t hi = _mul_wide(v.hi, SWAR_SCALE * SWAR_SCALE, &hi_hi);
+		uint64_t next = _decode_u64(digits + i, 2 * SWAR_DIGITS);
+		v.hi = hi + carry;
+		if (hi_hi || v.hi < hi) {
+			return LITERAL_OVERFLOW;
+		}
+		v.lo = lo + next;
+		if (v.lo < lo && ++v.hi == 0) {
+			return LITERAL_OVERFLOW;
+		}
+	}
+	*value = v;
+	return LITERAL_OK;
+}
+
+static inline uint64_t _swar8(char const *p)
+{
+	/*
+	 * value of the 8 digits at p, reduced in the word holding them: digits are paired into
+	 * 2-digit numbers, then those into 4-digit numbers, then into one 8-digit number.
+	 */
+	uint64_t chunk;
+	memcpy(&chunk, p, sizeof(chunk));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	chunk = __builtin_bswap64(chunk);	// first digit in the low byte
+#endif
+	chunk -= 0x3030303030303030ULL;				// '0' ... '9' to 0 ... 9
+	chunk = (chunk * 10) + (chunk >> 8);			// bytes 0, 2, 4, 6: 2 digits each
+	chunk = (((chunk & 0x000000ff000000ffULL) * (100 + (1000000ULL << 32)))
+		 + (((chunk >> 16) & 0x000000ff000000ffULL) * (1 + (10000ULL << 32)))) >> 32;
+	return chunk;
+}
+
+static inline uint64_t _decode_u64(char const *digits, size_t length)
+{
+	// length ≤ U64_DIGITS: the leading length % 8 digits one by one, then 8 at a time
+	size_t head = length % SWAR_DIGITS;
+	uint64_t v = 0;
+	for (size_t i = 0; i < head; i++) {
+		v = v * 10 + (uint64_t)(digits[i] - '0');
+	}
+	for (size_t i = head; i < length; i += SWAR_DIGITS) {
+		v = v * SWAR_SCALE + _swar8(digits + i);
+	}
+	return v;
+}
+
+static inline size_t _skip_zeros(char const **digits, size_t length)
+{
+	// drop leading zeros (a literal of zeros alone keeps none, its value is 0)
+	while (length > 0 && **digits == '0') {
+		(*digits)++;
+		length--;
+	}
+	return length;
+}
+
+static inline uint64_t _mul_wide(uint64_t a, uint64_t b, uint64_t *hi)
+{
+	// a * b as hi * 2^64 + returned low word, from 32-bit halves
+	uint64_t a_lo = (uint32_t)a, a_hi = a >> 32, b_lo = (uint32_t)b, b_hi = b >> 32;
+	uint64_t p0 = a_lo * b_lo, p1 = a_lo * b_hi, p2 = a_hi * b_lo, p3 = a_hi * b_hi;
+	uint64_t mid = (p0 >> 32) + (uint32_t)p1 + (uint32_t)p2;
+	*hi = p3 + (p1 >> 32) + (p2 >> 32) + (mid >> 32);
+	return (mid << 32) | (uint32_t)p0;
+}
@@ -0,0 +1,595 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "../headers/pareval.h"
+#include "../headers/stack.h"
+
+#define INLINE_SUBTREES 64	// subtrees kept on the C stack before the planning scan moves to the heap
+
+/* Subtree: an operand on the planning scan's stack, nodes[start ... ] up to the current node */
+typedef struct {
+	uint32_t start;
+	uint32_t max_stack;
+	bool tainted;		/* reads a variable the tree updates */
+} Subtree;
+
+/* TaskState: outcome of a task in the run in progress */
+typedef struct {
+	long *stack;		/* max_stack + 1 values, cut from one block per run */
+	long result;
+	eval_status_t status;
+	atomic_bool done;
+} TaskState;
+
+/* TaskDeque: queued task ids of a worker, ids[top ... bottom - 1]. The owner pushes and takes
+ * back at the bottom, thieves steal at the top. */
+typedef struct {
+	pthread_mutex_t lock;
+	uint32_t *ids;
+	size_t top;
+	size_t bottom;
+	size_t capacity;
+} TaskDeque;
+
+/* PoolWorker: a thread of the pool (workers[0] stands for the thread calling pareval_run) */
+typedef struct {
+	TaskPool *pool;
+	size_t id;		/* its deque is pool->deques[id] */
+	pthread_t thread;
+	size_t n_steals;
+} PoolWorker;
+
+/* Run: a plan being run, its variables and the state of its tasks */
+typedef struct {
+	EvalPlan const *plan;
+	long *vars;
+	TaskState *states;
+	TaskPool *pool;		/* NULL: every hole is run where the scan reaches it */
+} Run;
+
+struct TaskPool {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;	/* a task was queued or is done, or the pool closes */
+	TaskDeque *deques;
+	PoolWorker *workers;
+	size_t n_workers;	/* workers[0 ... n_workers - 1], threads from workers[1] on */
+	size_t n_queued;	/* tasks in the deques, guarded by lock */
+	bool closing;		/* guarded by lock */
+	Run run;		/* set before the run's first task is queued */
+};
+
+static inline int _plan_tasks(EvalPlan *plan, size_t grain);
+static int _compare_tasks(void const *a, void const *b);
+static void _run_task(Run *run, PoolWorker *self, uint32_t id);
+static inline eval_status_t _scan(Run *run, PoolWorker *self, PlanTask const *task, long *stack,
+				  uint32_t *n_reached, long *result);
+static inline eval_status_t _hole_value(Run *run, PoolWorker *self, uint32_t id, long *value);
+static inline void _push_holes(PoolWorker *self, EvalPlan const *plan, PlanTask const *task);
+static inline bool _take_back(PoolWorker *self, uint32_t id);
+static inline bool _take(TaskPool *pool, PoolWorker *self, uint32_t *id);
+static inline void _wait(Run *run, PoolWorker *self, uint32_t id);
+static void *_worker_main(void *arg);
+
+eval_status_t pareval_plan(ExpressionTree root, size_t grain, EvalPlan *plan)
+{
+	/*
+	 * - Flattens root and cuts it into tasks of at least grain nodes (PAREVAL_GRAIN if 0), to
+	 *   be released with pareval_destroy.
+	 * - Returns EVAL_OK, EVAL_NO_MEMORY, or what compact_from_tree fails with. A malformed tree
+	 *   gets a plan without tasks: pareval_run reports EVAL_MALFORMED, like compact_evaluate.
+	 */
+	assert(plan && "parameter plan must be a valid EvalPlan *");
+	*plan = (EvalPlan) {0};
+	eval_status_t status = compact_from_tree(root, &plan->ct);
+	if (status != EVAL_OK || !plan->ct.well_formed) {
+		return status;
+	}
+	if (_plan_tasks(plan, grain ? grain : PAREVAL_GRAIN) < 0) {
+		pareval_destroy(plan);
+		return EVAL_NO_MEMORY;
+	}
+	return EVAL_OK;
+}
+
+eval_status_t pareval_run(EvalPlan const *plan, TaskPool *pool, long *vars, long *result)
+{
+	/*
+	 * - Evaluates plan with the semantics of evaluate.h, on pool (NULL: on the calling thread
+	 *   alone). vars holds plan->ct.n_vars values, numbered as in compact.h (bind them with
+	 *   compact_bind_slots), updated in place by '++'/'--'.
+	 * - Returns as compact_evaluate does on plan->ct, with the same result and variables.
+	 */
+	assert(plan && result);
+	assert((vars || plan->ct.n_vars == 0) && "vars must hold plan->ct.n_vars values");
+	if (plan->n_tasks == 0) {
+		return EVAL_MALFORMED;
+	}
+	// every stack allocated up front: workers never allocate
+	size_t n_values = 0;
+	for (size_t t = 0; t < plan->n_tasks; t++) {
+		n_values += plan->tasks[t].max_stack + 1;
+	}
+	TaskState *states = calloc(plan->n_tasks, sizeof(*states));
+	long *stacks = malloc(n_values * sizeof(*stacks));
+	if (!states || !stacks) {
+		free(states);
+		free(stacks);
+		return EVAL_NO_MEMORY;
+	}
+	for (size_t t = 0, n = 0; t < plan->n_tasks; t++) {
+		states[t].stack = stacks + n;
+		n += plan->tasks[t].max_stack + 1;
+	}
+	Run local = {.plan = plan, .vars = vars, .states = states};
+	Run *run = &local;
+	PoolWorker *self = NULL;
+	if (pool && pool->n_workers > 1 && plan->n_tasks > 1) {
+		// every deque must hold all the tasks, the workers do not look at them between runs
+		for (size_t i = 0; i < pool->n_workers; i++) {
+			TaskDeque *deque = &pool->deques[i];
+			if (deque->capacity < plan->n_tasks) {
+				uint32_t *ids = realloc(deque->ids, plan->n_tasks * sizeof(*ids));
+				if (!ids) {
+					free(states);
+					free(stacks);
+					return EVAL_NO_MEMORY;
+				}
+				deque->ids = ids;
+				deque->capacity = plan->n_tasks;
+			}
+		}
+		pthread_mutex_lock(&pool->lock);
+		pool->run = (Run) {.plan = plan, .vars = vars, .states = states, .pool = pool};
+		pthread_mutex_unlock(&pool->lock);
+		run = &pool->run;
+		self = &pool->workers[0];
+	}
+
+	// the whole tree is done once tasks[0] is: a task is done only after all of its holes
+	_run_task(run, self, 0);
+	*result = states[0].result;
+	eval_status_t status = states[0].status;
+	free(states);
+	free(stacks);
+	return status;
+}
+
+void pareval_destroy(EvalPlan *plan)
+{
+	assert(plan && "parameter plan must be a valid EvalPlan *");
+	compact_destroy(&plan->ct);
+	free(plan->tasks);
+	free(plan->hole_ids);
+	*plan = (EvalPlan) {0};
+}
+
+TaskPool *taskpool_create(size_t n_threads)
+{
+	/*
+	 * - A pool of n_threads workers (0: one per CPU), the thread calling pareval_run being one
+	 *   of them: n_threads - 1 threads are started, they sleep while no task is queued.
+	 * - Returns NULL if out of memory. A thread that cannot be started makes the pool smaller.
+	 */
+	if (n_threads == 0) {
+		long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		n_threads = (n_cpus > 0) ? (size_t)n_cpus : 1;
+	}
+	TaskPool *pool = calloc(1, sizeof(*pool));
+	if (!pool || !(pool->deques = calloc(n_threads, sizeof(*pool->deques)))
+	    || !(pool->workers = calloc(n_threads, sizeof(*pool->workers)))) {
+		if (pool) {
+			free(pool->deques);
+		}
+		free(pool);
+		return NULL;
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->changed, NULL);
+	for (size_t i = 0; i < n_threads; i++) {
+		pthread_mutex_init(&pool->deques[i].lock, NULL);
+	}
+	// workers wait for the lock before they look at n_workers, final once it is released
+	pthread_mutex_lock(&pool->lock);
+	pool->workers[0] = (PoolWorker) {.pool = pool, .id = 0};
+	for (pool->n_workers = 1; pool->n_workers < n_threads; pool->n_workers++) {
+		PoolWorker *worker = &pool->workers[pool->n_workers];
+		*worker = (PoolWorker) {.pool = pool, .id = pool->n_workers};
+		if (pthread_create(&worker->thread, NULL, _worker_main, worker) != 0) {
+			break;
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return pool;
+}
+
+size_t taskpool_size(TaskPool const *pool)
+{
+	// workers of pool, the thread calling pareval_run included
+	assert(pool && "parameter pool must be a valid TaskPool *");
+	return pool->n_workers;
+}
+
+size_t taskpool_steals(TaskPool const *pool)
+{
+	// tasks a worker took from another worker's deque, over every run (call between runs)
+	assert(pool && "parameter pool must be a valid TaskPool *");
+	size_t n_steals = 0;
+	for (size_t i = 0; i < pool->n_workers; i++) {
+		n_steals += pool->workers[i].n_steals;
+	}
+	return n_steals;
+}
+
+void taskpool_destroy(TaskPool *pool)
+{
+	if (!pool) {
+		return;
+	}
+	pthread_mutex_lock(&pool->lock);
+	pool->closing = true;
+	pthread_cond_broadcast(&pool->changed);
+	pthread_mutex_unlock(&pool->lock);
+	for (size_t i = 1; i < pool->n_workers; i++) {
+		pthread_join(pool->workers[i].thread, NULL);
+	}
+	size_t n_deques = pool->n_workers;
+	for (size_t i = 0; i < n_deques; i++) {
+		pthread_mutex_destroy(&pool->deques[i].lock);
+		free(pool->deques[i].ids);
+	}
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->changed);
+	free(pool->deques);
+	free(pool->workers);
+	free(pool);
+}
+
+static inline int _plan_tasks(EvalPlan *plan, size_t grain)
+{
+	/*
+	 * One scan of the nodes with a stack of operands, as evaluating them would: at a binary
+	 * node whose operands both have grain nodes or more, each operand reading no updated
+	 * variable becomes a task. Then the tasks are nested: the holes of a task are the largest
+	 * tasks inside it.
+	 */
+	CompactTree const *ct = &plan->ct;
+	bool *updated = calloc(ct->n_vars + 1, sizeof(*updated));
+	PlanTask *tasks = NULL;
+	size_t n_tasks = 0, tasks_cap = 0;
+	Subtree inline_subtrees[INLINE_SUBTREES];
+	Subtree *subtrees = inline_subtrees;
+	size_t capacity = INLINE_SUBTREES, size = 0;
+	int status = updated ? 0 : -1;
+
+	for (size_t i = 0; i < ct->n_nodes && status == 0; i++) {
+		CompactNode const *node = &ct->nodes[i];
+		if (node->op >= CT_PRE_INC && node->leaf != COMPACT_NONE) {
+			updated[node->leaf] = true;
+		}
+	}
+	for (uint32_t i = 0; i < ct->n_nodes && status == 0; i++) {
+		CompactNode const *node = &ct->nodes[i];
+		if (!stack_reserve((void **)&subtrees, &capacity, size + 1, sizeof(*subtrees),
+				   inline_subtrees)
+		    || !stack_reserve((void **)&tasks, &tasks_cap, n_tasks + 3, sizeof(*tasks), NULL)) {
+			status = -1;
+			break;
+		}
+		switch ((enum compact_op_t)node->op) {
+		case CT_LIT: case CT_VAR:
+			subtrees[size++] = (Subtree) {
+				.start = i,
+				.max_stack = 1,
+				.tainted = node->op == CT_VAR && updated[node->leaf]
+			};
+			continue;
+		case CT_ADD: case CT_SUB: case CT_MUL: case CT_DIV: case CT_MOD:
+			break;
+		default:	// unary: the operand's subtree grows by one node
+			continue;
+		}
+		Subtree *lhs = &subtrees[size - 2], *rhs = &subtrees[size - 1];
+		if (rhs->start - lhs->start >= grain && i - rhs->start >= grain) {
+			if (!lhs->tainted) {
+				tasks[n_tasks++] = (PlanTask) {.first = lhs->start, .last = rhs->start - 1,
+							       .max_stack = lhs->max_stack};
+			}
+			if (!rhs->tainted) {
+				tasks[n_tasks++] = (PlanTask) {.first = rhs->start, .last = i - 1,
+							       .max_stack = rhs->max_stack};
+			}
+		}
+		if (lhs->max_stack < rhs->max_stack + 1) {
+			lhs->max_stack = rhs->max_stack + 1;
+		}
+		lhs->tainted = lhs->tainted || rhs->tainted;
+		size--;
+	}
+	stack_release(subtrees, inline_subtrees);
+	free(updated);
+	if (status == 0) {
+		tasks[n_tasks++] = (PlanTask) {.first = 0, .last = ct->n_nodes - 1,
+					       .max_stack = ct->max_stack};
+	}
+	uint32_t *parents = (status == 0) ? malloc(n_tasks * sizeof(*parents)) : NULL;
+	uint32_t *hole_ids = (status == 0) ? malloc(n_tasks * sizeof(*hole_ids)) : NULL;
+	if (!parents || !hole_ids) {
+		free(parents);
+		free(hole_ids);
+		free(tasks);
+		return -1;
+	}
+
+	// outer tasks first, then by position: tasks[0] is the whole tree, the parent of a task
+	// is the innermost one before it that contains it
+	qsort(tasks, n_tasks, sizeof(*tasks), _compare_tasks);
+	size_t depth = 0;
+	for (uint32_t t = 0; t < n_tasks; t++) {
+		while (depth > 0 && tasks[hole_ids[depth - 1]].last < tasks[t].first) {
+			depth--;
+		}
+		parents[t] = (depth > 0) ? hole_ids[depth - 1] : 0;
+		hole_ids[depth++] = t;	// used as the stack of open tasks for now
+		tasks[t].n_holes = 0;
+	}
+	for (uint32_t t = 1; t < n_tasks; t++) {
+		tasks[parents[t]].n_holes++;
+	}
+	uint32_t next = 0;
+	for (uint32_t t = 0; t < n_tasks; t++) {
+		tasks[t].holes = next;
+		next += tasks[t].n_holes;
+		tasks[t].n_holes = 0;
+	}
+	for (uint32_t t = 1; t < n_tasks; t++) {
+		PlanTask *parent = &tasks[parents[t]];
+		hole_ids[parent->holes + parent->n_holes++] = t;
+	}
+	free(parents);
+	plan->tasks = tasks;
+	plan->n_tasks = n_tasks;
+	plan->hole_ids = hole_ids;
+	return 0;
+}
+
+static int _compare_tasks(void const *a, void const *b)
+{
+	PlanTask const *x = a, *y = b;
+	if (x->first != y->first) {
+		return (x->first > y->first) - (x->first < y->first);
+	}
+	return (x->last < y->last) - (x->last > y->last);
+}
+
+static void _run_task(Run *run, PoolWorker *self, uint32_t id)
+{
+	/*
+	 * run task id and mark it done: once its holes are done too, taken back from the deque
+	 * without running them if the scan stopped on an error before reaching them
+	 */
+	PlanTask const *task = &run->plan->tasks[id];
+	TaskState *state = &run->states[id];
+	if (self && task->n_holes > 0) {
+		_push_holes(self, run->plan, task);
+	}
+	uint32_t n_reached = 0;
+	state->status = _scan(run, self, task, state->stack, &n_reached, &state->result);
+	for (uint32_t h = n_reached; self && h < task->n_holes; h++) {
+		uint32_t hole = run->plan->hole_ids[task->holes + h];
+		if (_take_back(self, hole)) {
+			atomic_store_explicit(&run->states[hole].done, true, memory_order_relaxed);
+		} else {
+			_wait(run, self, hole);
+		}
+	}
+	atomic_store_explicit(&state->done, true, memory_order_release);
+	if (self) {
+		TaskPool *pool = self->pool;
+		pthread_mutex_lock(&pool->lock);
+		pthread_cond_broadcast(&pool->changed);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+static inline eval_status_t _scan(Run *run, PoolWorker *self, PlanTask const *task, long *stack,
+				  uint32_t *n_reached, long *result)
+{
+	// compact_evaluate over the task's nodes, each hole pushing its value in one step
+	EvalPlan const *plan = run->plan;
+	CompactNode const *nodes = plan->ct.nodes;
+	long const *values = plan->ct.values;
+	long *vars = run->vars;
+	uint32_t hole = 0, hole_at = UINT32_MAX;
+	if (task->n_holes > 0) {
+		hole_at = plan->tasks[plan->hole_ids[task->holes]].first;
+	}
+	long *sp = stack;
+	long top = 0;
+	for (uint32_t i = task->first; i <= task->last; i++) {
+		if (i == hole_at) {
+			uint32_t id = plan->hole_ids[task->holes + hole];
+			*n_reached = ++hole;
+			*sp++ = top;
+			eval_status_t status = _hole_value(run, self, id, &top);
+			if (status != EVAL_OK) {
+				return status;
+			}
+			i = plan->tasks[id].last;
+			hole_at = (hole < task->n_holes)
+				  ? plan->tasks[plan->hole_ids[task->holes + hole]].first : UINT32_MAX;
+			continue;
+		}
+		CompactNode const *node = &nodes[i];
+		switch ((enum compact_op_t)node->op) {
+		case CT_LIT:
+			*sp++ = top;
+			top = values[node->leaf];
+			break;
+		case CT_VAR:
+			*sp++ = top;
+			top = vars[node->leaf];
+			break;
+		case CT_ADD: top = eval_add(*--sp, top); break;
+		case CT_SUB: top = eval_sub(*--sp, top); break;
+		case CT_MUL: top = eval_mul(*--sp, top); break;
+		case CT_DIV:
+			if (eval_div(sp[-1], top, &top) != EVAL_OK) {
+				return EVAL_DIV_BY_ZERO;
+			}
+			sp--;
+			break;
+		case CT_MOD:
+			if (eval_mod(sp[-1], top, &top) != EVAL_OK) {
+				return EVAL_DIV_BY_ZERO;
+			}
+			sp--;
+			break;
+		case CT_POS: break;
+		case CT_NEG: top = eval_sub(0, top); break;
+		case CT_PRE_INC:
+			top = eval_add(top, 1);
+			if (node->leaf != COMPACT_NONE) {
+				vars[node->leaf] = top;
+			}
+			break;
+		case CT_PRE_DEC:
+			top = eval_sub(top, 1);
+			if (node->leaf != COMPACT_NONE) {
+				vars[node->leaf] = top;
+			}
+			break;
+		case CT_POST_INC:
+			if (node->leaf != COMPACT_NONE) {
+				vars[node->leaf] = eval_add(top, 1);
+			}
+			break;
+		case CT_POST_DEC:
+			if (node->leaf != COMPACT_NONE) {
+				vars[node->leaf] = eval_sub(top, 1);
+			}
+			break;
+		}
+	}
+	*result = top;
+	return EVAL_OK;
+}
+
+static inline eval_status_t _hole_value(Run *run, PoolWorker *self, uint32_t id, long *value)
+{
+	// value of hole id, run here unless another worker took it
+	if (!self || _take_back(self, id)) {
+		_run_task(run, self, id);
+	} else {
+		_wait(run, self, id);
+	}
+	*value = run->states[id].result;
+	return run->states[id].status;
+}
+
+static inline void _push_holes(PoolWorker *self, EvalPlan const *plan, PlanTask const *task)
+{
+	// the first hole the scan reaches ends up at the bottom, thieves take the last ones first
+	TaskPool *pool = self->pool;
+	TaskDeque *deque = &pool->deques[self->id];
+	pthread_mutex_lock(&deque->lock);
+	for (uint32_t h = task->n_holes; h-- > 0;) {
+		deque->ids[deque->bottom++] = plan->hole_ids[task->holes + h];
+	}
+	pthread_mutex_unlock(&deque->lock);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->n_queued += task->n_holes;
+	pthread_cond_broadcast(&pool->changed);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static inline bool _take_back(PoolWorker *self, uint32_t id)
+{
+	// take task id back if it is still at the bottom of self's deque
+	TaskPool *pool = self->pool;
+	TaskDeque *deque = &pool->deques[self->id];
+	pthread_mutex_lock(&deque->lock);
+	bool taken = deque->bottom > deque->top && deque->ids[deque->bottom - 1] == id;
+	if (taken) {
+		deque->bottom--;
+		if (deque->bottom == deque->top) {
+			deque->top = deque->bottom = 0;
+		}
+	}
+	pthread_mutex_unlock(&deque->lock);
+	if (taken) {
+		pthread_mutex_lock(&pool->lock);
+		pool->n_queued -= 1;
+		pthread_mutex_unlock(&pool->lock);
+	}
+	return taken;
+}
+
+static inline bool _take(TaskPool *pool, PoolWorker *self, uint32_t *id)
+{
+	// the newest task of self's deque, else the oldest one of another deque
+	bool taken = false;
+	for (size_t i = 0; !taken && i < pool->n_workers; i++) {
+		TaskDeque *deque = &pool->deques[(self->id + i) % pool->n_workers];
+		pthread_mutex_lock(&deque->lock);
+		if ((taken = deque->bottom > deque->top)) {
+			*id = (i == 0) ? deque->ids[--deque->bottom] : deque->ids[deque->top++];
+			if (deque->bottom == deque->top) {
+				deque->top = deque->bottom = 0;
+			}
+		}
+		pthread_mutex_unlock(&deque->lock);
+		self->n_steals += taken && i > 0;
+	}
+	if (taken) {
+		pthread_mutex_lock(&pool->lock);
+		pool->n_queued -= 1;
+		pthread_mutex_unlock(&pool->lock);
+	}
+	return taken;
+}
+
+static inline void _wait(Run *run, PoolWorker *self, uint32_t id)
+{
+	// until task id is done, run whatever task is queued, sleep when there is none
+	TaskPool *pool = self->pool;
+	atomic_bool *done = &run->states[id].done;
+	while (!atomic_load_explicit(done, memory_order_acquire)) {
+		uint32_t other;
+		if (_take(pool, self, &other)) {
+			_run_task(run, self, other);
+			continue;
+		}
+		pthread_mutex_lock(&pool->lock);
+		while (!atomic_load_explicit(done, memory_order_acquire) && pool->n_queued == 0) {
+			pthread_cond_wait(&pool->changed, &pool->lock);
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+static void *_worker_main(void *arg)
+{
+	PoolWorker *self = arg;
+	TaskPool *pool = self->pool;
+	pthread_mutex_lock(&pool->lock);	// held by taskpool_create until every worker is started
+	while (1) {
+		while (pool->n_queued == 0 && !pool->closing) {
+			pthread_cond_wait(&pool->changed, &pool->lock);
+		}
+		if (pool->closing) {
+			break;
+		}
+		pthread_mutex_unlock(&pool->lock);
+		uint32_t id;
+		if (_take(pool, self, &id)) {
+			_run_task(&pool->run, self, id);
+		}
+		pthread_mutex_lock(&pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
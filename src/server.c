@@ -0,0 +1,590 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../headers/server.h"
+#include "../headers/tokenizer.h"
+#include "../headers/ExpressionTree.h"
+#include "../headers/arena.h"
+#include "../headers/cache.h"
+#include "../headers/evaluate.h"
+#include "../headers/literal.h"
+#include "../headers/stack.h"
+
+#define SERVER_READ (1 << 16)	// bytes asked of each read, more when a request is longer
+#define SERVER_BACKLOG 64
+
+/* ServerConn: one connection and the scratch memory kept between its requests */
+typedef struct {
+	int in_fd;
+	int out_fd;
+	char *in;		/* bytes read and not answered yet, in[0 ... in_size - 1] */
+	size_t in_size;
+	size_t in_cap;
+	FILE *out;		/* replies not written yet (open_memstream over out_buf) */
+	char *out_buf;
+	size_t out_size;
+	Tokenizer tkz;
+	NodeArena arena;
+	Binding *bindings;
+	size_t bindings_cap;
+	ParseCache *cache;	/* shared with the other connections, NULL: every request is parsed */
+	CacheEntry const *entry;	/* of the request being answered, released once it is */
+	ServerReport report;	/* counts not merged into the shared report yet */
+} ServerConn;
+
+/* ServerShared: the listening socket and what its connection threads report into
+ * - server_listen and every connection thread hold a reference, the last one to let go of it
+ *   frees it (a connection may outlive server_listen)
+ */
+typedef struct {
+	int listen_fd;
+	pthread_mutex_t lock;
+	ServerReport report;	/* guarded by lock */
+	ParseCache *cache;
+	FILE *cache_errors;
+	size_t n_refs;		/* guarded by lock */
+} ServerShared;
+
+/* ConnTask: what a connection thread is started with */
+typedef struct {
+	ServerShared *shared;
+	int fd;
+} ConnTask;
+
+static inline int _cache_open(ServerShared *shared);
+static inline void _cache_report(ServerShared *shared, ServerReport *report);
+static inline void _cache_close(ServerShared *shared, ServerReport *report);
+static inline void _shared_release(ServerShared *shared, ServerReport *report);
+static inline int _conn_init(ServerConn *conn, int in_fd, int out_fd, ParseCache *cache);
+static inline void _conn_destroy(ServerConn *conn);
+static inline int _conn_run(ServerConn *conn, ServerShared *shared);
+static inline int _flush(ServerConn *conn, ServerShared *shared);
+static inline size_t _answer(ServerConn *conn, bool *bad_frame);
+static inline off_t _reply_begin(ServerConn *conn);
+static inline void _reply_end(ServerConn *conn, off_t header_at, enum server_status_t status);
+static inline enum server_status_t _handle(ServerConn *conn, uint8_t op, char *text,
+					   size_t length);
+static inline enum server_status_t _handle_eval(ServerConn *conn, char *text, size_t length);
+static inline ExpressionTree _parse(ServerConn *conn, char const *text, size_t length);
+static inline bool _write_all(int fd, char const *buf, size_t size);
+static inline void _merge(ServerReport *dst, ServerReport *src);
+static void *_accept_main(void *arg);
+static void *_conn_main(void *arg);
+static inline double _elapsed(struct timespec start);
+static inline void _ignore_sigpipe(void);
+
+int server_serve(int in_fd, int out_fd, ServerReport *report)
+{
+	/*
+	 * - Answers the requests read from in_fd on out_fd until in_fd ends (or a frame is longer
+	 *   than SERVER_MAX_REQUEST, the stream cannot be followed past it).
+	 * - Returns 0 on success, -1 on a read/write error or out of memory (errno set).
+	 * - SIGPIPE is ignored from then on: a peer gone away is a failed write, not the end of
+	 *   the process (same for server_listen).
+	 */
+	assert(report && "parameter report must be a valid ServerReport *");
+	*report = (ServerReport) {0};
+	_ignore_sigpipe();
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ServerShared shared = {0};
+	ServerConn conn;
+	if (_cache_open(&shared) < 0) {
+		return -1;
+	}
+	if (_conn_init(&conn, in_fd, out_fd, shared.cache) < 0) {
+		_cache_close(&shared, report);
+		return -1;
+	}
+	int status = _conn_run(&conn, NULL);
+	int saved = errno;
+	*report = conn.report;
+	report->n_connections = 1;
+	report->seconds = _elapsed(start);
+	_conn_destroy(&conn);
+	_cache_close(&shared, report);
+	errno = saved;
+	return status;
+}
+
+int server_listen(char const *path, ServerReport *report)
+{
+	/*
+	 * - Listens on a Unix domain socket created at path (replacing a stale socket left there,
+	 *   never another kind of file) and serves each connection on a thread of its own.
+	 * - Runs until the process gets a SIGINT or SIGTERM, then stops accepting, removes the
+	 *   socket and returns 0. Connections still open are served until they end (or the
+	 *   process exits), report only counts what they did so far.
+	 * - Returns -1 if the socket cannot be set up (errno set).
+	 */
+	assert(path && report);
+	*report = (ServerReport) {0};
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+	_ignore_sigpipe();
+	struct stat st;
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		unlink(path);
+	}
+	ServerShared *shared = malloc(sizeof(*shared));
+	if (!shared) {
+		return -1;
+	}
+	*shared = (ServerShared) {.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0), .n_refs = 1};
+	if (shared->listen_fd < 0) {
+		int saved = errno;
+		free(shared);
+		errno = saved;
+		return -1;
+	}
+	if (bind(shared->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+	    || listen(shared->listen_fd, SERVER_BACKLOG) < 0 || _cache_open(shared) < 0) {
+		int saved = errno;
+		close(shared->listen_fd);
+		free(shared);
+		errno = saved;
+		return -1;
+	}
+	pthread_mutex_init(&shared->lock, NULL);
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	// every thread started from here on has SIGINT/SIGTERM blocked, this one waits for them
+	sigset_t stop, saved_mask;
+	sigemptyset(&stop);
+	sigaddset(&stop, SIGINT);
+	sigaddset(&stop, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &stop, &saved_mask);
+	pthread_t acceptor;
+	int status = pthread_create(&acceptor, NULL, _accept_main, shared);
+	if (status == 0) {
+		int sig;
+		sigwait(&stop, &sig);
+		shutdown(shared->listen_fd, SHUT_RDWR);	// wakes the acceptor up
+		pthread_join(acceptor, NULL);
+	}
+	pthread_sigmask(SIG_SETMASK, &saved_mask, NULL);
+	close(shared->listen_fd);
+	unlink(path);
+
+	_shared_release(shared, report);
+	report->seconds = _elapsed(start);
+	if (status != 0) {
+		errno = status;
+		return -1;
+	}
+	return 0;
+}
+
+void server_report_display(FILE *fp, ServerReport const *report)
+{
+	assert(fp && report);
+	double rate = (report->seconds > 0) ? report->n_requests / report->seconds : 0;
+	fprintf(fp, "%zu connections, %zu requests (%zu errors), %zu bytes in, %zu bytes out"
+		    " in %zu writes, %.3f s: %.0f requests/sec\n",
+		report->n_connections, report->n_requests, report->n_errors, report->n_bytes_in,
+		report->n_bytes_out, report->n_writes, report->seconds, rate);
+	fprintf(fp, "parse cache: %zu hits, %zu misses, %zu evictions\n", report->n_cache_hits,
+		report->n_cache_misses, report->n_cache_evictions);
+}
+
+static inline int _cache_open(ServerShared *shared)
+{
+	// a miss reports an invalid expression to nobody: the request is parsed again for its reply
+	shared->cache_errors = fopen("/dev/null", "w");
+	if (!shared->cache_errors) {
+		return -1;
+	}
+	shared->cache = parsecache_create(SERVER_CACHE, shared->cache_errors);
+	if (!shared->cache) {
+		fclose(shared->cache_errors);
+		errno = ENOMEM;
+		return -1;
+	}
+	return 0;
+}
+
+static inline void _cache_report(ServerShared *shared, ServerReport *report)
+{
+	// the cache's counters go to report
+	CacheStats stats;
+	parsecache_stats(shared->cache, &stats);
+	report->n_cache_hits = stats.n_hits;
+	report->n_cache_misses = stats.n_misses;
+	report->n_cache_evictions = stats.n_evictions;
+}
+
+static inline void _cache_close(ServerShared *shared, ServerReport *report)
+{
+	// the cache's counters go to report (if not NULL)
+	if (report) {
+		_cache_report(shared, report);
+	}
+	parsecache_destroy(shared->cache);
+	fclose(shared->cache_errors);
+}
+
+static inline void _shared_release(ServerShared *shared, ServerReport *report)
+{
+	/*
+	 * - Drops a reference to shared, report (if not NULL) gets what was merged into it and the
+	 *   cache's counters so far.
+	 * - The last reference closes the cache and frees shared.
+	 */
+	pthread_mutex_lock(&shared->lock);
+	if (report) {
+		*report = shared->report;
+		_cache_report(shared, report);
+	}
+	bool last = --shared->n_refs == 0;
+	pthread_mutex_unlock(&shared->lock);
+	if (last) {
+		_cache_close(shared, NULL);
+		pthread_mutex_destroy(&shared->lock);
+		free(shared);
+	}
+}
+
+static inline int _conn_init(ServerConn *conn, int in_fd, int out_fd, ParseCache *cache)
+{
+	*conn = (ServerConn) {.in_fd = in_fd, .out_fd = out_fd, .cache = cache};
+	conn->out = open_memstream(&conn->out_buf, &conn->out_size);
+	if (!conn->out) {
+		return -1;
+	}
+	nodearena_init(&conn->arena, NODEARENA_DEFAULT_SLAB);
+	return 0;
+}
+
+static inline void _conn_destroy(ServerConn *conn)
+{
+	fclose(conn->out);
+	free(conn->out_buf);
+	free(conn->in);
+	free(conn->bindings);
+	tokenizer_distroy(&conn->tkz);
+	nodearena_destroy(&conn->arena);
+}
+
+static inline int _conn_run(ServerConn *conn, ServerShared *shared)
+{
+	/*
+	 * read as much as the peer sent, answer every whole request of it, write all the replies
+	 * at once, repeat: a pipelining client gets its replies in batches, one write each
+	 */
+	while (1) {
+		bool bad_frame = false;
+		size_t used = _answer(conn, &bad_frame);
+		if (used > 0) {
+			memmove(conn->in, conn->in + used, conn->in_size - used);
+			conn->in_size -= used;
+		}
+		if (_flush(conn, shared) < 0) {
+			return -1;
+		}
+		if (bad_frame) {
+			return 0;
+		}
+
+		// room for the rest of a partial request, and at least SERVER_READ more bytes
+		size_t want = conn->in_size + SERVER_READ;
+		if (conn->in_size >= SERVER_FRAME) {
+			size_t frame = SERVER_FRAME + server_frame_length((uint8_t *)conn->in);
+			want = (frame > want) ? frame : want;
+		}
+		if (!stack_reserve((void **)&conn->in, &conn->in_cap, want, 1, NULL)) {
+			errno = ENOMEM;
+			return -1;
+		}
+		ssize_t n = read(conn->in_fd, conn->in + conn->in_size, conn->in_cap - conn->in_size);
+		if (n == 0) {
+			return 0;
+		}
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return (errno == ECONNRESET) ? 0 : -1;
+		}
+		conn->in_size += n;
+		conn->report.n_bytes_in += n;
+	}
+}
+
+static inline int _flush(ServerConn *conn, ServerShared *shared)
+{
+	// write the replies buffered in conn->out, then merge the connection's counts
+	if (fflush(conn->out) != 0) {
+		return -1;
+	}
+	if (conn->out_size > 0) {
+		if (!_write_all(conn->out_fd, conn->out_buf, conn->out_size)) {
+			return -1;
+		}
+		conn->report.n_bytes_out += conn->out_size;
+		conn->report.n_writes += 1;
+		fseeko(conn->out, 0, SEEK_SET);	// the next batch reuses the buffer
+	}
+	if (shared) {
+		pthread_mutex_lock(&shared->lock);
+		_merge(&shared->report, &conn->report);
+		pthread_mutex_unlock(&shared->lock);
+	}
+	return 0;
+}
+
+static inline size_t _answer(ServerConn *conn, bool *bad_frame)
+{
+	// append the reply of every whole request held in conn->in to conn->out, returns the bytes
+	// of requests answered
+	size_t pos = 0;
+	while (conn->in_size - pos >= SERVER_FRAME) {
+		uint8_t const *frame = (uint8_t const *)conn->in + pos;
+		uint32_t length = server_frame_length(frame);
+		if (length > SERVER_MAX_REQUEST) {
+			off_t header_at = _reply_begin(conn);
+			fprintf(conn->out, "request of %" PRIu32 " bytes is longer than the limit"
+					   " (%u bytes)\n", length, SERVER_MAX_REQUEST);
+			_reply_end(conn, header_at, SERVER_ERROR);
+			*bad_frame = true;
+			return conn->in_size;
+		}
+		if (conn->in_size - pos - SERVER_FRAME < length) {
+			break;
+		}
+		off_t header_at = _reply_begin(conn);
+		_reply_end(conn, header_at,
+			   _handle(conn, frame[4], conn->in + pos + SERVER_FRAME, length));
+		pos += SERVER_FRAME + length;
+	}
+	return pos;
+}
+
+static inline off_t _reply_begin(ServerConn *conn)
+{
+	// room for the reply header, filled in by _reply_end once the payload length is known
+	off_t header_at = ftello(conn->out);
+	fwrite((uint8_t[SERVER_FRAME]) {0}, 1, SERVER_FRAME, conn->out);
+	return header_at;
+}
+
+static inline void _reply_end(ServerConn *conn, off_t header_at, enum server_status_t status)
+{
+	off_t end = ftello(conn->out);
+	uint8_t header[SERVER_FRAME];
+	server_frame_encode(header, (uint32_t)(end - header_at - SERVER_FRAME), status);
+	fseeko(conn->out, header_at, SEEK_SET);
+	fwrite(header, 1, SERVER_FRAME, conn->out);
+	fseeko(conn->out, end, SEEK_SET);
+	conn->report.n_requests += 1;
+	conn->report.n_errors += status != SERVER_OK;
+}
+
+static inline enum server_status_t _handle(ServerConn *conn, uint8_t op, char *text,
+					   size_t length)
+{
+	// write the reply payload of one request to conn->out
+	enum server_status_t status = SERVER_ERROR;
+	if (op == SERVER_PARSE) {
+		ExpressionTree root = _parse(conn, text, length);
+		if (root) {
+			expressiontree_print_to_file(conn->out, 0, root);
+			status = SERVER_OK;
+		}
+	} else if (op == SERVER_EVAL) {
+		status = _handle_eval(conn, text, length);
+	} else {
+		fprintf(conn->out, "unknown op %u\n", op);
+	}
+	nodearena_reset(&conn->arena);
+	parsecache_release(conn->entry);
+	conn->entry = NULL;
+	return status;
+}
+
+static inline enum server_status_t _handle_eval(ServerConn *conn, char *text, size_t length)
+{
+	// text: the expression, then a "name=value" line per variable
+	char *end = text + length;
+	char *line = memchr(text, '\n', length);
+	char *expr_end = line ? line : end;
+	size_t n_bindings = 0;
+	while (line && line < end) {
+		char *name = line + 1;
+		line = memchr(name, '\n', end - name);
+		char *line_end = line ? line : end;
+		if (name == line_end) {
+			continue;	// blank line
+		}
+		char *eq = memchr(name, '=', line_end - name);
+		char *digits = eq ? eq + 1 : line_end;
+		bool negative = digits < line_end && *digits == '-';
+		digits += negative;
+		bool ok = eq && eq > name && digits < line_end;
+		for (char *p = digits; ok && p < line_end; p++) {
+			ok = *p >= '0' && *p <= '9';
+		}
+		long value;
+		if (!ok || literal_decode(digits, line_end - digits, &value) != LITERAL_OK) {
+			fprintf(conn->out, "invalid binding \"%.*s\" (name=value expected, the value"
+					   " a long)\n", (int)(line_end - name), name);
+			return SERVER_ERROR;
+		}
+		if (!stack_reserve((void **)&conn->bindings, &conn->bindings_cap, n_bindings + 1,
+				   sizeof(*conn->bindings), NULL)) {
+			fprintf(conn->out, "out of memory while binding the variables\n");
+			return SERVER_ERROR;
+		}
+		*eq = '\0';	// the request is ours: the name is terminated in place
+		conn->bindings[n_bindings++] = (Binding) {
+			.name = name,
+			.value = negative ? (long)(0UL - (unsigned long)value) : value
+		};
+	}
+
+	ExpressionTree root = _parse(conn, text, expr_end - text);
+	if (!root) {
+		return SERVER_ERROR;
+	}
+	long result;
+	eval_status_t status = expressiontree_evaluate(root, conn->bindings, n_bindings, &result);
+	if (status != EVAL_OK) {
+		fprintf(conn->out, "%s\n", eval_status_str(status));
+		return SERVER_ERROR;
+	}
+	fprintf(conn->out, "%ld\n", result);
+	return SERVER_OK;
+}
+
+static inline ExpressionTree _parse(ServerConn *conn, char const *text, size_t length)
+{
+	/*
+	 * - tree of text from the cache, or parsed in the connection's arena when the cache holds
+	 *   none (invalid expression, out of memory): NULL with the reason written to conn->out
+	 * - a cached tree is shared with the other connections, it is only read
+	 */
+	if (conn->cache) {
+		conn->entry = parsecache_get(conn->cache, text, length);
+		if (conn->entry && conn->entry->root) {
+			return conn->entry->root;
+		}
+	}
+	if (!tokenizer_tokenize_into(&conn->tkz, text, length)) {
+		fprintf(conn->out, "expression was not tokenized (too long or out of memory)\n");
+		return NULL;
+	}
+	if (conn->tkz.n_tokens == 1) {
+		fprintf(conn->out, "empty expression\n");
+		return NULL;
+	}
+	BuildOptions opts = {.arena = &conn->arena, .errors = conn->out};
+	return expressiontree_build_tree_opts(&conn->tkz, &opts);
+}
+
+static inline bool _write_all(int fd, char const *buf, size_t size)
+{
+	while (size > 0) {
+		ssize_t n = write(fd, buf, size);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		buf += n;
+		size -= n;
+	}
+	return true;
+}
+
+static inline void _merge(ServerReport *dst, ServerReport *src)
+{
+	// add src's counts to dst and clear them
+	dst->n_connections += src->n_connections;
+	dst->n_requests += src->n_requests;
+	dst->n_errors += src->n_errors;
+	dst->n_bytes_in += src->n_bytes_in;
+	dst->n_bytes_out += src->n_bytes_out;
+	dst->n_writes += src->n_writes;
+	*src = (ServerReport) {0};
+}
+
+static void *_accept_main(void *arg)
+{
+	// accept connections until the listening socket is shut down
+	ServerShared *shared = arg;
+	while (1) {
+		int fd = accept(shared->listen_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+				nanosleep(&(struct timespec) {.tv_nsec = 10000000}, NULL);
+				continue;	// out of resources for now, wait for a connection to end
+			}
+			return NULL;
+		}
+		ConnTask *task = malloc(sizeof(*task));
+		pthread_t thread;
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		pthread_mutex_lock(&shared->lock);
+		shared->n_refs += 1;	// the connection thread's
+		pthread_mutex_unlock(&shared->lock);
+		if (!task || (*task = (ConnTask) {.shared = shared, .fd = fd},
+			      pthread_create(&thread, &attr, _conn_main, task)) != 0) {
+			free(task);
+			close(fd);
+			pthread_mutex_lock(&shared->lock);
+			shared->n_refs -= 1;	// never the last one: server_listen holds one
+			pthread_mutex_unlock(&shared->lock);
+		}
+		pthread_attr_destroy(&attr);
+	}
+}
+
+static void *_conn_main(void *arg)
+{
+	ConnTask task = *(ConnTask *)arg;
+	free(arg);
+	ServerConn conn;
+	if (_conn_init(&conn, task.fd, task.fd, task.shared->cache) == 0) {
+		conn.report.n_connections = 1;
+		if (_conn_run(&conn, task.shared) < 0 && errno != EPIPE && errno != ECONNRESET) {
+			perror("server connection");
+		}
+		_conn_destroy(&conn);
+	}
+	close(task.fd);
+	_shared_release(task.shared, NULL);
+	return NULL;
+}
+
+static inline double _elapsed(struct timespec start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static inline void _ignore_sigpipe(void)
+{
+	struct sigaction ignore = {.sa_handler = SIG_IGN};
+	sigemptyset(&ignore.sa_mask);
+	sigaction(SIGPIPE, &ignore, NULL);
+}
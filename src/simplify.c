@@ -0,0 +1,403 @@
+#include "../headers/simplify.h"
+#include "../headers/evaluate.h"
+#include "../headers/arena.h"
+
+#define INLINE_FRAMES 64
+#define POOL_SIZE 16		// detached nodes kept around for reuse
+#define REWRITE_NODES 3		// most nodes a single rewrite needs
+
+/* Simplifier: state of one expressiontree_simplify call */
+typedef struct {
+	NodeArena *arena;		/* where the tree's nodes come from, NULL meant malloc */
+	ASTNode *pool[POOL_SIZE];	/* nodes detached from the tree, recycled by later rewrites */
+	size_t n_pool;
+} Simplifier;
+
+/* Split: a subtree read as `core op c` (core == NULL for a constant), with the nodes that
+ * writing it that way frees up (its operator and literal) */
+typedef struct {
+	ASTNode *core;
+	long c;
+	ASTNode *freed[2];
+} Split;
+
+static inline ASTNode *_rewrite(Simplifier *s, ASTNode *node, bool value_only);
+static inline ASTNode *_sum(Simplifier *s, ASTNode *node, Split l, Split r, bool subtract);
+static inline ASTNode *_product(Simplifier *s, ASTNode *node, Split l, Split r);
+static inline Split _split_sum(ASTNode *node);
+static inline Split _split_product(ASTNode *node);
+static inline bool _reserve(Simplifier *s, Split const *l, Split const *r);
+static inline ASTNode *_op(Simplifier *s, enum tok_type_t type, ASTNode *left, ASTNode *right);
+static inline ASTNode *_lit(Simplifier *s, long value);
+static inline ASTNode *_neg(Simplifier *s, ASTNode *operand);
+static inline ASTNode *_take(Simplifier *s);
+static inline void _recycle(Simplifier *s, ASTNode *node);
+static inline bool _droppable(ASTNode const *root);
+static inline void _drop(Simplifier *s, ASTNode *root);
+
+ExpressionTree expressiontree_simplify(ExpressionTree root, NodeArena *arena)
+{
+	/*
+	 * - Returns the simplified tree, built out of root's nodes (and of new ones from arena, or
+	 *   malloc if arena is NULL: pass the arena root was built in).
+	 * - Post-order walk: a node is rewritten once its operands are. Each rewrite stores its
+	 *   result in its parent right away, so the tree stays whole at every step (running out
+	 *   of memory only leaves it less simplified).
+	 */
+	typedef struct {ASTNode **slot; bool operands_done; bool value_only;} SimplifyFrame;
+	SimplifyFrame inline_frames[INLINE_FRAMES];
+	SimplifyFrame *frames = inline_frames;
+	size_t capacity = INLINE_FRAMES, size = 0;
+	Simplifier s = {.arena = arena};
+
+	if (root) {
+		frames[size++] = (SimplifyFrame) {&root, false, false};
+	}
+	while (size > 0) {
+		SimplifyFrame *top = &frames[size - 1];
+		ASTNode *node = *top->slot;
+		if (!top->operands_done) {
+			top->operands_done = true;
+			// '++'/'--' on a non-variable, decided before the operand is simplified (x + 0
+			// turning into x must not make ++(x + 0) update x)
+			ASTNode const *operand = node->unary.operand;
+			top->value_only = (node->token.type == TOK_INC || node->token.type == TOK_DEC)
+					  && operand && operand->token.type != TOK_VAR;
+			if (!stack_reserve((void **)&frames, &capacity, size + 2, sizeof(*frames),
+					   inline_frames)) {
+				break;
+			}
+			if (node->binary.right) {
+				frames[size++] = (SimplifyFrame) {&node->binary.right, false, false};
+			}
+			if (node->binary.left) {
+				frames[size++] = (SimplifyFrame) {&node->binary.left, false, false};
+			}
+			continue;
+		}
+		size--;
+		*top->slot = _rewrite(&s, node, top->value_only);
+	}
+
+	stack_release(frames, inline_frames);
+	while (s.n_pool > 0) {
+		ASTNode *spare = s.pool[--s.n_pool];
+		if (!arena) {
+			free(spare);
+		}
+	}
+	return root;
+}
+
+static inline ASTNode *_rewrite(Simplifier *s, ASTNode *node, bool value_only)
+{
+	// node with simplified operands -> simplified node (unchanged if it is malformed)
+	ASTNode *left = node->binary.left, *right = node->binary.right;
+	Split l, r;
+	switch (node->token.type) {
+	case TOK_INC: case TOK_DEC:
+		if (!value_only || !left) {
+			return node;
+		}
+		if (node->postfix) {
+			_recycle(s, node);	// (e)++ is e
+			return left;
+		}
+		l = _split_sum(left);	// ++e is e + 1
+		r = (Split) {.c = (node->token.type == TOK_INC) ? 1 : -1};
+		return _reserve(s, &l, &r) ? _sum(s, node, l, r, false) : node;
+	case TOK_ADD: case TOK_MINUS:
+		if (!left) {
+			return node;
+		}
+		if (!right && node->token.type == TOK_ADD) {
+			_recycle(s, node);	// +e is e
+			return left;
+		}
+		if (!right) {
+			// - - e is e, -c is a literal
+			if ((left->token.type == TOK_MINUS && astnode_is_unary(left) && left->unary.operand)
+			    || left->token.type == TOK_LIT) {
+				_recycle(s, node);
+				return _neg(s, left);
+			}
+			return node;
+		}
+		l = _split_sum(left);
+		r = _split_sum(right);
+		return _reserve(s, &l, &r) ?
+			_sum(s, node, l, r, node->token.type == TOK_MINUS) : node;
+	case TOK_MULT:
+		if (!left || !right) {
+			return node;
+		}
+		l = _split_product(left);
+		r = _split_product(right);
+		return _reserve(s, &l, &r) ? _product(s, node, l, r) : node;
+	case TOK_DIV: case TOK_MOD:
+		// only a divisor known not to be 0 makes '/' and '%' foldable
+		if (!left || !right || right->token.type != TOK_LIT || right->value == 0) {
+			return node;
+		}
+		if (left->token.type == TOK_LIT) {
+			(node->token.type == TOK_DIV) ? eval_div(left->value, right->value, &left->value)
+						      : eval_mod(left->value, right->value, &left->value);
+			left->token.token_string = NULL;
+			left->token.length = 0;
+			_recycle(s, node);
+			_recycle(s, right);
+			return left;
+		}
+		if (right->value != 1 && right->value != -1) {
+			return node;
+		}
+		if (node->token.type == TOK_DIV) {
+			// e / 1 is e, e / -1 is -e
+			long d = right->value;
+			_recycle(s, node);
+			_recycle(s, right);
+			return (d == 1) ? left : _neg(s, left);
+		}
+		if (!_droppable(left)) {
+			return node;
+		}
+		_drop(s, left);		// e % 1 and e % -1 are 0
+		_recycle(s, node);
+		right->value = 0;
+		right->token.token_string = NULL;
+		right->token.length = 0;
+		return right;
+	default:
+		return node;
+	}
+}
+
+static inline ASTNode *_sum(Simplifier *s, ASTNode *node, Split l, Split r, bool subtract)
+{
+	// (l.core + l.c) +/- (r.core + r.c) == (l.core +/- r.core) + (l.c +/- r.c)
+	_recycle(s, node);
+	_recycle(s, l.freed[0]);
+	_recycle(s, l.freed[1]);
+	_recycle(s, r.freed[0]);
+	_recycle(s, r.freed[1]);
+
+	long c = subtract ? eval_sub(l.c, r.c) : eval_add(l.c, r.c);
+	ASTNode *core = l.core;
+	if (l.core && r.core) {
+		core = _op(s, subtract ? TOK_MINUS : TOK_ADD, l.core, r.core);
+	} else if (r.core) {
+		core = subtract ? _neg(s, r.core) : r.core;
+	}
+
+	if (!core) {
+		return _lit(s, c);
+	}
+	if (c == 0) {
+		return core;
+	}
+	if (c < 0 && c != LONG_MIN) {
+		return _op(s, TOK_MINUS, core, _lit(s, -c));
+	}
+	return _op(s, TOK_ADD, core, _lit(s, c));
+}
+
+static inline ASTNode *_product(Simplifier *s, ASTNode *node, Split l, Split r)
+{
+	// (l.core * l.c) * (r.core * r.c) == (l.core * r.core) * (l.c * r.c)
+	_recycle(s, node);
+	_recycle(s, l.freed[0]);
+	_recycle(s, l.freed[1]);
+	_recycle(s, r.freed[0]);
+	_recycle(s, r.freed[1]);
+
+	long c = eval_mul(l.c, r.c);
+	ASTNode *core = (l.core && r.core) ? _op(s, TOK_MULT, l.core, r.core)
+		      : (l.core ? l.core : r.core);
+
+	if (!core) {
+		return _lit(s, c);
+	}
+	if (c == 1) {
+		return core;
+	}
+	if (c == -1) {
+		return _neg(s, core);
+	}
+	if (c == 0 && _droppable(core)) {
+		_drop(s, core);
+		return _lit(s, 0);
+	}
+	return _op(s, TOK_MULT, core, _lit(s, c));
+}
+
+static inline Split _split_sum(ASTNode *node)
+{
+	// c, core + c or core - c, anything else is core + 0
+	if (node->token.type == TOK_LIT) {
+		return (Split) {.c = node->value, .freed = {node}};
+	}
+	if ((node->token.type == TOK_ADD || node->token.type == TOK_MINUS)
+	    && node->binary.left && node->binary.right
+	    && node->binary.right->token.type == TOK_LIT) {
+		long c = node->binary.right->value;
+		return (Split) {
+			.core = node->binary.left,
+			.c = (node->token.type == TOK_ADD) ? c : eval_sub(0, c),
+			.freed = {node, node->binary.right}
+		};
+	}
+	return (Split) {.core = node};
+}
+
+static inline Split _split_product(ASTNode *node)
+{
+	// c, core * c, anything else is core * 1
+	if (node->token.type == TOK_LIT) {
+		return (Split) {.c = node->value, .freed = {node}};
+	}
+	if (node->token.type == TOK_MULT && node->binary.left && node->binary.right
+	    && node->binary.right->token.type == TOK_LIT) {
+		return (Split) {
+			.core = node->binary.left,
+			.c = node->binary.right->value,
+			.freed = {node, node->binary.right}
+		};
+	}
+	return (Split) {.core = node, .c = 1};
+}
+
+static inline bool _reserve(Simplifier *s, Split const *l, Split const *r)
+{
+	// make sure a rewrite into l, r can get all of its nodes before starting it (the rewritten
+	// node itself is always freed by it)
+	size_t available = s->n_pool + 1;
+	for (size_t i = 0; i < 2; i++) {
+		available += (l->freed[i] != NULL) + (r->freed[i] != NULL);
+	}
+	while (available < REWRITE_NODES) {
+		ASTNode *spare = s->arena ? nodearena_alloc(s->arena) : malloc(sizeof(*spare));
+		if (!spare) {
+			return false;
+		}
+		s->pool[s->n_pool++] = spare;
+		available++;
+	}
+	return true;
+}
+
+static inline ASTNode *_op(Simplifier *s, enum tok_type_t type, ASTNode *left, ASTNode *right)
+{
+	static char const *symbols[] = {[TOK_ADD] = "+", [TOK_MINUS] = "-", [TOK_MULT] = "*"};
+	ASTNode *node = _take(s);
+	node->token = (Token) {.type = type, .token_string = symbols[type], .length = 1};
+	node->binary.left = left;
+	node->binary.right = right;
+	return node;
+}
+
+static inline ASTNode *_lit(Simplifier *s, long value)
+{
+	ASTNode *node = _take(s);
+	node->token = (Token) {.type = TOK_LIT};
+	node->value = value;
+	return node;
+}
+
+static inline ASTNode *_neg(Simplifier *s, ASTNode *operand)
+{
+	// -operand: a literal is negated in place and - - e is e
+	if (operand->token.type == TOK_LIT) {
+		operand->value = eval_sub(0, operand->value);
+		operand->token.token_string = NULL;
+		operand->token.length = 0;
+		return operand;
+	}
+	if (operand->token.type == TOK_MINUS && astnode_is_unary(operand) && operand->unary.operand) {
+		ASTNode *inner = operand->unary.operand;
+		_recycle(s, operand);
+		return inner;
+	}
+	ASTNode *node = _op(s, TOK_MINUS, operand, NULL);
+	node->prefix = true;
+	return node;
+}
+
+static inline ASTNode *_take(Simplifier *s)
+{
+	// _reserve made sure the pool is not empty
+	assert(s->n_pool > 0);
+	ASTNode *node = s->pool[--s->n_pool];
+	*node = (ASTNode) { 0 };
+	return node;
+}
+
+static inline void _recycle(Simplifier *s, ASTNode *node)
+{
+	if (!node) {
+		return;
+	}
+	if (s->n_pool < POOL_SIZE) {
+		s->pool[s->n_pool++] = node;
+	} else if (!s->arena) {
+		free(node);
+	}
+}
+
+static inline bool _droppable(ASTNode const *root)
+{
+	/*
+	 * can root's subtree be left unevaluated? Only if evaluating it updates no variable and
+	 * cannot fail (apart from a variable being unbound): no '++'/'--' on a variable, no '/' or
+	 * '%' by anything but a non-zero literal, no operator missing an operand
+	 */
+	ASTNode const *inline_nodes[INLINE_FRAMES];
+	ASTNode const **nodes = inline_nodes;
+	size_t capacity = INLINE_FRAMES, size = 0;
+
+	bool droppable = true;
+	nodes[size++] = root;
+	while (size > 0 && droppable) {
+		ASTNode const *node = nodes[--size];
+		ASTNode const *left = node->binary.left, *right = node->binary.right;
+		switch (node->token.type) {
+		case TOK_LIT: case TOK_VAR:
+			continue;
+		case TOK_INC: case TOK_DEC:
+			droppable = left && left->token.type != TOK_VAR;
+			break;
+		case TOK_ADD: case TOK_MINUS:
+			droppable = left != NULL;
+			break;
+		case TOK_MULT:
+			droppable = left && right;
+			break;
+		case TOK_DIV: case TOK_MOD:
+			droppable = left && right && right->token.type == TOK_LIT && right->value != 0;
+			break;
+		default:
+			droppable = false;
+			break;
+		}
+		if (!droppable || !stack_reserve((void **)&nodes, &capacity, size + 2, sizeof(*nodes),
+						 inline_nodes)) {
+			droppable = false;	// too big to tell: keep it
+			break;
+		}
+		if (left) {
+			nodes[size++] = left;
+		}
+		if (right) {
+			nodes[size++] = right;
+		}
+	}
+	stack_release(nodes, inline_nodes);
+	return droppable;
+}
+
+static inline void _drop(Simplifier *s, ASTNode *root)
+{
+	// arena nodes are released with their arena
+	if (!s->arena) {
+		expressiontree_destroy_tree(&root);
+	}
+}
@@ -0,0 +1,144 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+#include "../headers/stats.h"
+
+_Thread_local ParseStats *stats_sink;
+
+static char const *phase_names[] = {
+	[STATS_LEX]      = "lex",
+	[STATS_VALIDATE] = "validate",
+	[STATS_PARSE]    = "parse",
+	[STATS_PRINT]    = "print",
+	[STATS_DESTROY]  = "destroy"
+};
+
+ParseStats *stats_attach(ParseStats *stats)
+{
+	// stats (NULL to detach) collects what the calling thread does, returns the previous one
+	ParseStats *previous = stats_sink;
+	stats_sink = stats;
+	return previous;
+}
+
+ParseStats *stats_attached(void)
+{
+	return stats_sink;
+}
+
+void stats_merge(ParseStats *dst, ParseStats const *src)
+{
+	assert(dst && src);
+	for (size_t p = 0; p < STATS_N_PHASES; p++) {
+		PhaseStats *to = &dst->phases[p];
+		PhaseStats const *from = &src->phases[p];
+		to->n_calls += from->n_calls;
+		to->total_ns += from->total_ns;
+		if (to->max_ns < from->max_ns) {
+			to->max_ns = from->max_ns;
+		}
+		for (size_t b = 0; b < STATS_BUCKETS; b++) {
+			to->buckets[b] += from->buckets[b];
+		}
+	}
+	dst->n_bytes += src->n_bytes;
+	dst->n_tokens += src->n_tokens;
+	dst->n_nodes += src->n_nodes;
+	dst->n_parse_frames += src->n_parse_frames;
+	dst->n_parens += src->n_parens;
+	if (dst->max_depth < src->max_depth) {
+		dst->max_depth = src->max_depth;
+	}
+	dst->n_trees += src->n_trees;
+	dst->n_rejected += src->n_rejected;
+}
+
+uint64_t stats_percentile(PhaseStats const *phase, double q)
+{
+	// upper bound (ns) of the bucket holding the q-quantile of the phase's latencies
+	assert(phase && q >= 0 && q <= 1);
+	uint64_t rank = (uint64_t)(q * phase->n_calls), seen = 0;
+	for (size_t b = 0; b < STATS_BUCKETS; b++) {
+		seen += phase->buckets[b];
+		if (seen > rank || (seen == phase->n_calls && seen > 0)) {
+			uint64_t bound = (b + 1 < 64) ? (UINT64_C(1) << (b + 1)) - 1 : UINT64_MAX;
+			return (bound < phase->max_ns) ? bound : phase->max_ns;
+		}
+	}
+	return 0;
+}
+
+void stats_write_text(FILE *fp, ParseStats const *stats)
+{
+	assert(fp && stats);
+	fprintf(fp, "%" PRIu64 " trees, %" PRIu64 " rejected, %" PRIu64 " bytes, %" PRIu64
+		    " tokens, %" PRIu64 " nodes, %" PRIu64 " parser frames (max depth %" PRIu64
+		    "), %" PRIu64 " parentheses\n",
+		stats->n_trees, stats->n_rejected, stats->n_bytes, stats->n_tokens, stats->n_nodes,
+		stats->n_parse_frames, stats->max_depth, stats->n_parens);
+	fprintf(fp, "%-9s %10s %12s %10s %10s %10s %10s\n",
+		"phase", "calls", "total ns", "mean ns", "p50 ns", "p99 ns", "max ns");
+	for (size_t p = 0; p < STATS_N_PHASES; p++) {
+		PhaseStats const *phase = &stats->phases[p];
+		fprintf(fp, "%-9s %10" PRIu64 " %12" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+			    " %10" PRIu64 "\n",
+			phase_names[p], phase->n_calls, phase->total_ns,
+			phase->n_calls ? phase->total_ns / phase->n_calls : 0,
+			stats_percentile(phase, 0.5), stats_percentile(phase, 0.99), phase->max_ns);
+	}
+}
+
+void stats_write_json(FILE *fp, ParseStats const *stats)
+{
+	assert(fp && stats);
+	fprintf(fp, "{\"trees\": %" PRIu64 ", \"rejected\": %" PRIu64 ", \"bytes\": %" PRIu64
+		    ", \"tokens\": %" PRIu64 ", \"nodes\": %" PRIu64 ", \"parse_frames\": %" PRIu64
+		    ", \"max_depth\": %" PRIu64 ", \"parens\": %" PRIu64 ", \"phases\": {",
+		stats->n_trees, stats->n_rejected, stats->n_bytes, stats->n_tokens, stats->n_nodes,
+		stats->n_parse_frames, stats->max_depth, stats->n_parens);
+	for (size_t p = 0; p < STATS_N_PHASES; p++) {
+		PhaseStats const *phase = &stats->phases[p];
+		fprintf(fp, "%s\"%s\": {\"calls\": %" PRIu64 ", \"total_ns\": %" PRIu64
+			    ", \"max_ns\": %" PRIu64 ", \"p50_ns\": %" PRIu64 ", \"p99_ns\": %" PRIu64
+			    ", \"histogram\": [",
+			(p > 0) ? ", " : "", phase_names[p], phase->n_calls, phase->total_ns,
+			phase->max_ns, stats_percentile(phase, 0.5), stats_percentile(phase, 0.99));
+		// trailing empty buckets are left out, bucket i stands for [2^i, 2^(i+1)) ns
+		size_t n_buckets = STATS_BUCKETS;
+		while (n_buckets > 0 && phase->buckets[n_buckets - 1] == 0) {
+			n_buckets--;
+		}
+		for (size_t b = 0; b < n_buckets; b++) {
+			fprintf(fp, "%s%" PRIu64, (b > 0) ? ", " : "", phase->buckets[b]);
+		}
+		fprintf(fp, "]}");
+	}
+	fprintf(fp, "}}\n");
+}
+
+uint64_t stats_now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+void stats_record(ParseStats *stats, enum stats_phase_t phase, uint64_t ns)
+{
+	PhaseStats *p = &stats->phases[phase];
+	p->n_calls += 1;
+	p->total_ns += ns;
+	if (p->max_ns < ns) {
+		p->max_ns = ns;
+	}
+	size_t bucket = 0;	// floor(log2(ns)), 0 for 0 and 1 ns
+	while (ns > 1 && bucket + 1 < STATS_BUCKETS) {
+		ns >>= 1;
+		bucket++;
+	}
+	p->buckets[bucket] += 1;
+}
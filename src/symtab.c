@@ -0,0 +1,274 @@
+#include "../headers/symtab.h"
+
+#define INLINE_WALK 64
+
+static inline uint64_t _name_hash(char const *name, size_t length);
+static inline size_t _index_slot(SymbolTable const *st, char const *name, size_t length);
+static inline bool _grow_index(SymbolTable *st);
+
+void symtab_init(SymbolTable *st)
+{
+	assert(st && "parameter st must be a valid SymbolTable *");
+	*st = (SymbolTable) { 0 };
+}
+
+uint32_t symtab_intern(SymbolTable *st, char const *name, size_t length)
+{
+	// slot of name[0 ... length - 1], added if it is new, SYMTAB_NO_SLOT if out of memory
+	assert(st && "parameter st must be a valid SymbolTable *");
+	assert(name && "parameter name must hold length characters");
+	uint32_t found = symtab_find(st, name, length);
+	if (found != SYMTAB_NO_SLOT) {
+		return found;
+	}
+	if (st->n_symbols == SYMTAB_NO_SLOT
+	    || (2 * (st->n_symbols + 1) > st->n_index && !_grow_index(st))) {
+		return SYMTAB_NO_SLOT;
+	}
+	if (st->n_symbols == st->capacity) {
+		size_t capacity = st->capacity ? 2 * st->capacity : 16;
+		Symbol *symbols = realloc(st->symbols, capacity * sizeof(*symbols));
+		if (!symbols) {
+			return SYMTAB_NO_SLOT;
+		}
+		st->symbols = symbols;
+		st->capacity = capacity;
+	}
+	char *copy = malloc(length + 1);
+	if (!copy) {
+		return SYMTAB_NO_SLOT;
+	}
+	memcpy(copy, name, length);
+	copy[length] = '\0';
+
+	uint32_t slot = st->n_symbols++;
+	st->symbols[slot] = (Symbol) {.name = copy, .length = length};
+	st->index[_index_slot(st, name, length)] = slot;
+	return slot;
+}
+
+uint32_t symtab_find(SymbolTable const *st, char const *name, size_t length)
+{
+	// slot of name[0 ... length - 1], SYMTAB_NO_SLOT if it was never interned
+	assert(st && "parameter st must be a valid SymbolTable *");
+	if (st->n_symbols == 0) {
+		return SYMTAB_NO_SLOT;
+	}
+	return st->index[_index_slot(st, name, length)];
+}
+
+void symtab_destroy(SymbolTable *st)
+{
+	assert(st && "parameter st must be a valid SymbolTable *");
+	for (size_t i = 0; i < st->n_symbols; i++) {
+		free(st->symbols[i].name);
+	}
+	free(st->symbols);
+	free(st->index);
+	if (st->spellings) {
+		symtab_destroy(st->spellings);
+		free(st->spellings);
+	}
+	*st = (SymbolTable) { 0 };
+}
+
+bool symtab_intern_node(SymbolTable *st, ASTNode *node)
+{
+	// detaches node alone (not its children) from the input, false if out of memory
+	static char const *symbols[] = {
+		[TOK_ADD] = "+", [TOK_MINUS] = "-", [TOK_MULT] = "*", [TOK_DIV] = "/", [TOK_MOD] = "%",
+		[TOK_INC] = "++", [TOK_DEC] = "--"
+	};
+	assert(st && node);
+	switch (node->token.type) {
+	case TOK_VAR:
+		node->slot = symtab_intern(st, node->token.token_string, node->token.length);
+		if (node->slot == SYMTAB_NO_SLOT) {
+			return false;
+		}
+		node->token.token_string = st->symbols[node->slot].name;
+		break;
+	case TOK_LIT:
+		if (node->token.token_string && node->token.length > 1
+		    && node->token.token_string[0] == '0') {
+			// printing the value would drop the leading zeros: keep the text
+			if (!st->spellings && (st->spellings = calloc(1, sizeof(*st->spellings)))) {
+				symtab_init(st->spellings);
+			}
+			uint32_t spelling = st->spellings ? symtab_intern(st->spellings,
+					node->token.token_string, node->token.length) : SYMTAB_NO_SLOT;
+			if (spelling == SYMTAB_NO_SLOT) {
+				return false;
+			}
+			node->token.token_string = st->spellings->symbols[spelling].name;
+			break;
+		}
+		node->token.token_string = NULL;
+		node->token.length = 0;
+		break;
+	case TOK_ADD: case TOK_MINUS: case TOK_MULT: case TOK_DIV: case TOK_MOD:
+	case TOK_INC: case TOK_DEC:
+		node->token.token_string = symbols[node->token.type];
+		node->token.length = strlen(symbols[node->token.type]);
+		break;
+	default:
+		break;
+	}
+	return true;
+}
+
+ExpressionTree symtab_intern_tree(SymbolTable *st, ExpressionTree root)
+{
+	/*
+	 * - Interns the variables of root (left to right) and detaches the tree from its input.
+	 * - Returns root, or NULL if out of memory (root is then left partly detached, still a
+	 *   valid tree to be released as usual).
+	 */
+	assert(st && "parameter st must be a valid SymbolTable *");
+	ExpressionTree inline_nodes[INLINE_WALK];
+	ExpressionTree *nodes = inline_nodes;
+	size_t capacity = INLINE_WALK, size = 0;
+
+	bool failed = false;
+	if (root) {
+		nodes[size++] = root;
+	}
+	while (size > 0 && !failed) {
+		ExpressionTree node = nodes[--size];
+		if (!symtab_intern_node(st, node)) {
+			failed = true;
+			continue;
+		}
+		if (!stack_reserve((void **)&nodes, &capacity, size + 2, sizeof(*nodes), inline_nodes)) {
+			failed = true;
+			continue;
+		}
+		// right is pushed first so that variables are numbered left to right
+		if (node->binary.right) {
+			nodes[size++] = node->binary.right;
+		}
+		if (node->binary.left) {
+			nodes[size++] = node->binary.left;
+		}
+	}
+	stack_release(nodes, inline_nodes);
+	return failed ? NULL : root;
+}
+
+int symtab_variables(ExpressionTree root, VarList *vars)
+{
+	/*
+	 * - Lists the slots of the variables of root, an interned tree, each once, in order of
+	 *   first appearance.
+	 * - Returns 0 (vars to be released with varlist_destroy) or -1 if out of memory (vars is
+	 *   then empty).
+	 */
+	assert(vars && "parameter vars must be a valid VarList *");
+	*vars = (VarList) { 0 };
+	ExpressionTree inline_nodes[INLINE_WALK];
+	ExpressionTree *nodes = inline_nodes;
+	size_t capacity = INLINE_WALK, size = 0;
+	size_t slots_cap = 0;
+	uint8_t *seen = NULL;	// one bit per slot
+	size_t seen_size = 0;
+
+	int status = 0;
+	if (root) {
+		nodes[size++] = root;
+	}
+	while (size > 0 && status == 0) {
+		ExpressionTree node = nodes[--size];
+		if (node->token.type == TOK_VAR) {
+			size_t byte = node->slot / 8;
+			if (byte >= seen_size) {
+				size_t grown_size = (byte + 1 > 2 * seen_size) ? byte + 1 : 2 * seen_size;
+				uint8_t *grown = realloc(seen, grown_size);
+				if (!grown) {
+					status = -1;
+					continue;
+				}
+				memset(grown + seen_size, 0, grown_size - seen_size);
+				seen = grown;
+				seen_size = grown_size;
+			}
+			uint8_t bit = 1u << (node->slot % 8);
+			if (!(seen[byte] & bit)) {
+				if (vars->n_slots == slots_cap) {
+					slots_cap = slots_cap ? 2 * slots_cap : 16;
+					uint32_t *slots = realloc(vars->slots, slots_cap * sizeof(*slots));
+					if (!slots) {
+						status = -1;
+						continue;
+					}
+					vars->slots = slots;
+				}
+				seen[byte] |= bit;
+				vars->slots[vars->n_slots++] = node->slot;
+			}
+		}
+		if (!stack_reserve((void **)&nodes, &capacity, size + 2, sizeof(*nodes), inline_nodes)) {
+			status = -1;
+			continue;
+		}
+		if (node->binary.right) {
+			nodes[size++] = node->binary.right;
+		}
+		if (node->binary.left) {
+			nodes[size++] = node->binary.left;
+		}
+	}
+	stack_release(nodes, inline_nodes);
+	free(seen);
+	if (status != 0) {
+		varlist_destroy(vars);
+	}
+	return status;
+}
+
+void varlist_destroy(VarList *vars)
+{
+	assert(vars && "parameter vars must be a valid VarList *");
+	free(vars->slots);
+	*vars = (VarList) { 0 };
+}
+
+static inline uint64_t _name_hash(char const *name, size_t length)
+{
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < length; i++) {
+		hash = (hash ^ (unsigned char)name[i]) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static inline size_t _index_slot(SymbolTable const *st, char const *name, size_t length)
+{
+	// index entry holding name, or the empty entry where it would go
+	size_t i = _name_hash(name, length) & (st->n_index - 1);
+	for (; st->index[i] != SYMTAB_NO_SLOT; i = (i + 1) & (st->n_index - 1)) {
+		Symbol const *sym = &st->symbols[st->index[i]];
+		if (sym->length == length && memcmp(sym->name, name, length) == 0) {
+			break;
+		}
+	}
+	return i;
+}
+
+static inline bool _grow_index(SymbolTable *st)
+{
+	size_t n_index = st->n_index ? 2 * st->n_index : 64;
+	uint32_t *index = malloc(n_index * sizeof(*index));
+	if (!index) {
+		return false;
+	}
+	memset(index, 0xff, n_index * sizeof(*index));	// every entry SYMTAB_NO_SLOT
+	free(st->index);
+	st->index = index;
+	st->n_index = n_index;
+	for (size_t slot = 0; slot < st->n_symbols; slot++) {
+		Symbol const *sym = &st->symbols[slot];
+		st->index[_index_slot(st, sym->name, sym->length)] = slot;
+	}
+	return true;
+}
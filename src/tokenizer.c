@@ -1,74 +1,737 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
 #include "../headers/tokenizer.h"
+#include "../headers/stats.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TOKENIZER_X86 1
+#endif
+
+/*
+ * Single pass, table driven lexer:
+ * - every byte is classified once through _char_class (a 256-entry table), the class of the
+ *   first byte of a token decides how far the token reaches.
+ * - the long runs (whitespace, identifiers, digits, error tokens) are scanned 16 (SSE2) or 32
+ *   (AVX2) bytes at a time, the instruction set is picked at startup from CPUID.
+ * - a long input can be cut into chunks lexed on threads of their own, the tokens straddling a
+ *   cut are lexed again (tokenizer_tokenize_parallel).
+ * The token stream is exactly the one the original grouping rules produce:
+ *	TOK_VAR   := [A-Za-z_][A-Za-z0-9_]*
+ *	TOK_LIT   := [0-9]+
+ *	TOK_ERROR := (illegal symbol)(non-whitespace)* | '+'{3,} | '-'{3,} | ('*'|'/'|'%'){2,}
+ *	TOK_EOF   := '\0'+
+ */
+
+// _char_class[byte]: token type the byte starts (low bits) | CC_* flags
+#define CC_TYPE  0x0f
+#define CC_SPACE 0x10
+#define CC_WORD  0x20	// [A-Za-z0-9_], continues a TOK_VAR
+#define CC_DIGIT 0x40	// [0-9], continues a TOK_LIT
+static unsigned char _char_class[256];
+
+typedef char const *(*scan_fn)(char const *p, char const *end);
+
+// scanners: each returns the first byte in [p, end) that does not belong to the current run
+static struct {
+	enum tokenizer_isa_t isa;
+	scan_fn skip_space;	/* past whitespace */
+	scan_fn skip_word;	/* past [A-Za-z0-9_] */
+	scan_fn skip_digit;	/* past [0-9] */
+	scan_fn skip_nonspace;	/* up to the next whitespace */
+} _scan;
+
+/* LexChunk: input[start ... end - 1], lexed on a thread of its own as if start were a token
+ * boundary (tkz), then fixed up against the chunk before it: tkz's tokens[first ... first +
+ * n_kept - 1] are those of the sequential lexer, fix holds the ones lexed again in front of them
+ * (straddling the boundary) and the whole goes to out from token index to on */
+typedef struct {
+	Tokenizer tkz;
+	Tokenizer fix;
+	size_t start;
+	size_t end;
+	size_t first;
+	size_t n_kept;
+	size_t to;
+	Tokenizer *out;
+	bool ok;
+	pthread_t thread;
+} LexChunk;
+
+static inline char const *_skip_while(char const *p, char const *end, unsigned char cls,
+				      scan_fn wide);
+static inline char const *_skip_until(char const *p, char const *end, unsigned char cls,
+				      scan_fn wide);
+static inline char const *_skip_same(char const *p, char const *end, char ch);
+static inline bool _continues(unsigned char lead, char last, char ch);
+static bool _reserve(Tokenizer *tkz, size_t capacity);
+static void _stream_lex(TokenStream *ts);
+static bool _stream_fill(TokenStream *ts);
+static char const *_skip_space_scalar(char const *p, char const *end);
+static char const *_skip_word_scalar(char const *p, char const *end);
+static char const *_skip_digit_scalar(char const *p, char const *end);
+static char const *_skip_nonspace_scalar(char const *p, char const *end);
+#ifdef TOKENIZER_X86
+static char const *_skip_space_sse2(char const *p, char const *end);
+static char const *_skip_word_sse2(char const *p, char const *end);
+static char const *_skip_digit_sse2(char const *p, char const *end);
+static char const *_skip_nonspace_sse2(char const *p, char const *end);
+static char const *_skip_space_avx2(char const *p, char const *end);
+static char const *_skip_word_avx2(char const *p, char const *end);
+static char const *_skip_digit_avx2(char const *p, char const *end);
+static char const *_skip_nonspace_avx2(char const *p, char const *end);
+#endif
+
+__attribute__((constructor)) static void _tokenizer_init(void)
+{
+	// build the classification table from the same rules the grammar is written in
+	for (int ch = 0; ch < 256; ch++) {
+		unsigned char cls = TOK_ERROR;
+		if (isdigit(ch)) {
+			cls = TOK_LIT | CC_WORD | CC_DIGIT;
+		} else if (isalpha(ch) || ch == '_') {
+			cls = TOK_VAR | CC_WORD;
+		} else {
+			switch (ch) {
+			case '+':  cls = TOK_ADD;    break;
+			case '-':  cls = TOK_MINUS;  break;
+			case '*':  cls = TOK_MULT;   break;
+			case '/':  cls = TOK_DIV;    break;
+			case '%':  cls = TOK_MOD;    break;
+			case '(':  cls = TOK_LPAREN; break;
+			case ')':  cls = TOK_RPAREN; break;
+			case '\0': cls = TOK_EOF;    break;
+			default:   break;
+			}
+		}
+		if (isspace(ch)) {
+			cls |= CC_SPACE;
+		}
+		_char_class[ch] = cls;
+	}
+	tokenizer_select_isa(TOKENIZER_ISA_AVX2);
+}
 
-static inline enum tok_type_t _assign_type(char ch);
-static inline Token _group_chars_into_token(char const *start, char const *end);
-static inline Token _tok_make_var(Token tok, char const *input_end);
-static inline Token _tok_make_error(Token tok, char const *input_end);
-static inline Token _tok_make_add_minus(Token tok);
-static inline Token _tok_make_mult_div_mod(Token tok);
+enum tokenizer_isa_t tokenizer_select_isa(enum tokenizer_isa_t isa)
+{
+	/*
+	 * use the scanners of isa, or of the best instruction set below it the CPU supports.
+	 * Returns the instruction set actually selected. Not thread-safe: call it before tokenizing
+	 * on several threads (the best one is already selected at startup).
+	 */
+#ifdef TOKENIZER_X86
+	__builtin_cpu_init();
+	if (isa >= TOKENIZER_ISA_AVX2 && __builtin_cpu_supports("avx2")) {
+		_scan.isa = TOKENIZER_ISA_AVX2;
+		_scan.skip_space = _skip_space_avx2;
+		_scan.skip_word = _skip_word_avx2;
+		_scan.skip_digit = _skip_digit_avx2;
+		_scan.skip_nonspace = _skip_nonspace_avx2;
+		return _scan.isa;
+	}
+	if (isa >= TOKENIZER_ISA_SSE2 && __builtin_cpu_supports("sse2")) {
+		_scan.isa = TOKENIZER_ISA_SSE2;
+		_scan.skip_space = _skip_space_sse2;
+		_scan.skip_word = _skip_word_sse2;
+		_scan.skip_digit = _skip_digit_sse2;
+		_scan.skip_nonspace = _skip_nonspace_sse2;
+		return _scan.isa;
+	}
+#else
+	(void)isa;
+#endif
+	_scan.isa = TOKENIZER_ISA_SCALAR;
+	_scan.skip_space = _skip_space_scalar;
+	_scan.skip_word = _skip_word_scalar;
+	_scan.skip_digit = _skip_digit_scalar;
+	_scan.skip_nonspace = _skip_nonspace_scalar;
+	return _scan.isa;
+}
+
+static inline bool _tokenize(Tokenizer *tkz, char const *input, size_t length);
+static inline bool _lex_range(Tokenizer *tkz, char const *base, char const *input,
+			      char const *input_end);
+static inline char const *_lex_token(char const *input, char const *input_end,
+				     enum tok_type_t *type_out);
+static void *_lex_chunk_main(void *arg);
+static void *_copy_chunk_main(void *arg);
+static inline void _run_chunks(LexChunk *chunks, size_t n_chunks, void *(*fn)(void *));
+static inline bool _fix_boundaries(LexChunk *chunks, size_t n_chunks, char const *input,
+				   size_t length);
 
 Tokenizer tokenizer_tokenize(char const *input, size_t length)
 {
 	assert(input && "argument input must be non-null");
+	STATS_BEGIN(start);
+	Tokenizer tokenizer = {.input = input};
+	if (!_tokenize(&tokenizer, input, length)) {
+		tokenizer_distroy(&tokenizer);
+	}
+	STATS_END(STATS_LEX, start);
+	STATS_ADD(n_bytes, length);
+	STATS_ADD(n_tokens, tokenizer.n_tokens);
+	return tokenizer;
+}
+
+bool tokenizer_tokenize_into(Tokenizer *tkz, char const *input, size_t length)
+{
+	/*
+	 * same as tokenizer_tokenize, into the arrays tkz already has (grown only if they are too
+	 * small): a loop tokenizing one input after another stops calling malloc once warm.
+	 * tkz must be zero-initialized or come from a tokenizer function. On failure, returns false
+	 * and tkz->n_tokens is 0, tkz keeps its arrays for the next input.
+	 */
+	assert(tkz && input && "arguments tkz and input must be non-null");
+	STATS_BEGIN(start);
+	bool ok = _tokenize(tkz, input, length);
+	STATS_END(STATS_LEX, start);
+	STATS_ADD(n_bytes, length);
+	STATS_ADD(n_tokens, tkz->n_tokens);
+	return ok;
+}
+
+Tokenizer tokenizer_tokenize_parallel(char const *input, size_t length, size_t n_threads)
+{
+	/*
+	 * - Same tokens as tokenizer_tokenize, lexed on up to n_threads threads (0: one per CPU),
+	 *   the calling thread included. Each one lexes a chunk of at least TOKENIZER_MIN_CHUNK
+	 *   bytes from its first byte on, whatever token that byte is in the middle of.
+	 * - Only the tokens around a boundary can come out wrong (an identifier, a digit run, a
+	 *   '+'/'-' run or an error token cut in two): the lexer goes on from the last token the
+	 *   chunk before got right until it starts a token where the chunk's own lexing did. From
+	 *   there on both agree, lexing is context free from a token boundary.
+	 * - The chunks are then copied in place, in parallel too. A thread that cannot be started
+	 *   leaves its chunk to the calling thread.
+	 */
+	assert(input && "argument input must be non-null");
+	if (n_threads == 0) {
+		long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		n_threads = (n_cpus > 0) ? (size_t)n_cpus : 1;
+	}
+	size_t n_chunks = length / TOKENIZER_MIN_CHUNK;
+	n_chunks = (n_chunks < n_threads) ? n_chunks : n_threads;
+	LexChunk *chunks = NULL;
+	if (n_chunks <= 1 || length > TOKENIZER_MAX_INPUT
+	    || !(chunks = calloc(n_chunks, sizeof(*chunks)))) {
+		return tokenizer_tokenize(input, length);
+	}
+	STATS_BEGIN(start);
+	for (size_t j = 0; j < n_chunks; j++) {
+		chunks[j].tkz.input = input;
+		chunks[j].start = length / n_chunks * j;
+		chunks[j].end = (j + 1 < n_chunks) ? length / n_chunks * (j + 1) : length;
+	}
+	_run_chunks(chunks, n_chunks, _lex_chunk_main);
+	bool ok = true;
+	for (size_t j = 0; j < n_chunks; j++) {
+		ok = ok && chunks[j].ok;
+	}
+	ok = ok && _fix_boundaries(chunks, n_chunks, input, length);
+
+	// chunks[0] keeps its tokens from index 0 on (nothing to fix in front of the first one):
+	// its arrays become the result, the other chunks are copied after them
+	Tokenizer tokenizer = {.input = input};
+	size_t n_tokens = 0;
+	for (size_t j = 0; j < n_chunks; j++) {
+		chunks[j].to = n_tokens;
+		chunks[j].out = &tokenizer;
+		n_tokens += chunks[j].fix.n_tokens + chunks[j].n_kept;
+	}
+	if (ok) {
+		tokenizer = chunks[0].tkz;
+		chunks[0].tkz = (Tokenizer) {.input = input};
+		chunks[0].n_kept = 0;
+		ok = _reserve(&tokenizer, n_tokens + 1);
+	}
+	if (ok) {
+		_run_chunks(chunks, n_chunks, _copy_chunk_main);
+		tokenizer.types[n_tokens] = TOK_EOF;
+		tokenizer.offsets[n_tokens] = length;
+		tokenizer.lengths[n_tokens] = 0;
+		tokenizer.n_tokens = n_tokens + 1;
+	} else {
+		tokenizer_distroy(&tokenizer);
+	}
+	for (size_t j = 0; j < n_chunks; j++) {
+		tokenizer_distroy(&chunks[j].tkz);
+		tokenizer_distroy(&chunks[j].fix);
+	}
+	free(chunks);
+	STATS_END(STATS_LEX, start);
+	STATS_ADD(n_bytes, length);
+	STATS_ADD(n_tokens, tokenizer.n_tokens);
+	return tokenizer;
+}
+
+static inline bool _tokenize(Tokenizer *tkz, char const *input, size_t length)
+{
+	tkz->input = input;
+	tkz->n_tokens = 0;
+	// start with room for a token every 4 bytes and grow from there, rather than reserving
+	// the worst case (a token per byte) up front
+	size_t capacity = length / 4 + 16;
+	if (length > TOKENIZER_MAX_INPUT
+	    || (tkz->capacity < capacity && !_reserve(tkz, capacity))) {
+		return false;
+	}
 
-	Tokenizer tokenizer = { 0 };
-	// tokenizer.tokens is ought to be Token[length]
-	tokenizer.tokens = malloc(sizeof(*tokenizer.tokens) * (length + 1));
+	if (!_lex_range(tkz, input, input, input + length)) {
+		tkz->n_tokens = 0;
+		return false;
+	}
+	size_t i = tkz->n_tokens;
 
+	// there is always room for the TOK_EOF token, it sits at the end of the input
+	tkz->types[i] = TOK_EOF;
+	tkz->offsets[i] = length;
+	tkz->lengths[i] = 0;
+	tkz->n_tokens = i + 1;
+	return true;
+}
+
+static inline bool _lex_range(Tokenizer *tkz, char const *base, char const *input,
+			      char const *input_end)
+{
+	/*
+	 * append the tokens of input[0 ... input_end - 1] to tkz, their offsets taken from base.
+	 * Room is always left for one more token (the caller's TOK_EOF), false if out of memory.
+	 */
 	// use a "greedy sliding-window" approach to isolate each token from input
 	// greedy in a sense that each pass of this tokenizing process will consume as many
 	// identically typed symbols as possible
-	int i = 0;	// index of the tokens array
-	size_t n_tokens = 0;
-	char const *input_end = input + length;
-	while (input < input_end) {
-		assert(i < length);
-
-		while (input < input_end && isspace(*input)) {
-			input++;
-		}
-
-		// for every non whitespace symbol, "consume/group" as many
-		// identically typed symbols as possible
-		Token tok = _group_chars_into_token(input, input_end);
-		n_tokens += 1;
-
-		/* depending on the type of the first non-whitespace symbol, either
-		 * consume more symbols from input ("widening" the token "width") 
-		 * or end "on the spot", and refine the type information
-		 */ 
-		switch (tok.type) {
-		// may continue consume symbol, type is determined
-		case TOK_VAR: 
-			tok = _tok_make_var(tok, input_end);
+	size_t i = tkz->n_tokens;	// index of the token arrays
+	while (1) {
+		input = _skip_while(input, input_end, CC_SPACE, _scan.skip_space);
+		if (input == input_end) {
+			// never look at input_end[0], the caller may not own that byte
+			// (e.g. one line of a memory-mapped file)
 			break;
-		case TOK_ERROR: 
-			tok = _tok_make_error(tok, input_end);
-			break;
-		// stop consuming symbol, type can change based on result
-		case TOK_ADD: case TOK_MINUS: 
-			tok = _tok_make_add_minus(tok);
-			break;
-		case TOK_MULT: case TOK_DIV: case TOK_MOD:
-			tok = _tok_make_mult_div_mod(tok);
+		}
+		assert(i < (size_t)(input_end - base));
+		if (i + 1 >= tkz->capacity
+		    && !_reserve(tkz, tkz->capacity ? tkz->capacity * 2 : 16)) {
+			tkz->n_tokens = i;
+			return false;
+		}
+
+		enum tok_type_t type;
+		char const *tok_end = _lex_token(input, input_end, &type);
+
+		// write the recognized token into the token arrays
+		tkz->types[i] = type;
+		tkz->offsets[i] = input - base;
+		tkz->lengths[i] = tok_end - input;
+		i++;
+		input = tok_end;
+	}
+	tkz->n_tokens = i;
+	return true;
+}
+
+static inline char const *_lex_token(char const *input, char const *input_end,
+				     enum tok_type_t *type_out)
+{
+	// the token starting at input (not a whitespace): its first symbol decides the type and
+	// how far the token reaches, returns where it ends
+	enum tok_type_t type = _char_class[(unsigned char)*input] & CC_TYPE;
+	char const *tok_end = input + 1;
+	switch (type) {
+	// may continue consume symbol, type is determined
+	case TOK_VAR:
+		tok_end = _skip_while(tok_end, input_end, CC_WORD, _scan.skip_word);
+		break;
+	case TOK_LIT:
+		tok_end = _skip_while(tok_end, input_end, CC_DIGIT, _scan.skip_digit);
+		break;
+	case TOK_ERROR:
+		tok_end = _skip_until(tok_end, input_end, CC_SPACE, _scan.skip_nonspace);
+		break;
+	case TOK_EOF:
+		tok_end = _skip_same(tok_end, input_end, '\0');
+		break;
+	// consume a run of the same symbol, type can change based on its length
+	case TOK_ADD: case TOK_MINUS:
+		tok_end = _skip_same(tok_end, input_end, *input);
+		switch (tok_end - input) {
+		case 1:
 			break;
-		// "ends on the spot" (i.e. consume no further, type is dertermined)
-		case TOK_LPAREN: case TOK_RPAREN: case TOK_LIT: case TOK_EOF: 
+		case 2: type = (type == TOK_ADD) ? TOK_INC : TOK_DEC;
 			break;
 		default:
+			type = TOK_ERROR;
+		}
+		break;
+	case TOK_MULT: case TOK_DIV: case TOK_MOD:
+		tok_end = _skip_same(tok_end, input_end, *input);
+		if (tok_end - input != 1) {
+			type = TOK_ERROR;
+		}
+		break;
+	// "ends on the spot" (i.e. consume no further, type is dertermined)
+	case TOK_LPAREN: case TOK_RPAREN:
+	default:
+		break;
+	}
+	*type_out = type;
+	return tok_end;
+}
+
+static void *_lex_chunk_main(void *arg)
+{
+	// the tokens of the chunk, from a token every 4 bytes on (as _tokenize)
+	LexChunk *chunk = arg;
+	char const *input = chunk->tkz.input;
+	chunk->ok = _reserve(&chunk->tkz, (chunk->end - chunk->start) / 4 + 16)
+		    && _lex_range(&chunk->tkz, input, input + chunk->start, input + chunk->end);
+	return NULL;
+}
+
+static void *_copy_chunk_main(void *arg)
+{
+	// the fixed tokens of the chunk, then the ones it kept, to their place in the result
+	LexChunk *chunk = arg;
+	Tokenizer *out = chunk->out;
+	Tokenizer const *parts[] = {&chunk->fix, &chunk->tkz};
+	size_t firsts[] = {0, chunk->first};
+	size_t counts[] = {chunk->fix.n_tokens, chunk->n_kept};
+	size_t to = chunk->to;
+	for (size_t k = 0; k < 2; k++) {
+		if (counts[k] == 0) {
+			continue;
+		}
+		Tokenizer const *part = parts[k];
+		memcpy(out->types + to, part->types + firsts[k], counts[k] * sizeof(*out->types));
+		memcpy(out->offsets + to, part->offsets + firsts[k], counts[k] * sizeof(*out->offsets));
+		memcpy(out->lengths + to, part->lengths + firsts[k], counts[k] * sizeof(*out->lengths));
+		to += counts[k];
+	}
+	return NULL;
+}
+
+static inline void _run_chunks(LexChunk *chunks, size_t n_chunks, void *(*fn)(void *))
+{
+	// fn on every chunk, chunks[0] (and any chunk whose thread does not start) on this thread
+	for (size_t j = 1; j < n_chunks; j++) {
+		if (pthread_create(&chunks[j].thread, NULL, fn, &chunks[j]) != 0) {
+			fn(&chunks[j]);
+			chunks[j].thread = pthread_self();
+		}
+	}
+	fn(&chunks[0]);
+	for (size_t j = 1; j < n_chunks; j++) {
+		if (!pthread_equal(chunks[j].thread, pthread_self())) {
+			pthread_join(chunks[j].thread, NULL);
+		}
+	}
+}
+
+static inline bool _fix_boundaries(LexChunk *chunks, size_t n_chunks, char const *input,
+				   size_t length)
+{
+	/*
+	 * in input order, lex sequentially from where the tokens known to be right end until a
+	 * token starts where one of the next chunk does: that chunk is right from there on, but for
+	 * a last token running up to its end (it may go on in the next chunk). A token longer than
+	 * a chunk leaves the chunk with nothing kept. false if out of memory.
+	 */
+	char const *end = input + length;
+	char const *p = input;	// the sequential lexer resumes here, on a token boundary
+	for (size_t j = 0; j < n_chunks; j++) {
+		LexChunk *chunk = &chunks[j];
+		Tokenizer const *tkz = &chunk->tkz;
+		chunk->fix = (Tokenizer) {.input = input};
+		size_t k = 0;
+		while (1) {
+			char const *q = _skip_while(p, end, CC_SPACE, _scan.skip_space);
+			size_t at = q - input;
+			if (q == end || at >= chunk->end) {
+				break;
+			}
+			while (k < tkz->n_tokens && tkz->offsets[k] < at) {
+				k++;
+			}
+			if (k < tkz->n_tokens && tkz->offsets[k] == at) {
+				// in step: resume after the last token, or on it if it may be cut
+				size_t last = tkz->n_tokens - 1;
+				bool cut = chunk->end < length
+					   && tkz->offsets[last] + tkz->lengths[last] == chunk->end;
+				chunk->first = k;
+				chunk->n_kept = tkz->n_tokens - k - cut;
+				p = input + tkz->offsets[last] + (cut ? 0 : tkz->lengths[last]);
+				break;
+			}
+			if (chunk->fix.n_tokens + 1 >= chunk->fix.capacity
+			    && !_reserve(&chunk->fix, chunk->fix.capacity ? 2 * chunk->fix.capacity : 16)) {
+				return false;
+			}
+			enum tok_type_t type;
+			char const *tok_end = _lex_token(q, end, &type);
+			chunk->fix.types[chunk->fix.n_tokens] = type;
+			chunk->fix.offsets[chunk->fix.n_tokens] = at;
+			chunk->fix.lengths[chunk->fix.n_tokens] = tok_end - q;
+			chunk->fix.n_tokens++;
+			p = tok_end;
+		}
+	}
+	return true;
+}
+
+bool tokenizer_relex(Tokenizer *tkz, char const *input, size_t length, TextEdit const *edit,
+		     TokenSplice *splice)
+{
+	/*
+	 * - Brings tkz (the tokens of the previous text) up to date with input, the new text
+	 *   after edit, lexing only from the token the edit touches until the new tokens line up
+	 *   with the previous ones again. What changed is reported in splice.
+	 * - Lexing is context free from a token boundary: once a new token starts where a previous
+	 *   token after the edit starts (shifted by the edit), all the following tokens are equal.
+	 * - Returns false, tkz untouched, if edit does not fit the two texts, the new text is too
+	 *   long or out of memory.
+	 */
+	assert(tkz && input && edit && splice);
+	size_t n = tkz->n_tokens;
+	size_t old_length = (n > 0) ? tkz->offsets[n - 1] : 0;	// TOK_EOF sits at the end
+	if (n == 0 || length > TOKENIZER_MAX_INPUT || edit->offset + edit->n_deleted > old_length
+	    || length != old_length - edit->n_deleted + edit->n_inserted) {
+		return false;
+	}
+	STATS_BEGIN(start);
+
+	// first token reaching the edit: the ones before end before the edit and keep their extent
+	size_t lo = 0, hi = n - 1;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (tkz->offsets[mid] + tkz->lengths[mid] < edit->offset) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	size_t first = lo;
+	size_t edit_end = edit->offset + edit->n_deleted;	// in the previous text
+	long delta = (long)edit->n_inserted - (long)edit->n_deleted;
+
+	// lex the new tokens into fresh, stop on a previous token boundary after the edit
+	Tokenizer fresh = {.input = input};
+	char const *p = input + ((first > 0) ? tkz->offsets[first - 1] + tkz->lengths[first - 1] : 0);
+	char const *end = input + length, *from = p;
+	size_t next = first;	// previous token that may line up next (never the final TOK_EOF)
+	while (1) {
+		p = _skip_while(p, end, CC_SPACE, _scan.skip_space);
+		if (p == end) {
+			next = n;	// the final TOK_EOF is replaced too
 			break;
 		}
+		size_t at = p - input;
+		while (next < n - 1 && (tkz->offsets[next] < edit_end
+					|| (long)tkz->offsets[next] + delta < (long)at)) {
+			next++;
+		}
+		if (next < n - 1 && (long)tkz->offsets[next] + delta == (long)at) {
+			break;
+		}
+		if (fresh.n_tokens + 1 >= fresh.capacity
+		    && !_reserve(&fresh, fresh.capacity ? 2 * fresh.capacity : 16)) {
+			tokenizer_distroy(&fresh);
+			return false;
+		}
+		enum tok_type_t type;
+		char const *tok_end = _lex_token(p, end, &type);
+		fresh.types[fresh.n_tokens] = type;
+		fresh.offsets[fresh.n_tokens] = at;
+		fresh.lengths[fresh.n_tokens] = tok_end - p;
+		fresh.n_tokens++;
+		p = tok_end;
+	}
+	if (next == n) {
+		if (fresh.n_tokens + 1 > fresh.capacity && !_reserve(&fresh, fresh.n_tokens + 1)) {
+			tokenizer_distroy(&fresh);
+			return false;
+		}
+		fresh.types[fresh.n_tokens] = TOK_EOF;
+		fresh.offsets[fresh.n_tokens] = length;
+		fresh.lengths[fresh.n_tokens] = 0;
+		fresh.n_tokens++;
+	}
 
-		// write the recognized token into the tokens array
-		tokenizer.tokens[i] = tok;
-		// loop update
-		input =  tok.token_string + tok.length;
-		i++;
+	// splice: previous tokens [first, next) become the fresh ones, the rest moves by delta
+	size_t n_tail = n - next;
+	size_t n_new = first + fresh.n_tokens + n_tail;
+	if (n_new > tkz->capacity && !_reserve(tkz, n_new)) {
+		tokenizer_distroy(&fresh);
+		return false;
+	}
+	size_t to = first + fresh.n_tokens;
+	memmove(tkz->types + to, tkz->types + next, n_tail * sizeof(*tkz->types));
+	memmove(tkz->offsets + to, tkz->offsets + next, n_tail * sizeof(*tkz->offsets));
+	memmove(tkz->lengths + to, tkz->lengths + next, n_tail * sizeof(*tkz->lengths));
+	for (size_t i = to; i < n_new; i++) {
+		tkz->offsets[i] = (uint32_t)((long)tkz->offsets[i] + delta);
+	}
+	if (fresh.n_tokens > 0) {
+		memcpy(tkz->types + first, fresh.types, fresh.n_tokens * sizeof(*tkz->types));
+		memcpy(tkz->offsets + first, fresh.offsets, fresh.n_tokens * sizeof(*tkz->offsets));
+		memcpy(tkz->lengths + first, fresh.lengths, fresh.n_tokens * sizeof(*tkz->lengths));
 	}
+	*splice = (TokenSplice) {.first = first, .n_removed = next - first, .n_added = fresh.n_tokens};
+	tkz->input = input;
+	tkz->n_tokens = n_new;
+	tokenizer_distroy(&fresh);
 
-	tokenizer.tokens[i] = (Token) {.token_string = '\0', .length = 0, .type = TOK_EOF};
-	tokenizer.n_tokens = n_tokens + 1;
-	return tokenizer;
+	STATS_END(STATS_LEX, start);
+	STATS_ADD(n_bytes, p - from);
+	STATS_ADD(n_tokens, splice->n_added);
+	return true;
+}
+
+size_t tokenizer_normalize(char const *input, size_t length, char *out)
+{
+	/*
+	 * write the canonical spelling of input[0...length - 1] to out (room for length bytes) and
+	 * return its length: whitespace is dropped, except for one ' ' where it separates two
+	 * tokens that would otherwise lex as one. The spelling depends on the tokens only: two
+	 * inputs share it exactly when they tokenize to the same tokens ("1a" and "1 a" do).
+	 */
+	size_t n = 0;
+	unsigned char lead = 0;		// class of the first symbol of the token out[n - 1] is in
+	bool space = false;		// whitespace between out[n - 1] and the next symbol
+	for (size_t i = 0; i < length; i++) {
+		unsigned char cls = _char_class[(unsigned char)input[i]];
+		if (cls & CC_SPACE) {
+			space = n > 0;
+			continue;
+		}
+		bool joined = n > 0 && _continues(lead, out[n - 1], input[i]);
+		if (space && joined) {
+			// keep the space where removing it would merge two tokens
+			out[n++] = ' ';
+			joined = false;
+		}
+		if (!joined) {
+			lead = cls;
+		}
+		space = false;
+		out[n++] = input[i];
+	}
+	return n;
+}
+
+bool tokenstream_init(TokenStream *ts, int fd, size_t window)
+{
+	/*
+	 * - Pulls tokens from fd (read as is, never seeked), window bytes at a time
+	 *   (TOKENSTREAM_DEFAULT_WINDOW if 0), and lexes the first one into ts->token.
+	 * - Returns false if the window cannot be allocated or the first read fails (ts->error),
+	 *   ts must be released with tokenstream_destroy either way.
+	 * - The tokens are exactly those tokenizer_tokenize gives for the whole input.
+	 */
+	assert(ts && fd >= 0);
+	*ts = (TokenStream) {.fd = fd, .capacity = window ? window : TOKENSTREAM_DEFAULT_WINDOW};
+	ts->window = malloc(ts->capacity + 1);
+	if (!ts->window) {
+		ts->error = ENOMEM;
+		ts->token = (Token) {.type = TOK_EOF, .token_string = ""};
+		return false;
+	}
+	ts->window[0] = '\0';
+	_stream_lex(ts);
+	return ts->error == 0;
+}
+
+Token tokenstream_advance(TokenStream *ts)
+{
+	// move to the next token and return it (the stream stays on its final TOK_EOF)
+	assert(ts && "parameter ts must be a valid TokenStream *");
+	if (ts->token.type != TOK_EOF || ts->token.length > 0) {
+		_stream_lex(ts);
+	}
+	return ts->token;
+}
+
+size_t tokenstream_offset(TokenStream const *ts)
+{
+	// input offset of the current token
+	assert(ts && "parameter ts must be a valid TokenStream *");
+	return ts->offset + (size_t)(ts->token.token_string - ts->window);
+}
+
+void tokenstream_destroy(TokenStream *ts)
+{
+	// the descriptor belongs to the caller, it is not closed
+	assert(ts && "parameter ts must be a valid TokenStream *");
+	free(ts->window);
+	*ts = (TokenStream) {.fd = -1};
+}
+
+static void _stream_lex(TokenStream *ts)
+{
+	// lex the token at ts->pos, reading more of the input until the whole token is in the window
+	while (1) {
+		char const *p = ts->window + ts->pos, *end = ts->window + ts->size;
+		p = _skip_while(p, end, CC_SPACE, _scan.skip_space);
+		ts->pos = p - ts->window;
+		if (p < end) {
+			enum tok_type_t type;
+			char const *tok_end = _lex_token(p, end, &type);
+			// a token running up to the end of the window may go on in the next read
+			if (tok_end < end || ts->eof) {
+				ts->token = (Token) {.type = type, .token_string = p, .length = tok_end - p};
+				ts->pos = tok_end - ts->window;
+				ts->n_tokens++;
+				STATS_ADD(n_tokens, 1);
+				return;
+			}
+		} else if (ts->eof) {
+			break;
+		}
+		if (!_stream_fill(ts)) {
+			break;
+		}
+	}
+	// the final TOK_EOF sits at the end of the input (or where reading failed)
+	ts->token = (Token) {.type = TOK_EOF, .token_string = ts->window + ts->pos, .length = 0};
+	ts->n_tokens++;
+	STATS_ADD(n_tokens, 1);
+}
+
+static bool _stream_fill(TokenStream *ts)
+{
+	/*
+	 * slide the bytes still to be lexed to the front of the window and read after them, the
+	 * window only grows when a single token fills it. false (ts->error set) on failure.
+	 */
+	if (ts->pos > 0) {
+		memmove(ts->window, ts->window + ts->pos, ts->size - ts->pos);
+		ts->offset += ts->pos;
+		ts->size -= ts->pos;
+		ts->pos = 0;
+	}
+	if (ts->size == ts->capacity) {
+		char *window = realloc(ts->window, 2 * ts->capacity + 1);
+		if (!window) {
+			ts->error = ENOMEM;
+			return false;
+		}
+		ts->window = window;
+		ts->capacity *= 2;
+	}
+	ssize_t n_read;
+	do {
+		n_read = read(ts->fd, ts->window + ts->size, ts->capacity - ts->size);
+	} while (n_read < 0 && errno == EINTR);
+	if (n_read < 0) {
+		ts->error = errno;
+		return false;
+	}
+	ts->eof = n_read == 0;
+	ts->size += n_read;
+	ts->window[ts->size] = '\0';
+	STATS_ADD(n_bytes, n_read);
+	return true;
 }
 
 void tokenizer_display(Tokenizer *a_tkz)
@@ -97,16 +760,17 @@ void tokenizer_display(Tokenizer *a_tkz)
 	printf("{\n");
 	printf("  .n_tokens: %ld\n", a_tkz->n_tokens);
 
-	for (int i = 0; i < a_tkz->n_tokens; i++) {
-		printf("  .tokens[%d] = {\n", i);
-		// print a_tkz->tokens[i].length characters in a_tkz->tokens[i].token_string
+	for (size_t i = 0; i < a_tkz->n_tokens; i++) {
+		Token tok = tokenizer_token(a_tkz, i);
+		printf("  .tokens[%zu] = {\n", i);
+		// print tok.length characters in tok.token_string
 		printf("  		   .token_string = \"%.*s\"\n"
 		       "		   .length	 = %ld\n"
 		       "		   .type 	 = %s\n"
 		       "		}\n",
-		       (int)a_tkz->tokens[i].length, a_tkz->tokens[i].token_string,
-		       a_tkz->tokens[i].length,
-		       tok_types[a_tkz->tokens[i].type]);
+		       (int)tok.length, tok.token_string,
+		       tok.length,
+		       tok_types[tok.type]);
 	}
 
 	printf("}\n");
@@ -115,93 +779,261 @@ void tokenizer_display(Tokenizer *a_tkz)
 void tokenizer_distroy(Tokenizer *a_tkz)
 {
 	assert(a_tkz && "parameter a_tkz must be non-NULL");
-	free(a_tkz->tokens);
+	free(a_tkz->types);
+	free(a_tkz->offsets);
+	free(a_tkz->lengths);
+	*a_tkz = (Tokenizer) {.input = a_tkz->input};
 }
 
-static inline enum tok_type_t _assign_type(char ch)
+static bool _reserve(Tokenizer *tkz, size_t capacity)
 {
-	if (isdigit(ch)) {
-		return TOK_LIT;
+	// grow every token array to capacity, the arrays are left untouched on failure
+	tkz->n_mallocs += 3;
+	void *types = realloc(tkz->types, sizeof(*tkz->types) * capacity);
+	if (types) {
+		tkz->types = types;
+	}
+	void *offsets = realloc(tkz->offsets, sizeof(*tkz->offsets) * capacity);
+	if (offsets) {
+		tkz->offsets = offsets;
 	}
-	if (isalpha(ch) || ch == '_') {
-		return TOK_VAR;
+	void *lengths = realloc(tkz->lengths, sizeof(*tkz->lengths) * capacity);
+	if (lengths) {
+		tkz->lengths = lengths;
 	}
-	switch (ch) {
-	case '+': return TOK_ADD;
-	case '-': return TOK_MINUS;
-	case '*': return TOK_MULT;
-	case '/': return TOK_DIV;
-	case '%': return TOK_MOD;
-	case '(': return TOK_LPAREN;
-	case ')': return TOK_RPAREN;
-	case '\0': return TOK_EOF;
-	default:  return TOK_ERROR;
+	if (!types || !offsets || !lengths) {
+		return false;
 	}
+	tkz->capacity = capacity;
+	return true;
 }
 
-static inline Token _group_chars_into_token(char const *start, char const *end)
+#define SHORT_RUN 8	// bytes looked at through the table before handing a run to a wide scanner
+
+static inline char const *_skip_while(char const *p, char const *end, unsigned char cls,
+				      scan_fn wide)
 {
-	// group as many non-whitespace symbols of the same type into one token as possible
-	assert(start && !isspace(*start) && 
-		"start must be an address of a valid non-whitespace char in the raw expression string");
-	assert(end >= start && "expression string begins at start must consist at least one char");
+	// most runs are a few bytes long, only go wide once a run outlasts SHORT_RUN bytes
+	for (int k = 0; k < SHORT_RUN; k++, p++) {
+		if (p == end || !(_char_class[(unsigned char)*p] & cls)) {
+			return p;
+		}
+	}
+	return wide(p, end);
+}
 
-	char const *tok_end = start;
-	enum tok_type_t start_type = _assign_type(*start);
-	while (tok_end < end && 
-			!isspace(*tok_end) && _assign_type(*tok_end) == start_type) {
-		tok_end++;
-		if (start_type == TOK_LPAREN || start_type == TOK_RPAREN) {
-			break;
+static inline char const *_skip_until(char const *p, char const *end, unsigned char cls,
+				      scan_fn wide)
+{
+	for (int k = 0; k < SHORT_RUN; k++, p++) {
+		if (p == end || (_char_class[(unsigned char)*p] & cls)) {
+			return p;
 		}
 	}
-	return (Token) {.token_string = start, .length = tok_end - start, .type = start_type};
+	return wide(p, end);
 }
 
-static inline Token _tok_make_var(Token tok, char const *input_end)
+static inline char const *_skip_same(char const *p, char const *end, char ch)
 {
-	// consume more symbols from the input, if they are of type TOK_LIT or 
-	// TOK_LIT_(TOK_LIT|TOK_VAR), group them into the current token
-	char const *tok_end = tok.token_string + tok.length;
-	while (tok_end < input_end && 
-	       (_assign_type(*tok_end) == TOK_LIT || _assign_type(*tok_end) == TOK_VAR)) {
-		tok_end++;
+	// operator runs are short, no point in vectorizing them
+	while (p < end && *p == ch) {
+		p++;
 	}
-	assert(_assign_type(*tok_end) != TOK_LIT && _assign_type(*tok_end) != TOK_VAR);
-	tok.length = tok_end - tok.token_string;
-	return tok;
+	return p;
 }
 
-static inline Token _tok_make_error(Token tok, char const *input_end)
+static inline bool _continues(unsigned char lead, char last, char ch)
 {
-	// an error token starts with an illegal symbol, followed by 0 or more 
-	// non-whitespace symbols (i.e. TOK_ERROR := ^(ILLEGAL)+(.)*$).
-	char const *tok_end = tok.token_string + tok.length;
-	while (tok_end < input_end && !isspace(*tok_end)) {
-		tok_end++;
+	// whether ch, right after last, belongs to the token whose first symbol is of class lead
+	// (the reach of each token type in _lex_token)
+	unsigned char cls = _char_class[(unsigned char)ch];
+	switch (lead & CC_TYPE) {
+	case TOK_VAR:   return cls & CC_WORD;
+	case TOK_LIT:   return cls & CC_DIGIT;
+	case TOK_ERROR: return !(cls & CC_SPACE);
+	case TOK_LPAREN: case TOK_RPAREN:
+		return false;
+	default:	// runs of the same symbol
+		return ch == last;
 	}
-	tok.length = tok_end - tok.token_string;
-	return tok;
 }
 
-static inline Token _tok_make_add_minus(Token tok)
+static char const *_skip_space_scalar(char const *p, char const *end)
 {
-	// classify if a stream of '+' or '-' symbols are valid based on their length
-	switch (tok.length) {
-	case 1:
-		break;
-	case 2: tok.type = (tok.type == TOK_ADD) ? TOK_INC : TOK_DEC;
-		break;
-	default: 
-		tok.type = TOK_ERROR;
+	while (p < end && (_char_class[(unsigned char)*p] & CC_SPACE)) {
+		p++;
+	}
+	return p;
+}
+
+static char const *_skip_word_scalar(char const *p, char const *end)
+{
+	while (p < end && (_char_class[(unsigned char)*p] & CC_WORD)) {
+		p++;
+	}
+	return p;
+}
+
+static char const *_skip_digit_scalar(char const *p, char const *end)
+{
+	while (p < end && (_char_class[(unsigned char)*p] & CC_DIGIT)) {
+		p++;
+	}
+	return p;
+}
+
+static char const *_skip_nonspace_scalar(char const *p, char const *end)
+{
+	while (p < end && !(_char_class[(unsigned char)*p] & CC_SPACE)) {
+		p++;
 	}
-	return tok;
+	return p;
 }
 
-static inline Token _tok_make_mult_div_mod(Token tok)
+#ifdef TOKENIZER_X86
+/*
+ * Vector scanners. Byte predicates are built from unsigned range checks:
+ *	lo <= x <= hi  ⇔  min(x - lo, hi - lo) == x - lo
+ * Each scanner handles whole 16/32 byte blocks, the remaining tail goes through the scalar loop
+ * so no load ever reaches past end.
+ */
+#define SSE2_IN_RANGE(v, lo, hi) _mm_cmpeq_epi8( \
+	_mm_min_epu8(_mm_sub_epi8(v, _mm_set1_epi8(lo)), _mm_set1_epi8((hi) - (lo))), \
+	_mm_sub_epi8(v, _mm_set1_epi8(lo)))
+#define AVX2_IN_RANGE(v, lo, hi) _mm256_cmpeq_epi8( \
+	_mm256_min_epu8(_mm256_sub_epi8(v, _mm256_set1_epi8(lo)), _mm256_set1_epi8((hi) - (lo))), \
+	_mm256_sub_epi8(v, _mm256_set1_epi8(lo)))
+
+static inline unsigned _sse2_space_mask(__m128i v)
+{
+	return _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+					      SSE2_IN_RANGE(v, '\t', '\r')));
+}
+
+static inline unsigned _sse2_digit_mask(__m128i v)
+{
+	return _mm_movemask_epi8(SSE2_IN_RANGE(v, '0', '9'));
+}
+
+static inline unsigned _sse2_word_mask(__m128i v)
+{
+	__m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));	// fold A-Z onto a-z
+	return _mm_movemask_epi8(_mm_or_si128(
+		_mm_or_si128(SSE2_IN_RANGE(v, '0', '9'), SSE2_IN_RANGE(lower, 'a', 'z')),
+		_mm_cmpeq_epi8(v, _mm_set1_epi8('_'))));
+}
+
+static char const *_skip_space_sse2(char const *p, char const *end)
+{
+	for (; end - p >= 16; p += 16) {
+		unsigned miss = ~_sse2_space_mask(_mm_loadu_si128((__m128i const *)p)) & 0xffff;
+		if (miss) {
+			return p + __builtin_ctz(miss);
+		}
+	}
+	return _skip_space_scalar(p, end);
+}
+
+static char const *_skip_word_sse2(char const *p, char const *end)
+{
+	for (; end - p >= 16; p += 16) {
+		unsigned miss = ~_sse2_word_mask(_mm_loadu_si128((__m128i const *)p)) & 0xffff;
+		if (miss) {
+			return p + __builtin_ctz(miss);
+		}
+	}
+	return _skip_word_scalar(p, end);
+}
+
+static char const *_skip_digit_sse2(char const *p, char const *end)
+{
+	for (; end - p >= 16; p += 16) {
+		unsigned miss = ~_sse2_digit_mask(_mm_loadu_si128((__m128i const *)p)) & 0xffff;
+		if (miss) {
+			return p + __builtin_ctz(miss);
+		}
+	}
+	return _skip_digit_scalar(p, end);
+}
+
+static char const *_skip_nonspace_sse2(char const *p, char const *end)
 {
-	if (tok.length != 1) {
-		tok.type = TOK_ERROR;
+	for (; end - p >= 16; p += 16) {
+		unsigned hit = _sse2_space_mask(_mm_loadu_si128((__m128i const *)p));
+		if (hit) {
+			return p + __builtin_ctz(hit);
+		}
+	}
+	return _skip_nonspace_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static inline unsigned _avx2_space_mask(__m256i v)
+{
+	return _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+						    AVX2_IN_RANGE(v, '\t', '\r')));
+}
+
+__attribute__((target("avx2")))
+static inline unsigned _avx2_digit_mask(__m256i v)
+{
+	return _mm256_movemask_epi8(AVX2_IN_RANGE(v, '0', '9'));
+}
+
+__attribute__((target("avx2")))
+static inline unsigned _avx2_word_mask(__m256i v)
+{
+	__m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+	return _mm256_movemask_epi8(_mm256_or_si256(
+		_mm256_or_si256(AVX2_IN_RANGE(v, '0', '9'), AVX2_IN_RANGE(lower, 'a', 'z')),
+		_mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'))));
+}
+
+__attribute__((target("avx2")))
+static char const *_skip_space_avx2(char const *p, char const *end)
+{
+	for (; end - p >= 32; p += 32) {
+		unsigned miss = ~_avx2_space_mask(_mm256_loadu_si256((__m256i const *)p));
+		if (miss) {
+			return p + __builtin_ctz(miss);
+		}
+	}
+	return _skip_space_sse2(p, end);
+}
+
+__attribute__((target("avx2")))
+static char const *_skip_word_avx2(char const *p, char const *end)
+{
+	for (; end - p >= 32; p += 32) {
+		unsigned miss = ~_avx2_word_mask(_mm256_loadu_si256((__m256i const *)p));
+		if (miss) {
+			return p + __builtin_ctz(miss);
+		}
+	}
+	return _skip_word_sse2(p, end);
+}
+
+__attribute__((target("avx2")))
+static char const *_skip_digit_avx2(char const *p, char const *end)
+{
+	for (; end - p >= 32; p += 32) {
+		unsigned miss = ~_avx2_digit_mask(_mm256_loadu_si256((__m256i const *)p));
+		if (miss) {
+			return p + __builtin_ctz(miss);
+		}
+	}
+	return _skip_digit_sse2(p, end);
+}
+
+__attribute__((target("avx2")))
+static char const *_skip_nonspace_avx2(char const *p, char const *end)
+{
+	for (; end - p >= 32; p += 32) {
+		unsigned hit = _avx2_space_mask(_mm256_loadu_si256((__m256i const *)p));
+		if (hit) {
+			return p + __builtin_ctz(hit);
+		}
 	}
-	return tok;
+	return _skip_nonspace_sse2(p, end);
 }
+#endif /* TOKENIZER_X86 */